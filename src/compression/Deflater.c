@@ -0,0 +1,632 @@
+/*
+ | LuaRT - A Windows programming framework for Lua
+ | Luart.org, Copyright (c) Tine Samir 2022.
+ | See Copyright Notice in LICENSE.TXT
+ |-------------------------------------------------
+ | Deflater.c | LuaRT Deflater and Inflater streaming objects implementation
+*/
+
+#include <Deflater.h>
+#include <Buffer.h>
+#include <luart.h>
+#include <stdlib.h>
+#include <string.h>
+
+luart_type TDeflater, TInflater;
+
+static const char *formats[] = { "zlib", "raw", "gzip", NULL };
+
+//--- Output is produced in CHUNK steps, and input is fed to miniz in slices that fit its 32 bits counters
+#define CHUNK			65536
+#define INFLATE_CHUNK	32768
+#define MAX_SLICE		0x40000000
+
+//-------------------------------------[ gzip framing ]
+#define GZIP_FHCRC		0x02
+#define GZIP_FEXTRA		0x04
+#define GZIP_FNAME		0x08
+#define GZIP_FCOMMENT	0x10
+#define GZIP_RESERVED	0xE0
+
+void gzip_header(BYTE *header) {
+	static const BYTE minimal[GZIP_HEADER_MINSIZE] = { 0x1F, 0x8B, 0x08, 0, 0, 0, 0, 0, 0, 0x0B };
+	memcpy(header, minimal, GZIP_HEADER_MINSIZE);
+}
+
+void gzip_trailer(BYTE *trailer, mz_ulong crc, mz_uint32 size) {
+	for (int i = 0; i < 4; i++) {
+		trailer[i] = (BYTE)(crc >> (i*8));
+		trailer[i+4] = (BYTE)(size >> (i*8));
+	}
+}
+
+//--- Skips a zero terminated field, returns 0 if the terminator is not yet available
+static size_t skip_field(const BYTE *p, size_t pos, size_t len) {
+	const BYTE *end = memchr(p+pos, 0, len-pos);
+	return end ? (size_t)(end-p)+1 : 0;
+}
+
+size_t gzip_headersize(const BYTE *p, size_t len) {
+	size_t pos = GZIP_HEADER_MINSIZE;
+	BYTE flags;
+
+	if (len < GZIP_HEADER_MINSIZE)
+		return (len && p[0] != 0x1F) || (len > 1 && p[1] != 0x8B) || (len > 2 && p[2] != 0x08) ? (size_t)-1 : 0;
+	if (p[0] != 0x1F || p[1] != 0x8B || p[2] != 0x08 || ((flags = p[3]) & GZIP_RESERVED))
+		return (size_t)-1;
+	if (flags & GZIP_FEXTRA) {
+		if (len < pos+2)
+			return 0;
+		pos += 2 + (p[pos] | (p[pos+1] << 8));
+		if (len < pos)
+			return 0;
+	}
+	if ((flags & GZIP_FNAME) && !(pos = skip_field(p, pos, len)))
+		return 0;
+	if ((flags & GZIP_FCOMMENT) && !(pos = skip_field(p, pos, len)))
+		return 0;
+	if (flags & GZIP_FHCRC) {
+		if (len < pos+2)
+			return 0;
+		if ((mz_crc32(MZ_CRC32_INIT, p, pos) & 0xFFFF) != (mz_ulong)(p[pos] | (p[pos+1] << 8)))
+			return (size_t)-1;
+		pos += 2;
+	}
+	return pos;
+}
+
+//--- CRC32 combination, by applying len2 zero bytes to crc1 as a GF(2) matrix operator
+static mz_ulong gf2_times(const mz_ulong *mat, mz_ulong vec) {
+	mz_ulong sum = 0;
+
+	for (; vec; vec >>= 1, mat++)
+		if (vec & 1)
+			sum ^= *mat;
+	return sum;
+}
+
+static void gf2_square(mz_ulong *square, const mz_ulong *mat) {
+	for (int n = 0; n < 32; n++)
+		square[n] = gf2_times(mat, mat[n]);
+}
+
+mz_ulong gzip_crc32combine(mz_ulong crc1, mz_ulong crc2, size_t len2) {
+	mz_ulong even[32], odd[32], row = 1;
+
+	if (!len2)
+		return crc1;
+	odd[0] = 0xEDB88320UL;
+	for (int n = 1; n < 32; n++, row <<= 1)
+		odd[n] = row;
+	gf2_square(even, odd);
+	gf2_square(odd, even);
+	do {
+		gf2_square(even, odd);
+		if (len2 & 1)
+			crc1 = gf2_times(even, crc1);
+		if (!(len2 >>= 1))
+			break;
+		gf2_square(odd, even);
+		if (len2 & 1)
+			crc1 = gf2_times(odd, crc1);
+		len2 >>= 1;
+	} while (len2);
+	return (crc1 ^ crc2) & 0xFFFFFFFFUL;
+}
+
+static mz_uint32 read_le32(const BYTE *p) {
+	return p[0] | (p[1] << 8) | (p[2] << 16) | ((mz_uint32)p[3] << 24);
+}
+
+int compression_threads(void) {
+	SYSTEM_INFO info;
+	GetSystemInfo(&info);
+	return info.dwNumberOfProcessors > MAXIMUM_WAIT_OBJECTS ? MAXIMUM_WAIT_OBJECTS : (int)info.dwNumberOfProcessors;
+}
+
+//-------------------------------------[ Parallel gzip ]
+//--- Input is split in GZIP_BLOCKSIZE blocks, each one compressed as byte aligned raw deflate blocks
+//--- The compressor is primed with the preceding GZIP_WINDOW bytes so that blocks keep referencing previous data
+#define GZIP_BLOCKSIZE	(1024*1024)
+#define GZIP_WINDOW		32768
+
+typedef struct {
+	const BYTE	*dict;
+	size_t		dictlen;
+	const BYTE	*data;
+	size_t		len;
+	BOOL		last;
+	int			level;
+	BYTE		*out;
+	size_t		outlen;
+	size_t		outsize;
+	mz_ulong	crc;
+	BOOL		failed;
+} GzipBlock;
+
+//--- Workers are started once, each round of blocks is handed out through the work semaphore
+typedef struct {
+	GzipBlock		*blocks;
+	LONG			count;		//--- blocks in the current round
+	volatile LONG	next;		//--- index of the next block to be compressed
+	BOOL			quit;
+	HANDLE			work;		//--- released once per worker woken up for a round
+	HANDLE			done;		//--- released by each woken up worker once no block is left
+} GzipPool;
+
+static void gzip_block(GzipBlock *blk) {
+	mz_stream stream = {0};
+	int status;
+
+	blk->crc = blk->len ? mz_crc32(MZ_CRC32_INIT, blk->data, blk->len) : MZ_CRC32_INIT;
+	if ((blk->failed = mz_deflateInit2(&stream, blk->level, MZ_DEFLATED, -MZ_DEFAULT_WINDOW_BITS, 9, MZ_DEFAULT_STRATEGY) != MZ_OK))
+		return;
+	if (blk->dictlen) {
+		//--- prime the compressor window with the dictionary, the flushed output is discarded
+		stream.next_in = blk->dict;
+		stream.avail_in = (unsigned int)blk->dictlen;
+		stream.next_out = blk->out;
+		stream.avail_out = (unsigned int)blk->outsize;
+		if (mz_deflate(&stream, MZ_SYNC_FLUSH) != MZ_OK || stream.avail_in)
+			goto done;
+	}
+	stream.next_in = blk->data;
+	stream.avail_in = (unsigned int)blk->len;
+	stream.next_out = blk->out;
+	stream.avail_out = (unsigned int)blk->outsize;
+	status = mz_deflate(&stream, blk->last ? MZ_FINISH : MZ_SYNC_FLUSH);
+	blk->outlen = blk->outsize - stream.avail_out;
+	blk->failed = stream.avail_in || (blk->last ? status != MZ_STREAM_END : (status != MZ_OK || !stream.avail_out));
+done:
+	mz_deflateEnd(&stream);
+}
+
+//--- Compresses the blocks of the current round until none is left
+static void gzip_blocks(GzipPool *pool) {
+	LONG i;
+
+	while ((i = InterlockedIncrement(&pool->next) - 1) < pool->count)
+		gzip_block(&pool->blocks[i]);
+}
+
+static DWORD WINAPI gzip_worker(LPVOID param) {
+	GzipPool *pool = param;
+
+	while (WaitForSingleObject(pool->work, INFINITE) == WAIT_OBJECT_0 && !pool->quit) {
+		gzip_blocks(pool);
+		ReleaseSemaphore(pool->done, 1, NULL);
+	}
+	return 0;
+}
+
+const char *gzip_parallel(gzip_reader read, void *in, gzip_writer write, void *out, int level, int nthreads) {
+	size_t capacity, bound = mz_compressBound(GZIP_BLOCKSIZE + GZIP_WINDOW) + 64, window = 0, total, n;
+	HANDLE threads[MAXIMUM_WAIT_OBJECTS];
+	GzipPool pool = {0};
+	BYTE *input, *output, frame[GZIP_HEADER_MINSIZE];
+	const char *err = NULL;
+	mz_ulong crc = MZ_CRC32_INIT;
+	mz_uint32 size = 0;
+	BOOL last = FALSE;
+	int nworkers = 0;
+
+	nthreads = nthreads < 1 ? 1 : (nthreads > MAXIMUM_WAIT_OBJECTS ? MAXIMUM_WAIT_OBJECTS : nthreads);
+	capacity = (size_t)nthreads*GZIP_BLOCKSIZE;
+	input = malloc(GZIP_WINDOW + capacity);
+	output = malloc(bound*nthreads);
+	pool.blocks = calloc(nthreads, sizeof(GzipBlock));
+	if (!input || !output || !pool.blocks) {
+		err = "out of memory";
+		goto done;
+	}
+	if (nthreads > 1 && (pool.work = CreateSemaphore(NULL, 0, nthreads, NULL)))
+		pool.done = CreateSemaphore(NULL, 0, nthreads, NULL);
+	gzip_header(frame);
+	if (!write(out, frame, GZIP_HEADER_MINSIZE))
+		goto ioerror;
+	while (!last) {
+		int count = 0, woken;
+		BYTE *data = input + GZIP_WINDOW;
+
+		//--- fill the input with up to nthreads blocks, a short read means the end of input
+		for (total = 0; total < capacity; total += n)
+			if (!(n = read(in, data + total, capacity - total)))
+				break;
+		last = total < capacity;
+		do {
+			GzipBlock *blk = &pool.blocks[count];
+			size_t before = window + (size_t)count*GZIP_BLOCKSIZE;
+
+			blk->data = data + (size_t)count*GZIP_BLOCKSIZE;
+			blk->len = total - (size_t)count*GZIP_BLOCKSIZE;
+			if (blk->len > GZIP_BLOCKSIZE)
+				blk->len = GZIP_BLOCKSIZE;
+			blk->dictlen = before > GZIP_WINDOW ? GZIP_WINDOW : before;
+			blk->dict = blk->data - blk->dictlen;
+			blk->level = level;
+			blk->out = output + count*bound;
+			blk->outsize = bound;
+			count++;
+			blk->last = last && ((size_t)count*GZIP_BLOCKSIZE >= total);
+		} while ((size_t)count*GZIP_BLOCKSIZE < total);
+		//--- workers are started when a round first needs them, the calling thread compresses blocks too
+		while (pool.done && nworkers < count-1 && (threads[nworkers] = CreateThread(NULL, 0, gzip_worker, &pool, 0, NULL)))
+			nworkers++;
+		pool.count = count;
+		pool.next = 0;
+		woken = count-1 < nworkers ? count-1 : nworkers;
+		if (woken)
+			ReleaseSemaphore(pool.work, woken, NULL);
+		gzip_blocks(&pool);
+		while (woken--)
+			WaitForSingleObject(pool.done, INFINITE);
+		for (int i = 0; i < count; i++) {
+			if (pool.blocks[i].failed) {
+				err = "Error during compression";
+				goto done;
+			}
+			if (!write(out, pool.blocks[i].out, pool.blocks[i].outlen))
+				goto ioerror;
+			crc = gzip_crc32combine(crc, pool.blocks[i].crc, pool.blocks[i].len);
+			size += (mz_uint32)pool.blocks[i].len;
+		}
+		//--- keep the last GZIP_WINDOW bytes as the dictionary of the next blocks
+		n = window + total > GZIP_WINDOW ? GZIP_WINDOW : window + total;
+		memmove(input + GZIP_WINDOW - n, data + total - n, n);
+		window = n;
+	}
+	gzip_trailer(frame, crc, size);
+	if (write(out, frame, GZIP_FOOTER_SIZE))
+		goto done;
+ioerror:
+	err = "error while writing compressed data";
+done:
+	if (nworkers) {
+		pool.quit = TRUE;
+		ReleaseSemaphore(pool.work, nworkers, NULL);
+		WaitForMultipleObjects(nworkers, threads, TRUE, INFINITE);
+		while (nworkers--)
+			CloseHandle(threads[nworkers]);
+	}
+	if (pool.work)
+		CloseHandle(pool.work);
+	if (pool.done)
+		CloseHandle(pool.done);
+	free(pool.blocks);
+	free(output);
+	free(input);
+	return err;
+}
+
+//-------------------------------------[ Helpers ]
+static const BYTE *stream_input(lua_State *L, int idx, size_t *len) {
+	Buffer *b;
+
+	if (lua_isnoneornil(L, idx)) {
+		*len = 0;
+		return NULL;
+	}
+	if (lua_type(L, idx) == LUA_TSTRING)
+		return (const BYTE *)lua_tolstring(L, idx, len);
+	b = luaL_checkcinstance(L, idx, Buffer);
+	*len = b->size;
+	return b->bytes;
+}
+
+static Buffer *push_output(lua_State *L) {
+	lua_pushnil(L);
+	return lua_pushinstance(L, Buffer, 1);
+}
+
+static void free_pending(Deflater *d) {
+	free(d->pending);
+	d->pending = NULL;
+	d->npending = 0;
+}
+
+//-------------------------------------[ Deflater object ]
+static int deflater_run(lua_State *L, BOOL finish) {
+	Deflater *d = lua_self(L, 1, Deflater);
+	size_t len;
+	const BYTE *src = stream_input(L, 2, &len);
+	Buffer *b = push_output(L);
+	int status;
+
+	if (d->state == STREAM_END)
+		luaL_error(L, "Deflater stream already finished");
+	if (d->state == STREAM_HEADER) {
+		gzip_header(buffer_reserve(L, b, GZIP_HEADER_MINSIZE));
+		b->size = GZIP_HEADER_MINSIZE;
+		d->state = STREAM_DATA;
+	}
+	if (d->format == FORMAT_GZIP && len) {
+		d->crc = mz_crc32(d->crc, src, len);
+		d->size += (mz_uint32)len;
+	}
+	d->stream.next_in = src;
+	do {
+		size_t slice = len > MAX_SLICE ? MAX_SLICE : len;
+		d->stream.avail_in = (unsigned int)slice;
+		d->stream.next_out = buffer_reserve(L, b, b->size + CHUNK) + b->size;
+		d->stream.avail_out = CHUNK;
+		status = mz_deflate(&d->stream, finish && slice == len ? MZ_FINISH : MZ_NO_FLUSH);
+		b->size += CHUNK - d->stream.avail_out;
+		len -= slice - d->stream.avail_in;
+		if (status < MZ_OK && status != MZ_BUF_ERROR)
+			luaL_error(L, "Error during compression");
+	} while (len || !d->stream.avail_out || (finish && status != MZ_STREAM_END));
+	if (finish) {
+		if (d->format == FORMAT_GZIP) {
+			gzip_trailer(buffer_reserve(L, b, b->size + GZIP_FOOTER_SIZE) + b->size, d->crc, d->size);
+			b->size += GZIP_FOOTER_SIZE;
+		}
+		mz_deflateEnd(&d->stream);
+		d->ready = FALSE;
+		d->state = STREAM_END;
+	}
+	return 1;
+}
+
+LUA_CONSTRUCTOR(Deflater) {
+	Deflater *d = lua_allocinstance(L, Deflater);
+	int level;
+
+	d->format = luaL_checkoption(L, 2, "zlib", formats);
+	level = luaL_optinteger(L, 3, MZ_DEFAULT_LEVEL);
+	luaL_argcheck(L, level >= 0 && level <= MZ_UBER_COMPRESSION, 3, "compression level out of range");
+	if (mz_deflateInit2(&d->stream, level, MZ_DEFLATED, d->format == FORMAT_ZLIB ? MZ_DEFAULT_WINDOW_BITS : -MZ_DEFAULT_WINDOW_BITS, 9, MZ_DEFAULT_STRATEGY) != MZ_OK)
+		luaL_error(L, "Failed to initialize deflate compression");
+	d->ready = TRUE;
+	d->state = d->format == FORMAT_GZIP ? STREAM_HEADER : STREAM_DATA;
+	lua_newinstance(L, d, Deflater);
+	return 1;
+}
+
+LUA_METHOD(Deflater, update) {
+	return deflater_run(L, FALSE);
+}
+
+LUA_METHOD(Deflater, finish) {
+	return deflater_run(L, TRUE);
+}
+
+LUA_METHOD(Deflater, __gc) {
+	Deflater *d = lua_self(L, 1, Deflater);
+	if (d->ready)
+		mz_deflateEnd(&d->stream);
+	d->ready = FALSE;
+	return 0;
+}
+
+//-------------------------------------[ Inflater object ]
+//--- Inflates src until the end of the current deflate stream, returns the number of bytes consumed
+static size_t inflate_data(Inflater *d, const BYTE *src, size_t len, gzip_writer write, void *ud, const char **err) {
+	BYTE out[INFLATE_CHUNK];
+	size_t total = len;
+	int status;
+
+	d->stream.next_in = src;
+	do {
+		size_t slice = len > MAX_SLICE ? MAX_SLICE : len, produced;
+
+		d->stream.avail_in = (unsigned int)slice;
+		d->stream.next_out = out;
+		d->stream.avail_out = INFLATE_CHUNK;
+		status = mz_inflate(&d->stream, MZ_NO_FLUSH);
+		produced = INFLATE_CHUNK - d->stream.avail_out;
+		len -= slice - d->stream.avail_in;
+		if (d->format == FORMAT_GZIP) {
+			d->crc = mz_crc32(d->crc, out, produced);
+			d->size += (mz_uint32)produced;
+		}
+		if (produced && !write(ud, out, produced)) {
+			*err = "error while writing decompressed data";
+			break;
+		}
+		if (status == MZ_STREAM_END) {
+			d->state = d->format == FORMAT_GZIP ? STREAM_TRAILER : STREAM_END;
+			break;
+		}
+		if ((status < MZ_OK && status != MZ_BUF_ERROR) || (status == MZ_BUF_ERROR && len && produced == 0)) {
+			*err = "Error during decompression";
+			break;
+		}
+	} while (len || !d->stream.avail_out);
+	return total - len;
+}
+
+//--- Runs the Inflater state machine over src, keeping an incomplete gzip header or trailer for the next call
+//--- Returns NULL on success or an error message
+static const char *inflater_run(Inflater *d, const BYTE *src, size_t len, gzip_writer write, void *ud) {
+	BYTE *stash = NULL;
+	const char *err = NULL;
+
+	if (d->npending) {
+		if (!(stash = realloc(d->pending, d->npending + len)))
+			return "out of memory";
+		memcpy(stash + d->npending, src, len);
+		src = stash;
+		len += d->npending;
+		d->pending = NULL;
+		d->npending = 0;
+	}
+	while (len && !err) {
+		switch (d->state) {
+			case STREAM_HEADER: {
+				size_t size = gzip_headersize(src, len);
+				if (size == (size_t)-1)
+					err = "invalid gzip header";
+				else if (!size)
+					goto incomplete;
+				else {
+					src += size;
+					len -= size;
+					if (d->members)
+						mz_inflateReset(&d->stream);
+					d->crc = MZ_CRC32_INIT;
+					d->size = 0;
+					d->state = STREAM_DATA;
+				}
+				break;
+			}
+			case STREAM_DATA: {
+				size_t consumed = inflate_data(d, src, len, write, ud, &err);
+				src += consumed;
+				len -= consumed;
+				break;
+			}
+			case STREAM_TRAILER:
+				if (len < GZIP_FOOTER_SIZE)
+					goto incomplete;
+				if (read_le32(src) != (mz_uint32)d->crc || read_le32(src+4) != d->size)
+					err = "gzip CRC or size mismatch";
+				else {
+					src += GZIP_FOOTER_SIZE;
+					len -= GZIP_FOOTER_SIZE;
+					d->members++;
+					d->state = STREAM_HEADER;
+				}
+				break;
+			case STREAM_END:
+				//--- data after a zlib or raw deflate stream is ignored
+				len = 0;
+		}
+	}
+	free(stash);
+	return err;
+incomplete:
+	if ((d->pending = malloc(len))) {
+		memcpy(d->pending, src, len);
+		d->npending = len;
+	} else
+		err = "out of memory";
+	free(stash);
+	return err;
+}
+
+static BOOL inflater_complete(Inflater *d) {
+	return d->state == STREAM_END || (d->state == STREAM_HEADER && d->members && !d->npending);
+}
+
+const char *gunzip_stream(gzip_reader read, void *in, gzip_writer write, void *out) {
+	Inflater d = {0};
+	BYTE *input = malloc(CHUNK);
+	const char *err = NULL;
+	size_t n;
+
+	if (!input)
+		return "out of memory";
+	if (mz_inflateInit2(&d.stream, -MZ_DEFAULT_WINDOW_BITS) != MZ_OK) {
+		free(input);
+		return "Failed to initialize inflate decompression";
+	}
+	d.format = FORMAT_GZIP;
+	d.state = STREAM_HEADER;
+	while (!err && (n = read(in, input, CHUNK)))
+		err = inflater_run(&d, input, n, write, out);
+	if (!err && !inflater_complete(&d))
+		err = "incomplete compressed stream";
+	free_pending(&d);
+	mz_inflateEnd(&d.stream);
+	free(input);
+	return err;
+}
+
+typedef struct {
+	Buffer		*b;
+	BOOL		nomem;
+} BufferOutput;
+
+//--- Does not throw errors, so that inflater_run() releases its stash first
+static BOOL buffer_writer(void *ud, const BYTE *buff, size_t len) {
+	BufferOutput *out = ud;
+	BYTE *bytes;
+
+	if (!(bytes = buffer_tryreserve(out->b, out->b->size + len))) {
+		out->nomem = TRUE;
+		return FALSE;
+	}
+	memcpy(bytes + out->b->size, buff, len);
+	out->b->size += len;
+	return TRUE;
+}
+
+static int inflater_update(lua_State *L, BOOL finish) {
+	Inflater *d = lua_self(L, 1, Inflater);
+	size_t len;
+	const BYTE *src = stream_input(L, 2, &len);
+	BufferOutput out = { push_output(L), FALSE };
+	const char *err;
+
+	if (!d->ready)
+		luaL_error(L, "Inflater stream already finished");
+	if ((err = inflater_run(d, src, len, buffer_writer, &out)))
+		luaL_error(L, "%s", out.nomem ? "Buffer allocation error: not enough memory" : err);
+	if (finish) {
+		BOOL complete = inflater_complete(d);
+		free_pending(d);
+		mz_inflateEnd(&d->stream);
+		d->ready = FALSE;
+		if (!complete)
+			luaL_error(L, "incomplete compressed stream");
+	}
+	return 1;
+}
+
+LUA_CONSTRUCTOR(Inflater) {
+	Inflater *d = lua_allocinstance(L, Inflater);
+
+	d->format = luaL_checkoption(L, 2, "zlib", formats);
+	if (mz_inflateInit2(&d->stream, d->format == FORMAT_ZLIB ? MZ_DEFAULT_WINDOW_BITS : -MZ_DEFAULT_WINDOW_BITS) != MZ_OK)
+		luaL_error(L, "Failed to initialize inflate decompression");
+	d->ready = TRUE;
+	d->state = d->format == FORMAT_GZIP ? STREAM_HEADER : STREAM_DATA;
+	lua_newinstance(L, d, Inflater);
+	return 1;
+}
+
+LUA_METHOD(Inflater, update) {
+	return inflater_update(L, FALSE);
+}
+
+LUA_METHOD(Inflater, finish) {
+	return inflater_update(L, TRUE);
+}
+
+LUA_PROPERTY_GET(Inflater, eof) {
+	Inflater *d = lua_self(L, 1, Inflater);
+	lua_pushboolean(L, inflater_complete(d));
+	return 1;
+}
+
+LUA_METHOD(Inflater, __gc) {
+	Inflater *d = lua_self(L, 1, Inflater);
+	free_pending(d);
+	if (d->ready)
+		mz_inflateEnd(&d->stream);
+	d->ready = FALSE;
+	return 0;
+}
+
+const luaL_Reg Deflater_methods[] = {
+	{"update",		Deflater_update},
+	{"finish",		Deflater_finish},
+	{NULL, NULL}
+};
+
+const luaL_Reg Deflater_metafields[] = {
+	{"__gc",		Deflater___gc},
+	{NULL, NULL}
+};
+
+const luaL_Reg Inflater_methods[] = {
+	{"update",		Inflater_update},
+	{"finish",		Inflater_finish},
+	{"get_eof",		Inflater_geteof},
+	{NULL, NULL}
+};
+
+const luaL_Reg Inflater_metafields[] = {
+	{"__gc",		Inflater___gc},
+	{NULL, NULL}
+};
@@ -8,6 +8,7 @@
 */
 
 #include <Zip.h>
+#include <Deflater.h>
 #include <File.h>
 #include <Directory.h>
 #include <Buffer.h>
@@ -33,7 +34,7 @@ LUALIB_API LUA_CONSTRUCTOR(Zip) {
 	char mode;
 	
 	if (lua_islightuserdata(L, 2)) {
-		z = calloc(1, sizeof(Zip));	
+		z = lua_allocinstance(L, Zip);
 		z->zip = lua_touserdata(L, 2);
 		z->mode = 'r';
 		goto done;
@@ -43,7 +44,7 @@ LUALIB_API LUA_CONSTRUCTOR(Zip) {
 		fname = luaL_checkFilename(L, 2);
 		mode = *zip_modes[idx];
 		if ( (zip = zip_open(fname, level, mode))) {
-			z = calloc(1, sizeof(Zip));	
+			z = lua_allocinstance(L, Zip);
 			z->zip = zip;
 			z->mode = mode;
 			z->fname = fname;
@@ -56,22 +57,36 @@ done:		lua_newinstance(L, z, Zip);
 	return 1;
 }
 
+void zip_release(Zip *z) {
+	if (z->writer)
+		zipstream_close(z->writer);
+	if (!z->streams)
+		zip_close(z->zip);
+	else if (z->zip)
+		z->pending = z->zip;
+}
+
 LUA_METHOD(Zip, close) {
 	Zip *z = lua_self(L, 1, Zip);
 	if (z->fname)
-		zip_close(z->zip);
+		zip_release(z);
 	z->zip = NULL;
 	return 0;
 }
 
 LUA_METHOD(Zip, __gc) {
 	Zip *z = lua_self(L, 1, Zip);
-	zip_close(z->zip);
+	zip_release(z);
 	free(z->fname);
-	free(z);
 	return 0;
 }
 
+LUA_METHOD(Zip, open) {
+	lua_settop(L, 2);
+	lua_pushinstance(L, ZipStream, 2);
+	return 1;
+}
+
 LUA_PROPERTY_GET(Zip, count) {
 	lua_pushinteger(L, zip_total_entries(lua_self(L, 1, Zip)->zip));
 	return 1;
@@ -99,6 +114,8 @@ LUA_METHOD(Zip, reopen) {
 	
 	if (z->zip == fs)
 		luaL_error(L, "cannot reopen bundled Zip archive");
+	if (z->streams)
+		luaL_error(L, "cannot reopen Zip archive while ZipStream objects are opened");
 	mode = *zip_modes[luaL_checkoption(L, 2, "read", zip_modes)];
 	zip_close(z->zip);
 	z->level = luaL_optint(L, 3, MZ_DEFAULT_COMPRESSION);
@@ -124,6 +141,155 @@ static wchar_t *append_path(wchar_t *str, wchar_t* path) {
 	return result;
 }
 
+//--- Runs worker on nthreads threads sharing the same job, or on the calling thread
+static void run_workers(LPTHREAD_START_ROUTINE worker, void *job, int nthreads) {
+	HANDLE threads[MAXIMUM_WAIT_OBJECTS];
+	int started = 0;
+
+	if (nthreads > MAXIMUM_WAIT_OBJECTS)
+		nthreads = MAXIMUM_WAIT_OBJECTS;
+	if (nthreads > 1)
+		for (; started < nthreads; started++)
+			if (!(threads[started] = CreateThread(NULL, 0, worker, job, 0, NULL)))
+				break;
+	if (!started)
+		worker(job);
+	else {
+		WaitForMultipleObjects(started, threads, TRUE, INFINITE);
+		while (started--)
+			CloseHandle(threads[started]);
+	}
+}
+
+//--- Makes room for one more element in a growable array, returns FALSE when out of memory
+static BOOL grow_array(void *array, size_t *capacity, size_t count, size_t size) {
+	void *p;
+
+	if (count < *capacity)
+		return TRUE;
+	if (!(p = realloc(*(void **)array, (*capacity ? *capacity*2 : 64)*size)))
+		return FALSE;
+	*(void **)array = p;
+	*capacity = *capacity ? *capacity*2 : 64;
+	return TRUE;
+}
+
+//-------------------------------------[ Parallel compression of directories ]
+//--- Files are read and deflated by the workers, then appended to the archive in order by the calling thread
+//--- Files bigger than ZIP_MAXPARALLEL are streamed to the archive instead, and batches hold at most ZIP_BATCHSIZE bytes
+#define ZIP_MAXPARALLEL	(32*1024*1024)
+#define ZIP_BATCHSIZE	(256*1024*1024)
+
+typedef struct {
+	char		*entry;
+	wchar_t		*path;
+	BYTE		*data;
+	size_t		size;
+	mz_uint64	uncomp_size;
+	mz_uint32	crc;
+	MZ_TIME_T	mtime;
+	BOOL		deflated;
+	BOOL		failed;
+} ZipFile;
+
+typedef struct {
+	ZipFile			*files;
+	size_t			count;
+	size_t			capacity;
+	int				level;
+	LONG			end;
+	volatile LONG	next;
+} WriteJob;
+
+static BOOL read_file(ZipFile *f) {
+	struct MZ_FILE_STAT_STRUCT st;
+	FILE *stream;
+	BOOL result;
+
+	if (MZ_FILE_STAT(f->path, &st) != 0 || !(stream = _wfopen(f->path, L"rb")))
+		return FALSE;
+	f->mtime = st.st_mtime;
+	f->uncomp_size = f->size = (size_t)st.st_size;
+	result = (f->data = malloc(f->size ? f->size : 1)) && fread(f->data, 1, f->size, stream) == f->size;
+	fclose(stream);
+	return result;
+}
+
+static DWORD WINAPI write_worker(LPVOID param) {
+	WriteJob *job = param;
+	LONG i;
+
+	while ((i = InterlockedIncrement(&job->next)-1) < job->end) {
+		ZipFile *f = &job->files[i];
+		void *out;
+		size_t len;
+
+		if (!(f->failed = !read_file(f)) && job->level && f->size > 3) {
+			f->crc = (mz_uint32)mz_crc32(MZ_CRC32_INIT, f->data, f->size);
+			if ((out = tdefl_compress_mem_to_heap(f->data, f->size, &len, tdefl_create_comp_flags_from_zip_params(job->level, -MZ_DEFAULT_WINDOW_BITS, MZ_DEFAULT_STRATEGY)))) {
+				if (len < f->size) {
+					free(f->data);
+					f->data = out;
+					f->size = len;
+					f->deflated = TRUE;
+				} else free(out);
+			}
+		}
+	}
+	return 0;
+}
+
+static BOOL add_file(Zip *z, ZipFile *f) {
+	if (f->deflated)
+		return mz_zip_writer_add_mem_ex_v2(&z->zip->archive, f->entry, f->data, f->size, NULL, 0, (z->zip->level & 0xF) | MZ_ZIP_FLAG_COMPRESSED_DATA, f->uncomp_size, f->crc, &f->mtime, NULL, 0, NULL, 0);
+	return mz_zip_writer_add_mem_ex_v2(&z->zip->archive, f->entry, f->data, f->size, NULL, 0, f->size > 3 ? 0 : z->zip->level & 0xF, 0, 0, &f->mtime, NULL, 0, NULL, 0);
+}
+
+static BOOL write_files(Zip *z, WriteJob *job) {
+	size_t i = 0, start;
+	BOOL result = TRUE;
+
+	job->level = z->zip->level & 0xF;
+	while (result && i < job->count) {
+		size_t bytes = 0;
+		struct MZ_FILE_STAT_STRUCT st;
+
+		//--- big files are streamed by the calling thread
+		if (MZ_FILE_STAT(job->files[i].path, &st) == 0 && st.st_size > ZIP_MAXPARALLEL) {
+			result = !zip_entry_open(z->zip, job->files[i].entry) && !zip_entry_fwrite(z->zip, job->files[i].path);
+			zip_entry_close(z->zip);
+			i++;
+			continue;
+		}
+		for (start = i; i < job->count && bytes < ZIP_BATCHSIZE; i++) {
+			if (MZ_FILE_STAT(job->files[i].path, &st) == 0) {
+				if (st.st_size > ZIP_MAXPARALLEL)
+					break;
+				bytes += (size_t)st.st_size;
+			}
+		}
+		job->next = (LONG)start;
+		job->end = (LONG)i;
+		run_workers(write_worker, job, (int)(i - start) < compression_threads() ? (int)(i - start) : compression_threads());
+		for (size_t j = start; j < i; j++) {
+			ZipFile *f = &job->files[j];
+			result = result && !f->failed && add_file(z, f);
+			free(f->data);
+			f->data = NULL;
+		}
+	}
+	return result;
+}
+
+static void free_files(WriteJob *job) {
+	for (size_t i = 0; i < job->count; i++) {
+		free(job->files[i].entry);
+		free(job->files[i].path);
+		free(job->files[i].data);
+	}
+	free(job->files);
+}
+
 static void make_dir_path(Zip *z, char *dir) {
 	char *start = dir;
 	char ch;
@@ -142,7 +308,7 @@ static void make_dir_path(Zip *z, char *dir) {
 	}
 }
 
-static BOOL write_dir(Zip *z, wchar_t *dir, BOOL isfullpath, wchar_t* dest) {
+static BOOL collect_dir(Zip *z, wchar_t *dir, BOOL isfullpath, wchar_t* dest, WriteJob *job) {
 	HANDLE hFind;
 	WIN32_FIND_DATAW FindFileData;
 	wchar_t *path;
@@ -163,16 +329,24 @@ static BOOL write_dir(Zip *z, wchar_t *dir, BOOL isfullpath, wchar_t* dest) {
 				wchar_t *newpath = append_path(dir, FindFileData.cFileName);
 				wchar_t *newdest = dest ? append_path(dest, FindFileData.cFileName) : NULL;
 
-				if (FindFileData.dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY)
-					result = write_dir(z, newpath, isfullpath, newdest ?: FindFileData.cFileName);
-	        	else {
+				if (FindFileData.dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY) {
+					result = collect_dir(z, newpath, isfullpath, newdest ?: FindFileData.cFileName, job);
+					free(newpath);
+				} else if (grow_array(&job->files, &job->capacity, job->count, sizeof(ZipFile))) {
 	        		int s = -1;
-	        		char *entry = wchar_toutf8(newdest ?: FindFileData.cFileName, &s);
-			    	result = !zip_entry_open(z->zip, entry) && !zip_entry_fwrite(z->zip, newpath);
-	        		zip_entry_close(z->zip);
-			    	free(entry);
+					ZipFile *f = &job->files[job->count++];
+					char *p;
+
+					memset(f, 0, sizeof(ZipFile));
+	        		f->entry = wchar_toutf8(newdest ?: FindFileData.cFileName, &s);
+					for (p = f->entry; *p; p++)
+						if (*p == '\\')
+							*p = '/';
+					f->path = newpath;
+				} else {
+					free(newpath);
+					result = FALSE;
 				}
-				free(newpath);
 				free(newdest);				
 			} else result = TRUE;
 	  	} while (result && FindNextFileW(hFind, &FindFileData));
@@ -182,6 +356,15 @@ static BOOL write_dir(Zip *z, wchar_t *dir, BOOL isfullpath, wchar_t* dest) {
 	return result;
 }
 
+//--- Adds a directory content to the archive, deflating its files on worker threads
+static BOOL write_dir(Zip *z, wchar_t *dir, BOOL isfullpath, wchar_t* dest) {
+	WriteJob job = {0};
+	BOOL result = collect_dir(z, dir, isfullpath, dest, &job) && write_files(z, &job);
+
+	free_files(&job);
+	return result;
+}
+
 LUA_METHOD(Zip, write) {
 	Zip *z = lua_self(L, 1, Zip);
 	int is_entry = lua_gettop(L) == 3;
@@ -193,11 +376,15 @@ LUA_METHOD(Zip, write) {
 	int size = -1;
 	wchar_t *fname = NULL;
 	
+	if (z->writer) {
+		free(dest);
+		luaL_error(L, "cannot write to Zip archive while a ZipStream is writing an entry");
+	}
 	if (lua_isstring(L, 2)) {
 		fname = lua_towstring(L, 2);		
 		attrib = GetFileAttributesW(fname);
 		if (attrib != INVALID_FILE_ATTRIBUTES && (attrib & FILE_ATTRIBUTE_DIRECTORY)) {
-			result = write_dir(z, fname, !PathIsRelativeW(fname), dest) == 0;
+			result = write_dir(z, fname, !PathIsRelativeW(fname), dest);
 			goto done;
 		}
 		else
@@ -262,42 +449,129 @@ LUA_METHOD(Zip, read) {
 
 extern BOOL make_path(wchar_t *folder);
 
-__int64 extract_zip(struct zip_t *z, const char *dir) {
-	int	entry = 0, slen;
-	size_t size = 0, len = dir ? strlen(dir) : 0, count = 0;
-	BOOL success = TRUE;
+//-------------------------------------[ Parallel extraction ]
+//--- Each worker extracts files through its own reader: file archives are reopened,
+//--- memory archives (the embedded filesystem) share the reader callback of the source archive
+typedef struct {
+	mz_uint			index;
+	wchar_t			*path;
+} ExtractFile;
+
+typedef struct {
+	mz_zip_archive	*source;
+	const wchar_t	*fname;
+	BOOL			shared;
+	ExtractFile		*files;
+	LONG			count;
+	volatile LONG	next;
+	volatile LONG	done;
+	volatile LONG	failed;
+} ExtractJob;
+
+static DWORD WINAPI extract_worker(LPVOID param) {
+	ExtractJob *job = param;
+	mz_zip_archive archive = {0}, *zip = &archive;
+	BOOL ready = TRUE;
+	LONG i;
+
+	if (job->shared)
+		zip = job->source;
+	else if (job->fname)
+		ready = mz_zip_reader_init_file(&archive, job->fname, MZ_ZIP_FLAG_DO_NOT_SORT_CENTRAL_DIRECTORY);
+	else {
+		archive.m_pRead = job->source->m_pRead;
+		archive.m_pIO_opaque = job->source->m_pIO_opaque;
+		ready = mz_zip_reader_init(&archive, job->source->m_archive_size, MZ_ZIP_FLAG_DO_NOT_SORT_CENTRAL_DIRECTORY);
+	}
+	if (!job->shared && !ready) {
+		job->failed = TRUE;
+		return 0;
+	}
+	while (!job->failed && (i = InterlockedIncrement(&job->next)-1) < job->count) {
+		if (mz_zip_reader_extract_to_file(zip, job->files[i].index, job->files[i].path, 0))
+			InterlockedIncrement(&job->done);
+		else
+			job->failed = TRUE;
+	}
+	if (!job->shared)
+		mz_zip_reader_end(&archive);
+	return 0;
+}
 
-	while(success && (zip_entry_openbyindex(z, entry++) == 0)) {
-		const char *name = zip_entry_name(z, &size);
-		char *fname = malloc(++size);
-		wchar_t *wfname;
-		int i;
-		
+static int compare_paths(const void *a, const void *b) {
+	return wcscmp(*(const wchar_t **)a, *(const wchar_t **)b);
+}
+
+//--- Extracts all entries starting with dir (or all entries if NULL) to the current directory
+//--- Returns the number of entries processed
+__int64 extract_zip(Zip *z, const char *dir) {
+	mz_zip_archive *pzip = &z->zip->archive;
+	mz_uint i, total = mz_zip_reader_get_num_files(pzip);
+	size_t len = dir ? strlen(dir) : 0, ndirs = 0, dcapacity = 0, capacity = 0, skipped = 0;
+	wchar_t **dirs = NULL;
+	ExtractJob job = {0};
+	BOOL success = TRUE;
+	int nthreads;
+
+	if (pzip->m_zip_mode != MZ_ZIP_MODE_READING)
+		return 0;
+	//--- list the files to extract and the tree of directories to create
+	for (i = 0; success && i < total; i++) {
+		mz_uint size = mz_zip_reader_get_filename(pzip, i, NULL, 0);
+		char *name = malloc(size);
+		wchar_t *wname;
+		int wlen = -1;
+
+		if (!name || !mz_zip_reader_get_filename(pzip, i, name, size)) {
+			free(name);
+			success = FALSE;
+			break;
+		}
 		if (dir && (strncmp(dir, name, len) != 0)) {
-			count++;
-			goto next;
+			free(name);
+			skipped++;
+			continue;
 		}
-		strncpy(fname, name, size);
-		slen = (int)size;
-		wfname = utf8_towchar(fname, &slen);
-		wfname[slen-1] = 0;
-		for (i = 0; i < slen; i++) {
-			if (wfname[i] == L'/') {
-				wfname[i] = 0;
-				if (GetFileAttributesW(wfname) == INVALID_FILE_ATTRIBUTES)
-					CreateDirectoryW(wfname, NULL);
-				wfname[i] = L'\\';
+		wname = utf8_towchar(name, &wlen);
+		free(name);
+		for (int j = 1; wname[j]; j++)
+			if (wname[j] == L'/' || wname[j] == L'\\') {
+				wname[j] = 0;
+				if ((success = grow_array(&dirs, &dcapacity, ndirs, sizeof(wchar_t *))))
+					dirs[ndirs++] = _wcsdup(wname);
+				wname[j] = L'\\';
 			}
+		if (mz_zip_reader_is_file_a_directory(pzip, i)) {
+			free(wname);
+			skipped++;
+		} else if (success && grow_array(&job.files, &capacity, job.count, sizeof(ExtractFile))) {
+			job.files[job.count].index = i;
+			job.files[job.count++].path = wname;
+		} else {
+			free(wname);
+			success = FALSE;
 		}
-		if ( !zip_entry_isdir(z) )
-			success = (zip_entry_fread(z, wfname) == 0);
-		count++;
-		free(wfname);
-next:
-		free(fname);
-		zip_entry_close(z);
 	}
-	return(__int64)count;
+	//--- sorted paths list parents first, each directory is created once
+	qsort(dirs, ndirs, sizeof(wchar_t *), compare_paths);
+	for (i = 0; i < ndirs; i++) {
+		if (!i || wcscmp(dirs[i], dirs[i-1]))
+			CreateDirectoryW(dirs[i], NULL);
+	}
+	if (success && job.count) {
+		job.source = pzip;
+		job.fname = z->fname;
+		nthreads = job.count < compression_threads() ? job.count : compression_threads();
+		job.shared = nthreads < 2 || (!z->fname && pzip->m_zip_type != MZ_ZIP_TYPE_MEMORY);
+		run_workers(extract_worker, &job, job.shared ? 1 : nthreads);
+	}
+	for (i = 0; i < ndirs; i++)
+		free(dirs[i]);
+	free(dirs);
+	for (LONG f = 0; f < job.count; f++)
+		free(job.files[f].path);
+	free(job.files);
+	return (__int64)(skipped + job.done);
 }
 
 static wchar_t *prep_destdir(lua_State *L, int idx) {
@@ -315,7 +589,7 @@ LUA_METHOD(Zip, extract)
 {
 	Zip *z = lua_self(L, 1, Zip);
 	size_t len;
-	int narg = lua_gettop(L);
+	int narg = lua_gettop(L), idx, isdir = 0;
 	const char *name = lua_tolstring(L, 2, &len);
 	BOOL include_path = narg > 3 ? lua_toboolean(L, 4) : TRUE;
 	wchar_t *oldpath = NULL, *fname = lua_towstring(L, 2);
@@ -328,25 +602,19 @@ LUA_METHOD(Zip, extract)
 	lua_pushboolean(L, FALSE);
 	if (z->mode != 'r')
 		luaL_error(L, "cannot extract from a Zip archive opened in write/append mode");
-	if (zip_entry_open(z->zip, name) == 0) {
-dir:	if (zip_entry_isdir(z->zip)) {
-			zip_entry_close(z->zip);
-			extract_zip(z->zip, dname);		
+	if ((idx = zip_locate(z->zip, name, &isdir)) != -1) {
+		if (isdir) {
+			extract_zip(z, dname);		
 			lua_pushvalue(L, 2);
 			lua_pushinstance(L, Directory, 1);
-		}
-		else {
-			if (include_path) {
-				if (make_path(fname) && (zip_entry_fread(z->zip, fname) == 0))
-					goto done;
-			} else if (zip_entry_fread(z->zip, PathFindFileNameW(fname)) == 0) {
-done:			lua_pushstring(L, name);
+		} else if (zip_entry_openbyindex(z->zip, idx) == 0) {
+			if (include_path ? make_path(fname) && (zip_entry_fread(z->zip, fname) == 0) : (zip_entry_fread(z->zip, PathFindFileNameW(fname)) == 0)) {
+				lua_pushstring(L, name);
 				lua_pushinstance(L, File, 1);
-				zip_entry_close(z->zip);
 			}
-		} 
-	} else if (zip_entry_open(z->zip, dname) == 0)
-		goto dir;
+			zip_entry_close(z->zip);
+		}
+	}
 	free(fname);
 	free(dname);
 	if (oldpath) {
@@ -356,13 +624,12 @@ done:			lua_pushstring(L, name);
 	return 1;
 }
 
-
 LUA_METHOD(Zip, extractall) {
 	wchar_t *oldpath = NULL;
 
 	if (lua_gettop(L) > 1)
 		oldpath = prep_destdir(L, 2);
-	lua_pushinteger(L, extract_zip(lua_self(L, 1, Zip)->zip, NULL));
+	lua_pushinteger(L, extract_zip(lua_self(L, 1, Zip), NULL));
 	if (oldpath) {
 		SetCurrentDirectoryW(oldpath);
 		free(oldpath);
@@ -371,16 +638,10 @@ LUA_METHOD(Zip, extractall) {
 }
 
 LUA_METHOD(Zip, isdirectory) {
-	Zip *z =lua_self(L, 1, Zip);
-	size_t len = 0;
-	char tmp[len+2];
-	
-	snprintf(tmp, len+2, "%s/", luaL_checklstring(L, 2, &len));
-	lua_pushboolean(L, FALSE);
-	if (zip_entry_open(z->zip, tmp) == 0) {
-		lua_pushboolean(L, zip_entry_isdir(z->zip));
-		zip_entry_close(z->zip);
-	}
+	Zip *z = lua_self(L, 1, Zip);
+	int isdir = 0;
+
+	lua_pushboolean(L, (zip_locate(z->zip, luaL_checkstring(L, 2), &isdir) != -1) && isdir);
 	return 1;
 }
 
@@ -421,6 +682,7 @@ const luaL_Reg Zip_metafields[] = {
 
 const luaL_Reg Zip_methods[] = {
 	{"close",		Zip_close},
+	{"open",		Zip_open},
 	{"write",		Zip_write},
 	{"read",		Zip_read},
 	{"extract",		Zip_extract},
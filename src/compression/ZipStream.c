@@ -0,0 +1,359 @@
+/*
+ | LuaRT - A Windows programming framework for Lua
+ | Luart.org, Copyright (c) Tine Samir 2022.
+ | See Copyright Notice in LICENSE.TXT
+ |-------------------------------------------------
+ | ZipStream.c | LuaRT ZipStream object implementation
+*/
+
+#include <Zip.h>
+#include <Buffer.h>
+#include <luart.h>
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "lib\zip.h"
+
+luart_type TZipStream;
+extern const char *seek_modes[];
+
+static const char *zip_error(ZipStream *s) {
+	return mz_zip_get_error_string(mz_zip_get_last_error(&s->archive->archive));
+}
+
+//--- Reads raw entry bytes at the current stream end (bufstart+buflen)
+//--- Stored entries are read directly from the archive, deflated entries are inflated sequentially
+//--- The CRC-32 is checked when the end of the entry is reached (for stored entries, only if read sequentially up to there)
+static size_t stream_rawread(lua_State *L, ZipStream *s, void *dst, size_t len) {
+	mz_uint64 pos = s->bufstart + s->buflen;
+	mz_uint32 crc;
+	size_t count;
+
+	if (pos >= s->size)
+		return 0;
+	if (len > s->size - pos)
+		len = (size_t)(s->size - pos);
+	if (s->stored) {
+		count = s->archive->archive.m_pRead(s->archive->archive.m_pIO_opaque, s->offset + pos, dst, len);
+		if (pos == s->crcpos) {
+			s->crc = (mz_uint32)mz_crc32(s->crc, dst, count);
+			s->crcpos += count;
+		}
+		if (s->crcpos < s->size)
+			return count;
+		crc = s->crc;
+	} else {
+		count = mz_zip_reader_extract_iter_read(s->iter, dst, len);
+		crc = s->iter->file_crc32;
+	}
+	if (count && (pos + count == s->size) && (crc != s->crc32))
+		luaL_error(L, "error reading Zip entry : %s", mz_zip_get_error_string(MZ_ZIP_CRC_CHECK_FAILED));
+	return count;
+}
+
+//--- Discards the buffered bytes and reads the next chunk of the entry
+static BOOL stream_fill(lua_State *L, ZipStream *s) {
+	if (!s->buffer && !(s->buffer = malloc(s->bufsize)))
+		luaL_error(L, "not enough memory");
+	s->bufstart += s->buflen;
+	s->bufpos = 0;
+	if ( !(s->buflen = stream_rawread(L, s, s->buffer, s->bufsize)) && (s->bufstart < s->size) )
+		luaL_error(L, "error reading Zip entry : %s", zip_error(s));
+	return s->buflen > 0;
+}
+
+static size_t stream_read(lua_State *L, ZipStream *s, BYTE *dst, size_t len) {
+	size_t done = 0, count;
+
+	while (done < len) {
+		if ((count = s->buflen - s->bufpos)) {
+			if (count > len - done)
+				count = len - done;
+			memcpy(dst + done, s->buffer + s->bufpos, count);
+			s->bufpos += count;
+			done += count;
+		} else if (len - done >= s->bufsize) {
+			//--- large reads bypass the stream buffer
+			s->bufstart += s->buflen;
+			s->bufpos = s->buflen = 0;
+			if ( !(count = stream_rawread(L, s, dst + done, len - done)) ) {
+				if (s->bufstart < s->size)
+					luaL_error(L, "error reading Zip entry : %s", zip_error(s));
+				break;
+			}
+			s->bufstart += count;
+			done += count;
+		} else if (!stream_fill(L, s))
+			break;
+	}
+	return done;
+}
+
+//--- Restarts the decompression of a deflated entry from its beginning
+static void stream_rewind(lua_State *L, ZipStream *s) {
+	mz_zip_reader_extract_iter_free(s->iter);
+	s->bufstart = s->bufpos = s->buflen = 0;
+	if ( !(s->iter = mz_zip_reader_extract_iter_new(&s->archive->archive, s->index, 0)) )
+		luaL_error(L, "error reading Zip entry : %s", zip_error(s));
+}
+
+static void stream_seek(lua_State *L, ZipStream *s, mz_uint64 pos) {
+	if (pos > s->size)
+		pos = s->size;
+	if (pos >= s->bufstart && pos <= s->bufstart + s->buflen)
+		s->bufpos = (size_t)(pos - s->bufstart);
+	else if (s->stored) {
+		s->bufstart = pos;
+		s->bufpos = s->buflen = 0;
+	} else {
+		if (pos < s->bufstart)
+			stream_rewind(L, s);
+		//--- deflated entries can only move forward, by inflating the skipped data
+		while (pos > s->bufstart + s->buflen && stream_fill(L, s));
+		s->bufpos = (size_t)(pos - s->bufstart);
+	}
+}
+
+static ZipStream *check_stream(lua_State *L, BOOL writing) {
+	ZipStream *s = lua_self(L, 1, ZipStream);
+	if (s->closed)
+		luaL_error(L, "attempt to use a closed ZipStream");
+	if (s->writing != writing)
+		luaL_error(L, writing ? "cannot write to a ZipStream opened for reading" : "cannot read from a ZipStream opened for writing");
+	return s;
+}
+
+const char *zipstream_close(ZipStream *s) {
+	Zip *z = s->zip;
+	const char *err = NULL;
+
+	if (s->closed)
+		return NULL;
+	s->closed = TRUE;
+	if (s->writing) {
+		//--- error messages are static strings, that remain valid once the archive is closed
+		//--- (write errors during compression are not recorded by miniz)
+		if (zip_entry_close(s->archive) != 0)
+			err = mz_zip_get_last_error(&s->archive->archive) ? zip_lasterror(s->archive) : "failed to write Zip entry data";
+		z->writer = NULL;
+	} else if (s->iter)
+		mz_zip_reader_extract_iter_free(s->iter);
+	s->iter = NULL;
+	free(s->buffer);
+	s->buffer = NULL;
+	if (!--z->streams && z->pending) {
+		zip_close(z->pending);
+		z->pending = NULL;
+	}
+	return err;
+}
+
+/* ------------------------------------------------------------------------ */
+
+LUA_CONSTRUCTOR(ZipStream) {
+	Zip *z = luaL_checkcinstance(L, 2, Zip);
+	const char *entry = luaL_checkstring(L, 3);
+	ZipStream *s;
+
+	if (!z->zip)
+		luaL_error(L, "attempt to use a closed Zip archive");
+	s = lua_allocinstance(L, ZipStream);
+	//--- closed until completely opened, as __gc may be called if an error occurs
+	s->closed = TRUE;
+	s->ref = LUA_NOREF;
+	s->zip = z;
+	s->archive = z->zip;
+	if (z->mode == 'r') {
+		int idx, isdir = 0;
+
+		if ((idx = zip_locate(z->zip, entry, &isdir)) == -1)
+			luaL_error(L, "Zip entry '%s' not found", entry);
+		if (isdir)
+			luaL_error(L, "cannot open Zip directory entry '%s'", entry);
+		if ( !(s->iter = mz_zip_reader_extract_iter_new(&z->zip->archive, idx, 0)) )
+			luaL_error(L, "cannot open Zip entry '%s' : %s", entry, zip_error(s));
+		s->index = idx;
+		s->size = s->iter->file_stat.m_uncomp_size;
+		s->crc32 = s->iter->file_stat.m_crc32;
+		if ( (s->stored = !s->iter->file_stat.m_method) ) {
+			s->offset = s->iter->cur_file_ofs;
+			mz_zip_reader_extract_iter_free(s->iter);
+			s->iter = NULL;
+		}
+		s->bufsize = s->size < ZIPSTREAM_BUFFERSIZE ? (size_t)s->size+1 : ZIPSTREAM_BUFFERSIZE;
+	} else {
+		if (z->writer)
+			luaL_error(L, "another Zip entry is already opened for writing");
+		if (zip_entry_open(z->zip, entry) != 0)
+			luaL_error(L, "cannot open Zip entry '%s' : %s", entry, zip_lasterror(z->zip));
+		s->writing = TRUE;
+		z->writer = s;
+	}
+	z->streams++;
+	s->closed = FALSE;
+	//--- the stream keeps its Zip archive alive
+	lua_pushvalue(L, 2);
+	s->ref = luaL_ref(L, LUA_REGISTRYINDEX);
+	lua_newinstance(L, s, ZipStream);
+	return 1;
+}
+
+LUA_METHOD(ZipStream, read) {
+	ZipStream *s = check_stream(L, FALSE);
+	mz_uint64 pos = s->bufstart + s->bufpos, left = s->size - pos;
+	lua_Integer n = luaL_optinteger(L, 2, (lua_Integer)left);
+	Buffer *b;
+
+	if (n < 0)
+		luaL_argerror(L, 2, "positive number expected");
+	if (!left && n) {
+		lua_pushnil(L);
+		return 1;
+	}
+	if ((mz_uint64)n > left)
+		n = (lua_Integer)left;
+	lua_pushnil(L);
+	b = lua_pushinstance(L, Buffer, 1);
+	b->size = stream_read(L, s, buffer_reserve(L, b, (size_t)n), (size_t)n);
+	return 1;
+}
+
+static int iterate_lines(lua_State *L) {
+	ZipStream *s = lua_self(L, lua_upvalueindex(1), ZipStream);
+	luaL_Buffer b;
+	BYTE *start, *lf;
+	size_t len;
+
+	if (s->closed || s->writing)
+		luaL_error(L, "cannot read lines from this ZipStream");
+	if (s->bufstart + s->bufpos >= s->size)
+		return 0;
+	luaL_buffinit(L, &b);
+	for (;;) {
+		if (s->bufpos == s->buflen && !stream_fill(L, s))
+			break;
+		start = s->buffer + s->bufpos;
+		len = s->buflen - s->bufpos;
+		if ( (lf = memchr(start, '\n', len)) ) {
+			luaL_addlstring(&b, (const char *)start, lf - start);
+			s->bufpos += lf - start + 1;
+			break;
+		}
+		luaL_addlstring(&b, (const char *)start, len);
+		s->bufpos = s->buflen;
+	}
+	luaL_pushresult(&b);
+	len = lua_rawlen(L, -1);
+	if (len && lua_tostring(L, -1)[len-1] == '\r') {
+		lua_pushlstring(L, lua_tostring(L, -1), len-1);
+		lua_remove(L, -2);
+	}
+	return 1;
+}
+
+LUA_METHOD(ZipStream, getlines) {
+	lua_pushvalue(L, 1);
+	lua_pushcclosure(L, iterate_lines, 1);
+	return 1;
+}
+
+//--- ZipStream:seek([offset], ["start"|"here"|"end"]) returns the new 1-based position
+LUA_METHOD(ZipStream, seek) {
+	ZipStream *s = check_stream(L, FALSE);
+	lua_Integer offset = luaL_optinteger(L, 2, 0);
+	int mode = luaL_checkoption(L, 3, "here", seek_modes);
+	lua_Integer origin = mode == 0 ? 0 : (mode == 1 ? (lua_Integer)(s->bufstart + s->bufpos) : (lua_Integer)s->size);
+
+	if (origin + offset < 0)
+		luaL_argerror(L, 2, "cannot seek before the start of the Zip entry");
+	stream_seek(L, s, (mz_uint64)(origin + offset));
+	lua_pushinteger(L, (lua_Integer)(s->bufstart + s->bufpos) + 1);
+	return 1;
+}
+
+LUA_METHOD(ZipStream, write) {
+	ZipStream *s = check_stream(L, TRUE);
+	size_t len;
+	const char *data;
+	Buffer *b;
+
+	if ( (b = lua_iscinstance(L, 2, TBuffer)) ) {
+		data = (const char *)b->bytes;
+		len = b->size;
+	} else data = luaL_checklstring(L, 2, &len);
+	if (zip_entry_write(s->archive, data, len) != 0)
+		luaL_error(L, "error writing Zip entry : %s", zip_lasterror(s->archive));
+	s->size += len;
+	lua_pushinteger(L, (lua_Integer)len);
+	return 1;
+}
+
+//--- ZipStream:close() returns true, or false and the error message if the written entry could not be completed
+LUA_METHOD(ZipStream, close) {
+	ZipStream *s = lua_self(L, 1, ZipStream);
+	const char *err = zipstream_close(s);
+
+	luaL_unref(L, LUA_REGISTRYINDEX, s->ref);
+	s->ref = LUA_NOREF;
+	lua_pushboolean(L, !err);
+	if (err) {
+		lua_pushstring(L, err);
+		return 2;
+	}
+	return 1;
+}
+
+LUA_PROPERTY_GET(ZipStream, size) {
+	lua_pushinteger(L, (lua_Integer)lua_self(L, 1, ZipStream)->size);
+	return 1;
+}
+
+LUA_PROPERTY_GET(ZipStream, position) {
+	ZipStream *s = lua_self(L, 1, ZipStream);
+	if (s->closed || s->writing)
+		lua_pushnil(L);
+	else lua_pushinteger(L, (lua_Integer)(s->bufstart + s->bufpos) + 1);
+	return 1;
+}
+
+LUA_PROPERTY_SET(ZipStream, position) {
+	ZipStream *s = check_stream(L, FALSE);
+	lua_Integer pos = luaL_checkinteger(L, 2);
+
+	if (pos < 1)
+		luaL_error(L, "invalid ZipStream.position value");
+	stream_seek(L, s, (mz_uint64)pos-1);
+	return 0;
+}
+
+LUA_PROPERTY_GET(ZipStream, eof) {
+	ZipStream *s = lua_self(L, 1, ZipStream);
+	lua_pushboolean(L, s->closed || s->writing || s->bufstart + s->bufpos >= s->size);
+	return 1;
+}
+
+LUA_METHOD(ZipStream, __gc) {
+	ZipStream *s = lua_self(L, 1, ZipStream);
+	zipstream_close(s);
+	luaL_unref(L, LUA_REGISTRYINDEX, s->ref);
+	return 0;
+}
+
+const luaL_Reg ZipStream_methods[] = {
+	{"read",			ZipStream_read},
+	{"seek",			ZipStream_seek},
+	{"write",			ZipStream_write},
+	{"close",			ZipStream_close},
+	{"get_lines",		ZipStream_getlines},
+	{"get_size",		ZipStream_getsize},
+	{"get_position",	ZipStream_getposition},
+	{"set_position",	ZipStream_setposition},
+	{"get_eof",			ZipStream_geteof},
+	{NULL, NULL}
+};
+
+const luaL_Reg ZipStream_metafields[] = {
+	{"__gc",		ZipStream___gc},
+	{NULL, NULL}
+};
@@ -10,6 +10,7 @@
 #include <File.h>
 #include <Buffer.h>
 #include <Zip.h>
+#include <Deflater.h>
 
 LUA_METHOD(compression, deflate) {
 	size_t len; 
@@ -54,118 +55,153 @@ LUA_METHOD(compression, isZip) {
 	return 1;
 }
 
-#define  	GZIP_HEADER_MINSIZE 10
-#define  	GZIP_FOOTER_SIZE 8
-#define  	GZIP_COMPRESSION_DEFLATE 8
-#define 	CHUNK 16384
+//-------------------------------------[ gzip sources and targets ]
+//--- Compressed or uncompressed data is read from a FILE stream or from memory
+typedef struct {
+	FILE		*stream;
+	const BYTE	*bytes;
+	size_t		len;
+} GzipSource;
 
-LUA_METHOD(compression, gunzip) {
-	int ret;
-    unsigned int have;
-    z_stream stream = {0};
-    unsigned char in[CHUNK];
-    unsigned char out[CHUNK];
+//--- and written to a FILE stream or to a Buffer
+typedef struct {
+	FILE		*stream;
+	Buffer		*b;
+	const char	*err;		//--- set when the Buffer cannot grow
+} GzipTarget;
+
+static size_t source_reader(void *ud, BYTE *buff, size_t len) {
+	GzipSource *src = ud;
+
+	if (src->stream)
+		return fread(buff, 1, len, src->stream);
+	if (len > src->len)
+		len = src->len;
+	memcpy(buff, src->bytes, len);
+	src->bytes += len;
+	src->len -= len;
+	return len;
+}
+
+static BOOL target_writer(void *ud, const BYTE *buff, size_t len) {
+	GzipTarget *t = ud;
+
+	BYTE *bytes;
+
+	if (t->stream)
+		return fwrite(buff, 1, len, t->stream) == len;
+	//--- no error can be thrown from here, gzip_done() raises it once everything is released
+	if (!(bytes = buffer_tryreserve(t->b, t->b->size + len))) {
+		t->err = "Buffer allocation error: not enough memory";
+		return FALSE;
+	}
+	memcpy(bytes + t->b->size, buff, len);
+	t->b->size += len;
+	return TRUE;
+}
+
+//--- Source is a Buffer, a File (read from its current position when opened) or a filename
+//--- Returns the FILE stream to be closed once done, if any
+static FILE *open_source(lua_State *L, int idx, GzipSource *src) {
+	Buffer *b;
+	File *f;
 	wchar_t *fname;
-	FILE *filefrom, *fileto;
-	wchar_t path[MAX_PATH], tmp[MAX_PATH];
 
-    if (mz_inflateInit2(&stream, -MZ_DEFAULT_WINDOW_BITS) != MZ_OK)
-		luaL_error(L, "Failed to initialize deflate compression");
- 	fname = luaL_checkFilename(L, 1);
-	if (!(filefrom = _wfopen(fname, L"rb")))
-		luaL_error(L, "File not found");
-	GetTempPathW(MAX_PATH, path);
-	GetTempFileNameW(path, NULL, 0, tmp);
-	if (!(fileto = _wfopen(tmp, L"wb")))
-		luaL_error(L, "Cannot create temporary uncompressed file");
-	fread(in, 1, GZIP_HEADER_MINSIZE, filefrom);
-    do {
-        stream.avail_in = fread(in, 1, CHUNK, filefrom);
-        if (ferror(filefrom)) {
-ioerror: 	inflateEnd(&stream);
-            luaL_error(L, strerror(errno));
-        }
-        if (stream.avail_in == 0)
-            break;
-        stream.next_in = in;
-        do {
-            stream.avail_out = CHUNK;
-            stream.next_out = out;
-            ret = mz_inflate(&stream, MZ_NO_FLUSH);
-			if (ret < MZ_OK || ret > MZ_STREAM_END)
-				luaL_error(L, "Error during decompression");
-            have = CHUNK - stream.avail_out;
-            if (fwrite(out, 1, have, fileto) != have || ferror(fileto)) 
-				goto ioerror;
-        } while (stream.avail_out == 0);
-
-    } while (ret != Z_STREAM_END);
-    (void)inflateEnd(&stream);
-	fclose(filefrom);
-	fclose(fileto);
-	lua_pushwstring(L, tmp);
-	lua_pushinstance(L, File, 1);
+	if ((b = lua_iscinstance(L, idx, TBuffer))) {
+		src->bytes = b->bytes;
+		src->len = b->size;
+		return NULL;
+	}
+	if ((f = lua_iscinstance(L, idx, TFile)) && f->stream) {
+		file_sync(f);
+		src->stream = f->stream;
+		return NULL;
+	}
+	fname = luaL_checkFilename(L, idx);
+	src->stream = _wfopen(fname, L"rb");
 	free(fname);
-    return ret == Z_STREAM_END;
+	if (!src->stream)
+		luaL_error(L, "File not found");
+	return src->stream;
+}
+
+//--- Target is a File (written at its current position when opened), or a Buffer for in-memory sources,
+//--- or else a new temporary file. Pushes the value to be returned and the FILE stream to be closed once done, if any
+static FILE *open_target(lua_State *L, int idx, GzipSource *src, FILE *from, GzipTarget *t, wchar_t *tmp) {
+	const char *err = NULL;
+	wchar_t path[MAX_PATH];
+
+	if (idx && !lua_isnoneornil(L, idx)) {
+		File *f = luaL_checkcinstance(L, idx, File);
+		lua_pushvalue(L, idx);
+		if (!f->stream) {
+			if (!(t->stream = _wfopen(f->fullpath, L"wb")))
+				err = strerror(errno);
+			else
+				return t->stream;
+		} else if (!f->mode)
+			err = "File is not opened for writing";
+		else {
+			file_sync(f);
+			t->stream = f->stream;
+			return NULL;
+		}
+	} else if (!src->stream) {
+		lua_pushnil(L);
+		t->b = lua_pushinstance(L, Buffer, 1);
+		return NULL;
+	} else {
+		GetTempPathW(MAX_PATH, path);
+		GetTempFileNameW(path, NULL, 0, tmp);
+		if ((t->stream = _wfopen(tmp, L"wb")))
+			return t->stream;
+		err = "Cannot create temporary file";
+	}
+	if (from)
+		fclose(from);
+	luaL_error(L, "%s", err);
+	return NULL;
+}
+
+static int gzip_done(lua_State *L, const char *err, GzipSource *src, FILE *from, GzipTarget *t, FILE *to, const wchar_t *tmp) {
+	if (err && t->err)
+		err = t->err;
+	else if (!err && src->stream && ferror(src->stream))
+		err = strerror(errno);
+	if (from)
+		fclose(from);
+	if (to)
+		fclose(to);
+	if (err) {
+		if (*tmp)
+			DeleteFileW(tmp);
+		luaL_error(L, "%s", err);
+	}
+	if (*tmp) {
+		lua_pushwstring(L, tmp);
+		lua_pushinstance(L, File, 1);
+	}
+	return 1;
+}
+
+LUA_METHOD(compression, gunzip) {
+	GzipSource src = {0};
+	GzipTarget t = {0};
+	wchar_t tmp[MAX_PATH] = {0};
+	FILE *from = open_source(L, 1, &src), *to = open_target(L, 2, &src, from, &t, tmp);
+
+	return gzip_done(L, gunzip_stream(source_reader, &src, target_writer, &t), &src, from, &t, to, tmp);
 }
 
 LUA_METHOD(compression, gzip) {
-    int flush;
-    unsigned int have;
-    z_stream stream = {0};
-    unsigned char in[CHUNK];
-    unsigned char out[CHUNK];
-	wchar_t *fname;
-	FILE *filefrom, *fileto;
-	wchar_t path[MAX_PATH], tmp[MAX_PATH];
-	static unsigned char gzip_header[] = { 0x1F, 0x8B, 0x08, 0, 0, 0, 0, 0, 0, 0x0B };
-	mz_ulong crc = 0;
-	LONGLONG fsize = 0;
-
-	if (mz_deflateInit2(&stream, MZ_DEFAULT_LEVEL, MZ_DEFLATED, -MZ_DEFAULT_WINDOW_BITS, 1, 0) != MZ_OK)
-		luaL_error(L, "Failed to initialize deflate compression");
- 	fname = luaL_checkFilename(L, 1);
-	if (!(filefrom = _wfopen(fname, L"rb")))
-		luaL_error(L, "File not found");
-	GetTempPathW(MAX_PATH, path);
-	GetTempFileNameW(path, NULL, 0, tmp);
-	if (!(fileto = _wfopen(tmp, L"wb")))
-		luaL_error(L, "Cannot create temporary gzip file");
-	fwrite(gzip_header, 1, GZIP_HEADER_MINSIZE, fileto);
-    do {
-        stream.avail_in = fread(in, 1, CHUNK, filefrom);
-		fsize += stream.avail_in;
-		crc = mz_crc32(crc, in, stream.avail_in);
-        if (ferror(filefrom)) {
-            deflateEnd(&stream);
-            luaL_error(L, strerror(errno));
-        }
-        flush = feof(filefrom) ? Z_FINISH : Z_NO_FLUSH;
-        stream.next_in = in;
-        do {
-            stream.avail_out = CHUNK;
-            stream.next_out = out;
-            deflate(&stream, flush);
-            have = CHUNK - stream.avail_out;
-            if (fwrite(out, 1, have, fileto) != have || ferror(fileto)) {
-                deflateEnd(&stream);
-                luaL_error(L, strerror(errno));
-            }
-        } while (stream.avail_out == 0);
-    } while (flush != Z_FINISH);
-
-    deflateEnd(&stream);
-	fclose(filefrom);
-	
-	for (int i = 0; i < 4; i++)
-		fputc(crc >> (i*8), fileto);
-	for (int i = 0; i < 4; i++)
-		fputc(fsize >> (i*8), fileto);
-	fclose(fileto);
-	lua_pushwstring(L, tmp);
-	lua_pushinstance(L, File, 1);
-	free(fname);
-    return 1;
+	GzipSource src = {0};
+	GzipTarget t = {0};
+	wchar_t tmp[MAX_PATH] = {0};
+	int target = lua_type(L, 2) == LUA_TNUMBER ? 0 : 2;
+	int nthreads = (int)luaL_optinteger(L, target ? 3 : 2, compression_threads());
+	FILE *from = open_source(L, 1, &src), *to = open_target(L, target, &src, from, &t, tmp);
+
+	return gzip_done(L, gzip_parallel(source_reader, &src, target_writer, &t, MZ_DEFAULT_LEVEL, nthreads), &src, from, &t, to, tmp);
 }
 
 static const luaL_Reg compression_properties[] = {
@@ -183,6 +219,9 @@ static const luaL_Reg compressionlib[] = {
 
 LUAMOD_API int luaopen_compression(lua_State *L) {
 	lua_regmodule(L, compression);
-	lua_regobjectmt(L, Zip);
+	lua_regcobjectmt(L, Zip);
+	lua_regcobjectmt(L, ZipStream);
+	lua_regcobjectmt(L, Deflater);
+	lua_regcobjectmt(L, Inflater);
 	return 1;
-}
\ No newline at end of file
+}
\ No newline at end of file
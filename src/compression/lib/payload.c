@@ -0,0 +1,70 @@
+/*
+ | LuaRT - A Windows programming framework for Lua
+ | Luart.org, Copyright (c) Tine Samir 2022.
+ | See Copyright Notice in LICENSE.TXT
+ |-------------------------------------------------
+ | payload.c | Location of a Zip archive appended to an executable or any other file
+*/
+
+#include "payload.h"
+#include <string.h>
+
+static uint32_t read_u16(const uint8_t *p) {
+	return p[0] | (p[1] << 8);
+}
+
+static uint32_t read_u32(const uint8_t *p) {
+	return p[0] | (p[1] << 8) | (p[2] << 16) | ((uint32_t)p[3] << 24);
+}
+
+size_t payload_peend(const uint8_t *head, size_t len) {
+	size_t pe, sections, end = 0, maxpointer = 0, ptr;
+	uint32_t i, count;
+
+	if (len < 0x40 || head[0] != 'M' || head[1] != 'Z')
+		return 0;
+	pe = read_u32(head+0x3C);
+	if (pe > len || len-pe < 24 || memcmp(head+pe, "PE\0\0", 4))
+		return 0;
+	count = read_u16(head+pe+6);
+	sections = pe+24+read_u16(head+pe+20);
+	if (sections > len || (len-sections)/40 < count)
+		return 0;
+	for (i = 0; i < count; i++, sections += 40)
+		if ((ptr = read_u32(head+sections+20)) > maxpointer) {
+			maxpointer = ptr;
+			end = ptr + read_u32(head+sections+16);
+		}
+	return end;
+}
+
+size_t payload_zipoffset(const uint8_t *tail, size_t len, size_t size) {
+	size_t pos, base, cdsize, cdoffset;
+
+	if (len < 22 || len > size)
+		return size;
+	//--- file offset of the first tail byte
+	base = size-len;
+	for (pos = len-22;; pos--) {
+		//--- the comment length must match the bytes that follow the record
+		if (read_u32(tail+pos) == 0x06054b50 && pos+22+read_u16(tail+pos+20) == len) {
+			cdsize = read_u32(tail+pos+12);
+			cdoffset = read_u32(tail+pos+16);
+			//--- Zip64 archives are not supported here
+			if (cdoffset == 0xFFFFFFFF || cdsize + cdoffset > base+pos)
+				return size;
+			return base + pos - cdsize - cdoffset;
+		}
+		if (pos == 0 || len-pos >= PAYLOAD_TAIL)
+			break;
+	}
+	return size;
+}
+
+size_t payload_offset(const uint8_t *head, size_t headlen, const uint8_t *tail, size_t taillen, size_t size) {
+	size_t end;
+
+	if (headlen >= 2 && head[0] == 'M' && head[1] == 'Z')
+		return (end = payload_peend(head, headlen)) && end < size ? end : size;
+	return payload_zipoffset(tail, taillen, size);
+}
@@ -0,0 +1,30 @@
+/*
+ | LuaRT - A Windows programming framework for Lua
+ | Luart.org, Copyright (c) Tine Samir 2022.
+ | See Copyright Notice in LICENSE.TXT
+ |-------------------------------------------------
+ | payload.h | Location of a Zip archive appended to an executable or any other file
+*/
+
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+//--- Size of the file start needed to read PE executables headers
+#define PAYLOAD_HEAD	4096
+//--- Size of the file end that may hold the Zip end of central directory record (record and comment)
+#define PAYLOAD_TAIL	(22+0xFFFF)
+
+//--- Returns the end of the last section of a PE executable from its headers, not clamped to the file size
+//--- Returns 0 if head is not the start of a PE executable, or if its headers do not fit in it
+size_t payload_peend(const uint8_t *head, size_t len);
+
+//--- Returns the offset of the Zip archive whose end of central directory record is in tail, the last len bytes of a file
+//--- Returns size if there is no such archive
+size_t payload_zipoffset(const uint8_t *tail, size_t len, size_t size);
+
+//--- Returns the offset of the archive appended to a file, from its first headlen bytes and its last taillen bytes
+//--- PE executables payload follows the last section, other files are searched for a Zip archive
+//--- Returns size if there is no appended archive
+size_t payload_offset(const uint8_t *head, size_t headlen, const uint8_t *tail, size_t taillen, size_t size);
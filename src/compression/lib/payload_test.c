@@ -0,0 +1,151 @@
+/*
+ | LuaRT - A Windows programming framework for Lua
+ | Luart.org, Copyright (c) Tine Samir 2022.
+ | See Copyright Notice in LICENSE.TXT
+ |-------------------------------------------------
+ | payload_test.c | Standalone test of the appended Zip archive location (POSIX build)
+ |
+ | gcc -std=gnu99 -Wall -o payload_test compression/lib/payload_test.c compression/lib/payload.c && ./payload_test
+*/
+
+#include "payload.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+static int failures = 0;
+
+#define check(cond) do { if (!(cond)) { fprintf(stderr, "%s:%d: check failed: %s\n", __FILE__, __LINE__, #cond); failures++; } } while (0)
+
+static void put_u16(uint8_t *p, uint32_t v) {
+	p[0] = (uint8_t)v;
+	p[1] = (uint8_t)(v >> 8);
+}
+
+static void put_u32(uint8_t *p, uint32_t v) {
+	put_u16(p, v);
+	put_u16(p+2, v >> 16);
+}
+
+//--- Minimal PE image : DOS header, PE header at 0x80, optional header of optsize bytes, and sections (raw offset, raw size)
+static size_t make_pe(uint8_t *data, size_t optsize, const uint32_t sections[][2], int count) {
+	size_t table = 0x80+24+optsize, end = 0;
+	int i;
+
+	data[0] = 'M';
+	data[1] = 'Z';
+	put_u32(data+0x3C, 0x80);
+	memcpy(data+0x80, "PE\0\0", 4);
+	put_u16(data+0x80+6, count);
+	put_u16(data+0x80+20, (uint32_t)optsize);
+	for (i = 0; i < count; i++) {
+		put_u32(data+table+i*40+16, sections[i][1]);
+		put_u32(data+table+i*40+20, sections[i][0]);
+		if (sections[i][0]+sections[i][1] > end)
+			end = sections[i][0]+sections[i][1];
+	}
+	return end;
+}
+
+//--- Minimal Zip archive at offset : local data, central directory, and end of central directory record with a comment
+static size_t make_zip(uint8_t *data, size_t offset, size_t datalen, size_t cdsize, size_t comment) {
+	uint8_t *eocd = data+offset+datalen+cdsize;
+
+	memset(data+offset, 'z', datalen+cdsize);
+	memcpy(data+offset, "PK\3\4", 4);
+	memset(eocd, 0, 22);
+	put_u32(eocd, 0x06054b50);
+	put_u32(eocd+12, (uint32_t)cdsize);
+	put_u32(eocd+16, (uint32_t)datalen);
+	put_u16(eocd+20, (uint32_t)comment);
+	memset(eocd+22, 'c', comment);
+	return offset+datalen+cdsize+22+comment;
+}
+
+//--- Locates the payload like the embed module : from the whole file, and from its first and last bytes only
+static size_t whole(const uint8_t *data, size_t size) {
+	size_t tail = size < PAYLOAD_TAIL ? size : PAYLOAD_TAIL;
+	return payload_offset(data, size, data+size-tail, tail, size);
+}
+
+static size_t partial(const uint8_t *data, size_t size) {
+	size_t head = size < PAYLOAD_HEAD ? size : PAYLOAD_HEAD, tail = size < PAYLOAD_TAIL ? size : PAYLOAD_TAIL;
+	return payload_offset(data, head, data+size-tail, tail, size);
+}
+
+static void test_pe(void) {
+	static const uint32_t sections[][2] = { {0x400, 0x2000}, {0x2400, 0x600}, {0x2A00, 0x200} };
+	size_t size = 0x4000, end;
+	uint8_t *data = calloc(1, 0x40000);
+
+	end = make_pe(data, 0xF0, sections, 3);
+	check(end == 0x2C00);
+	check(payload_peend(data, size) == end);
+	//--- the headers are enough, whatever the file size
+	check(payload_peend(data, PAYLOAD_HEAD) == end);
+	check(payload_peend(data, 0x80+24+0xF0+3*40) == end);
+	check(payload_peend(data, 0x80+24+0xF0+3*40-1) == 0);
+	//--- appended payload, found from the headers only
+	check(whole(data, size) == end);
+	check(partial(data, size) == end);
+	check(partial(data, 0x40000) == end);
+	//--- no payload, or truncated executable
+	check(whole(data, end) == end);
+	check(partial(data, end-0x100) == end-0x100);
+	//--- SizeOfOptionalHeader is honoured
+	memset(data, 0, 0x1000);
+	end = make_pe(data, 0x200, sections, 2);
+	check(partial(data, size) == end && end == 0x2A00);
+	//--- not a PE executable
+	memcpy(data+0x80, "NE\0\0", 4);
+	check(payload_peend(data, size) == 0);
+	check(whole(data, size) == size);
+	put_u32(data+0x3C, 0xFFFFFFF0);
+	check(payload_peend(data, size) == 0);
+	free(data);
+}
+
+static void test_zip(void) {
+	uint8_t *data = calloc(1, 0x80000);
+	size_t size;
+
+	//--- plain archive, archive appended to another file, with and without comments
+	size = make_zip(data, 0, 300, 100, 0);
+	check(whole(data, size) == 0);
+	size = make_zip(data, 5000, 300, 100, 0);
+	check(whole(data, size) == 5000);
+	check(partial(data, size) == 5000);
+	size = make_zip(data, 5000, 300, 100, 1000);
+	check(whole(data, size) == 5000);
+	//--- largest comment, the record is at the start of the tail
+	size = make_zip(data, 0x10000, 300, 100, 0xFFFF);
+	check(whole(data, size) == 0x10000);
+	check(payload_zipoffset(data+size-PAYLOAD_TAIL, PAYLOAD_TAIL, size) == 0x10000);
+	//--- the tail is too short to hold the record and its comment
+	check(payload_zipoffset(data+size-PAYLOAD_TAIL+1, PAYLOAD_TAIL-1, size) == size);
+	//--- the comment length does not match the file end
+	size = make_zip(data, 5000, 300, 100, 10);
+	check(whole(data, size-1) == size-1);
+	//--- directory larger than the data before the record
+	size = make_zip(data, 0, 300, 100, 0);
+	put_u32(data+size-22+16, 1000);
+	check(whole(data, size) == size);
+	//--- Zip64 archives
+	put_u32(data+size-22+16, 0xFFFFFFFF);
+	check(whole(data, size) == size);
+	//--- no archive, tiny files
+	memset(data, 0, 1000);
+	check(whole(data, 1000) == 1000);
+	check(whole(data, 10) == 10);
+	check(whole(data, 0) == 0);
+	free(data);
+}
+
+int main(void) {
+	test_pe();
+	test_zip();
+	if (failures)
+		printf("%d check(s) failed\n", failures);
+	else puts("all tests passed");
+	return failures != 0;
+}
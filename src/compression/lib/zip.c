@@ -58,6 +58,8 @@ int symlink(const char *target, const char *linkpath); // needed on Linux
 #define ISSLASHW(C) ((C) == L'/' || (C) == L'\\')
 #endif
 
+static void index_free(struct zip_t *zip);
+
 #define CLEANUP(ptr) free(ptr);
 /*                                                          \
   do {                                                                         \
@@ -127,6 +129,8 @@ struct zip_t *zip_open(const wchar_t *zipname, int level, char mode) {
       mz_zip_reader_end(&(zip->archive));
       goto cleanup;
     }
+    if (mode == 'r')
+      zip_index(zip);
     break;
 
   default:
@@ -148,6 +152,7 @@ void zip_close(struct zip_t *zip) {
 
     mz_zip_writer_end(&(zip->archive));
     mz_zip_reader_end(&(zip->archive));
+    index_free(zip);
     free(zip);
   }
 }
@@ -174,8 +179,209 @@ static void normalize(struct zip_t *zip, const char *entryname, mz_uint16 len) {
 	zip->entry.namelen = len;
 
 	while ((c = *entryname++))
-		if (c == '\\')
-			*p++ = '/';
+		*p++ = c == '\\' ? '/' : c;
+}
+
+/*
+  Hash index of entry names. Slots reference the entry names in the central
+  directory, implicit directories reference the path prefix of the first entry
+  found in them. Names are compared case insensitively, like
+  mz_zip_reader_locate_file() does, and trailing separators are not indexed.
+*/
+typedef struct {
+  mz_uint32 hash;
+  int entry; // entry index, or -1 for an empty slot
+  mz_uint16 len;
+  mz_uint8 isdir;
+  mz_uint8 implicit;
+} zip_slot_t;
+
+struct zip_index_t {
+  zip_slot_t *slots;
+  mz_uint32 mask;
+  mz_uint32 count;
+};
+
+static char fold(char c) {
+  if (c == '\\')
+    return '/';
+  return (c >= 'A' && c <= 'Z') ? c + ('a' - 'A') : c;
+}
+
+static mz_uint32 name_hash(const char *name, size_t len) {
+  mz_uint32 hash = 2166136261u;
+
+  while (len--)
+    hash = (hash ^ (mz_uint8)fold(*name++)) * 16777619u;
+  return hash;
+}
+
+static const char *central_name(mz_zip_archive *pzip, mz_uint index, mz_uint16 *len) {
+  const mz_uint8 *pHeader = &MZ_ZIP_ARRAY_ELEMENT(
+      &pzip->m_pState->m_central_dir, mz_uint8,
+      MZ_ZIP_ARRAY_ELEMENT(&pzip->m_pState->m_central_dir_offsets, mz_uint32, index));
+
+  *len = MZ_READ_LE16(pHeader + MZ_ZIP_CDH_FILENAME_LEN_OFS);
+  return (const char *)pHeader + MZ_ZIP_CENTRAL_DIR_HEADER_SIZE;
+}
+
+static zip_slot_t *index_find(struct zip_t *zip, const char *name, mz_uint16 len, mz_uint32 hash) {
+  struct zip_index_t *index = zip->index;
+  mz_uint32 i;
+  mz_uint16 n;
+
+  for (i = hash & index->mask;; i = (i + 1) & index->mask) {
+    zip_slot_t *slot = &index->slots[i];
+    const char *p, *q = name;
+
+    if (slot->entry < 0)
+      return slot;
+    if (slot->hash == hash && slot->len == len) {
+      for (p = central_name(&zip->archive, (mz_uint)slot->entry, &n), n = len; n && fold(*p) == fold(*q); n--, p++, q++);
+      if (!n)
+        return slot;
+    }
+  }
+}
+
+static int index_grow(struct zip_index_t *index) {
+  mz_uint32 i, j, size = (index->mask + 1) * 2;
+  zip_slot_t *slots = (zip_slot_t *)malloc(size * sizeof(zip_slot_t));
+
+  if (!slots)
+    return -1;
+  for (i = 0; i < size; i++)
+    slots[i].entry = -1;
+  for (i = 0; i <= index->mask; i++)
+    if (index->slots[i].entry >= 0) {
+      for (j = index->slots[i].hash & (size - 1); slots[j].entry >= 0; j = (j + 1) & (size - 1));
+      slots[j] = index->slots[i];
+    }
+  free(index->slots);
+  index->slots = slots;
+  index->mask = size - 1;
+  return 0;
+}
+
+// Returns 0 when the name has been added, 1 if it was already indexed
+static int index_add(struct zip_t *zip, mz_uint entry, const char *name, mz_uint16 len, int isdir, int implicit) {
+  struct zip_index_t *index = zip->index;
+  mz_uint32 hash = name_hash(name, len);
+  zip_slot_t *slot;
+
+  if ((index->count + 1) * 2 > index->mask + 1 && index_grow(index))
+    return -1;
+  slot = index_find(zip, name, len, hash);
+  if (slot->entry >= 0) {
+    // a directory entry takes the place of the implicit directory
+    if (slot->implicit && !implicit) {
+      slot->entry = (int)entry;
+      slot->implicit = 0;
+    }
+    return 1;
+  }
+  slot->hash = hash;
+  slot->entry = (int)entry;
+  slot->len = len;
+  slot->isdir = (mz_uint8)isdir;
+  slot->implicit = (mz_uint8)implicit;
+  index->count++;
+  return 0;
+}
+
+static void index_free(struct zip_t *zip) {
+  if (zip->index) {
+    free(zip->index->slots);
+    free(zip->index);
+    zip->index = NULL;
+  }
+}
+
+int zip_index(struct zip_t *zip) {
+  mz_zip_archive *pzip;
+  mz_uint i, total;
+  mz_uint32 size = 16;
+
+  if (!zip || zip->archive.m_zip_mode != MZ_ZIP_MODE_READING)
+    return -1;
+  pzip = &(zip->archive);
+  total = pzip->m_total_files;
+  while (size < total * 2 && size < 0x80000000u)
+    size <<= 1;
+  index_free(zip);
+  if (!(zip->index = (struct zip_index_t *)calloc(1, sizeof(struct zip_index_t))) ||
+      !(zip->index->slots = (zip_slot_t *)malloc(size * sizeof(zip_slot_t))))
+    goto cleanup;
+  zip->index->mask = size - 1;
+  for (i = 0; i < size; i++)
+    zip->index->slots[i].entry = -1;
+
+  for (i = 0; i < total; i++) {
+    mz_uint16 len, j;
+    const char *name = central_name(pzip, i, &len);
+    int isdir = len && ISSLASH(name[len - 1]), added;
+
+    if (index_add(zip, i, name, (mz_uint16)(len - isdir), isdir, 0) < 0)
+      goto cleanup;
+    // parent directories, up to the first one already indexed
+    for (j = (mz_uint16)(len - isdir); j-- > 0;)
+      if (ISSLASH(name[j])) {
+        if ((added = index_add(zip, i, name, j, 1, 1)) < 0)
+          goto cleanup;
+        if (added)
+          break;
+      }
+  }
+  return 0;
+
+cleanup:
+  index_free(zip);
+  return -1;
+}
+
+int zip_locate(struct zip_t *zip, const char *entryname, int *isdir) {
+  size_t len;
+  int dironly, dir, result;
+
+  if (!zip || !entryname)
+    return -1;
+  len = strlen(entryname);
+  dironly = len && ISSLASH(entryname[len - 1]);
+  if (zip->index) {
+    zip_slot_t *slot;
+
+    len -= dironly;
+    if (len > 0xFFFF)
+      return -1;
+    slot = index_find(zip, entryname, (mz_uint16)len, name_hash(entryname, len));
+    if (slot->entry < 0)
+      return -1;
+    dir = slot->isdir;
+    result = slot->implicit ? ZIP_IMPLICITDIR : slot->entry;
+  } else {
+    // archives opened for writing are not indexed
+    mz_zip_archive *pzip = &(zip->archive);
+
+    if ((result = mz_zip_reader_locate_file(pzip, entryname, NULL, 0)) < 0 && !dironly) {
+      char *dname = (char *)malloc(len + 2);
+
+      if (!dname)
+        return -1;
+      memcpy(dname, entryname, len);
+      dname[len] = '/';
+      dname[len + 1] = '\0';
+      result = mz_zip_reader_locate_file(pzip, dname, NULL, 0);
+      free(dname);
+    }
+    if (result < 0)
+      return -1;
+    dir = mz_zip_reader_is_file_a_directory(pzip, (mz_uint)result);
+  }
+  if (dironly && !dir)
+    return -1;
+  if (isdir)
+    *isdir = dir;
+  return result;
 }
 
 int zip_entry_open(struct zip_t *zip, const char *entryname) {
@@ -208,8 +414,7 @@ int zip_entry_open(struct zip_t *zip, const char *entryname) {
 
   pzip = &(zip->archive);
   if (pzip->m_zip_mode == MZ_ZIP_MODE_READING) {
-    zip->entry.index =
-        mz_zip_reader_locate_file(pzip, zip->entry.name, NULL, 0);
+    zip->entry.index = zip_locate(zip, entryname, NULL);
     if (zip->entry.index < 0) {
       goto cleanup;
     }
@@ -78,12 +78,20 @@ struct zip_entry_t {
   __time64_t m_time;
 };
 
+struct zip_index_t;
+
 typedef struct zip_t {
   mz_zip_archive archive;
   mz_uint level;
   struct zip_entry_t entry;
+  struct zip_index_t *index;
 } zip_t;
 
+/**
+ * Value returned by zip_locate() for directories without their own entry.
+ */
+#define ZIP_IMPLICITDIR -2
+
 /**
  * Default zip compression level.
  */
@@ -121,6 +129,29 @@ extern void zip_close(struct zip_t *zip);
  */
 extern int zip_is64(struct zip_t *zip);
 
+/**
+ * Builds a hash index of the entry names of a zip archive opened for reading,
+ * including the directories implied by the entry paths.
+ *
+ * @param zip zip archive handler.
+ *
+ * @return the return code - 0 on success, negative number (< 0) on error.
+ */
+extern int zip_index(struct zip_t *zip);
+
+/**
+ * Locates an entry by name, case insensitively, with '/' or '\\' separators.
+ * A trailing separator only matches directories.
+ *
+ * @param zip zip archive handler.
+ * @param entryname an entry name.
+ * @param isdir if not NULL, set to 1 when the entry is a directory.
+ *
+ * @return the entry index, ZIP_IMPLICITDIR for a directory that has no entry
+ *         of its own, or -1 if not found.
+ */
+extern int zip_locate(struct zip_t *zip, const char *entryname, int *isdir);
+
 /**
  * Opens an entry by name in the zip archive.
  *
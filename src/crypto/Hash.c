@@ -0,0 +1,97 @@
+/*
+ | LuaRT - A Windows programming framework for Lua
+ | Luart.org, Copyright (c) Tine Samir 2022.
+ | See Copyright Notice in LICENSE.TXT
+ |-------------------------------------------------
+ | Hash.c | LuaRT Hash object implementation
+*/
+
+#include <luart.h>
+#include <Hash.h>
+#include <Buffer.h>
+#include <string.h>
+
+luart_type THash;
+
+DigestAlgo luaL_checkdigest(lua_State *L, int idx, const char *def) {
+	const char *name = def ? luaL_optstring(L, idx, def) : luaL_checkstring(L, idx);
+	int i;
+
+	for (i = 0; digest_names[i]; i++)
+		if (strcmp(digest_names[i], name) == 0)
+			return (DigestAlgo)i;
+	return luaL_error(L, "unknown '%s' algorithm", name);
+}
+
+void lua_pushdigest(lua_State *L, const digest_ctx *ctx) {
+	BYTE out[DIGEST_MAXSIZE];
+	digest_ctx copy;
+
+	//--- finalization pads the context, so it is done on a copy to allow further updates
+	memcpy(&copy, ctx, sizeof(digest_ctx));
+	digest_final(&copy, out);
+	lua_toBuffer(L, out, digest_size(ctx->algo));
+}
+
+/* ------------------------------------------------------------------------ */
+
+LUA_CONSTRUCTOR(Hash) {
+	Hash *h = lua_allocinstance(L, Hash);
+
+	digest_init(&h->ctx, luaL_checkdigest(L, 2, "sha256"));
+	lua_newinstance(L, h, Hash);
+	return 1;
+}
+
+//--- Hash:update(data) accepts strings and Buffers, and returns the Hash to chain calls
+LUA_METHOD(Hash, update) {
+	Hash *h = lua_self(L, 1, Hash);
+	Buffer *b;
+	const char *data;
+	size_t len;
+
+	if ( (b = lua_iscinstance(L, 2, TBuffer)) )
+		digest_update(&h->ctx, b->bytes, b->size);
+	else {
+		data = luaL_checklstring(L, 2, &len);
+		digest_update(&h->ctx, data, len);
+	}
+	lua_settop(L, 1);
+	return 1;
+}
+
+LUA_METHOD(Hash, digest) {
+	lua_pushdigest(L, &lua_self(L, 1, Hash)->ctx);
+	return 1;
+}
+
+LUA_METHOD(Hash, reset) {
+	Hash *h = lua_self(L, 1, Hash);
+	digest_init(&h->ctx, h->ctx.algo);
+	return 0;
+}
+
+LUA_PROPERTY_GET(Hash, algorithm) {
+	lua_pushstring(L, digest_names[lua_self(L, 1, Hash)->ctx.algo]);
+	return 1;
+}
+
+LUA_PROPERTY_GET(Hash, size) {
+	lua_pushinteger(L, digest_size(lua_self(L, 1, Hash)->ctx.algo));
+	return 1;
+}
+
+LUA_PROPERTY_GET(Hash, implementation) {
+	lua_pushstring(L, digest_implementation(lua_self(L, 1, Hash)->ctx.algo));
+	return 1;
+}
+
+const luaL_Reg Hash_methods[] = {
+	{"update",				Hash_update},
+	{"digest",				Hash_digest},
+	{"reset",				Hash_reset},
+	{"get_algorithm",		Hash_getalgorithm},
+	{"get_size",			Hash_getsize},
+	{"get_implementation",	Hash_getimplementation},
+	{NULL, NULL}
+};
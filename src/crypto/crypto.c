@@ -6,9 +6,12 @@
  | crypto.c | LuaRT crypto module
 */
 
+#include "lrtapi.h"
 #include <luart.h>
 #include <Cipher.h>
+#include <Hash.h>
 #include <Buffer.h>
+#include <File.h>
 #include <stdlib.h>
 
 #define MINIZ_HEADER_FILE_ONLY
@@ -21,40 +24,47 @@ UNCRYPT uncrypt = NULL;
 
 static HINSTANCE dll;
 
-static const crypt_Reg hash_funcs[] = {
-  { "md5",		0, 	0,	0,	CALG_MD5 },
-  { "sha1",		0, 	0,	0,	CALG_SHA1 },
-  { "sha256",	0, 	0,	0,	CALG_SHA_256 },
-  { "sha384",	0, 	0,	0,	CALG_SHA_384 },
-  { "sha512",	0, 	0,	0,	CALG_SHA_512 },
-  { NULL,		0, 	0 ,  0,   0}
-};
-
-static int hash(lua_State *L, ALG_ID algo)
-{
-	HCRYPTHASH hash;
+LUA_METHOD(crypto, hash) {
+	DigestAlgo algo = luaL_checkdigest(L, 1, NULL);
 	Buffer *buff = luart_tobuffer(L, 2);
-	DWORD len = 0;
-	int result = 0;
+	digest_ctx ctx;
 
-	if (CryptCreateHash(hProv, algo, 0, 0, &hash)) {
-		if (CryptHashData(hash, buff->bytes, buff->size, 0)) {
-			if (CryptGetHashParam(hash, HP_HASHVAL, NULL, &len, 0)) {
-				BYTE* buff = malloc(len);
-				if (CryptGetHashParam(hash, HP_HASHVAL, buff, &len, 0)) {
-					lua_toBuffer(L, buff, len);
-					result = 1;
-				}
-				free(buff);
-			}
-		}
-		CryptDestroyHash(hash);
-	}
-	return result;
+	digest_init(&ctx, algo);
+	digest_update(&ctx, buff->bytes, buff->size);
+	lua_pushdigest(L, &ctx);
+	return 1;
 }
 
-LUA_METHOD(crypto, hash) {
-	return hash(L, hash_funcs[get_algo(L, hash_funcs, 1)].algo);
+//--- crypto.hashfile(file, [algo]) hashes the file content sequentially, without loading it in memory
+LUA_METHOD(crypto, hashfile) {
+	wchar_t *fname = luaL_checkFilename(L, 1);
+	DigestAlgo algo = luaL_checkdigest(L, 2, "sha256");
+	HANDLE h = CreateFileW(fname, GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, NULL);
+	BYTE *chunk;
+	DWORD len;
+	BOOL success;
+	digest_ctx ctx;
+
+	free(fname);
+	if (h == INVALID_HANDLE_VALUE) {
+		lasterror(L, GetLastError());
+		luaL_error(L, "cannot open file : %s", lua_tostring(L, -1));
+	}
+	if ( !(chunk = malloc(HASHFILE_CHUNKSIZE)) ) {
+		CloseHandle(h);
+		luaL_error(L, "not enough memory");
+	}
+	digest_init(&ctx, algo);
+	while ( (success = ReadFile(h, chunk, HASHFILE_CHUNKSIZE, &len, NULL)) && len )
+		digest_update(&ctx, chunk, len);
+	free(chunk);
+	CloseHandle(h);
+	if (!success) {
+		lasterror(L, GetLastError());
+		luaL_error(L, "error reading file : %s", lua_tostring(L, -1));
+	}
+	lua_pushdigest(L, &ctx);
+	return 1;
 }
 
 LUA_METHOD(crypto, generate) {
@@ -74,6 +84,7 @@ LUA_METHOD(crypto, crc32) {
 
 static const luaL_Reg cryptolib[] = {
 	{"hash",	crypto_hash},
+	{"hashfile",crypto_hashfile},
 	{"generate",crypto_generate},
 	{"crc32",	crypto_crc32},
 	{NULL, NULL}
@@ -96,6 +107,7 @@ LUAMOD_API int luaopen_crypto(lua_State *L)
 	uncrypt = (void*)GetProcAddress(dll, "CryptDecrypt");
 	lua_regmodulefinalize(L, crypto);
 	lua_regobjectmt(L, Cipher);
+	lua_regcobject(L, Hash);
 	CryptAcquireContextA(&hProv, NULL, NULL, PROV_RSA_AES, CRYPT_VERIFYCONTEXT);
 	return 1;
 }
@@ -0,0 +1,663 @@
+/*
+ | LuaRT - A Windows programming framework for Lua
+ | Luart.org, Copyright (c) Tine Samir 2022.
+ | See Copyright Notice in LICENSE.TXT
+ |-------------------------------------------------
+ | digest.c | Portable message digests (MD5, SHA-1, SHA-2, XXH64, BLAKE3)
+ | SHA-1 and SHA-256 use the x86 SHA extensions when the processor supports them
+*/
+
+#include "digest.h"
+#include <string.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#define DIGEST_SHANI
+#include <cpuid.h>
+#include <immintrin.h>
+#endif
+
+const char *digest_names[] = { "md5", "sha1", "sha256", "sha384", "sha512", "xxh64", "blake3", NULL };
+
+static const uint8_t digest_sizes[] = { 16, 20, 32, 48, 64, 8, 32 };
+
+//-------------------------------------[ Byte order helpers ]
+static uint32_t load32le(const uint8_t *p) {
+	return p[0] | (p[1] << 8) | (p[2] << 16) | ((uint32_t)p[3] << 24);
+}
+
+static uint32_t load32be(const uint8_t *p) {
+	return ((uint32_t)p[0] << 24) | (p[1] << 16) | (p[2] << 8) | p[3];
+}
+
+static uint64_t load64le(const uint8_t *p) {
+	return load32le(p) | ((uint64_t)load32le(p+4) << 32);
+}
+
+static uint64_t load64be(const uint8_t *p) {
+	return ((uint64_t)load32be(p) << 32) | load32be(p+4);
+}
+
+static void store32le(uint8_t *p, uint32_t v) {
+	p[0] = (uint8_t)v; p[1] = (uint8_t)(v >> 8); p[2] = (uint8_t)(v >> 16); p[3] = (uint8_t)(v >> 24);
+}
+
+static void store32be(uint8_t *p, uint32_t v) {
+	p[0] = (uint8_t)(v >> 24); p[1] = (uint8_t)(v >> 16); p[2] = (uint8_t)(v >> 8); p[3] = (uint8_t)v;
+}
+
+static void store64le(uint8_t *p, uint64_t v) {
+	store32le(p, (uint32_t)v);
+	store32le(p+4, (uint32_t)(v >> 32));
+}
+
+static void store64be(uint8_t *p, uint64_t v) {
+	store32be(p, (uint32_t)(v >> 32));
+	store32be(p+4, (uint32_t)v);
+}
+
+#define ROTL32(x, n)	(((x) << (n)) | ((x) >> (32-(n))))
+#define ROTR32(x, n)	(((x) >> (n)) | ((x) << (32-(n))))
+#define ROTL64(x, n)	(((x) << (n)) | ((x) >> (64-(n))))
+#define ROTR64(x, n)	(((x) >> (n)) | ((x) << (64-(n))))
+
+//-------------------------------------[ MD5 ]
+static const uint32_t md5_K[64] = {
+	0xd76aa478, 0xe8c7b756, 0x242070db, 0xc1bdceee, 0xf57c0faf, 0x4787c62a, 0xa8304613, 0xfd469501,
+	0x698098d8, 0x8b44f7af, 0xffff5bb1, 0x895cd7be, 0x6b901122, 0xfd987193, 0xa679438e, 0x49b40821,
+	0xf61e2562, 0xc040b340, 0x265e5a51, 0xe9b6c7aa, 0xd62f105d, 0x02441453, 0xd8a1e681, 0xe7d3fbc8,
+	0x21e1cde6, 0xc33707d6, 0xf4d50d87, 0x455a14ed, 0xa9e3e905, 0xfcefa3f8, 0x676f02d9, 0x8d2a4c8a,
+	0xfffa3942, 0x8771f681, 0x6d9d6122, 0xfde5380c, 0xa4beea44, 0x4bdecfa9, 0xf6bb4b60, 0xbebfbc70,
+	0x289b7ec6, 0xeaa127fa, 0xd4ef3085, 0x04881d05, 0xd9d4d039, 0xe6db99e5, 0x1fa27cf8, 0xc4ac5665,
+	0xf4292244, 0x432aff97, 0xab9423a7, 0xfc93a039, 0x655b59c3, 0x8f0ccc92, 0xffeff47d, 0x85845dd1,
+	0x6fa87e4f, 0xfe2ce6e0, 0xa3014314, 0x4e0811a1, 0xf7537e82, 0xbd3af235, 0x2ad7d2bb, 0xeb86d391
+};
+
+static const uint8_t md5_R[16] = { 7, 12, 17, 22, 5, 9, 14, 20, 4, 11, 16, 23, 6, 10, 15, 21 };
+
+static void md5_blocks(uint32_t *state, const uint8_t *data, size_t blocks) {
+	uint32_t M[16], a, b, c, d, f, t;
+	int i, g;
+
+	for (; blocks--; data += 64) {
+		for (i = 0; i < 16; i++)
+			M[i] = load32le(data + 4*i);
+		a = state[0]; b = state[1]; c = state[2]; d = state[3];
+		for (i = 0; i < 64; i++) {
+			switch (i >> 4) {
+				case 0:		f = (b & c) | (~b & d); g = i; break;
+				case 1:		f = (d & b) | (~d & c); g = (5*i + 1) & 15; break;
+				case 2:		f = b ^ c ^ d; g = (3*i + 5) & 15; break;
+				default:	f = c ^ (b | ~d); g = (7*i) & 15;
+			}
+			t = d;
+			d = c;
+			c = b;
+			f += a + md5_K[i] + M[g];
+			b += ROTL32(f, md5_R[((i >> 4) << 2) | (i & 3)]);
+			a = t;
+		}
+		state[0] += a; state[1] += b; state[2] += c; state[3] += d;
+	}
+}
+
+//-------------------------------------[ SHA-1 ]
+static void sha1_blocks_portable(uint32_t *state, const uint8_t *data, size_t blocks) {
+	uint32_t W[80], a, b, c, d, e, f, k, t;
+	int i;
+
+	for (; blocks--; data += 64) {
+		for (i = 0; i < 16; i++)
+			W[i] = load32be(data + 4*i);
+		for (; i < 80; i++)
+			W[i] = ROTL32(W[i-3] ^ W[i-8] ^ W[i-14] ^ W[i-16], 1);
+		a = state[0]; b = state[1]; c = state[2]; d = state[3]; e = state[4];
+		for (i = 0; i < 80; i++) {
+			if (i < 20) {
+				f = (b & c) | (~b & d); k = 0x5a827999;
+			} else if (i < 40) {
+				f = b ^ c ^ d; k = 0x6ed9eba1;
+			} else if (i < 60) {
+				f = (b & c) | (b & d) | (c & d); k = 0x8f1bbcdc;
+			} else {
+				f = b ^ c ^ d; k = 0xca62c1d6;
+			}
+			t = ROTL32(a, 5) + f + e + k + W[i];
+			e = d; d = c; c = ROTL32(b, 30); b = a; a = t;
+		}
+		state[0] += a; state[1] += b; state[2] += c; state[3] += d; state[4] += e;
+	}
+}
+
+//-------------------------------------[ SHA-256 ]
+static const uint32_t sha256_K[64] = {
+	0x428a2f98, 0x71374491, 0xb5c0fbcf, 0xe9b5dba5, 0x3956c25b, 0x59f111f1, 0x923f82a4, 0xab1c5ed5,
+	0xd807aa98, 0x12835b01, 0x243185be, 0x550c7dc3, 0x72be5d74, 0x80deb1fe, 0x9bdc06a7, 0xc19bf174,
+	0xe49b69c1, 0xefbe4786, 0x0fc19dc6, 0x240ca1cc, 0x2de92c6f, 0x4a7484aa, 0x5cb0a9dc, 0x76f988da,
+	0x983e5152, 0xa831c66d, 0xb00327c8, 0xbf597fc7, 0xc6e00bf3, 0xd5a79147, 0x06ca6351, 0x14292967,
+	0x27b70a85, 0x2e1b2138, 0x4d2c6dfc, 0x53380d13, 0x650a7354, 0x766a0abb, 0x81c2c92e, 0x92722c85,
+	0xa2bfe8a1, 0xa81a664b, 0xc24b8b70, 0xc76c51a3, 0xd192e819, 0xd6990624, 0xf40e3585, 0x106aa070,
+	0x19a4c116, 0x1e376c08, 0x2748774c, 0x34b0bcb5, 0x391c0cb3, 0x4ed8aa4a, 0x5b9cca4f, 0x682e6ff3,
+	0x748f82ee, 0x78a5636f, 0x84c87814, 0x8cc70208, 0x90befffa, 0xa4506ceb, 0xbef9a3f7, 0xc67178f2
+};
+
+static const uint32_t sha256_H[8] = {
+	0x6a09e667, 0xbb67ae85, 0x3c6ef372, 0xa54ff53a, 0x510e527f, 0x9b05688c, 0x1f83d9ab, 0x5be0cd19
+};
+
+static void sha256_blocks_portable(uint32_t *state, const uint8_t *data, size_t blocks) {
+	uint32_t W[64], s[8], t1, t2;
+	int i;
+
+	for (; blocks--; data += 64) {
+		for (i = 0; i < 16; i++)
+			W[i] = load32be(data + 4*i);
+		for (; i < 64; i++)
+			W[i] = W[i-16] + (ROTR32(W[i-15], 7) ^ ROTR32(W[i-15], 18) ^ (W[i-15] >> 3)) + W[i-7]
+				 + (ROTR32(W[i-2], 17) ^ ROTR32(W[i-2], 19) ^ (W[i-2] >> 10));
+		memcpy(s, state, sizeof(s));
+		for (i = 0; i < 64; i++) {
+			t1 = s[7] + (ROTR32(s[4], 6) ^ ROTR32(s[4], 11) ^ ROTR32(s[4], 25)) + ((s[4] & s[5]) ^ (~s[4] & s[6])) + sha256_K[i] + W[i];
+			t2 = (ROTR32(s[0], 2) ^ ROTR32(s[0], 13) ^ ROTR32(s[0], 22)) + ((s[0] & s[1]) ^ (s[0] & s[2]) ^ (s[1] & s[2]));
+			memmove(s+1, s, 7*sizeof(uint32_t));
+			s[4] += t1;
+			s[0] = t1 + t2;
+		}
+		for (i = 0; i < 8; i++)
+			state[i] += s[i];
+	}
+}
+
+//-------------------------------------[ SHA-1 and SHA-256 with x86 SHA extensions ]
+#ifdef DIGEST_SHANI
+
+#define SHA1_ROUNDS(g, func) \
+	e = g ? _mm_sha1nexte_epu32(E1, M[g & 3]) : _mm_add_epi32(E0, M[0]); \
+	E1 = ABCD; \
+	if (g >= 3 && g <= 18) M[(g+1) & 3] = _mm_sha1msg2_epu32(M[(g+1) & 3], M[g & 3]); \
+	ABCD = _mm_sha1rnds4_epu32(ABCD, e, func); \
+	if (g >= 1 && g <= 16) M[(g+3) & 3] = _mm_sha1msg1_epu32(M[(g+3) & 3], M[g & 3]); \
+	if (g >= 2 && g <= 17) M[(g+2) & 3] = _mm_xor_si128(M[(g+2) & 3], M[g & 3]);
+
+__attribute__((target("sha,sse4.1")))
+static void sha1_blocks_shani(uint32_t *state, const uint8_t *data, size_t blocks) {
+	const __m128i MASK = _mm_set_epi64x(0x0001020304050607ULL, 0x08090a0b0c0d0e0fULL);
+	__m128i ABCD, ABCD_SAVE, E0, E1, e, M[4];
+	int i;
+
+	ABCD = _mm_shuffle_epi32(_mm_loadu_si128((const __m128i *)state), 0x1B);
+	E0 = _mm_set_epi32((int)state[4], 0, 0, 0);
+	for (; blocks--; data += 64) {
+		ABCD_SAVE = ABCD;
+		for (i = 0; i < 4; i++)
+			M[i] = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i *)(data + 16*i)), MASK);
+		SHA1_ROUNDS(0, 0)  SHA1_ROUNDS(1, 0)  SHA1_ROUNDS(2, 0)  SHA1_ROUNDS(3, 0)  SHA1_ROUNDS(4, 0)
+		SHA1_ROUNDS(5, 1)  SHA1_ROUNDS(6, 1)  SHA1_ROUNDS(7, 1)  SHA1_ROUNDS(8, 1)  SHA1_ROUNDS(9, 1)
+		SHA1_ROUNDS(10, 2) SHA1_ROUNDS(11, 2) SHA1_ROUNDS(12, 2) SHA1_ROUNDS(13, 2) SHA1_ROUNDS(14, 2)
+		SHA1_ROUNDS(15, 3) SHA1_ROUNDS(16, 3) SHA1_ROUNDS(17, 3) SHA1_ROUNDS(18, 3) SHA1_ROUNDS(19, 3)
+		E0 = _mm_sha1nexte_epu32(E1, E0);
+		ABCD = _mm_add_epi32(ABCD, ABCD_SAVE);
+	}
+	_mm_storeu_si128((__m128i *)state, _mm_shuffle_epi32(ABCD, 0x1B));
+	state[4] = (uint32_t)_mm_extract_epi32(E0, 3);
+}
+
+__attribute__((target("sha,sse4.1")))
+static void sha256_blocks_shani(uint32_t *state, const uint8_t *data, size_t blocks) {
+	const __m128i MASK = _mm_set_epi64x(0x0c0d0e0f08090a0bULL, 0x0405060700010203ULL);
+	__m128i STATE0, STATE1, SAVE0, SAVE1, MSG, TMP, W[4];
+	int i;
+
+	TMP = _mm_shuffle_epi32(_mm_loadu_si128((const __m128i *)state), 0xB1);
+	STATE1 = _mm_shuffle_epi32(_mm_loadu_si128((const __m128i *)(state+4)), 0x1B);
+	STATE0 = _mm_alignr_epi8(TMP, STATE1, 8);		//--- ABEF
+	STATE1 = _mm_blend_epi16(STATE1, TMP, 0xF0);	//--- CDGH
+	for (; blocks--; data += 64) {
+		SAVE0 = STATE0;
+		SAVE1 = STATE1;
+		for (i = 0; i < 16; i++) {
+			if (i < 4)
+				W[i] = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i *)(data + 16*i)), MASK);
+			else
+				W[i & 3] = _mm_sha256msg2_epu32(_mm_add_epi32(_mm_sha256msg1_epu32(W[i & 3], W[(i+1) & 3]),
+							_mm_alignr_epi8(W[(i+3) & 3], W[(i+2) & 3], 4)), W[(i+3) & 3]);
+			MSG = _mm_add_epi32(W[i & 3], _mm_loadu_si128((const __m128i *)(sha256_K + 4*i)));
+			STATE1 = _mm_sha256rnds2_epu32(STATE1, STATE0, MSG);
+			STATE0 = _mm_sha256rnds2_epu32(STATE0, STATE1, _mm_shuffle_epi32(MSG, 0x0E));
+		}
+		STATE0 = _mm_add_epi32(STATE0, SAVE0);
+		STATE1 = _mm_add_epi32(STATE1, SAVE1);
+	}
+	TMP = _mm_shuffle_epi32(STATE0, 0x1B);			//--- FEBA
+	STATE1 = _mm_shuffle_epi32(STATE1, 0xB1);		//--- DCHG
+	_mm_storeu_si128((__m128i *)state, _mm_blend_epi16(TMP, STATE1, 0xF0));
+	_mm_storeu_si128((__m128i *)(state+4), _mm_alignr_epi8(STATE1, TMP, 8));
+}
+
+static int has_shani(void) {
+	unsigned int a, b, c, d;
+
+	if (!__get_cpuid(1, &a, &b, &c, &d) || !(c & bit_SSE4_1) || !(c & bit_SSSE3))
+		return 0;
+	return __get_cpuid_count(7, 0, &a, &b, &c, &d) && (b & (1 << 29));
+}
+#endif
+
+typedef void (*blocks_func)(uint32_t *state, const uint8_t *data, size_t blocks);
+
+static blocks_func sha1_blocks = NULL, sha256_blocks = NULL;
+
+static void select_implementations(void) {
+	sha1_blocks = sha1_blocks_portable;
+	sha256_blocks = sha256_blocks_portable;
+#ifdef DIGEST_SHANI
+	if (has_shani()) {
+		sha1_blocks = sha1_blocks_shani;
+		sha256_blocks = sha256_blocks_shani;
+	}
+#endif
+}
+
+//-------------------------------------[ SHA-384 and SHA-512 ]
+static const uint64_t sha512_K[80] = {
+	0x428a2f98d728ae22ULL, 0x7137449123ef65cdULL, 0xb5c0fbcfec4d3b2fULL, 0xe9b5dba58189dbbcULL,
+	0x3956c25bf348b538ULL, 0x59f111f1b605d019ULL, 0x923f82a4af194f9bULL, 0xab1c5ed5da6d8118ULL,
+	0xd807aa98a3030242ULL, 0x12835b0145706fbeULL, 0x243185be4ee4b28cULL, 0x550c7dc3d5ffb4e2ULL,
+	0x72be5d74f27b896fULL, 0x80deb1fe3b1696b1ULL, 0x9bdc06a725c71235ULL, 0xc19bf174cf692694ULL,
+	0xe49b69c19ef14ad2ULL, 0xefbe4786384f25e3ULL, 0x0fc19dc68b8cd5b5ULL, 0x240ca1cc77ac9c65ULL,
+	0x2de92c6f592b0275ULL, 0x4a7484aa6ea6e483ULL, 0x5cb0a9dcbd41fbd4ULL, 0x76f988da831153b5ULL,
+	0x983e5152ee66dfabULL, 0xa831c66d2db43210ULL, 0xb00327c898fb213fULL, 0xbf597fc7beef0ee4ULL,
+	0xc6e00bf33da88fc2ULL, 0xd5a79147930aa725ULL, 0x06ca6351e003826fULL, 0x142929670a0e6e70ULL,
+	0x27b70a8546d22ffcULL, 0x2e1b21385c26c926ULL, 0x4d2c6dfc5ac42aedULL, 0x53380d139d95b3dfULL,
+	0x650a73548baf63deULL, 0x766a0abb3c77b2a8ULL, 0x81c2c92e47edaee6ULL, 0x92722c851482353bULL,
+	0xa2bfe8a14cf10364ULL, 0xa81a664bbc423001ULL, 0xc24b8b70d0f89791ULL, 0xc76c51a30654be30ULL,
+	0xd192e819d6ef5218ULL, 0xd69906245565a910ULL, 0xf40e35855771202aULL, 0x106aa07032bbd1b8ULL,
+	0x19a4c116b8d2d0c8ULL, 0x1e376c085141ab53ULL, 0x2748774cdf8eeb99ULL, 0x34b0bcb5e19b48a8ULL,
+	0x391c0cb3c5c95a63ULL, 0x4ed8aa4ae3418acbULL, 0x5b9cca4f7763e373ULL, 0x682e6ff3d6b2b8a3ULL,
+	0x748f82ee5defb2fcULL, 0x78a5636f43172f60ULL, 0x84c87814a1f0ab72ULL, 0x8cc702081a6439ecULL,
+	0x90befffa23631e28ULL, 0xa4506cebde82bde9ULL, 0xbef9a3f7b2c67915ULL, 0xc67178f2e372532bULL,
+	0xca273eceea26619cULL, 0xd186b8c721c0c207ULL, 0xeada7dd6cde0eb1eULL, 0xf57d4f7fee6ed178ULL,
+	0x06f067aa72176fbaULL, 0x0a637dc5a2c898a6ULL, 0x113f9804bef90daeULL, 0x1b710b35131c471bULL,
+	0x28db77f523047d84ULL, 0x32caab7b40c72493ULL, 0x3c9ebe0a15c9bebcULL, 0x431d67c49c100d4cULL,
+	0x4cc5d4becb3e42b6ULL, 0x597f299cfc657e2aULL, 0x5fcb6fab3ad6faecULL, 0x6c44198c4a475817ULL
+};
+
+static const uint64_t sha384_H[8] = {
+	0xcbbb9d5dc1059ed8ULL, 0x629a292a367cd507ULL, 0x9159015a3070dd17ULL, 0x152fecd8f70e5939ULL,
+	0x67332667ffc00b31ULL, 0x8eb44a8768581511ULL, 0xdb0c2e0d64f98fa7ULL, 0x47b5481dbefa4fa4ULL
+};
+
+static const uint64_t sha512_H[8] = {
+	0x6a09e667f3bcc908ULL, 0xbb67ae8584caa73bULL, 0x3c6ef372fe94f82bULL, 0xa54ff53a5f1d36f1ULL,
+	0x510e527fade682d1ULL, 0x9b05688c2b3e6c1fULL, 0x1f83d9abfb41bd6bULL, 0x5be0cd19137e2179ULL
+};
+
+static void sha512_blocks(uint64_t *state, const uint8_t *data, size_t blocks) {
+	uint64_t W[80], s[8], t1, t2;
+	int i;
+
+	for (; blocks--; data += 128) {
+		for (i = 0; i < 16; i++)
+			W[i] = load64be(data + 8*i);
+		for (; i < 80; i++)
+			W[i] = W[i-16] + (ROTR64(W[i-15], 1) ^ ROTR64(W[i-15], 8) ^ (W[i-15] >> 7)) + W[i-7]
+				 + (ROTR64(W[i-2], 19) ^ ROTR64(W[i-2], 61) ^ (W[i-2] >> 6));
+		memcpy(s, state, sizeof(s));
+		for (i = 0; i < 80; i++) {
+			t1 = s[7] + (ROTR64(s[4], 14) ^ ROTR64(s[4], 18) ^ ROTR64(s[4], 41)) + ((s[4] & s[5]) ^ (~s[4] & s[6])) + sha512_K[i] + W[i];
+			t2 = (ROTR64(s[0], 28) ^ ROTR64(s[0], 34) ^ ROTR64(s[0], 39)) + ((s[0] & s[1]) ^ (s[0] & s[2]) ^ (s[1] & s[2]));
+			memmove(s+1, s, 7*sizeof(uint64_t));
+			s[4] += t1;
+			s[0] = t1 + t2;
+		}
+		for (i = 0; i < 8; i++)
+			state[i] += s[i];
+	}
+}
+
+//-------------------------------------[ Merkle-Damgard buffering ]
+static void md_update32(digest_ctx *ctx, const uint8_t *p, size_t len) {
+	digest32_ctx *c = &ctx->d32;
+	size_t used = c->count & 63, n;
+	blocks_func blocks = ctx->algo == DIGEST_MD5 ? md5_blocks : (ctx->algo == DIGEST_SHA1 ? sha1_blocks : sha256_blocks);
+
+	c->count += len;
+	if (used) {
+		n = 64 - used < len ? 64 - used : len;
+		memcpy(c->buffer + used, p, n);
+		p += n;
+		len -= n;
+		if (used + n < 64)
+			return;
+		blocks(c->state, c->buffer, 1);
+	}
+	if (len >= 64) {
+		blocks(c->state, p, len / 64);
+		p += len & ~(size_t)63;
+		len &= 63;
+	}
+	memcpy(c->buffer, p, len);
+}
+
+static void md_final32(digest_ctx *ctx, uint8_t *out) {
+	digest32_ctx *c = &ctx->d32;
+	size_t used = c->count & 63;
+	uint64_t bits = c->count << 3;
+	int i;
+
+	c->buffer[used++] = 0x80;
+	if (used > 56) {
+		memset(c->buffer + used, 0, 64 - used);
+		(ctx->algo == DIGEST_MD5 ? md5_blocks : (ctx->algo == DIGEST_SHA1 ? sha1_blocks : sha256_blocks))(c->state, c->buffer, 1);
+		used = 0;
+	}
+	memset(c->buffer + used, 0, 56 - used);
+	if (ctx->algo == DIGEST_MD5) {
+		store64le(c->buffer + 56, bits);
+		md5_blocks(c->state, c->buffer, 1);
+		for (i = 0; i < 4; i++)
+			store32le(out + 4*i, c->state[i]);
+	} else {
+		store64be(c->buffer + 56, bits);
+		(ctx->algo == DIGEST_SHA1 ? sha1_blocks : sha256_blocks)(c->state, c->buffer, 1);
+		for (i = 0; i < (ctx->algo == DIGEST_SHA1 ? 5 : 8); i++)
+			store32be(out + 4*i, c->state[i]);
+	}
+}
+
+static void md_update64(digest64_ctx *c, const uint8_t *p, size_t len) {
+	size_t used = c->count & 127, n;
+
+	c->count += len;
+	if (used) {
+		n = 128 - used < len ? 128 - used : len;
+		memcpy(c->buffer + used, p, n);
+		p += n;
+		len -= n;
+		if (used + n < 128)
+			return;
+		sha512_blocks(c->state, c->buffer, 1);
+	}
+	if (len >= 128) {
+		sha512_blocks(c->state, p, len / 128);
+		p += len & ~(size_t)127;
+		len &= 127;
+	}
+	memcpy(c->buffer, p, len);
+}
+
+static void md_final64(digest64_ctx *c, uint8_t *out, size_t size) {
+	size_t used = c->count & 127, i;
+
+	c->buffer[used++] = 0x80;
+	if (used > 112) {
+		memset(c->buffer + used, 0, 128 - used);
+		sha512_blocks(c->state, c->buffer, 1);
+		used = 0;
+	}
+	memset(c->buffer + used, 0, 120 - used);
+	store64be(c->buffer + 120, c->count << 3);
+	store32be(c->buffer + 116, (uint32_t)(c->count >> 61));
+	sha512_blocks(c->state, c->buffer, 1);
+	for (i = 0; i < size/8; i++)
+		store64be(out + 8*i, c->state[i]);
+}
+
+//-------------------------------------[ XXH64 ]
+#define XXH_P1	0x9E3779B185EBCA87ULL
+#define XXH_P2	0xC2B2AE3D27D4EB4FULL
+#define XXH_P3	0x165667B19E3779F9ULL
+#define XXH_P4	0x85EBCA77C2B2AE63ULL
+#define XXH_P5	0x27D4EB2F165667C5ULL
+
+static uint64_t xxh64_round(uint64_t acc, uint64_t input) {
+	acc += input * XXH_P2;
+	return ROTL64(acc, 31) * XXH_P1;
+}
+
+static uint64_t xxh64_merge(uint64_t acc, uint64_t v) {
+	acc ^= xxh64_round(0, v);
+	return acc * XXH_P1 + XXH_P4;
+}
+
+static void xxh64_stripes(uint64_t *v, const uint8_t *p, size_t stripes) {
+	for (; stripes--; p += 32) {
+		v[0] = xxh64_round(v[0], load64le(p));
+		v[1] = xxh64_round(v[1], load64le(p+8));
+		v[2] = xxh64_round(v[2], load64le(p+16));
+		v[3] = xxh64_round(v[3], load64le(p+24));
+	}
+}
+
+static void xxh64_update(xxh64_ctx *c, const uint8_t *p, size_t len) {
+	size_t n;
+
+	c->total += len;
+	if (c->buflen) {
+		n = 32 - c->buflen < len ? 32 - c->buflen : len;
+		memcpy(c->buffer + c->buflen, p, n);
+		c->buflen += (uint32_t)n;
+		p += n;
+		len -= n;
+		if (c->buflen < 32)
+			return;
+		xxh64_stripes(c->v, c->buffer, 1);
+		c->buflen = 0;
+	}
+	xxh64_stripes(c->v, p, len / 32);
+	p += len & ~(size_t)31;
+	c->buflen = (uint32_t)(len & 31);
+	memcpy(c->buffer, p, c->buflen);
+}
+
+static void xxh64_final(xxh64_ctx *c, uint8_t *out) {
+	const uint8_t *p = c->buffer;
+	size_t len = c->buflen;
+	uint64_t h;
+
+	if (c->total >= 32) {
+		h = ROTL64(c->v[0], 1) + ROTL64(c->v[1], 7) + ROTL64(c->v[2], 12) + ROTL64(c->v[3], 18);
+		h = xxh64_merge(h, c->v[0]);
+		h = xxh64_merge(h, c->v[1]);
+		h = xxh64_merge(h, c->v[2]);
+		h = xxh64_merge(h, c->v[3]);
+	} else h = c->v[2] + XXH_P5;
+	h += c->total;
+	for (; len >= 8; len -= 8, p += 8) {
+		h ^= xxh64_round(0, load64le(p));
+		h = ROTL64(h, 27) * XXH_P1 + XXH_P4;
+	}
+	if (len >= 4) {
+		h ^= (uint64_t)load32le(p) * XXH_P1;
+		h = ROTL64(h, 23) * XXH_P2 + XXH_P3;
+		p += 4;
+		len -= 4;
+	}
+	for (; len; len--, p++) {
+		h ^= *p * XXH_P5;
+		h = ROTL64(h, 11) * XXH_P1;
+	}
+	h ^= h >> 33;
+	h *= XXH_P2;
+	h ^= h >> 29;
+	h *= XXH_P3;
+	h ^= h >> 32;
+	store64be(out, h);
+}
+
+//-------------------------------------[ BLAKE3 (hash mode, 32 bytes output) ]
+#define B3_CHUNK_START	1
+#define B3_CHUNK_END	2
+#define B3_PARENT		4
+#define B3_ROOT			8
+#define B3_CHUNKSIZE	1024
+
+static const uint8_t b3_permutation[16] = { 2, 6, 3, 10, 7, 0, 4, 13, 1, 11, 12, 5, 9, 14, 15, 8 };
+
+#define B3_G(a, b, c, d, x, y) \
+	v[a] += v[b] + x; v[d] = ROTR32(v[d] ^ v[a], 16); \
+	v[c] += v[d];     v[b] = ROTR32(v[b] ^ v[c], 12); \
+	v[a] += v[b] + y; v[d] = ROTR32(v[d] ^ v[a], 8);  \
+	v[c] += v[d];     v[b] = ROTR32(v[b] ^ v[c], 7);
+
+static void b3_compress(const uint32_t *cv, const uint8_t *block, uint64_t counter, uint32_t blocklen, uint32_t flags, uint32_t *out) {
+	uint32_t v[16], m[16], t[16];
+	int i, r;
+
+	for (i = 0; i < 16; i++)
+		m[i] = load32le(block + 4*i);
+	memcpy(v, cv, 8*sizeof(uint32_t));
+	memcpy(v+8, sha256_H, 4*sizeof(uint32_t));
+	v[12] = (uint32_t)counter;
+	v[13] = (uint32_t)(counter >> 32);
+	v[14] = blocklen;
+	v[15] = flags;
+	for (r = 0; r < 7; r++) {
+		B3_G(0, 4, 8, 12, m[0], m[1]);
+		B3_G(1, 5, 9, 13, m[2], m[3]);
+		B3_G(2, 6, 10, 14, m[4], m[5]);
+		B3_G(3, 7, 11, 15, m[6], m[7]);
+		B3_G(0, 5, 10, 15, m[8], m[9]);
+		B3_G(1, 6, 11, 12, m[10], m[11]);
+		B3_G(2, 7, 8, 13, m[12], m[13]);
+		B3_G(3, 4, 9, 14, m[14], m[15]);
+		for (i = 0; i < 16; i++)
+			t[i] = m[b3_permutation[i]];
+		memcpy(m, t, sizeof(m));
+	}
+	for (i = 0; i < 8; i++)
+		out[i] = v[i] ^ v[i+8];
+}
+
+static void b3_init(blake3_ctx *c) {
+	memset(c, 0, sizeof(blake3_ctx));
+	memcpy(c->cv, sha256_H, sizeof(c->cv));
+}
+
+//--- Merges completed subtrees: the number of trailing zero bits of the chunk count gives the merges to do
+static void b3_push(blake3_ctx *c, const uint32_t *cv, uint64_t chunks) {
+	uint8_t block[64];
+	uint32_t node[8];
+	int i;
+
+	memcpy(node, cv, sizeof(node));
+	for (; !(chunks & 1); chunks >>= 1) {
+		c->stacklen--;
+		for (i = 0; i < 8; i++) {
+			store32le(block + 4*i, c->stack[c->stacklen][i]);
+			store32le(block + 32 + 4*i, node[i]);
+		}
+		b3_compress(sha256_H, block, 0, 64, B3_PARENT, node);
+	}
+	memcpy(c->stack[c->stacklen++], node, sizeof(node));
+}
+
+static void b3_update(blake3_ctx *c, const uint8_t *p, size_t len) {
+	size_t n;
+
+	while (len) {
+		//--- the last block of a chunk is only compressed when more input follows
+		if (c->blocklen == 64) {
+			if (c->blocks == B3_CHUNKSIZE/64 - 1) {
+				b3_compress(c->cv, c->block, c->chunk, 64, (c->blocks ? 0 : B3_CHUNK_START) | B3_CHUNK_END, c->cv);
+				b3_push(c, c->cv, ++c->chunk);
+				memcpy(c->cv, sha256_H, sizeof(c->cv));
+				c->blocks = 0;
+			} else {
+				b3_compress(c->cv, c->block, c->chunk, 64, c->blocks ? 0 : B3_CHUNK_START, c->cv);
+				c->blocks++;
+			}
+			c->blocklen = 0;
+		}
+		n = (size_t)(64 - c->blocklen) < len ? (size_t)(64 - c->blocklen) : len;
+		memcpy(c->block + c->blocklen, p, n);
+		c->blocklen += (uint8_t)n;
+		p += n;
+		len -= n;
+	}
+}
+
+static void b3_final(blake3_ctx *c, uint8_t *out) {
+	uint8_t block[64];
+	uint32_t node[8], flags = (c->blocks ? 0 : B3_CHUNK_START) | B3_CHUNK_END;
+	int i, depth = (int)c->stacklen;
+
+	memset(c->block + c->blocklen, 0, 64 - c->blocklen);
+	if (!depth)
+		b3_compress(c->cv, c->block, c->chunk, c->blocklen, flags | B3_ROOT, node);
+	else {
+		b3_compress(c->cv, c->block, c->chunk, c->blocklen, flags, node);
+		while (depth--) {
+			for (i = 0; i < 8; i++) {
+				store32le(block + 4*i, c->stack[depth][i]);
+				store32le(block + 32 + 4*i, node[i]);
+			}
+			b3_compress(sha256_H, block, 0, 64, B3_PARENT | (depth ? 0 : B3_ROOT), node);
+		}
+	}
+	for (i = 0; i < 8; i++)
+		store32le(out + 4*i, node[i]);
+}
+
+//-------------------------------------[ Digest interface ]
+size_t digest_size(DigestAlgo algo) {
+	return digest_sizes[algo];
+}
+
+const char *digest_implementation(DigestAlgo algo) {
+	if (!sha256_blocks)
+		select_implementations();
+#ifdef DIGEST_SHANI
+	if ((algo == DIGEST_SHA1 || algo == DIGEST_SHA256) && sha256_blocks == sha256_blocks_shani)
+		return "sha-ni";
+#endif
+	return "portable";
+}
+
+void digest_init(digest_ctx *ctx, DigestAlgo algo) {
+	static const uint32_t md5_H[4] = { 0x67452301, 0xefcdab89, 0x98badcfe, 0x10325476 };
+	static const uint32_t sha1_H[5] = { 0x67452301, 0xefcdab89, 0x98badcfe, 0x10325476, 0xc3d2e1f0 };
+
+	if (!sha256_blocks)
+		select_implementations();
+	//--- the BLAKE3 context is much larger than the others and cleared by b3_init()
+	if (algo != DIGEST_BLAKE3)
+		memset(ctx, 0, offsetof(digest_ctx, d64) + sizeof(digest64_ctx));
+	ctx->algo = algo;
+	switch (algo) {
+		case DIGEST_MD5:	memcpy(ctx->d32.state, md5_H, sizeof(md5_H)); break;
+		case DIGEST_SHA1:	memcpy(ctx->d32.state, sha1_H, sizeof(sha1_H)); break;
+		case DIGEST_SHA256:	memcpy(ctx->d32.state, sha256_H, sizeof(sha256_H)); break;
+		case DIGEST_SHA384:	memcpy(ctx->d64.state, sha384_H, sizeof(sha384_H)); break;
+		case DIGEST_SHA512:	memcpy(ctx->d64.state, sha512_H, sizeof(sha512_H)); break;
+		case DIGEST_XXH64:	ctx->xxh.v[0] = XXH_P1 + XXH_P2;
+							ctx->xxh.v[1] = XXH_P2;
+							ctx->xxh.v[3] = 0 - XXH_P1; break;
+		case DIGEST_BLAKE3:	b3_init(&ctx->b3);
+	}
+}
+
+void digest_update(digest_ctx *ctx, const void *data, size_t len) {
+	if (!len)
+		return;
+	switch (ctx->algo) {
+		case DIGEST_MD5:
+		case DIGEST_SHA1:
+		case DIGEST_SHA256:	md_update32(ctx, data, len); break;
+		case DIGEST_SHA384:
+		case DIGEST_SHA512:	md_update64(&ctx->d64, data, len); break;
+		case DIGEST_XXH64:	xxh64_update(&ctx->xxh, data, len); break;
+		case DIGEST_BLAKE3:	b3_update(&ctx->b3, data, len);
+	}
+}
+
+void digest_final(digest_ctx *ctx, uint8_t *out) {
+	switch (ctx->algo) {
+		case DIGEST_MD5:
+		case DIGEST_SHA1:
+		case DIGEST_SHA256:	md_final32(ctx, out); break;
+		case DIGEST_SHA384:	md_final64(&ctx->d64, out, 48); break;
+		case DIGEST_SHA512:	md_final64(&ctx->d64, out, 64); break;
+		case DIGEST_XXH64:	xxh64_final(&ctx->xxh, out); break;
+		case DIGEST_BLAKE3:	b3_final(&ctx->b3, out);
+	}
+}
@@ -0,0 +1,68 @@
+/*
+ | LuaRT - A Windows programming framework for Lua
+ | Luart.org, Copyright (c) Tine Samir 2022.
+ | See Copyright Notice in LICENSE.TXT
+ |-------------------------------------------------
+ | digest.h | Portable message digests (MD5, SHA-1, SHA-2, XXH64, BLAKE3)
+*/
+
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+typedef enum { DIGEST_MD5, DIGEST_SHA1, DIGEST_SHA256, DIGEST_SHA384, DIGEST_SHA512, DIGEST_XXH64, DIGEST_BLAKE3 } DigestAlgo;
+
+//--- Algorithm names, in DigestAlgo order and NULL terminated
+extern const char *digest_names[];
+
+#define DIGEST_MAXSIZE		64
+#define BLAKE3_MAXDEPTH		54
+
+typedef struct {
+	uint32_t	state[8];
+	uint64_t	count;
+	uint8_t		buffer[64];
+} digest32_ctx;		//--- MD5, SHA-1 and SHA-256
+
+typedef struct {
+	uint64_t	state[8];
+	uint64_t	count;
+	uint8_t		buffer[128];
+} digest64_ctx;		//--- SHA-384 and SHA-512
+
+typedef struct {
+	uint64_t	v[4];
+	uint64_t	total;
+	uint8_t		buffer[32];
+	uint32_t	buflen;
+} xxh64_ctx;
+
+typedef struct {
+	uint32_t	cv[8];
+	uint64_t	chunk;
+	uint8_t		block[64];
+	uint8_t		blocklen;
+	uint8_t		blocks;
+	uint32_t	stacklen;
+	uint32_t	stack[BLAKE3_MAXDEPTH][8];
+} blake3_ctx;
+
+typedef struct {
+	DigestAlgo		algo;
+	union {
+		digest32_ctx	d32;
+		digest64_ctx	d64;
+		xxh64_ctx		xxh;
+		blake3_ctx		b3;
+	};
+} digest_ctx;
+
+//--- Digest size in bytes
+size_t digest_size(DigestAlgo algo);
+void digest_init(digest_ctx *ctx, DigestAlgo algo);
+void digest_update(digest_ctx *ctx, const void *data, size_t len);
+//--- Writes the digest to out (digest_size() bytes), the context must be initialized again to be reused
+void digest_final(digest_ctx *ctx, uint8_t *out);
+//--- Name of the compression function in use for the algorithm ("portable", "sha-ni")
+const char *digest_implementation(DigestAlgo algo);
@@ -0,0 +1,205 @@
+/*
+ | LuaRT - A Windows programming framework for Lua
+ | Luart.org, Copyright (c) Tine Samir 2022.
+ | See Copyright Notice in LICENSE.TXT
+ |-------------------------------------------------
+ | digest_test.c | Standalone test and benchmark of the message digests
+ |
+ | gcc -std=gnu99 -O2 -Wall -o digest_test crypto/lib/digest_test.c crypto/lib/digest.c && ./digest_test [bench]
+*/
+
+#include "digest.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+static int failures = 0;
+
+#define check(cond) do { if (!(cond)) { fprintf(stderr, "%s:%d: check failed: %s\n", __FILE__, __LINE__, #cond); failures++; } } while (0)
+
+//--- Known digests of the message of len bytes (i*131+7) & 255, from Python hashlib, xxhash and blake3
+static const struct {
+	DigestAlgo	algo;
+	size_t		len;
+	const char	*hex;
+} vectors[] = {
+	{DIGEST_MD5, 0, "d41d8cd98f00b204e9800998ecf8427e"},
+	{DIGEST_MD5, 3, "685e7341789ffe8fd8cf4fab0fd60033"},
+	{DIGEST_MD5, 55, "852e13533f66e414bbbbb3348de4f81f"},
+	{DIGEST_MD5, 64, "bc00c8534af1e5aef0ede584d8ad5bc3"},
+	{DIGEST_MD5, 112, "06c11672e8a4a4d90fc05c5be02551fa"},
+	{DIGEST_MD5, 128, "154b8c17cfb174384edd9557e3e64e2b"},
+	{DIGEST_MD5, 1024, "15ee510138a80d0470331212a023ab66"},
+	{DIGEST_MD5, 1025, "642ef7bb1127b54d5199d7fa562c1cfa"},
+	{DIGEST_MD5, 8193, "d31acac67f44bae20cebe3e963d97165"},
+	{DIGEST_MD5, 102400, "6d7fcdc186f154a22bf132f681aef23d"},
+	{DIGEST_SHA1, 0, "da39a3ee5e6b4b0d3255bfef95601890afd80709"},
+	{DIGEST_SHA1, 3, "09182f082afc61e78585bdfb60501dfe876ccf62"},
+	{DIGEST_SHA1, 55, "9e5a20c2604688df0b1eecf4474b58bfe7227881"},
+	{DIGEST_SHA1, 64, "1abec92bfbde4197236cfba30b6b61c69d605d88"},
+	{DIGEST_SHA1, 112, "7df255002406f60edaffe46d7a0c385dab7a81e0"},
+	{DIGEST_SHA1, 128, "8abf03d87a20327b0a0dfbee98f04a881350d8f4"},
+	{DIGEST_SHA1, 1024, "788b64e9b335dd53eba616523638b98cd79c6234"},
+	{DIGEST_SHA1, 1025, "250bf967b128744b6df4250694c0edc144b07cc7"},
+	{DIGEST_SHA1, 8193, "b8ca46368f9f8f726db15dcfedc383a854b14168"},
+	{DIGEST_SHA1, 102400, "7b0f03b16d0633e1d920326fd366a29f06767437"},
+	{DIGEST_SHA256, 0, "e3b0c44298fc1c149afbf4c8996fb92427ae41e4649b934ca495991b7852b855"},
+	{DIGEST_SHA256, 3, "17aef23a39d753e713c203c152454d29fa8e39a98e83a69b39a5094dba9ae951"},
+	{DIGEST_SHA256, 55, "16ed9c4697ca11d5f6fb25ea7900252dd4cb97215d7f6d0b2bb3e2a86ac0ec72"},
+	{DIGEST_SHA256, 64, "b337ba9b0c69c391364e985fdcb23a889887e59800832c92fbfa22b8a3c40304"},
+	{DIGEST_SHA256, 112, "ecf2bd67b292d09ff421b2f279b9f9525c17b8bbd71711dba7fae1fab799c791"},
+	{DIGEST_SHA256, 128, "485a94e53eba9717a5d8b7b4489cad92a752f1c5722e7dfd29dd164b7c438d11"},
+	{DIGEST_SHA256, 1024, "583860e60cae1aad49d6cb0f5e604ade00da2d3cb4ae9b7b022ccf45c476d426"},
+	{DIGEST_SHA256, 1025, "2e39b5d82a981f2c313544a8b749017761def42e95c78e90932b8e496c7c1e96"},
+	{DIGEST_SHA256, 8193, "3238b82084e608e2314ee55f0ca8895ecc95225d14eb0a6ca22a4346f5540c34"},
+	{DIGEST_SHA256, 102400, "85ef88f5ce452c8c24090476e45b074982295bccf94207444a974657d19717af"},
+	{DIGEST_SHA384, 0, "38b060a751ac96384cd9327eb1b1e36a21fdb71114be07434c0cc7bf63f6e1da274edebfe76f65fbd51ad2f14898b95b"},
+	{DIGEST_SHA384, 3, "be7350a7123b823c0f25a00072a8bda08abcfcd4899b58affcba01fb71fa9476c0e34a5eeec5318307579a7efdd4d449"},
+	{DIGEST_SHA384, 55, "90b2858b3e9b810c641926affbdc5069fa1db9d0d610867012a96ab84b639eb3c14a66fb60b2c43944d33c5549365164"},
+	{DIGEST_SHA384, 64, "b5669d49e2e1e533842e8af4404c16622fc4db80c60c8c47ed0a621d67deea19d7e58ce45ae84c72c4a01ea11cadc060"},
+	{DIGEST_SHA384, 112, "0dd0c03d92bf4c9f7fafd0d5e0b664c38c8bb477750cafa97208b8501a0d6291e6f7770b068160e2f477548207e2d3e2"},
+	{DIGEST_SHA384, 128, "3b3d876d25f23f11905b5e8f66e7c67ed55a81a1aafff412208f36fe34dc635c60e7a2a63284e514c3c4a274c9949fdf"},
+	{DIGEST_SHA384, 1024, "a92d9fce2cbefb780a600a67f9f59c01f20ab28d9a32aaff7a52a0a46adea0b750a60e0da2eedafc57e24c3a40089a94"},
+	{DIGEST_SHA384, 1025, "667ef758e5a7d2c09a062f24f6677ae11d50ef66485aa2def219a1ae472afbf28885855549e1d1516a05f7b424a0f40a"},
+	{DIGEST_SHA384, 8193, "d31442fda700da5b82ef0ac6e132734165b370b7245bad10506f1c9d59d817d4ebbf257237b186c40a6ea797d764752c"},
+	{DIGEST_SHA384, 102400, "340be6a0fba74289d56f50cb7b690490e9b0bb2026e019c526c5aa0a3a0a86dc13434f029b7231c996e7c2978f9908fe"},
+	{DIGEST_SHA512, 0, "cf83e1357eefb8bdf1542850d66d8007d620e4050b5715dc83f4a921d36ce9ce47d0d13c5d85f2b0ff8318d2877eec2f63b931bd47417a81a538327af927da3e"},
+	{DIGEST_SHA512, 3, "4a964c5015a3520207df0ca03cabebac5494f00e0d0da8560498ebf57a629d0f43dd965f9b61f464ef660886ebf6acffec411788a79a4568f12880b72a27923a"},
+	{DIGEST_SHA512, 55, "25333ac58c5facaca5108692ed55fe7fb75e011864201eba8dcc60766a853d6bf7b2fa6785e2a76efb6959ed30adc84befecf13d1cdd7de7b60ef3e26d065a96"},
+	{DIGEST_SHA512, 64, "897a8a2a8a31c1adb4c7a65b79430a54beee0e8dfe9d66f2f97adb307fdd3aab6bb96a997c6e95e6f32706838d1c6832a334f4e30be4c9e9becbecb04a9cb890"},
+	{DIGEST_SHA512, 112, "ff7d52fc3a61de5265b1f12a31ddaf4d7b1d810512d9ff05a1749e9af2b6e154aca9df6f38f74d1fe9e9a17e2751c28e0a9f22a0cff74af4a11551da33c04384"},
+	{DIGEST_SHA512, 128, "f225e70ebaf47c24482148ef1610c2eafaf640fbee9f860c0f883b79a72e764f3a788f69ce19b09aaa2b38eba4c0631f4ea86b0a8c01c623e9c8966d8bffe956"},
+	{DIGEST_SHA512, 1024, "96d132078308783437a018063bbd292bd31a3425685b6926be29be5d95ef91cece6ba747f04c0f504bdce9d999b6996eb45d5e736ab410d35de5ccedb4e4d144"},
+	{DIGEST_SHA512, 1025, "ec10fade7361f3fc5bec3fd78edad35eee020e4962150953b92d17ec842272913ec835dfc9d436ec57e66a67dbacf5192312d91152c9d5ee82d2fb1c488d9806"},
+	{DIGEST_SHA512, 8193, "232d68f27b770ccd27daebf0b1414a58f960ac5de8ec5a566253f5f85c886b4609fa94c800bdf33e35746ebe340de0f742241216fba707bb68494611917a5372"},
+	{DIGEST_SHA512, 102400, "e6ee7ae5fdbec375a4c4f792389ad4e2e492ff1127cf411584b0c1d041458a3d595439eb27c7137e45db91520576061bf59b8060624bfd73db8f036ec5d9bf86"},
+	{DIGEST_XXH64, 0, "ef46db3751d8e999"},
+	{DIGEST_XXH64, 3, "bed43740ee6332bb"},
+	{DIGEST_XXH64, 55, "8f8dc5b07f6d48ed"},
+	{DIGEST_XXH64, 64, "50d4159a0411632e"},
+	{DIGEST_XXH64, 112, "3a0c515490b4820d"},
+	{DIGEST_XXH64, 128, "0430e433b792e757"},
+	{DIGEST_XXH64, 1024, "5960af0c625acfb7"},
+	{DIGEST_XXH64, 1025, "dbd366621190a655"},
+	{DIGEST_XXH64, 8193, "33fe155a23d1717a"},
+	{DIGEST_XXH64, 102400, "e66101206b4275f9"},
+	{DIGEST_BLAKE3, 0, "af1349b9f5f9a1a6a0404dea36dcc9499bcb25c9adc112b7cc9a93cae41f3262"},
+	{DIGEST_BLAKE3, 3, "107fa8d3104f89cb2cfbb94cd45773a8a28154f6e2d1285c045aefd5439916df"},
+	{DIGEST_BLAKE3, 55, "535e0a16cac82a854477d39afc62178e050a794ce5c63191b5aec2bf174fc9b4"},
+	{DIGEST_BLAKE3, 64, "69b67daeacd7d246f6e3541fab4c7ec315ec1ceb7833b38540fd3e53e91f5e25"},
+	{DIGEST_BLAKE3, 112, "11966c3aaed85e9dd0537c3698651ee2c7e2f4335300f24298a5c62c77638848"},
+	{DIGEST_BLAKE3, 128, "26501bc004813501b2d3336d0b75978ce71bb52b10a69970f80da4b922af6c1c"},
+	{DIGEST_BLAKE3, 1024, "b017ef5fc657b7dfff99ea58e6c8c5ceadcebe091567682530cb66a07fc8c94c"},
+	{DIGEST_BLAKE3, 1025, "96afeacb2c9bcac416a0457d8d1ceddc7452670746a461a25b3266d83f703e8f"},
+	{DIGEST_BLAKE3, 8193, "39fdca1550e5d0c71ad02a7c05a2b90d6267157acec5a67e5631dbb0d3d0d497"},
+	{DIGEST_BLAKE3, 102400, "87b993d84703b30bc5b52b3bcb178fde27e6c590ea622aaa20a5642ca9e6a5be"},
+};
+
+static uint8_t *message(size_t len) {
+	uint8_t *data = malloc(len ? len : 1);
+	size_t i;
+
+	for (i = 0; i < len; i++)
+		data[i] = (uint8_t)(i*131+7);
+	return data;
+}
+
+static void tohex(const uint8_t *digest, size_t len, char *hex) {
+	size_t i;
+
+	for (i = 0; i < len; i++)
+		sprintf(hex + 2*i, "%02x", digest[i]);
+}
+
+//--- Hashes the message in chunks of step bytes (the whole message at once if step is 0)
+static void hash(DigestAlgo algo, const uint8_t *data, size_t len, size_t step, char *hex) {
+	uint8_t out[DIGEST_MAXSIZE];
+	digest_ctx ctx;
+	size_t i, n;
+
+	digest_init(&ctx, algo);
+	for (i = 0; i < len; i += n) {
+		n = step && step < len-i ? step : len-i;
+		digest_update(&ctx, data+i, n);
+	}
+	digest_final(&ctx, out);
+	tohex(out, digest_size(algo), hex);
+}
+
+static void test_vectors(void) {
+	static const size_t steps[] = { 0, 1, 3, 63, 64, 65, 1000, 1024 };
+	char hex[2*DIGEST_MAXSIZE+1];
+	size_t i, j;
+	uint8_t *data;
+
+	for (i = 0; i < sizeof(vectors)/sizeof(vectors[0]); i++) {
+		data = message(vectors[i].len);
+		check(strlen(vectors[i].hex) == 2*digest_size(vectors[i].algo));
+		for (j = 0; j < sizeof(steps)/sizeof(steps[0]); j++) {
+			hash(vectors[i].algo, data, vectors[i].len, steps[j], hex);
+			if (strcmp(hex, vectors[i].hex)) {
+				fprintf(stderr, "%s of %zu bytes in steps of %zu : %s\n", digest_names[vectors[i].algo], vectors[i].len, steps[j], hex);
+				failures++;
+			}
+		}
+		free(data);
+	}
+}
+
+//--- Random update sizes give the same digest as a single update
+static void test_random_splits(void) {
+	size_t len = 200000, i, n;
+	uint8_t *data = message(len), out[DIGEST_MAXSIZE], ref[DIGEST_MAXSIZE];
+	digest_ctx ctx;
+	int algo, round;
+
+	srand(1);
+	for (algo = DIGEST_MD5; algo <= DIGEST_BLAKE3; algo++) {
+		digest_init(&ctx, algo);
+		digest_update(&ctx, data, len);
+		digest_final(&ctx, ref);
+		for (round = 0; round < 20; round++) {
+			digest_init(&ctx, algo);
+			for (i = 0; i < len; i += n) {
+				n = (size_t)rand() % (round < 10 ? 130 : 5000);
+				if (n > len-i)
+					n = len-i;
+				digest_update(&ctx, data+i, n);
+			}
+			digest_final(&ctx, out);
+			check(memcmp(out, ref, digest_size(algo)) == 0);
+		}
+	}
+	free(data);
+}
+
+static void bench(void) {
+	size_t len = 64 << 20;
+	uint8_t *data = message(len), out[DIGEST_MAXSIZE];
+	digest_ctx ctx;
+	clock_t start;
+	double seconds;
+	int algo;
+
+	for (algo = DIGEST_MD5; algo <= DIGEST_BLAKE3; algo++) {
+		start = clock();
+		digest_init(&ctx, algo);
+		digest_update(&ctx, data, len);
+		digest_final(&ctx, out);
+		seconds = (double)(clock() - start) / CLOCKS_PER_SEC;
+		printf("%-7s %-9s %8.0f MB/s\n", digest_names[algo], digest_implementation(algo), seconds > 0 ? (len >> 20) / seconds : 0);
+	}
+	free(data);
+}
+
+int main(int argc, char **argv) {
+	test_vectors();
+	test_random_splits();
+	if (failures)
+		printf("%d check(s) failed\n", failures);
+	else puts("all tests passed");
+	if (argc > 1 && !strcmp(argv[1], "bench"))
+		bench();
+	return failures != 0;
+}
@@ -13,10 +13,22 @@
 
 
 
+//--- Buffer storage: heap allocated bytes, or a read-only/read-write file mapping view
+typedef enum { BUFFER_HEAP, BUFFER_MAPPED, BUFFER_MAPPEDRW } BufferStorage;
+
+//--- Reference counted storage, shared between a Buffer and its slices
+typedef struct {
+	size_t			refs;
+	size_t			capacity;
+	BufferStorage	storage;
+	BYTE			*base;
+} BufferData;
+
 typedef struct {
 	luart_type		type;
 	size_t			size;
-	BYTE			*bytes;
+	BYTE			*bytes;		//--- first byte of the Buffer, inside data->base
+	BufferData		*data;
 } Buffer;
 
 extern luart_type TBuffer;
@@ -30,3 +42,11 @@ void lua_toBuffer(lua_State *L, void *p, size_t len);
 Buffer *luart_tobuffer(lua_State *L, int idx);
 int base64_encode(lua_State *L, Buffer *b);
 
+//--- Buffer storage management
+void buffer_attach(lua_State *L, Buffer *b, BYTE *bytes, size_t size, size_t capacity, BufferStorage storage);
+BYTE *buffer_alloc(lua_State *L, Buffer *b, size_t size);
+BYTE *buffer_reserve(lua_State *L, Buffer *b, size_t capacity);
+//--- Same as buffer_reserve(), returning NULL instead of raising an error (for callbacks that must clean up first)
+BYTE *buffer_tryreserve(Buffer *b, size_t capacity);
+void buffer_release(Buffer *b);
+
@@ -0,0 +1,46 @@
+/*
+ | LuaRT - A Windows programming framework for Lua
+ | Luart.org, Copyright (c) Tine Samir 2022.
+ | See Copyright Notice in LICENSE.TXT
+ |-------------------------------------------------
+ | Codec.h | LuaRT Encoder and Decoder objects header
+*/
+
+#pragma once
+
+#include <luart.h>
+#include <stdlib.h>
+
+typedef enum { CODEC_BASE64, CODEC_BASE64URL, CODEC_HEX } CodecKind;
+
+//--- Streaming codec state: pending input bytes (encoder) or pending decoded bits (decoder)
+typedef struct {
+	luart_type	type;
+	CodecKind	kind;
+	BYTE		pending[3];
+	int			npending;
+	UINT32		bits;
+	int			nbits;
+} Codec;
+
+typedef Codec Encoder;
+typedef Codec Decoder;
+
+extern luart_type TEncoder;
+extern luart_type TDecoder;
+
+//---------------------------------------- Codec functions
+//--- Encoded size of len bytes, and maximum decoded size of len characters
+size_t codec_encodedsize(CodecKind kind, size_t len);
+size_t codec_decodedsize(CodecKind kind, size_t len);
+//--- Encodes/decodes len bytes to dst and returns the number of bytes written
+//--- Incomplete input is kept in the codec, and flushed when last is TRUE
+size_t codec_encode(Codec *c, const BYTE *src, size_t len, char *dst, BOOL last);
+size_t codec_decode(lua_State *L, Codec *c, const char *src, size_t len, BYTE *dst, BOOL last);
+
+//---------------------------------------- Encoder and Decoder objects
+LUA_CONSTRUCTOR(Encoder);
+extern const luaL_Reg Encoder_methods[];
+
+LUA_CONSTRUCTOR(Decoder);
+extern const luaL_Reg Decoder_methods[];
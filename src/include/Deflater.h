@@ -0,0 +1,72 @@
+/*
+ | LuaRT - A Windows programming framework for Lua
+ | Luart.org, Copyright (c) Tine Samir 2022.
+ | See Copyright Notice in LICENSE.TXT
+ |-------------------------------------------------
+ | Deflater.h | LuaRT Deflater and Inflater objects header
+*/
+
+#pragma once
+
+#include <luart.h>
+#include <compression\lib\miniz.h>
+
+typedef enum { FORMAT_ZLIB, FORMAT_RAW, FORMAT_GZIP } CompressionFormat;
+
+//--- Inflater stream state, gzip streams go through header and trailer states for each member
+typedef enum { STREAM_HEADER, STREAM_DATA, STREAM_TRAILER, STREAM_END } StreamState;
+
+typedef struct {
+	luart_type			type;
+	mz_stream			stream;
+	CompressionFormat	format;
+	StreamState			state;
+	BOOL				ready;		//--- miniz stream initialized
+	mz_ulong			crc;		//--- gzip CRC32 and size of the current member
+	mz_uint32			size;
+	int					members;	//--- gzip members fully decompressed
+	BYTE				*pending;	//--- incomplete gzip header or trailer bytes
+	size_t				npending;
+} Deflater;
+
+typedef Deflater Inflater;
+
+extern luart_type TDeflater;
+extern luart_type TInflater;
+
+//---------------------------------------- gzip framing
+#define GZIP_HEADER_MINSIZE 10
+#define GZIP_FOOTER_SIZE 8
+
+//--- Writes the minimal 10 bytes gzip header
+void gzip_header(BYTE *header);
+//--- Writes the 8 bytes gzip trailer (CRC32 and input size modulo 2^32)
+void gzip_trailer(BYTE *trailer, mz_ulong crc, mz_uint32 size);
+//--- Returns the size of the gzip header at p, 0 if more bytes are needed or (size_t)-1 if invalid
+size_t gzip_headersize(const BYTE *p, size_t len);
+//--- Returns the CRC32 of two concatenated blocks from their CRC32 and the length of the second one
+mz_ulong gzip_crc32combine(mz_ulong crc1, mz_ulong crc2, size_t len2);
+
+//---------------------------------------- Worker threads
+//--- Default number of worker threads for parallel compression and extraction
+int compression_threads(void);
+
+//---------------------------------------- gzip streams
+//--- Reader returns the number of bytes read (0 at end of input), writer returns FALSE on failure
+typedef size_t (*gzip_reader)(void *ud, BYTE *buff, size_t len);
+typedef BOOL (*gzip_writer)(void *ud, const BYTE *buff, size_t len);
+
+//--- Compresses input as one gzip stream, split into blocks compressed by nthreads workers
+//--- Returns NULL on success or an error message
+const char *gzip_parallel(gzip_reader read, void *in, gzip_writer write, void *out, int level, int nthreads);
+//--- Decompresses a single or multi-member gzip stream, returns NULL on success or an error message
+const char *gunzip_stream(gzip_reader read, void *in, gzip_writer write, void *out);
+
+//---------------------------------------- Deflater and Inflater objects
+LUA_CONSTRUCTOR(Deflater);
+extern const luaL_Reg Deflater_methods[];
+extern const luaL_Reg Deflater_metafields[];
+
+LUA_CONSTRUCTOR(Inflater);
+extern const luaL_Reg Inflater_methods[];
+extern const luaL_Reg Inflater_metafields[];
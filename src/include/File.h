@@ -26,8 +26,17 @@ typedef struct {
 	wchar_t		*fname;
 	wchar_t		*fullpath;
 	int			mode;
+	char		*buffer;
+	size_t		bufpos;
+	size_t		buflen;
 } File;
 
+//--- Size of the File read buffer
+#define FILE_BUFFERSIZE	65536
+
+//--- Discards the read buffer, moving the stream position back to the first unread byte
+void file_sync(File *f);
+
 extern luart_type TFile;
 
 typedef enum { ASCII, UTF8, UNICODE } Encoding;
@@ -0,0 +1,31 @@
+/*
+ | LuaRT - A Windows programming framework for Lua
+ | Luart.org, Copyright (c) Tine Samir 2022.
+ | See Copyright Notice in LICENSE.TXT
+ |-------------------------------------------------
+ | Hash.h | LuaRT Hash object header file
+*/
+
+#pragma once
+
+#include <luart.h>
+#include <crypto\lib\digest.h>
+
+//--- Size of the chunks read by crypto.hashfile()
+#define HASHFILE_CHUNKSIZE	(1024*1024)
+
+//---------------------------------------- Hash object
+typedef struct {
+	luart_type		type;
+	digest_ctx		ctx;
+} Hash;
+
+extern luart_type THash;
+
+//--- Returns the DigestAlgo named at index idx, or def when the argument is none or nil (the argument is required if def is NULL)
+DigestAlgo luaL_checkdigest(lua_State *L, int idx, const char *def);
+//--- Pushes the digest of the context as a Buffer, without altering the context
+void lua_pushdigest(lua_State *L, const digest_ctx *ctx);
+
+LUA_CONSTRUCTOR(Hash);
+extern const luaL_Reg Hash_methods[];
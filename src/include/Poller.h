@@ -0,0 +1,28 @@
+/*
+ | LuaRT - A Windows programming framework for Lua
+ | Luart.org, Copyright (c) Tine Samir 2022.
+ | See Copyright Notice in LICENSE.TXT
+ |-------------------------------------------------
+ | Poller.h | LuaRT Poller object header
+*/
+
+#pragma once
+
+#include <Socket.h>
+#include <net\lib\poller.h>
+
+typedef struct {
+	luart_type		type;
+	poller_t		*poller;
+	poller_entry	*events;	//--- poller_wait() results, grown with the registered sockets
+	int				size;
+	int				ready;		//--- reference to the table returned by Poller:wait()
+	int				nready;
+} Poller;
+
+extern luart_type TPoller;
+
+//---------------------------------------- Poller type
+LUA_CONSTRUCTOR(Poller);
+extern const luaL_Reg Poller_methods[];
+extern const luaL_Reg Poller_metafields[];
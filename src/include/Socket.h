@@ -10,6 +10,8 @@
 
 #include <ws2tcpip.h>
 #include <luart.h>
+#include <net\lib\poller.h>
+#include <net\lib\tlsrec.h>
 
 #include <stdlib.h>
 
@@ -25,7 +27,9 @@ typedef struct
 	PCtxtHandle					pCtxtHandle;
 	SecPkgContext_StreamSizes	sizes;
 	SecBuffer					ExtraData;
-	SecBuffer					RemainingDecryptData;
+	tlsrec_buffer				in;			//--- received records, decrypted in place
+	tlsrec_buffer				plain;		//--- decrypted data that did not fit in the recv() buffer
+	tlsrec_writer				writer;		//--- records being written, and sealed records waiting to be sent
 	PCCERT_CONTEXT				pCertContext;
 	BOOL						acceptSuccess;
 } TLS;
@@ -46,11 +50,41 @@ typedef struct {
 	BOOL		write;
 	BOOL		error;
 	int			protocol;
+	BOOL		async;
+	BYTE		*rbuf;		//--- received data buffered by readline(), readuntil() and readexactly()
+	size_t		rstart;
+	size_t		rlen;
+	size_t		rcapacity;
 } Socket;
 
+//--- Initial size of the Socket receive buffer, and minimum free space for each recv() call
+#define SOCKET_RECVBUFFER	16384
+#define SOCKET_RECVCHUNK	4096
+
+//--- Chunks sent with a single Socket:sendv() call without allocation, and Socket:sendfile() chunk sizes
+#define SOCKET_MAXVEC		32
+#define SOCKET_SENDCHUNK	65536
+#define SOCKET_TRANSMITMAX	0x40000000
+
+//--- Interval at which async connections are checked, as WSAPoll() may not report failed connections
+#define SOCKET_CONNECTPOLL	100
+
+//--- Plaintext encrypted in records before they are sent, by TLS Socket send operations
+#define TLS_SENDWINDOW		65536
+
 extern luart_type TSocket;
 
 //---------------------------------------- Socket type
 LUA_CONSTRUCTOR(Socket);
 extern const luaL_Reg Socket_methods[];
-extern const luaL_Reg Socket_metafields[];
\ No newline at end of file
+extern const luaL_Reg Socket_metafields[];
+
+//---------------------------------------- Tasks scheduler (net/async.c)
+//--- Checks if an operation on an async Socket can yield the current task
+BOOL async_intask(lua_State *L, Socket *s);
+//--- Yields the current task until the Socket is ready for events (POLLER_READ or POLLER_WRITE), then calls k
+int async_wait(lua_State *L, Socket *s, int events, lua_KContext ctx, lua_KFunction k);
+//--- Same as async_wait(), but the task is also resumed after delay milliseconds if the Socket is still not ready
+int async_waitfor(lua_State *L, Socket *s, int events, int delay, lua_KContext ctx, lua_KFunction k);
+void async_release(lua_State *L, Socket *s);
+void async_finalize(void);
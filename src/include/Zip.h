@@ -19,8 +19,36 @@ typedef struct {
 	wchar_t			*fname;
 	int				level;
 	char			mode;
+	int				streams;	//--- opened ZipStream objects
+	struct zip_t	*pending;	//--- archive closed while streams are still opened
+	void			*writer;	//--- ZipStream currently writing an entry
 } Zip;
 
+//--- ZipStream read buffer size
+#define ZIPSTREAM_BUFFERSIZE	65536
+
+typedef struct {
+	luart_type		type;
+	Zip				*zip;
+	struct zip_t	*archive;
+	int				ref;		//--- registry reference to the Zip object
+	mz_zip_reader_extract_iter_state *iter;	//--- deflated entries are read sequentially
+	mz_uint64		offset;		//--- archive offset of stored entries data
+	mz_uint64		size;
+	mz_uint32		index;
+	BYTE			*buffer;
+	size_t			bufsize;
+	size_t			bufpos;
+	size_t			buflen;
+	mz_uint64		bufstart;	//--- entry position of the first buffered byte
+	mz_uint32		crc32;		//--- expected CRC-32 of the entry
+	mz_uint32		crc;		//--- CRC-32 of stored entries data, computed while read sequentially up to crcpos
+	mz_uint64		crcpos;
+	BOOL			stored;
+	BOOL			writing;
+	BOOL			closed;
+} ZipStream;
+
 //---------------------------------------- Zip type
 
 extern luart_type TZip;
@@ -28,3 +56,18 @@ extern luart_type TZip;
 LUA_CONSTRUCTOR(Zip);
 extern const luaL_Reg Zip_methods[];
 extern const luaL_Reg Zip_metafields[];
+
+//--- Closes the Zip archive, or defers it until the last ZipStream is closed
+void zip_release(Zip *z);
+
+//---------------------------------------- ZipStream type
+
+extern luart_type TZipStream;
+
+LUA_CONSTRUCTOR(ZipStream);
+extern const luaL_Reg ZipStream_methods[];
+extern const luaL_Reg ZipStream_metafields[];
+
+//--- Releases the stream resources, and closes its Zip archive if it has been closed meanwhile
+//--- Returns NULL, or the error message if the written entry could not be completed
+const char *zipstream_close(ZipStream *s);
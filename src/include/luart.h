@@ -46,13 +46,18 @@ typedef int luart_type;
 
 //--------------------------------------------------| Object registration
 
-//--- Register object function
+//--- Register object function, instances are full userdata pointing to the C object created by the constructor
 int lua_registerobject(lua_State *L, luart_type *type, const char *typename, lua_CFunction constructor, const luaL_Reg *methods, const luaL_Reg *mt);
 
 //--- Object registration macros
 #define lua_regobjectmt(L, typename) lua_registerobject(L, &T##typename, #typename, typename##_constructor, typename##_methods, typename##_metafields)
 #define lua_regobject(L, typename) lua_registerobject(L, &T##typename, #typename, typename##_constructor, typename##_methods, NULL)
 
+//--- Register object function for C objects allocated with lua_allocinstance() : instances hold the C object themselves
+int lua_registercobject(lua_State *L, luart_type *type, const char *typename, lua_CFunction constructor, const luaL_Reg *methods, const luaL_Reg *mt, size_t size);
+#define lua_regcobjectmt(L, typename) lua_registercobject(L, &T##typename, #typename, typename##_constructor, typename##_methods, typename##_metafields, sizeof(typename))
+#define lua_regcobject(L, typename) lua_registercobject(L, &T##typename, #typename, typename##_constructor, typename##_methods, NULL, sizeof(typename))
+
 //--------------------------------------------------| Lua object manipulation
 
 //--- Push a new instance from a Lua object at index idx on stack
@@ -70,12 +75,21 @@ int lua_isinstance(lua_State *L, int idx, const char **objectname);
 void lua_createcinstance(lua_State *L, void *t, luart_type type);
 #define lua_newinstance(L, t, _type) lua_createcinstance(L, t, T##_type)
 
+//--- Allocates a zeroed C object in the instance being constructed (no need to free it in __gc)
+//--- Only for objects registered with lua_registercobject()
+//--- The object is tagged with its type at once, so __gc is called even if the constructor fails afterwards
+void *lua_alloccinstance(lua_State *L, size_t size, luart_type type);
+#define lua_allocinstance(L, _type) ((_type*)lua_alloccinstance(L, sizeof(_type), T##_type))
+
 //--- Returns any instance at index position or error with type t expected
 void *lua_toself(lua_State *L, int idx, luart_type t);
 
 //--- Returns object at specified index, and gets its type
 void *lua_tocinstance(lua_State *L, int idx, luart_type *t);
 
+//--- lua_rawset() alternative for instances, setting a field without calling properties
+void lua_rawsetinstance(lua_State *L, int idx);
+
 //--- Returns instance of specified type at index or NULL
 void *lua_iscinstance(lua_State *L, int idx, luart_type t);
 
@@ -133,11 +147,22 @@ LUALIB_API int luaL_embedopen(lua_State *L, const wchar_t *exename);
 //--- Closes embedded content previously opened with luaL_embedopen()
 LUALIB_API int luaL_embedclose(lua_State *L);
 
+//--- Returns the offset of the Zip archive appended to the specified file contents (PE executable, or any file)
+//--- Returns size if no appended archive has been found
+LUALIB_API size_t luaL_embedoffset(const BYTE *data, size_t size);
+
+//--- Compiles the Lua source string at index 1 (chunkname at index 2, strip flag at index 3, defaults to true)
+//--- Pushes a bytecode cache entry, to be embedded as "module.luac" and preferred by the embedded modules loader
+LUALIB_API int luaL_embedcompile(lua_State *L);
+
 //--- luaL_setfuncs() alternative with lua_rawset() and without upvalues
 LUALIB_API void luaL_setrawfuncs(lua_State *L, const luaL_Reg *l);
 
-//--- luaL_require() alternative with luaL_requiref()
+//--- luaL_require() alternative with luaL_requiref(), opens modules registered in package.preload
 LUALIB_API void luaL_require(lua_State *L, const char *modname);
+
+//--- Registers modules in package.preload : they are only opened on first require()
+LUALIB_API void luaL_preloadlibs(lua_State *L, const luaL_Reg *libs);
 #include <commctrl.h>
 
 //--------------------------------------------------| Widget object definition
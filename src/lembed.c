@@ -11,10 +11,14 @@
 
 #define MINIZ_HEADER_FILE_ONLY
 #include <compression\lib\zip.h>
+#include <compression\lib\payload.h>
+#include "sys\lib\map.h"
 
 extern int Zip_extract(lua_State *L); 
 struct zip_t *fs = NULL;
 BYTE *datafs  = NULL;
+static BOOL mapped = FALSE;
+static size_t mapsize;
 
 struct zip_t *open_fs(void *ptr, size_t size) {
 	struct zip_t *zip = (struct zip_t *)calloc((size_t)1, sizeof(struct zip_t));
@@ -22,10 +26,127 @@ struct zip_t *open_fs(void *ptr, size_t size) {
 	if (mz_zip_reader_init_mem(&zip->archive, ptr, size,  MZ_DEFAULT_LEVEL | MZ_ZIP_FLAG_DO_NOT_SORT_CENTRAL_DIRECTORY) == FALSE) {
 		free(zip);
 		zip = NULL;
-	}
+	} else zip_index(zip);
 	return zip;
 }
 
+//-------------------------------------------------[Embedded modules bytecode cache]
+//--- "module.luac" entries hold a header followed by the dumped chunk :
+//--- magic, Lua version, lua_Integer and lua_Number sizes, CRC32 of the bytecode, CRC32 of the source
+#define BYTECODE_MAGIC		"LRTC"
+#define BYTECODE_HEADER		16
+#define BOM					"\xEF\xBB\xBF"
+
+static mz_uint32 read_le32(const BYTE *p) {
+	return p[0] | (p[1] << 8) | (p[2] << 16) | ((mz_uint32)p[3] << 24);
+}
+
+static void write_le32(BYTE *p, mz_uint32 v) {
+	p[0] = (BYTE)v;
+	p[1] = (BYTE)(v >> 8);
+	p[2] = (BYTE)(v >> 16);
+	p[3] = (BYTE)(v >> 24);
+}
+
+static mz_uint32 checksum(const void *p, size_t len) {
+	return len ? (mz_uint32)mz_crc32(MZ_CRC32_INIT, p, len) : 0;
+}
+
+typedef struct {
+	BYTE	*bytes;
+	size_t	size;
+	size_t	capacity;
+} DumpBuffer;
+
+static int dump_writer(lua_State *L, const void *p, size_t size, void *ud) {
+	DumpBuffer *d = (DumpBuffer *)ud;
+
+	if (d->size + size > d->capacity) {
+		size_t capacity = d->capacity*2 > d->size + size ? d->capacity*2 : d->size + size;
+		BYTE *bytes = realloc(d->bytes, capacity);
+		if (!bytes)
+			return 1;
+		d->bytes = bytes;
+		d->capacity = capacity;
+	}
+	memcpy(d->bytes + d->size, p, size);
+	d->size += size;
+	return 0;
+}
+
+//-------------------------------------------------[luaL_embedcompile() luaRT C API]
+LUALIB_API int luaL_embedcompile(lua_State *L) {
+	size_t len;
+	const char *src = luaL_checklstring(L, 1, &len);
+	const char *chunkname = luaL_optstring(L, 2, "=?");
+	int strip = lua_isnoneornil(L, 3) || lua_toboolean(L, 3);
+	int idx = (len >= 3) && !memcmp(src, BOM, 3) ? 3 : 0;
+	BYTE header[BYTECODE_HEADER];
+	DumpBuffer d = { NULL, 0, 0 };
+	luaL_Buffer b;
+
+	if (luaL_loadbufferx(L, src+idx, len-idx, chunkname, "t"))
+		lua_error(L);
+	if (lua_dump(L, dump_writer, &d, strip)) {
+		free(d.bytes);
+		luaL_error(L, "unable to dump compiled chunk");
+	}
+	memcpy(header, BYTECODE_MAGIC, 4);
+	header[4] = LUA_VERSION_NUM & 0xFF;
+	header[5] = LUA_VERSION_NUM >> 8;
+	header[6] = sizeof(lua_Integer);
+	header[7] = sizeof(lua_Number);
+	write_le32(header+8, checksum(d.bytes, d.size));
+	//--- the source checksum is the one stored by the Zip archive for the embedded source
+	write_le32(header+12, checksum(src, len));
+	luaL_buffinit(L, &b);
+	luaL_addlstring(&b, (const char *)header, BYTECODE_HEADER);
+	luaL_addlstring(&b, (const char *)d.bytes, d.size);
+	free(d.bytes);
+	luaL_pushresult(&b);
+	return 1;
+}
+
+//--- Bytecode is outdated when the module source is embedded too, and has changed since its compilation
+static BOOL source_matches(const char *modname, mz_uint32 crc, char *fname, size_t len) {
+	static const char *extensions[] = { "lua", "wlua" };
+	mz_zip_archive_file_stat stat;
+	int i, idx;
+
+	for (i = 0; i < 2; i++) {
+		_snprintf(fname, len, "%s.%s", modname, extensions[i]);
+		if ((idx = zip_locate(fs, fname, NULL)) >= 0)
+			return mz_zip_reader_file_stat(&fs->archive, idx, &stat) && (stat.m_crc32 == crc);
+	}
+	return TRUE;
+}
+
+static void *fsload_bytecode(lua_State *L, const char *modname, char *fname, size_t len) {
+	void *buff = NULL;
+	size_t size = 0;
+	BYTE *h;
+
+	_snprintf(fname, len, "%s.luac", modname);
+	if (zip_entry_open(fs, fname) != 0)
+		return NULL;
+	if (zip_entry_read(fs, &buff, &size) < 0)
+		size = 0;
+	zip_entry_close(fs);
+	h = buff;
+	if ((size > BYTECODE_HEADER) && !memcmp(h, BYTECODE_MAGIC, 4) && ((h[4] | (h[5] << 8)) == LUA_VERSION_NUM)
+		&& (h[6] == sizeof(lua_Integer)) && (h[7] == sizeof(lua_Number))
+		&& (read_le32(h+8) == checksum(h+BYTECODE_HEADER, size-BYTECODE_HEADER))
+		&& source_matches(modname, read_le32(h+12), fname, len)) {
+		_snprintf(fname, len, "%s.luac", modname);
+		if (luaL_loadbufferx(L, (const char *)h+BYTECODE_HEADER, size-BYTECODE_HEADER, fname, "b") == LUA_OK)
+			return buff;
+		//--- bytecode rejected by Lua (incompatible format) : fallback to the module source
+		lua_pop(L, 1);
+	}
+	free(buff);
+	return NULL;
+}
+
 //-------------------------------------------------[luaRT embeded package loader]
 static void *fsload(lua_State *L, const char *fname) {
 	 void *buff = NULL; 
@@ -34,7 +155,7 @@ static void *fsload(lua_State *L, const char *fname) {
 
 	 if (zip_entry_open(fs, fname) == 0) {
         zip_entry_read(fs, &buff, &size);
-		if (memcmp(buff, "\xEF\xBB\xBF", 3)==0)
+		if (memcmp(buff, BOM, 3)==0)
 			idx = 3;
 		if (luaL_loadbuffer(L, buff+idx, size-idx, fname))
 			lua_error(L);
@@ -51,10 +172,13 @@ static int luart_fsloader(lua_State *L) {
 	char *fname;
 
 	fname = calloc(1, len);
-	_snprintf(fname, len, "%s.lua", modname);
-	if ( !(buff = fsload(L, fname)) ) {
-		_snprintf(fname, len, "%s.wlua", modname);
-		buff = fsload(L, fname);
+	//--- precompiled module first, then its source
+	if ( !(buff = fsload_bytecode(L, modname, fname, len)) ) {
+		_snprintf(fname, len, "%s.lua", modname);
+		if ( !(buff = fsload(L, fname)) ) {
+			_snprintf(fname, len, "%s.wlua", modname);
+			buff = fsload(L, fname);
+		}
 	}
 	if (!buff)
 		lua_pushfstring(L, "no embedded module '%s' found", modname);
@@ -65,66 +189,87 @@ static int luart_fsloader(lua_State *L) {
 
 //-------------------------------------------------[luaL_embedclose() luaRT C API]
 LUALIB_API int luaL_embedclose(lua_State *L) {
-	free(datafs);
+	if (mapped)
+		map_release(datafs, mapsize);
+	else
+		free(datafs);
+	datafs = NULL;
+	mapped = FALSE;
 	return 0;
 }
 
+//-------------------------------------------------[luaL_embedoffset() luaRT C API]
+LUALIB_API size_t luaL_embedoffset(const BYTE *data, size_t size) {
+	size_t tail = size < PAYLOAD_TAIL ? size : PAYLOAD_TAIL;
+	return payload_offset(data, size, data+size-tail, tail, size);
+}
+
 //-------------------------------------------------[luaL_embedopen() luaRT C API]
+//--- Reads len bytes at the specified file position
+static BOOL read_at(HANDLE hFile, size_t offset, BYTE *buffer, size_t len) {
+	LARGE_INTEGER pos;
+	DWORD read;
+
+	pos.QuadPart = offset;
+	return SetFilePointerEx(hFile, pos, NULL, FILE_BEGIN) && ReadFile(hFile, buffer, (DWORD)len, &read, NULL) && read == len;
+}
+
+//--- Fallback when the executable cannot be mapped : the payload is read into memory
+static BYTE *read_payload(HANDLE hFile, size_t *offset, size_t *size) {
+	BYTE head[PAYLOAD_HEAD], *tail, *payload = NULL;
+	LARGE_INTEGER filesize;
+	size_t headlen, taillen;
+
+	if (!GetFileSizeEx(hFile, &filesize) || (ULONGLONG)filesize.QuadPart > (DWORD)-1)
+		return NULL;
+	*size = (size_t)filesize.QuadPart;
+	headlen = *size < PAYLOAD_HEAD ? *size : PAYLOAD_HEAD;
+	taillen = *size < PAYLOAD_TAIL ? *size : PAYLOAD_TAIL;
+	if (!read_at(hFile, 0, head, headlen))
+		return NULL;
+	//--- the headers of PE executables fit in the first page, other files need their end for the Zip directory record
+	if (headlen >= 2 && head[0] == 'M' && head[1] == 'Z')
+		*offset = payload_offset(head, headlen, NULL, 0, *size);
+	else if ((tail = malloc(taillen))) {
+		*offset = read_at(hFile, *size-taillen, tail, taillen) ? payload_offset(head, headlen, tail, taillen, *size) : *size;
+		free(tail);
+	} else return NULL;
+	if ((*size -= *offset) && (payload = malloc(*size)) && !read_at(hFile, *offset, payload, *size)) {
+		free(payload);
+		payload = NULL;
+	}
+	return payload;
+}
+
 LUALIB_API int luaL_embedopen(lua_State *L, const wchar_t *exename) {
-  DWORD read;
-  HANDLE hFile;
-  BYTE buff[4096];
-  IMAGE_DOS_HEADER* dosheader;
-#ifdef _WIN64
-#define HEADERS	IMAGE_NT_HEADERS64
-#else
-#define HEADERS	IMAGE_NT_HEADERS32
-#endif
-  HEADERS* header;
-  DWORD maxpointer = 0, exesize = 0;
-  int i;  
-  DWORD filesize;
-  size_t fssize;
-  IMAGE_SECTION_HEADER* sectiontable;
-
-  luaL_embedclose(L);
-  hFile = CreateFileW(exename, GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
-  if(INVALID_HANDLE_VALUE == hFile)
-      return FALSE;
-  ReadFile(hFile, buff, sizeof(buff), &read, NULL);
-  dosheader = (IMAGE_DOS_HEADER*)buff;
-
-  // Locate PE header
-  header = (HEADERS*)((DWORD_PTR)buff + dosheader->e_lfanew);
-  if(dosheader->e_magic != IMAGE_DOS_SIGNATURE || header->Signature != IMAGE_NT_SIGNATURE) {
-    CloseHandle(hFile);
-    return FALSE;
-  }
-  sectiontable = (IMAGE_SECTION_HEADER*)((BYTE*)header + sizeof(HEADERS));
-  for(i = 0; i < header->FileHeader.NumberOfSections; i++) {
-    if(sectiontable->PointerToRawData > maxpointer) {
-      maxpointer = sectiontable->PointerToRawData;
-      exesize = sectiontable->PointerToRawData +
-        sectiontable->SizeOfRawData;
-    }
-    sectiontable++;
-  }
-  filesize = GetFileSize(hFile, NULL);
-  SetFilePointer(hFile, exesize, NULL, FILE_BEGIN);
-  if ((fssize = filesize - exesize)) {
-	  datafs = malloc(fssize);
-	  ReadFile(hFile, datafs, fssize, &read, NULL);
-	  CloseHandle(hFile);
-	  if ((fs = open_fs(datafs, fssize))) {
-	  	lua_getglobal(L, "package");
+	HANDLE hFile;
+	size_t size = 0, offset = 0;
+	BYTE *payload;
+
+	luaL_embedclose(L);
+	hFile = CreateFileW(exename, GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+	if (INVALID_HANDLE_VALUE == hFile)
+		return FALSE;
+	//--- the executable is mapped read-only : embedded entries are only paged in when accessed
+	if (!map_handle((intptr_t)hFile, 0, (void **)&datafs, &size) && datafs) {
+		mapped = TRUE;
+		mapsize = size;
+		offset = luaL_embedoffset(datafs, size);
+		payload = datafs + offset;
+		size -= offset;
+	} else if ((datafs = payload = read_payload(hFile, &offset, &size)))
+		mapped = FALSE;
+	CloseHandle(hFile);
+	if (datafs && size && (fs = open_fs(payload, size))) {
+		lua_getglobal(L, "package");
 		lua_getfield(L, -1, "searchers");
 		lua_pushcfunction(L, luart_fsloader);
 		lua_rawseti(L, -2, luaL_len(L, -2)+1);
 		lua_pop(L, 2);
 		return TRUE;
-	  }
-  }
-  return FALSE;
+	}
+	luaL_embedclose(L);
+	return FALSE;
 }
 
 LUA_METHOD(embed, File) {
@@ -152,14 +297,12 @@ static const luaL_Reg embed_properties[] = {
 //-------------------------------------------------[luaopen_embed() "embed" module]
 int luaopen_embed(lua_State *L) {
 	lua_registermodule(L, "embed", embedlib, embed_properties, luaL_embedclose);
-    lua_getglobal(L, "package");
-    lua_getfield(L, -1, "loaded");
-    lua_getfield(L, -1, "compression");
+    luaL_require(L, "compression");
     lua_pushstring(L, "zip");
     lua_getfield(L, -2, "Zip");
     lua_pushlightuserdata(L, fs);
     lua_pcall(L, 1, 1, 0);
-    lua_rawset(L, -6);
-    lua_pop(L, 3);
+    lua_rawset(L, -4);
+    lua_pop(L, 1);
 	return 1;
 }
@@ -71,12 +71,18 @@ LUALIB_API void luaL_setrawfuncs(lua_State *L, const luaL_Reg *l) {
 }
 
 //-------------------------------------------------[LuaL_require alternative with luaL_requiref]
-static int module_error(lua_State *L) {
+//--- Modules not loaded yet are opened from package.preload
+static int module_preload(lua_State *L) {
+	if (luaL_getsubtable(L, LUA_REGISTRYINDEX, LUA_PRELOAD_TABLE) && (lua_getfield(L, -1, lua_tostring(L, 1)) == LUA_TFUNCTION)) {
+		lua_pushvalue(L, 1);
+		lua_call(L, 1, 1);
+		return 1;
+	}
 	return luaL_error(L, "required module '%s' not found", lua_tostring(L, 1));
 }
 
 LUALIB_API void luaL_require(lua_State *L, const char *modname) {
-	luaL_requiref(L, modname, module_error, 0);
+	luaL_requiref(L, modname, module_preload, 0);
 }
 
 //-------------------------------------------------[LuaRT Extended base library]
@@ -175,9 +181,11 @@ static int luaB_type (lua_State *L) {
 static int luaB_super(lua_State *L) {
 	BOOL is_super = TRUE;
 
-	if ( !(lua_istable(L, 1) && luaL_getmetafield(L, 1, "__name")) )
+	if ( !((lua_istable(L, 1) || lua_isuserdata(L, 1)) && luaL_getmetafield(L, 1, "__name")) )
 		luaL_typeerror(L, 1, "Object or instance");
-	if (!luaL_getmetafield(L, 1, "__super")) {
+	weak_subtable(L, LUART_SUPER);
+	lua_pushvalue(L, 1);
+	if (lua_rawget(L, -2) == LUA_TNIL) {
 		luaL_getmetafield(L, 1, "__type");
 		if ((is_super = luaL_getmetafield(L, 1, "__call")))
 			lua_pop(L, 1);
@@ -191,8 +199,6 @@ static int luaB_super(lua_State *L) {
 #ifndef RTCOMPAT
 static int luaB_rawget (lua_State *L) {
   luaL_checktype(L, 1, LUA_TTABLE);
-  if (lua_tocinstance(L, 1, NULL))
-	luaL_typeerror(L, 1, "object");
   luaL_checkany(L, 2);
   lua_settop(L, 2);
   lua_rawget(L, 1);
@@ -201,8 +207,6 @@ static int luaB_rawget (lua_State *L) {
 
 static int luaB_rawset (lua_State *L) {
   luaL_checktype(L, 1, LUA_TTABLE);
-  if (lua_tocinstance(L, 1, NULL))
-	luaL_typeerror(L, 1, "table");
   luaL_checkany(L, 2);
   luaL_checkany(L, 3);
   lua_settop(L, 3);
@@ -239,6 +243,12 @@ static void register_module(lua_State *L, const char *modname, lua_CFunction ope
 	lua_pop(L, 1);
 }
 
+//-------------------------------------------------[luaL_preloadlibs() luaRT C API]
+LUALIB_API void luaL_preloadlibs(lua_State *L, const luaL_Reg *libs) {
+	for (; libs->func; libs++)
+		register_module(L, libs->name, libs->func);
+}
+
 //-------------------------------------------------[luaL_openlibs() luaRT C API]
 
 static const luaL_Reg def_libs[] = {
@@ -15,6 +15,15 @@
 //--- Utility macro to calculate UTF8 char size in bytes
 #define utf8_charsize(c) (((0xE5000000 >> ((((unsigned char)*c) >> 3) & 0x1E)) & 3) + 1)
 
+//--- UTF8 scanning functions, vectorized when the CPU supports it
+size_t utf8_asciispan(const char *s, size_t l);
+size_t utf8_count(const char *s, size_t l);
+size_t utf8_skip(const char *s, size_t l, size_t *n);
+size_t utf8_check(const char *s, size_t l);
+
+//--- Binary safe substring search
+const char *str_memfind(const char *h, size_t hlen, const char *n, size_t nlen);
+
 //--- Utility functions for UTF8 <=> Wide string conversions
 wchar_t *utf8_towchar(const char *str, int *len);
 char *wchar_toutf8(const wchar_t *str, int *len);
@@ -35,4 +44,9 @@ LUAMOD_API int luaopen_com(lua_State *L);
 //--- Pushes Windows system error string on stack
 int lasterror(lua_State *L, DWORD err);
 
-int obj_each_iter(lua_State *L);
\ No newline at end of file
+int obj_each_iter(lua_State *L);
+
+//--- Registry tables, with weak keys, for instances current super type, iteration state and C object
+#define LUART_SUPER		"LuaRT super"
+#define LUART_ITERATORS	"LuaRT iterators"
+void weak_subtable(lua_State *L, const char *name);
\ No newline at end of file
@@ -13,41 +13,123 @@
 
 typedef enum { Function, Method, PropertyGet, PropertySet } CallMethod;
 
+//--- Dispatch cache lookup results
+typedef enum { CacheNone = -1, CacheMiss, CacheField, CacheProperty } CacheKind;
+
+//--- Dispatch cache values for a field that does not exist, and for an existing field (__newindex caches only)
+static char cache_miss, cache_field;
+
+//--- Bumped each time a type or a mixin table gets a new field, invalidating all dispatch caches
+static lua_Integer dispatch_epoch = 1;
+
+//--- Instances of C objects are full userdata : a header, followed by the C object for types registered with lua_registercobject()
+//--- Their fields are kept in a table, their only user value, created when the first field is set
+typedef struct {
+	const char	*tag;		//--- cinstance_tag
+	void		*obj;		//--- the C object once the constructor created it, NULL before (may follow the header)
+} CInstance;
+
+static const char cinstance_tag[] = "LuaRT instance";
+
+int usertype_constructor(lua_State *L);
+
+//--- Returns the header of the userdata instance at index idx, or NULL if it is not one
+static CInstance *to_cinstance(lua_State *L, int idx) {
+	CInstance *c;
+
+	if (lua_type(L, idx) == LUA_TUSERDATA && lua_rawlen(L, idx) >= sizeof(CInstance) && (c = lua_touserdata(L, idx))->tag == cinstance_tag)
+		return c;
+	return NULL;
+}
+
+//--- lua_rawget() for instances, looking in the fields table of userdata instances
+static int instance_rawget(lua_State *L, int idx) {
+	if (lua_type(L, idx) != LUA_TUSERDATA)
+		return lua_rawget(L, idx);
+	if (lua_getiuservalue(L, idx, 1) != LUA_TTABLE) {
+		lua_pop(L, 2);
+		lua_pushnil(L);
+		return LUA_TNIL;
+	}
+	lua_insert(L, -2);
+	lua_rawget(L, -2);
+	lua_remove(L, -2);
+	return lua_type(L, -1);
+}
+
+//--- lua_rawset() for instances, creating the fields table of userdata instances if needed
+static void instance_rawset(lua_State *L, int idx) {
+	idx = lua_absindex(L, idx);
+	if (lua_type(L, idx) != LUA_TUSERDATA) {
+		lua_rawset(L, idx);
+		return;
+	}
+	if (lua_getiuservalue(L, idx, 1) != LUA_TTABLE) {
+		lua_pop(L, 1);
+		lua_createtable(L, 0, 2);
+		lua_pushvalue(L, -1);
+		lua_setiuservalue(L, idx, 1);
+	}
+	lua_insert(L, -3);
+	lua_rawset(L, -3);
+	lua_pop(L, 1);
+}
+
 static int type_isproperty(lua_State *L, CallMethod prop) {
 	lua_pushfstring(L, "%s_%s", prop == PropertyGet ? "get" : "set", lua_tostring(L, 2));
 	return lua_rawget(L, -2);
 }
 
-static void call_field(lua_State *L, int nargs, int nresults, const char *type, const char *field, CallMethod cm) {
+//--- Raises the error on top of the stack, prefixed with the location and the failing type field
+static void field_error(lua_State *L, const char *type, const char *field, CallMethod cm) {
 	static const char *msg[] = { "in function %s", "in method", "error while getting property", "error while setting property"};
-	if (lua_pcall(L, nargs, nresults, 0)) {
-		char buff[256];
-		const char *err = lua_tostring(L, -1);
-		const char *_type = type;
-
-		luaL_where(L, 1); 
-		if (cm > Function) {
-			const char *errmsg;
-			if (!type) {
-				luaL_getmetafield(L, 1, "__name");
-				_type = lua_tostring(L, -1);
-				lua_pop(L, 1);
-			}
-			if (!(errmsg = strstr(err, "'?'")))
-				sprintf_s(buff, 256, "%s '%s.%s' : ", msg[cm], _type, field);
-			else {
-				sprintf_s(buff, 256, "%s '%s.%s'", msg[cm], _type, field);
-				err = errmsg+3;
-			}
-			if (!strstr(err, buff)) {
-				lua_pushstring(L, buff);
-				lua_concat(L, 2);
-			}
-			lua_pushstring(L, err);
+	char buff[256];
+	const char *err = lua_tostring(L, -1);
+	const char *_type = type;
+
+	luaL_where(L, 1); 
+	if (cm > Function) {
+		const char *errmsg;
+		if (!type) {
+			luaL_getmetafield(L, 1, "__name");
+			_type = lua_tostring(L, -1);
+			lua_pop(L, 1);
+		}
+		if (!(errmsg = strstr(err, "'?'")))
+			sprintf_s(buff, 256, "%s '%s.%s' : ", msg[cm], _type, field);
+		else {
+			sprintf_s(buff, 256, "%s '%s.%s'", msg[cm], _type, field);
+			err = errmsg+3;
+		}
+		if (!strstr(err, buff)) {
+			lua_pushstring(L, buff);
 			lua_concat(L, 2);
-			lua_error(L);
-		} else luaL_error(L, msg[cm], field);
-	}
+		}
+		lua_pushstring(L, err);
+		lua_concat(L, 2);
+		lua_error(L);
+	} else luaL_error(L, msg[cm], field);
+}
+
+static void call_field(lua_State *L, int nargs, int nresults, const char *type, const char *field, CallMethod cm) {
+	if (lua_pcall(L, nargs, nresults, 0))
+		field_error(L, type, field, cm);
+}
+
+//--- Lua property getters and setters may yield : __index and __newindex complete in these continuations
+//--- The field name is still at index 2, below the call results
+static int property_getk(lua_State *L, int status, lua_KContext base) {
+	if (status != LUA_OK && status != LUA_YIELD)
+		field_error(L, NULL, lua_isstring(L, 2) ? lua_tostring(L, 2) : NULL, PropertyGet);
+	if (lua_gettop(L) == (int)base)
+		luaL_error(L, "property %s must return a value", lua_tostring(L, 2));
+	return 1;
+}
+
+static int property_setk(lua_State *L, int status, lua_KContext ctx) {
+	if (status != LUA_OK && status != LUA_YIELD)
+		field_error(L, NULL, lua_isstring(L, 2) ? lua_tostring(L, 2) : NULL, PropertySet);
+	return 0;
 }
 
 static int get_mixins_field(lua_State *L, const char *field, CallMethod prop) {
@@ -68,28 +150,277 @@ static int get_mixins_field(lua_State *L, const char *field, CallMethod prop) {
 	return LUA_TNIL;
 }
 
+static int super_proxy(lua_State *L);
+int type___index(lua_State *L);
+int type___newindex(lua_State *L);
+
+//--------------------------------------------------| Per type dispatch cache
+//--- The __index and __newindex metamethods of types and instances are closures with the following upvalues :
+//--- the cache table (field -> cache entry), the dispatch epoch it was built at, the type the lookup starts from, and
+//--- whether instances of the type define their own get_/set_ properties (checked before the cache when set)
+//--- A cache entry remembers the table the field was found in, the raw key and value found there, and the resolved value
+//--- (Lua methods already wrapped by super_proxy). Entries are checked against the table they come from before being used,
+//--- so that fields replaced or removed in place are seen at once, new fields bumping the epoch through __newindex
+
+//--- Cache entries, as closures holding the owner table, raw key, raw value and resolved value as upvalues
+static int cached_field(lua_State *L) {
+	return 0;
+}
+
+static int cached_property(lua_State *L) {
+	return 0;
+}
+
+//--- Pushes a type___index or type___newindex closure, with an empty dispatch cache, starting lookups at the type at index idx
+static void push_dispatcher(lua_State *L, lua_CFunction f, int idx) {
+	idx = lua_absindex(L, idx);
+	lua_createtable(L, 0, 8);
+	lua_pushinteger(L, dispatch_epoch);
+	lua_pushvalue(L, idx);
+	lua_pushboolean(L, FALSE);
+	lua_pushcclosure(L, f, 4);
+}
+
+//--- Makes the dispatchers of the instance at index 1 check the get_/set_ properties defined in the instances of its type
+static void watch_instance_properties(lua_State *L) {
+	static const char *names[] = { "__index", "__newindex" };
+	static const lua_CFunction funcs[] = { type___index, type___newindex };
+
+	for (int i = 0; i < 2; i++) {
+		if (luaL_getmetafield(L, 1, names[i]) && lua_tocfunction(L, -1) == funcs[i]) {
+			lua_pushboolean(L, TRUE);
+			lua_setupvalue(L, -2, 4);
+		}
+		lua_settop(L, 3);
+	}
+}
+
+//--- Walks the type chain for the field at index 2, and pushes the cache entry for it
+static void dispatch_resolve(lua_State *L, CallMethod prop) {
+	int top = lua_gettop(L), current = top+2, owner, key, i, len;
+	lua_CFunction kind;
+
+	lua_pushfstring(L, "%s_%s", prop == PropertyGet ? "get" : "set", lua_tostring(L, 2));
+	lua_pushvalue(L, lua_upvalueindex(3));
+	for (;;) {
+		owner = current;
+		kind = cached_property;
+		lua_pushvalue(L, key = top+1);
+		if (lua_rawget(L, current))
+			goto found;
+		lua_pop(L, 1);
+		lua_pushvalue(L, key = 2);
+		kind = cached_field;
+		if (lua_rawget(L, current))
+			goto found;
+		lua_pop(L, 1);
+		if (luaL_getmetafield(L, current, "__mixins")) {
+			for (i = 1, len = luaL_len(L, -1); i <= len; i++) {
+				owner = lua_gettop(L)+1;
+				lua_rawgeti(L, -1, i);
+				lua_pushvalue(L, key = 2);
+				kind = cached_field;
+				if (lua_gettable(L, -2))
+					goto found;
+				lua_pop(L, 1);
+				lua_pushvalue(L, key = top+1);
+				kind = cached_property;
+				if (lua_rawget(L, -2))
+					goto found;
+				lua_pop(L, 2);
+			}
+			lua_pop(L, 1);
+		}
+		if (!luaL_getmetafield(L, current, "__type")) {
+			lua_pushlightuserdata(L, &cache_miss);
+			goto done;
+		}
+		lua_replace(L, current);
+	}
+found:
+	lua_pushvalue(L, owner);
+	lua_pushvalue(L, key);
+	lua_pushvalue(L, key);
+	lua_rawget(L, owner);
+	if (kind == cached_property)
+		lua_pushvalue(L, -4);
+	else if (prop == PropertySet)
+		lua_pushlightuserdata(L, &cache_field);
+	else if ((owner == current) && (lua_type(L, -4) == LUA_TFUNCTION) && !lua_iscfunction(L, -4)) {
+		lua_pushvalue(L, current);
+		lua_pushvalue(L, -5);
+		lua_pushcclosure(L, super_proxy, 2);
+	} else
+		lua_pushvalue(L, -4);
+	lua_pushcclosure(L, kind, 4);
+done:
+	lua_replace(L, top+1);
+	lua_settop(L, top+1);
+}
+
+//--- Checks that the cache entry on top of the stack still matches the raw value of the table it was found in
+static int dispatch_valid(lua_State *L) {
+	int valid;
+
+	if (lua_type(L, -1) != LUA_TFUNCTION)
+		return TRUE;
+	lua_getupvalue(L, -1, 1);
+	lua_getupvalue(L, -2, 2);
+	lua_rawget(L, -2);
+	lua_getupvalue(L, -3, 3);
+	valid = lua_rawequal(L, -1, -2);
+	lua_pop(L, 3);
+	return valid;
+}
+
+//--- Looks up the field at index 2 for the object at index 1 using the dispatch cache of the running metamethod
+//--- Returns CacheNone when the metamethod has no cache, otherwise the kind of the field with its value pushed (except for CacheMiss)
+static CacheKind dispatch_lookup(lua_State *L, CallMethod prop) {
+	int cache = lua_upvalueindex(1);
+	lua_CFunction kind;
+
+	if (!lua_istable(L, cache))
+		return CacheNone;
+	if (lua_toboolean(L, lua_upvalueindex(4))) {
+		lua_pushfstring(L, "%s_%s", prop == PropertyGet ? "get" : "set", lua_tostring(L, 2));
+		if (instance_rawget(L, 1))
+			return CacheProperty;
+		lua_pop(L, 1);
+	}
+	if (lua_tointeger(L, lua_upvalueindex(2)) != dispatch_epoch) {
+		lua_createtable(L, 0, 8);
+		lua_replace(L, cache);
+		lua_pushinteger(L, dispatch_epoch);
+		lua_replace(L, lua_upvalueindex(2));
+	}
+	lua_pushvalue(L, 2);
+	if (lua_rawget(L, cache) == LUA_TNIL || !dispatch_valid(L)) {
+		lua_pop(L, 1);
+		dispatch_resolve(L, prop);
+		lua_pushvalue(L, 2);
+		lua_pushvalue(L, -2);
+		lua_rawset(L, cache);
+	}
+	if (lua_touserdata(L, -1) == &cache_miss) {
+		lua_pop(L, 1);
+		return CacheMiss;
+	}
+	kind = lua_tocfunction(L, -1);
+	lua_getupvalue(L, -1, 4);
+	lua_remove(L, -2);
+	if (lua_touserdata(L, -1) == &cache_field) {
+		lua_pop(L, 1);
+		return CacheField;
+	}
+	return kind == cached_property ? CacheProperty : CacheField;
+}
+
+//--- Checks if the table at index idx is an object type (and not an instance)
+static int is_type(lua_State *L, int idx) {
+	int result = FALSE;
+	if (lua_getmetatable(L, idx)) {
+		lua_getfield(L, -1, "__call");
+		result = lua_tocfunction(L, -1) == usertype_constructor;
+		lua_pop(L, 2);
+	}
+	return result;
+}
+
+//--- Mixin tables __newindex, forwarding to the previous __newindex metamethod (upvalue) if any
+static int mixin___newindex(lua_State *L) {
+	lua_settop(L, 3);
+	dispatch_epoch++;
+	switch (lua_type(L, lua_upvalueindex(1))) {
+		case LUA_TNIL:		lua_rawset(L, 1);
+							break;
+		case LUA_TTABLE:	lua_settable(L, lua_upvalueindex(1));
+							break;
+		default:			lua_pushvalue(L, lua_upvalueindex(1));
+							lua_insert(L, 1);
+							lua_call(L, 3, 0);
+	}
+	return 0;
+}
+
+//--- Makes any new field in a mixin table invalidate the dispatch caches
+//--- The mixin gets its own copy of its metatable, so that other tables sharing it are not affected
+static void watch_mixin(lua_State *L, int idx) {
+	idx = lua_absindex(L, idx);
+	if (luaL_getmetafield(L, idx, "__newindex") != LUA_TNIL) {
+		if (lua_tocfunction(L, -1) == mixin___newindex) {
+			lua_pop(L, 1);
+			return;
+		}
+	} else
+		lua_pushnil(L);
+	if (luaL_getmetafield(L, idx, "__metatable") != LUA_TNIL)
+		luaL_argerror(L, idx, "mixin table has a protected metatable");
+	lua_createtable(L, 0, 2);
+	if (lua_getmetatable(L, idx)) {
+		lua_pushnil(L);
+		while (lua_next(L, -2)) {
+			lua_pushvalue(L, -2);
+			lua_insert(L, -2);
+			lua_rawset(L, -5);
+		}
+		lua_pop(L, 1);
+	}
+	lua_insert(L, -2);
+	lua_pushcclosure(L, mixin___newindex, 1);
+	lua_setfield(L, -2, "__newindex");
+	lua_setmetatable(L, idx);
+}
+
+void weak_subtable(lua_State *L, const char *name) {
+	if (!luaL_getsubtable(L, LUA_REGISTRYINDEX, name)) {
+		lua_createtable(L, 0, 1);
+		lua_pushliteral(L, "k");
+		lua_setfield(L, -2, "__mode");
+		lua_setmetatable(L, -2);
+	}
+}
+
+static int super_proxyk(lua_State *L, int status, lua_KContext ctx) {
+	return lua_gettop(L);
+}
+
+//--- Calls a Lua method (upvalue 2) after recording its type (upvalue 1) for super(), the method may yield
 static int super_proxy(lua_State *L) {
 	int nargs = lua_gettop(L);
-	if (lua_getmetatable(L, 1)) {
-		lua_pushstring(L, "__super");
+	if (lua_istable(L, 1) || to_cinstance(L, 1)) {
+		weak_subtable(L, LUART_SUPER);
+		lua_pushvalue(L, 1);
 		lua_pushvalue(L, lua_upvalueindex(1));
 		lua_rawset(L, -3);
 		lua_pop(L, 1);
 	}
 	lua_pushvalue(L, lua_upvalueindex(2));
 	lua_insert(L, -lua_gettop(L));
-	lua_call(L, nargs, LUA_MULTRET);
+	lua_callk(L, nargs, LUA_MULTRET, 0, super_proxyk);
 	return lua_gettop(L);
 }
 
 LUA_METHOD(type, __index) {
-	int n = lua_gettop(L);
 	const char *field = lua_tostring(L, 2);
-	int type;
+	int type, base;
 
+	if (lua_type(L, 1) == LUA_TUSERDATA) {
+		lua_pushvalue(L, 2);
+		if (instance_rawget(L, 1) != LUA_TNIL)
+			return 1;
+		lua_pop(L, 1);
+	}
 	if (lua_type(L, 2) != LUA_TSTRING) 
 		goto __index;
-	lua_pushvalue(L, 1);
+	switch (dispatch_lookup(L, PropertyGet)) {
+		case CacheNone:		break;
+		case CacheMiss:		goto __index;
+		case CacheProperty:	type = lua_type(L, -1); goto __done;
+		default:			return 1;
+	}
+	if (!lua_istable(L, 1))
+		luaL_getmetafield(L, 1, "__type");
+	else lua_pushvalue(L, 1);
 	while (!(type = type_isproperty(L, PropertyGet)) ){
 		lua_pop(L, 1);
 		lua_pushvalue(L, 2);
@@ -107,10 +438,9 @@ __index:	return luaL_getmetafield(L, 1, "__metaindex") ? lua_tocfunction(L, -1)(
 	}
 __done:
 	if (type == LUA_TFUNCTION) {
+		base = lua_gettop(L)-1;
 		lua_pushvalue(L, 1);
-		call_field(L, 1, LUA_MULTRET, NULL, lua_isstring(L, 2) ? field : NULL, PropertyGet);
-		if ( (n = lua_gettop(L)-n ) == 0)
-			luaL_error(L, "property %s must return a value", field);
+		return property_getk(L, lua_pcallk(L, 1, LUA_MULTRET, 0, base, property_getk), base);
 	}
 	return 1;
 }
@@ -119,9 +449,28 @@ LUA_METHOD(type, __newindex) {
 	int type = 0;
 	const char *field = lua_tostring(L, 2);
 
+	//--- existing fields of userdata instances are replaced at once, as the fields of table instances
+	if (lua_type(L, 1) == LUA_TUSERDATA) {
+		lua_pushvalue(L, 2);
+		if (instance_rawget(L, 1) != LUA_TNIL) {
+			lua_pushvalue(L, 2);
+			lua_pushvalue(L, 3);
+			instance_rawset(L, 1);
+			return 0;
+		}
+		lua_pop(L, 1);
+	}
 	if (lua_type(L, 2) != LUA_TSTRING) 
 		goto __newindex;
-	lua_pushvalue(L, 1);
+	switch (dispatch_lookup(L, PropertySet)) {
+		case CacheNone:		break;
+		case CacheMiss:		goto __newindex;
+		case CacheProperty:	type = lua_type(L, -1); goto __done;
+		default:			goto setfield;
+	}
+	if (!lua_istable(L, 1))
+		luaL_getmetafield(L, 1, "__type");
+	else lua_pushvalue(L, 1);
 	while (!(type = type_isproperty(L, PropertySet))) {
 		lua_pop(L, 1);
 		lua_pushvalue(L, 2);
@@ -141,7 +490,14 @@ setfield:	lua_pushvalue(L, 2);
 			}
 			else
 				lua_pushvalue(L, 3);
-			lua_rawset(L, 1);
+			if (is_type(L, 1))
+				dispatch_epoch++;
+			else if ((lua_type(L, 2) == LUA_TSTRING) && (!strncmp(field, "get_", 4) || !strncmp(field, "set_", 4))) {
+				instance_rawset(L, 1);
+				watch_instance_properties(L);
+				return 0;
+			}
+			instance_rawset(L, 1);
 			return 0;
 		}
 	}
@@ -149,9 +505,9 @@ __done:
 	if (type == LUA_TFUNCTION) {
 		lua_pushvalue(L, 1);
 		lua_pushvalue(L, 3);
-		call_field(L, 2, 0, NULL, lua_isstring(L, 2) ? lua_tostring(L, 2) : NULL, PropertySet);
-	} else goto setfield;
-	return 0;
+		return property_setk(L, lua_pcallk(L, 2, 0, 0, 0, property_setk), 0);
+	}
+	goto setfield;
 }
 
 LUA_METHOD(type, __tostring) {
@@ -161,20 +517,21 @@ LUA_METHOD(type, __tostring) {
 }
 
 LUA_METHOD(type, __gc) {
+	CInstance *c = to_cinstance(L, 1);
+
 	if (lua_getfield(L, 1, "destructor") == LUA_TFUNCTION) {
 		lua_pushvalue(L, 1);
 		call_field(L, 1, 0, NULL, "destructor", Method);
 	}
-	if (luaL_getmetafield(L, 1, "__userdata")) {
+	if (c && c->obj) {
 		luaL_getmetafield(L, 1, "__type");
 		luaL_getmetafield(L, -1, "__type");
 		luaL_getmetafield(L, -1, "__mt");
 		if (lua_getfield(L, -1, "__gc") != LUA_TNIL && lua_tocfunction(L, -1) != type___gc)
 			lua_tocfunction(L, -1)(L);
-		else {
-			luaL_getmetafield(L, 1, "__userdata");
-			free(lua_touserdata(L, -1));
-		}
+		//--- only C objects that are not held by the instance itself are freed
+		else if (c->obj != c+1)
+			free(c->obj);
 	}
 	return 0;
 }
@@ -260,13 +617,137 @@ int type_tostring(lua_State *L) {
 	return 1;
 }
 
+//--- Iterates over a Lua object instance with its iterator() method
+static int type___call(lua_State *L) {
+	int results;
+
+	lua_settop(L, 1);
+	weak_subtable(L, LUART_ITERATORS);
+	if (!lua_getfield(L, 1, "iterator"))
+		luaL_error(L, "could not iterate over %s instance (iterator function not found)", luaL_typename(L, 1));
+	lua_pushvalue(L, 1);
+	lua_pushvalue(L, 1);
+	lua_rawget(L, 2);
+	lua_call(L, 2, LUA_MULTRET);
+	results = lua_gettop(L)-2;
+	lua_pushvalue(L, 1);
+	if (lua_isnoneornil(L, 3)) {
+		lua_pushnil(L);
+		lua_rawset(L, 2);
+		return 0;
+	}
+	lua_pushvalue(L, -2);
+	lua_rawset(L, 2);
+	lua_pop(L, 1);
+	return results-1;
+}
+
+//--- Gives the metatable on top of the stack its own type___index and type___newindex dispatchers for the type at index 1
+//--- (C objects metatables keep their own __index and __newindex metamethods, if any)
+static void set_dispatchers(lua_State *L, BOOL force) {
+	static const char *names[] = { "__index", "__newindex" };
+	static const lua_CFunction funcs[] = { type___index, type___newindex };
+
+	for (int i = 0; i < 2; i++) {
+		lua_getfield(L, -1, names[i]);
+		if (force || lua_tocfunction(L, -1) == funcs[i]) {
+			push_dispatcher(L, funcs[i], 1);
+			lua_setfield(L, -3, names[i]);
+		}
+		lua_pop(L, 1);
+	}
+}
+
+//--- C objects __gc guard, calling the C finalizer (upvalue) only for instances that got a C object
+//--- (the constructor may fail before allocating it)
+static int cinstance___gc(lua_State *L) {
+	if (!lua_tocinstance(L, 1, NULL))
+		return 0;
+	return lua_tocfunction(L, lua_upvalueindex(1))(L);
+}
+
+static int cinstance_next(lua_State *L) {
+	lua_settop(L, 2);
+	if (lua_getiuservalue(L, 1, 1) != LUA_TTABLE)
+		return 0;
+	lua_insert(L, 2);
+	return lua_next(L, 2) ? 2 : 0;
+}
+
+//--- pairs() iterates over the fields of userdata instances
+static int cinstance___pairs(lua_State *L) {
+	lua_pushcfunction(L, cinstance_next);
+	lua_pushvalue(L, 1);
+	lua_pushnil(L);
+	return 3;
+}
+
+//--- Pushes the metatable shared by all the instances of the type at index 1, created on first use
+static void instance_metatable(lua_State *L, const char *typename, BOOL cusertype) {
+	if (!luaL_getmetafield(L, 1, "__instances")) {
+		lua_getmetatable(L, 1);
+		lua_createtable(L, 0, 1);
+		lua_pushvalue(L, -1);
+		lua_setfield(L, -3, "__instances");
+		lua_remove(L, -2);
+	}
+	lua_pushstring(L, typename ? typename : "");
+	if (lua_rawget(L, -2) == LUA_TNIL) {
+		lua_pop(L, 1);
+		lua_createtable(L, 0, 8);
+		if (luaL_getmetafield(L, 1, "__mt")) {
+			lua_pushnil(L);
+			while(lua_next(L, -2) != 0) {
+				lua_pushvalue(L, -2);
+				lua_insert(L, -2);
+				lua_settable(L, -5);
+			}
+			lua_pop(L, 1);
+		}
+		lua_pushstring(L, typename);
+		lua_setfield(L, -2, "__name");
+		lua_pushvalue(L, 1);
+		lua_setfield(L, -2, "__type");
+		if (!cusertype) {
+			lua_pushcfunction(L, type___gc);
+			lua_setfield(L, -2, "__gc");
+			lua_pushcfunction(L, type___call);
+			lua_setfield(L, -2, "__call");
+		} else if (lua_getfield(L, -1, "__gc") == LUA_TFUNCTION && lua_tocfunction(L, -1) != type___gc) {
+			lua_pushcclosure(L, cinstance___gc, 1);
+			lua_setfield(L, -2, "__gc");
+		} else lua_pop(L, 1);
+		if (luaL_getmetafield(L, 1, "__size")) {
+			lua_pop(L, 1);
+			if (lua_getfield(L, -1, "__pairs") == LUA_TNIL) {
+				lua_pushcfunction(L, cinstance___pairs);
+				lua_setfield(L, -3, "__pairs");
+			}
+			lua_pop(L, 1);
+		}
+		set_dispatchers(L, !cusertype);
+		lua_pushstring(L, typename ? typename : "");
+		lua_pushvalue(L, -2);
+		lua_rawset(L, -4);
+	}
+	lua_remove(L, -2);
+}
+
 int usertype_constructor(lua_State *L) {
 	BOOL cusertype = TRUE;
 	int nargs = lua_gettop(L);
 	const char *typename;
+	size_t size;
+	CInstance *c;
 
-	lua_createtable(L, 0, 1);						//--- instance
-	lua_createtable(L, 0, 1);						//--- instance metatable
+	if (luaL_getmetafield(L, 1, "__size")) {		//--- userdata instance, with room for the C object
+		size = sizeof(CInstance) + (size_t)lua_tointeger(L, -1);
+		lua_pop(L, 1);
+		c = lua_newuserdatauv(L, size, 1);
+		memset(c, 0, size);
+		c->tag = cinstance_tag;
+	} else
+		lua_createtable(L, 0, 1);					//--- table instance
 	if (!luaL_getmetafield(L, 1, "__typename")) { 	//-- adjust __typename for Lua objects
 		lua_Debug ar;
 		lua_getstack(L, 0, &ar);
@@ -275,36 +756,9 @@ int usertype_constructor(lua_State *L) {
 		cusertype = FALSE;
 	}
 	typename = lua_tostring(L, -1);
+	instance_metatable(L, typename, cusertype);
+	lua_setmetatable(L, -3);
 	lua_pop(L, 1);
-	if (luaL_getmetafield(L, 1, "__mt")) {
-		lua_pushnil(L);
-        while(lua_next(L, -2) != 0) {
-			lua_pushvalue(L, -2);
-            lua_insert(L, -2);
-			lua_settable(L, -5);
-		}
-		lua_pop(L, 1);
-	}
-	if (!cusertype) {
-		lua_pushcfunction(L, type___gc);
-		lua_setfield(L, -2, "__gc");
-	}
-	lua_pushstring(L, typename);
-	lua_setfield(L, -2, "__name");
-	lua_pushvalue(L, 1);
-	lua_setfield(L, -2, "__type");
-
-	if (!cusertype) {
-		lua_pushcfunction(L, type___index); 
-		lua_setfield(L, -2, "__index");
-		lua_pushcfunction(L, type___newindex); 
-		lua_setfield(L, -2, "__newindex");
-		lua_pushvalue(L, -2);
-		lua_pushnil(L);
-		lua_pushcclosure(L, obj_each_iter, 2);
-		lua_setfield(L, -2, "__call");
-	}
-	lua_setmetatable(L, -2);
 	lua_pushvalue(L, -1);
 	lua_insert(L, -nargs-1);
 	if (lua_getfield(L, 1, "constructor") == LUA_TFUNCTION)  {
@@ -351,9 +805,13 @@ int lua_registerobject(lua_State *L, int *type, const char *typename, lua_CFunct
 			lua_pop(L, 1);
 		}
 		lua_setfield(L, -2, "__mt");
-	} else if (luaL_getmetafield(L, 1, "__mt")) //--- parent is a C Object
+		lua_pushinteger(L, 0);
+		lua_setfield(L, -2, "__size");
+	} else if (luaL_getmetafield(L, 1, "__mt")) { //--- parent is a C Object
 		lua_setfield(L, -2, "__mt");
-	else luaL_setrawfuncs(L, usertype_mt);
+		if (luaL_getmetafield(L, 1, "__size"))
+			lua_setfield(L, -2, "__size");
+	} else luaL_setrawfuncs(L, usertype_mt);
 	if (typename) {
 		lua_pushstring(L, typename);
 		lua_setfield(L, -2, "__typename");
@@ -370,14 +828,15 @@ int lua_registerobject(lua_State *L, int *type, const char *typename, lua_CFunct
 				luaL_typeerror(L, i, "mixin table");
 			lua_pushvalue(L, i);
 			lua_rawseti(L, -2, i-1);
+			watch_mixin(L, i);
 		}
 		lua_setfield(L, -2, "__mixins");
 	}
 	lua_pushcfunction(L, type_tostring);
 	lua_setfield(L, -2, "__tostring");
-	lua_pushcfunction(L, type___index);
+	push_dispatcher(L, type___index, -2);
 	lua_setfield(L, -2, "__index");
-	lua_pushcfunction(L, type___newindex);
+	push_dispatcher(L, type___newindex, -2);
 	lua_setfield(L, -2, "__newindex");
 	lua_pushstring(L, "Object");
 	lua_setfield(L, -2, "__name");
@@ -397,6 +856,17 @@ int lua_registerobject(lua_State *L, int *type, const char *typename, lua_CFunct
 	return t;
 }
 
+int lua_registercobject(lua_State *L, int *type, const char *typename, lua_CFunction constructor, const luaL_Reg *methods, const luaL_Reg *mt, size_t size) {
+	int t = lua_registerobject(L, type, typename, constructor, methods, mt);
+
+	lua_getfield(L, LUA_REGISTRYINDEX, typename);
+	lua_getmetatable(L, -1);
+	lua_pushinteger(L, (lua_Integer)size);
+	lua_setfield(L, -2, "__size");
+	lua_pop(L, 2);
+	return t;
+}
+
 int lua_createinstance(lua_State *L, int idx) {
 	if (!lua_istable(L, idx))
 		luaL_argerror(L, 1, "object expected");
@@ -405,8 +875,7 @@ int lua_createinstance(lua_State *L, int idx) {
 }
 
 int lua_isinstance(lua_State *L, int idx, const char **objectname) {
-	if (lua_istable(L, idx)) {
-		lua_getmetatable(L, idx);
+	if ((lua_istable(L, idx) || to_cinstance(L, idx)) && lua_getmetatable(L, idx)) {
 		if (lua_getfield(L, -1, "__type")) {
 			lua_pop(L, 1);
 			if (lua_getfield(L, -1, "__name")) {
@@ -426,23 +895,35 @@ void lua_checkinstance(lua_State *L, int idx, const char *objectname) {
 		luaL_typeerror(L, idx, objectname);
 }
 
+//--- Returns the header of the instance being constructed at index 1
+static CInstance *check_cinstance(lua_State *L) {
+	CInstance *c = to_cinstance(L, 1);
+
+	if (!c)
+		luaL_typeerror(L, 1, "C object instance");
+	return c;
+}
+
+void *lua_alloccinstance(lua_State *L, size_t size, luart_type type) {
+	CInstance *c = check_cinstance(L);
+
+	if (size > lua_rawlen(L, 1) - sizeof(CInstance))
+		luaL_error(L, "C object larger than its %s instance", lua_objectname(L, 1));
+	memset(c+1, 0, size);
+	c->obj = c+1;
+	*((luart_type *)c->obj) = type;
+	return c->obj;
+}
+
 void lua_createcinstance(lua_State *L, void *t, luart_type type) {
-	lua_getmetatable(L, 1);
-	lua_pushstring(L, "__userdata");
-	lua_pushlightuserdata(L, t);
-	lua_rawset(L, -3);
-	lua_pop(L, 1);
+	check_cinstance(L)->obj = t;
 	*((luart_type *)t) = type;
 	lua_pushvalue(L, 1);
 }
 
 void *lua_checkcinstancebyname(lua_State *L, int idx, const char *name) {
-	void *instance;
 	lua_checkinstance(L, idx, name);
-	luaL_getmetafield(L, idx, "__userdata");
-	instance = lua_touserdata(L, -1);
-	lua_pop(L, 2);
-	return lua_tocinstance(L, idx, instance);
+	return lua_tocinstance(L, idx, NULL);
 }
 
 void *lua_checkcinstance(lua_State *L, int idx, luart_type t) {
@@ -462,16 +943,18 @@ void *lua_toself(lua_State *L, int idx, luart_type t) {
 }
 
 void *lua_tocinstance(lua_State *L, int idx, luart_type *t) {
-    void *obj = NULL;
-    if ( lua_istable(L, idx) && (luaL_getmetafield(L, idx, "__userdata")) ) {
-        obj = lua_touserdata(L, -1);
-        if (t)
-            *t = *(int*)obj;
-    	lua_pop(L, 1);
-    }
+    CInstance *c = to_cinstance(L, idx);
+    void *obj = c ? c->obj : NULL;
+
+    if (obj && t)
+        *t = *(luart_type*)obj;
     return obj;
 }
 
+void lua_rawsetinstance(lua_State *L, int idx) {
+	instance_rawset(L, idx);
+}
+
 void *lua_iscinstance(lua_State *L, int idx, luart_type t) {
 	void *obj;
 	if ( (obj = lua_tocinstance(L, idx, NULL)) ) {
@@ -20,6 +20,11 @@
 #include "lauxlib.h"
 #include "lualib.h"
 
+/* LuaRT vectorized UTF8 scanning functions (see string/string.c) */
+size_t utf8_count(const char *s, size_t l);
+size_t utf8_skip(const char *s, size_t l, size_t *n);
+size_t utf8_check(const char *s, size_t l);
+
 
 #define MAXUNICODE	0x10FFFFu
 
@@ -100,6 +105,14 @@ static int utflen (lua_State *L) {
                    "initial position out of bounds");
   luaL_argcheck(L, --posj < (lua_Integer)len, 3,
                    "final position out of bounds");
+  if (posi <= posj) {  /* fast path for valid UTF-8 */
+    size_t end = posj + 1;
+    while (end < len && iscont(s + end)) end++;  /* include last character */
+    if (utf8_check(s + posi, end - posi) == end - posi) {
+      lua_pushinteger(L, utf8_count(s + posi, end - posi));
+      return 1;
+    }
+  }
   while (posi <= posj) {
     const char *s1 = utf8_decode(s + posi, NULL, !lax);
     if (s1 == NULL) {  /* conversion error? */
@@ -205,11 +218,10 @@ static int byteoffset (lua_State *L) {
      }
      else {
        n--;  /* do not move for 1st character */
-       while (n > 0 && posi < (lua_Integer)len) {
-         do {  /* find beginning of next character */
-           posi++;
-         } while (iscont(s + posi));  /* (cannot pass final '\0') */
-         n--;
+       if (n > 0 && posi < (lua_Integer)len) {
+         size_t skip = n - 1;  /* find beginning of n-th next character */
+         posi += utf8_skip(s + posi + 1, len - posi - 1, &skip) + 1;
+         n = skip;
        }
      }
   }
@@ -17,6 +17,7 @@
 #include <luart.h>
 #include <wchar.h>
 #include <stdlib.h>
+#include <stdio.h>
 
 extern int _CRT_glob;
 void __wgetmainargs(int*,wchar_t***,wchar_t***,int,int*);
@@ -143,6 +144,30 @@ static luaL_Reg luaRT_libs[] = {
   { NULL,		NULL }
 };
 
+//--- Startup timing report, enabled with the LUART_STARTUP environment variable
+static LARGE_INTEGER freq, last;
+
+static double elapsed(void) {
+	LARGE_INTEGER now;
+	double ms;
+
+	QueryPerformanceCounter(&now);
+	ms = (now.QuadPart - last.QuadPart) * 1000.0 / freq.QuadPart;
+	last = now;
+	return ms;
+}
+
+static void startup_report(double *times) {
+	char report[256];
+
+	snprintf(report, sizeof(report), "startup: state+libs %.3f ms, modules %.3f ms, embed %.3f ms, total %.3f ms\n", times[0], times[1], times[2], times[0]+times[1]+times[2]);
+#ifdef RTWIN
+	OutputDebugStringA(report);
+#else
+	fputs(report, stderr);
+#endif
+}
+
 void lua_stop() {
 	if (L) {
 		if (lua_getfield(L, LUA_REGISTRYINDEX, "atexit") == LUA_TFUNCTION) {
@@ -164,30 +189,38 @@ __attribute__((used)) int main() {
 	int i, result = EXIT_SUCCESS;
 	WCHAR exename[MAX_PATH];
 	BOOL is_embeded = FALSE;
-	const luaL_Reg *lib;
 	wchar_t **enpv, **wargv;
 	int argc, si = 0;
+	BOOL report = GetEnvironmentVariableW(L"LUART_STARTUP", NULL, 0) > 0;
+	double times[3];
 
 	__wgetmainargs(&argc, &wargv, &enpv, _CRT_glob, &si);
 	icex.dwSize = sizeof(INITCOMMONCONTROLSEX);
 	icex.dwICC = ICC_USEREX_CLASSES;
 	InitCommonControlsEx(&icex);
 	CoInitializeEx(NULL, COINIT_APARTMENTTHREADED);
+	QueryPerformanceFrequency(&freq);
+	QueryPerformanceCounter(&last);
 	L = luaL_newstate();
 	luaL_openlibs(L);
-	for (lib = luaRT_libs; lib->func; lib++) {
-		luaL_requiref(L, lib->name, lib->func, 0);
-		lua_pop(L, 1);
-	}
+	times[0] = elapsed();
+	//--- LuaRT modules are only opened (with their OS resources) when first required
+	luaL_preloadlibs(L, luaRT_libs);
+	times[1] = elapsed();
 	GetModuleFileNameW(NULL, (WCHAR*)exename, sizeof(exename));
 	if ((is_embeded = luaL_embedopen(L, exename))) {
 		luaL_requiref(L, "embed", luaopen_embed, 1);
 		lua_pop(L, 1);
 	}
+	times[2] = elapsed();
+	if (report)
+		startup_report(times);
 	atexit(lua_stop);
 #ifdef RTC
 	lua_pushcfunction(L, update_exe_icon);
 	lua_setglobal(L, "seticon");
+	lua_pushcfunction(L, luaL_embedcompile);
+	lua_setglobal(L, "compile");
 #endif
 	if (argc == 1 && !is_embeded)
 		puts(LUA_VERSION " " LUA_ARCH " - Windows programming framework for Lua.\nCopyright (c) 2022, Samir Tine.\nusage:\tluart.exe [-e statement | script] [args]\n\n\t-e statement\tExecutes the given Lua statement\n\tscript\t\tRun a Lua script file\n\targs\t\tArguments for Lua interpreter");
@@ -280,7 +280,7 @@ static size_t ExtractRequest(lua_State *L, HINTERNET req) {
 										return FALSE;
 								} else total_size +=  sizeof(CONTENT__) + len + sizeof(__STRING__) + sizeof(__END) - 3;
 								break;
-			case LUA_TTABLE:	file = luaL_checkcinstance(L, -1, File);
+			case LUA_TUSERDATA:	file = luaL_checkcinstance(L, -1, File);
 								if ( (h = CreateFileW(file->fullpath, GENERIC_READ, FILE_SHARE_READ | FILE_SHARE_WRITE, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL)) == INVALID_HANDLE_VALUE)  {
 									lasterror(L, GetLastError());
 									luaL_error(L, "cannot open File : %s", lua_tostring(L, -1));
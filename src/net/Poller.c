@@ -0,0 +1,189 @@
+/*
+ | LuaRT - A Windows programming framework for Lua
+ | Luart.org, Copyright (c) Tine Samir 2022.
+ | See Copyright Notice in LICENSE.TXT
+ |-------------------------------------------------
+ | Poller.c | LuaRT Poller object implementation
+*/
+
+#include <Poller.h>
+#include "lrtapi.h"
+#include <luart.h>
+
+#include <stdint.h>
+
+luart_type TPoller;
+static const char *poller_modes[] = {"read", "write", "readwrite", NULL};
+
+//--- Registered entries hold a registry reference to their Socket, which keeps it alive
+#define entry_ref(e)	((int)(intptr_t)(e)->udata)
+
+static Socket *push_socket(lua_State *L, poller_entry *e) {
+	lua_rawgeti(L, LUA_REGISTRYINDEX, entry_ref(e));
+	return lua_self(L, -1, Socket);
+}
+
+//--- A closed Socket may still be registered with its former handle, which can be reused by another socket
+static BOOL is_stale(lua_State *L, poller_entry *e) {
+	BOOL stale = push_socket(L, e)->sock != e->fd;
+	lua_pop(L, 1);
+	return stale;
+}
+
+static void unregister(lua_State *L, Poller *p, poller_entry *e) {
+	luaL_unref(L, LUA_REGISTRYINDEX, entry_ref(e));
+	poller_remove(p->poller, e->fd);
+}
+
+//--- Finds the entry of a Socket, even a closed one
+static poller_entry *find_socket(lua_State *L, Poller *p, int idx, Socket *s) {
+	poller_entry *e;
+	int i;
+
+	if (s->sock != INVALID_SOCKET)
+		return (e = poller_find(p->poller, s->sock)) && !is_stale(L, e) ? e : NULL;
+	for (i = 0; (e = poller_entry_at(p->poller, i)); i++) {
+		lua_rawgeti(L, LUA_REGISTRYINDEX, entry_ref(e));
+		if (lua_rawequal(L, -1, idx)) {
+			lua_pop(L, 1);
+			return e;
+		}
+		lua_pop(L, 1);
+	}
+	return NULL;
+}
+
+/* ------------------------------------------------------------------------ */
+
+LUA_CONSTRUCTOR(Poller) {
+	Poller *p = lua_allocinstance(L, Poller);
+
+	if ( !(p->poller = poller_new()) ) {
+		lasterror(L, WSAGetLastError());
+		lua_error(L);
+	}
+	lua_newtable(L);
+	p->ready = luaL_ref(L, LUA_REGISTRYINDEX);
+	lua_newinstance(L, p, Poller);
+	return 1;
+}
+
+//--- Poller:add(socket, ["read"|"write"|"readwrite"]), errors are always reported
+LUA_METHOD(Poller, add) {
+	Poller *p = lua_self(L, 1, Poller);
+	Socket *s = luaL_checkcinstance(L, 2, Socket);
+	int events = luaL_checkoption(L, 3, "read", poller_modes) + 1, ref;
+	poller_entry *e;
+
+	if (s->sock == INVALID_SOCKET)
+		luaL_error(L, "cannot add a closed Socket to a Poller");
+	if ( (e = poller_find(p->poller, s->sock)) ) {
+		if (!is_stale(L, e))
+			luaL_error(L, "Socket is already registered in this Poller");
+		unregister(L, p, e);
+	}
+	lua_pushvalue(L, 2);
+	ref = luaL_ref(L, LUA_REGISTRYINDEX);
+	if (poller_add(p->poller, s->sock, events, (void*)(intptr_t)ref)) {
+		luaL_unref(L, LUA_REGISTRYINDEX, ref);
+		lua_pushboolean(L, FALSE);
+	} else lua_pushboolean(L, TRUE);
+	return 1;
+}
+
+LUA_METHOD(Poller, modify) {
+	Poller *p = lua_self(L, 1, Poller);
+	Socket *s = luaL_checkcinstance(L, 2, Socket);
+	int events = luaL_checkoption(L, 3, NULL, poller_modes) + 1;
+	poller_entry *e = find_socket(L, p, 2, s);
+
+	lua_pushboolean(L, e && poller_modify(p->poller, e->fd, events) == 0);
+	return 1;
+}
+
+LUA_METHOD(Poller, remove) {
+	Poller *p = lua_self(L, 1, Poller);
+	poller_entry *e = find_socket(L, p, 2, luaL_checkcinstance(L, 2, Socket));
+
+	if (e)
+		unregister(L, p, e);
+	lua_pushboolean(L, e != NULL);
+	return 1;
+}
+
+//--- Poller:wait([timeout]) waits up to timeout milliseconds (-1 waits indefinitely, defaults to 0)
+//--- Returns the ready Sockets (the same table is reused by each call) with their canread/canwrite/failed properties updated
+LUA_METHOD(Poller, wait) {
+	Poller *p = lua_self(L, 1, Poller);
+	int timeout = (int)luaL_optinteger(L, 2, 0), count = poller_count(p->poller), n, i;
+	poller_entry *e;
+	Socket *s;
+
+	if (count > p->size) {
+		if ( !(e = realloc(p->events, count*sizeof(poller_entry))) )
+			luaL_error(L, "not enough memory");
+		p->events = e;
+		p->size = count;
+	}
+	if ((n = poller_wait(p->poller, p->events, count, timeout)) == -1) {
+		lua_pushboolean(L, FALSE);
+		return 1;
+	}
+	lua_rawgeti(L, LUA_REGISTRYINDEX, p->ready);
+	for (i = 0, count = 0; i < n; i++) {
+		e = &p->events[i];
+		s = push_socket(L, e);
+		if (s->sock != e->fd) {
+			//--- drops Sockets closed while registered
+			lua_pop(L, 1);
+			if ( (e = poller_find(p->poller, e->fd)) )
+				unregister(L, p, e);
+			continue;
+		}
+		s->read = (e->events & POLLER_READ) != 0;
+		s->write = (e->events & POLLER_WRITE) != 0;
+		s->error = (e->events & POLLER_ERROR) != 0;
+		lua_rawseti(L, -2, ++count);
+	}
+	for (i = count; i < p->nready; i++) {
+		lua_pushnil(L);
+		lua_rawseti(L, -2, i+1);
+	}
+	p->nready = count;
+	return 1;
+}
+
+LUA_PROPERTY_GET(Poller, count) {
+	lua_pushinteger(L, poller_count(lua_self(L, 1, Poller)->poller));
+	return 1;
+}
+
+LUA_METHOD(Poller, __gc) {
+	Poller *p = lua_self(L, 1, Poller);
+	poller_entry *e;
+	int i;
+
+	//--- the constructor may have failed to create the poller
+	if (p->poller) {
+		for (i = 0; (e = poller_entry_at(p->poller, i)); i++)
+			luaL_unref(L, LUA_REGISTRYINDEX, entry_ref(e));
+		poller_free(p->poller);
+		luaL_unref(L, LUA_REGISTRYINDEX, p->ready);
+	}
+	free(p->events);
+	return 0;
+}
+
+const luaL_Reg Poller_metafields[] = {
+	{"__gc",		Poller___gc},
+	{NULL, NULL}
+};
+
+const luaL_Reg Poller_methods[] = {
+	{"add",			Poller_add},
+	{"modify",		Poller_modify},
+	{"remove",		Poller_remove},
+	{"wait",		Poller_wait},
+	{"get_count",	Poller_getcount},
+	{NULL, NULL}
+};
@@ -10,27 +10,47 @@
 #include "lrtapi.h"
 #include <luart.h>
 #include <Buffer.h>
+#include <File.h>
 
 #include <io.h>
 #include <windns.h>
+#include <mswsock.h>
+#include <limits.h>
 
 luart_type TSocket;
 static const char *socket_mode [] = {"ipv4", "ipv6"};
 
 extern int dns(lua_State *L, const char *str, WORD type);
 
+//--- Continuations of the operations that yield async Sockets tasks
+static int Socket_recvk(lua_State *L, int status, lua_KContext ctx);
+static int Socket_sendk(lua_State *L, int status, lua_KContext ctx);
+static int Socket_sendallk(lua_State *L, int status, lua_KContext ctx);
+static int Socket_acceptk(lua_State *L, int status, lua_KContext ctx);
+static int Socket_recvintok(lua_State *L, int status, lua_KContext ctx);
+static int Socket_readlinek(lua_State *L, int status, lua_KContext ctx);
+static int Socket_readuntilk(lua_State *L, int status, lua_KContext ctx);
+static int Socket_readexactlyk(lua_State *L, int status, lua_KContext ctx);
+static int Socket_sendvk(lua_State *L, int status, lua_KContext ctx);
+static int Socket_sendfilek(lua_State *L, int status, lua_KContext ctx);
+
+static int EncryptFlush(Socket *s);
+
 LUA_CONSTRUCTOR(Socket) {
 	Socket *s;
 	int mode = lua_optstring(L, 4, socket_mode, 0);
 	BOOL resolved = FALSE;
 	DWORD len = INET6_ADDRSTRLEN;
 
-	if (lua_islightuserdata(L, -1))
-		s = lua_touserdata(L, -1);
-	else {
+	if (lua_islightuserdata(L, -1)) {
+		Socket *from = lua_touserdata(L, -1);
+		s = lua_allocinstance(L, Socket);
+		*s = *from;
+	} else {
 		int port = htons((u_short)luaL_checkinteger(L, 3));
 		const char *str = luaL_checkstring(L, 2);
-		s = (Socket *)calloc(1, sizeof(Socket));
+		s = lua_allocinstance(L, Socket);
+		s->sock = INVALID_SOCKET;
 		s->blocking = TRUE;
 addr:	if (inet_pton(AF_INET, str, &(s->addr.sin_addr)) != 0 ) {
 			s->addr.sin_family = AF_INET;
@@ -89,8 +109,9 @@ static void free_tls(TLS *t) {
 	}
 	if (t->ExtraData.BufferType != SECBUFFER_EMPTY)
 		free(t->ExtraData.pvBuffer);
-	if (t->RemainingDecryptData.BufferType != SECBUFFER_EMPTY)
-		free(t->RemainingDecryptData.pvBuffer);
+	tlsrec_free(&t->in);
+	tlsrec_free(&t->plain);
+	tlsrec_free(&t->writer.out);
 	if (t->pCertContext != NULL)
 		CertFreeCertificateContext(t->pCertContext);
 	free(t);
@@ -223,213 +244,435 @@ SECURITY_STATUS DoHandshake(Socket *s, BOOL read, ULONG msTimeout)
 
 LUA_METHOD(Socket, close) {
 	Socket *s = lua_self(L, 1, Socket);
+	if (s->async)
+		async_release(L, s);
+	if (s->tls) {
+		//--- last chance to send pending records, that are lost if the Socket would block
+		EncryptFlush(s);
+		free_tls(s->tls);
+		s->tls = NULL;
+	}
 	if (s->sock)
 		closesocket(s->sock);
-	if (s->tls)
-		free_tls(s->tls);
+	free(s->rbuf);
+	s->rbuf = NULL;
+	s->rstart = s->rlen = s->rcapacity = 0;
 	s->sock = INVALID_SOCKET;
 	return 0;
 }
 
-static int DecryptRecv(Socket *s, char *buffer, ULONG bufLen) {
-	SECURITY_STATUS scRet = 0;
+//-------------------------------------[ TLS records ]
+//--- Decrypts in place a complete record, and sets its plaintext
+static SECURITY_STATUS DecryptRecord(TLS *t, BYTE *record, size_t size, BYTE **data, ULONG *len) {
 	SecBufferDesc MessageBufDesc;
 	SecBuffer MsgBuffer[4] = {0};
-	PSecBuffer pDataBuf = NULL, pExtraBuf = NULL;
-	int decryptBufSize = s->tls->sizes.cbHeader + s->tls->sizes.cbMaximumMessage + s->tls->sizes.cbTrailer;
-	int decryptBufUsed = 0;
-	PBYTE decryptBuf = NULL;
-	int Amount = 0, received, i;
-	PSecBuffer pRemnant = &s->tls->RemainingDecryptData;
-	PSecBuffer pExtra;
-
-	if (pRemnant->BufferType) {
-		int min = min(bufLen, pRemnant->cbBuffer);
-		CopyMemory(buffer, pRemnant->pvBuffer, min);
-		if (pRemnant->cbBuffer > bufLen) {
-			MoveMemory(pRemnant->pvBuffer, (char*)pRemnant->pvBuffer + bufLen, pRemnant->cbBuffer - bufLen);
-			pRemnant->cbBuffer = pRemnant->cbBuffer - bufLen;
-		} else {
-			free(pRemnant->pvBuffer);
-			memset(pRemnant, 0, sizeof(SecBuffer));
+	SECURITY_STATUS scRet;
+	int i;
+
+	MessageBufDesc.ulVersion = SECBUFFER_VERSION;
+	MessageBufDesc.cBuffers = 4;
+	MessageBufDesc.pBuffers = MsgBuffer;
+	FillSecBuffer(&MsgBuffer[0], SECBUFFER_DATA, (ULONG)size, record);
+	scRet = DecryptMessage(t->pCtxtHandle, &MessageBufDesc, 0, NULL);
+	*len = 0;
+	for (i = 0; i < 4; i++)
+		if (MsgBuffer[i].BufferType == SECBUFFER_DATA) {
+			*data = MsgBuffer[i].pvBuffer;
+			*len = MsgBuffer[i].cbBuffer;
+			break;
 		}
-		return min;
-	}
-	if ((decryptBuf = calloc(1, decryptBufSize)) == NULL) {
-		SetLastError(SEC_E_INSUFFICIENT_MEMORY);
-		return SOCKET_ERROR;
-	}
-	pExtra = &s->tls->ExtraData;
-	if (pExtra->BufferType) {
-		CopyMemory(decryptBuf, pExtra->pvBuffer, pExtra->cbBuffer);
-		decryptBufUsed = pExtra->cbBuffer;
-		free(pExtra->pvBuffer);
-		memset(pExtra, 0, sizeof(SecBuffer));
+	return scRet;
+}
+
+//--- Receives and decrypts at most bufLen bytes, all the complete records already received being decrypted first
+//--- Received records and plaintext that does not fit in buffer are kept, so that a would-block error loses nothing
+static int DecryptRecv(Socket *s, char *buffer, ULONG bufLen) {
+	TLS *t = s->tls;
+	SECURITY_STATUS scRet;
+	ULONG done = 0, len, n;
+	size_t size;
+	BYTE *data;
+	int received;
+
+	if (t->plain.len) {
+		done = (ULONG)min(bufLen, t->plain.len);
+		CopyMemory(buffer, t->plain.data + t->plain.start, done);
+		tlsrec_consume(&t->plain, done);
 	}
-	while (TRUE) {
-		if (decryptBufUsed == 0 || scRet == SEC_E_INCOMPLETE_MESSAGE) {
-			if ((received = recv(s->sock, (LPSTR)decryptBuf + decryptBufUsed, decryptBufSize - decryptBufUsed, 0)) <= 0) {
-				Amount = SOCKET_ERROR;
-				if (received == 0)
-					WSASetLastError(WSAEDISCON);
-				break;
+	for (;;) {
+		//--- data received at the end of a handshake
+		if (t->ExtraData.BufferType != SECBUFFER_EMPTY) {
+			if (tlsrec_append(&t->in, t->ExtraData.pvBuffer, t->ExtraData.cbBuffer))
+				goto nomem;
+			free(t->ExtraData.pvBuffer);
+			memset(&t->ExtraData, 0, sizeof(SecBuffer));
+		}
+		while (done < bufLen && (size = tlsrec_framed(t->in.data + t->in.start, t->in.len))) {
+			if (size == (size_t)-1) {
+				SetLastError(SEC_E_INVALID_TOKEN);
+				return SOCKET_ERROR;
+			}
+			scRet = DecryptRecord(t, t->in.data + t->in.start, size, &data, &len);
+			if (scRet != SEC_E_OK && scRet != SEC_I_RENEGOTIATE && scRet != SEC_I_CONTEXT_EXPIRED) {
+				SetLastError(scRet);
+				return SOCKET_ERROR;
+			}
+			n = min(len, bufLen - done);
+			CopyMemory(buffer + done, data, n);
+			done += n;
+			if (n < len && tlsrec_append(&t->plain, data + n, len - n))
+				goto nomem;
+			tlsrec_consume(&t->in, size);
+			//--- the peer has closed the TLS session
+			if (scRet == SEC_I_CONTEXT_EXPIRED)
+				return done;
+			if (scRet == SEC_I_RENEGOTIATE && ((scRet = DoHandshake(s, FALSE, 0)) != SEC_E_OK)) {
+				SetLastError(scRet);
+				return -2;
 			}
-			decryptBufUsed += received;
 		}
-		MessageBufDesc.ulVersion = SECBUFFER_VERSION;
-		MessageBufDesc.cBuffers = 4;
-		MessageBufDesc.pBuffers = MsgBuffer;
-		FillSecBuffer(&MsgBuffer[0], SECBUFFER_DATA, decryptBufUsed, decryptBuf);
-		scRet = DecryptMessage(s->tls->pCtxtHandle, &MessageBufDesc, 0, NULL);
-		if (scRet == SEC_I_CONTEXT_EXPIRED) break; 
-		else if (scRet != SEC_E_OK && scRet != SEC_I_RENEGOTIATE && scRet != SEC_I_CONTEXT_EXPIRED && scRet != SEC_E_INCOMPLETE_MESSAGE) {
-			SetLastError(scRet);
-			Amount = SOCKET_ERROR;
-			break;
+		if (done)
+			return done;
+		if (!tlsrec_reserve(&t->in, TLSREC_MAXSIZE))
+			goto nomem;
+		if ((received = recv(s->sock, (char*)t->in.data + t->in.start + t->in.len, (int)(t->in.capacity - t->in.start - t->in.len), 0)) <= 0) {
+			if (received == 0)
+				WSASetLastError(WSAEDISCON);
+			return SOCKET_ERROR;
 		}
-		else if (scRet == SEC_E_INCOMPLETE_MESSAGE) continue;
-		for (i = 0; i < 4; i++)	{
-			if (pDataBuf == NULL && MsgBuffer[i].BufferType == SECBUFFER_DATA)
-				pDataBuf = &MsgBuffer[i];
-			if (pExtraBuf == NULL && MsgBuffer[i].BufferType == SECBUFFER_EXTRA)
-				pExtraBuf = &MsgBuffer[i];
+		t->in.len += received;
+	}
+nomem:
+	SetLastError(SEC_E_INSUFFICIENT_MEMORY);
+	return -2;
+}
+
+//--- Receives at most len bytes, returns 0 when the peer has disconnected, or SOCKET_ERROR
+static int receive(Socket *s, char *buffer, int len) {
+	int done;
+
+	if (!s->tls)
+		return recv(s->sock, buffer, len, 0);
+	if ((done = DecryptRecv(s, buffer, len)) == SOCKET_ERROR && WSAGetLastError() == WSAEDISCON)
+		return 0;
+	return done < 0 ? SOCKET_ERROR : done;
+}
+
+//--- Pushes the result of a failed receive: nil when it would block (or yields the async task), false otherwise
+static int recv_failed(lua_State *L, Socket *s, int done, lua_KContext ctx, lua_KFunction k) {
+	if (done == SOCKET_ERROR && !s->blocking && WSAGetLastError() == WSAEWOULDBLOCK) {
+		if (async_intask(L, s))
+			return async_wait(L, s, POLLER_READ, ctx, k);
+		lua_pushnil(L);
+	} else
+		lua_pushboolean(L, FALSE);
+	return 1;
+}
+
+//-------------------------------------[ Receive buffer ]
+//--- Received data is kept contiguous, and moved back to the start of the buffer only when more room is needed
+
+static void buffer_consume(Socket *s, size_t len) {
+	s->rstart += len;
+	if (!(s->rlen -= len))
+		s->rstart = 0;
+}
+
+//--- Receives at least one byte in the Socket buffer, with room for at least want bytes
+static int buffer_fill(Socket *s, size_t want) {
+	size_t capacity;
+	BYTE *rbuf;
+	int done;
+
+	if (want < SOCKET_RECVCHUNK)
+		want = SOCKET_RECVCHUNK;
+	if (s->rstart + s->rlen + want > s->rcapacity) {
+		if (s->rstart) {
+			memmove(s->rbuf, s->rbuf + s->rstart, s->rlen);
+			s->rstart = 0;
 		}
-		if (pExtraBuf) {
-			pExtra->BufferType = SECBUFFER_EXTRA;
-			pExtra->cbBuffer = pExtraBuf->cbBuffer;
-			pExtra->pvBuffer = calloc(1, pExtra->cbBuffer);
-			CopyMemory(pExtra->pvBuffer, pExtraBuf->pvBuffer, pExtra->cbBuffer);
+		if (s->rlen + want > s->rcapacity) {
+			for (capacity = s->rcapacity ? s->rcapacity : SOCKET_RECVBUFFER; capacity < s->rlen + want; capacity *= 2);
+			if ( !(rbuf = realloc(s->rbuf, capacity)) ) {
+				WSASetLastError(WSA_NOT_ENOUGH_MEMORY);
+				return SOCKET_ERROR;
+			}
+			s->rbuf = rbuf;
+			s->rcapacity = capacity;
 		}
-		if (pDataBuf) {
-			ULONG length = pDataBuf->cbBuffer;
-			Amount = min(length, bufLen);
-			CopyMemory(buffer, pDataBuf->pvBuffer, min(length, bufLen));
-			if (length > bufLen) {
-				int diff = length - bufLen;
-				pRemnant->BufferType = SECBUFFER_DATA;
-				pRemnant->cbBuffer = diff;
-				if ((pRemnant->pvBuffer = calloc(1, diff)) == NULL) {
-					SetLastError(SEC_E_INSUFFICIENT_MEMORY);
-					Amount = -2;
-					break;
-				}
-				CopyMemory(pRemnant->pvBuffer, (char*)pDataBuf->pvBuffer + bufLen, diff);
+	}
+	want = s->rcapacity - s->rstart - s->rlen;
+	if ((done = receive(s, (char*)s->rbuf + s->rstart + s->rlen, want > INT_MAX ? INT_MAX : (int)want)) > 0)
+		s->rlen += done;
+	return done;
+}
+
+static const BYTE *find(const BYTE *data, size_t len, const char *delim, size_t dlen) {
+	const BYTE *p, *end = data + len - dlen + 1;
+
+	for (p = data; p < end && (p = memchr(p, *delim, end - p)); p++)
+		if (!memcmp(p, delim, dlen))
+			return p;
+	return NULL;
+}
+
+//--- Reads up to the delimiter (excluded), scanned is the count of bytes already searched
+static int read_until(lua_State *L, const char *delim, size_t dlen, BOOL line, size_t scanned, lua_KFunction k) {
+	Socket *s = lua_self(L, 1, Socket);
+	const BYTE *start, *found;
+	size_t len;
+	int done;
+
+	s->read = FALSE;
+	for (;;) {
+		start = s->rbuf + s->rstart;
+		if (s->rlen >= dlen) {
+			if ( (found = find(start + scanned, s->rlen - scanned, delim, dlen)) ) {
+				len = found - start;
+				lua_pushlstring(L, (const char*)start, line && len && start[len-1] == '\r' ? len-1 : len);
+				buffer_consume(s, len + dlen);
+				return 1;
 			}
-			break;
+			scanned = s->rlen - dlen + 1;
 		}
-		if (scRet == SEC_I_RENEGOTIATE && ((scRet = DoHandshake(s, FALSE, 0)) != SEC_E_OK)) {
-			SetLastError(scRet);
-			Amount = -2;
-			break;
+		if ((done = buffer_fill(s, 0)) <= 0) {
+			//--- data received before the peer has disconnected is returned first
+			if (done == 0 && s->rlen) {
+				lua_pushlstring(L, (const char*)s->rbuf + s->rstart, s->rlen);
+				buffer_consume(s, s->rlen);
+				return 1;
+			}
+			return recv_failed(L, s, done, (lua_KContext)scanned, k);
 		}
 	}
-	free(decryptBuf);
-	return Amount;
 }
 
+static int readline(lua_State *L, size_t scanned) {
+	return read_until(L, "\n", 1, TRUE, scanned, Socket_readlinek);
+}
+
+static int Socket_readlinek(lua_State *L, int status, lua_KContext ctx) {
+	return readline(L, (size_t)ctx);
+}
+
+LUA_METHOD(Socket, readline) {
+	return readline(L, 0);
+}
+
+static int readuntil(lua_State *L, size_t scanned) {
+	size_t dlen;
+	const char *delim = luaL_checklstring(L, 2, &dlen);
+
+	luaL_argcheck(L, dlen, 2, "empty delimiter");
+	return read_until(L, delim, dlen, FALSE, scanned, Socket_readuntilk);
+}
+
+static int Socket_readuntilk(lua_State *L, int status, lua_KContext ctx) {
+	return readuntil(L, (size_t)ctx);
+}
+
+LUA_METHOD(Socket, readuntil) {
+	return readuntil(L, 0);
+}
+
+LUA_METHOD(Socket, readexactly) {
+	Socket *s = lua_self(L, 1, Socket);
+	lua_Integer n = luaL_checkinteger(L, 2);
+	int done;
+
+	luaL_argcheck(L, n >= 0, 2, "negative size");
+	s->read = FALSE;
+	while (s->rlen < (size_t)n)
+		if ((done = buffer_fill(s, (size_t)n - s->rlen)) <= 0)
+			return recv_failed(L, s, done, 0, Socket_readexactlyk);
+	lua_pushlstring(L, (const char*)s->rbuf + s->rstart, (size_t)n);
+	buffer_consume(s, (size_t)n);
+	return 1;
+}
+
+static int Socket_readexactlyk(lua_State *L, int status, lua_KContext ctx) {
+	return Socket_readexactly(L);
+}
+
+//-------------------------------------[ Socket:recv() ]
+//--- Receives directly in the returned Buffer, buffered data being returned first
 LUA_METHOD(Socket, recv) {
 	Socket *s = lua_self(L, 1, Socket);
-	int size = (size_t)luaL_optinteger(L, 2, 1024), done = 0;
-	char *buff = malloc(size);
-	
+	lua_Integer size = luaL_optinteger(L, 2, 1024);
+	Buffer *b;
+	int done;
+
+	luaL_argcheck(L, size > 0 && size <= INT_MAX, 2, "invalid size");
 	s->read = FALSE;
-	if ( s->tls ) {
-		if ( (done = DecryptRecv(s, buff+done, size)) == SOCKET_ERROR  )
-			goto error;
+	lua_settop(L, 2);
+	lua_pushnil(L);
+	b = lua_pushinstance(L, Buffer, 1);
+	if (s->rlen) {
+		done = (int)min((size_t)size, s->rlen);
+		memcpy(buffer_reserve(L, b, done), s->rbuf + s->rstart, done);
+		buffer_consume(s, done);
+	} else if ((done = receive(s, (char*)buffer_reserve(L, b, (size_t)size), (int)size)) <= 0) {
+		lua_pop(L, 1);
+		return recv_failed(L, s, done, 0, Socket_recvk);
 	}
-	else { 
-		if ( (done = recv(s->sock, buff, size, 0)) == SOCKET_ERROR ) {
-error:		if ( !s->blocking && WSAGetLastError() == WSAEWOULDBLOCK )
-				lua_pushnil(L);
-			else
-				lua_pushboolean(L, FALSE);
-			free(buff);
-			return 1;
-		}
+	b->size = done;
+	return 1;
+}
+
+static int Socket_recvk(lua_State *L, int status, lua_KContext ctx) {
+	return Socket_recv(L);
+}
+
+//--- Socket:recvinto(buffer, [offset], [n]) receives at most n bytes in buffer, starting at offset
+LUA_METHOD(Socket, recvinto) {
+	Socket *s = lua_self(L, 1, Socket);
+	Buffer *b = luaL_checkcinstance(L, 2, Buffer);
+	lua_Integer offset = luaL_optinteger(L, 3, 1), n;
+	BYTE *dest;
+	int done;
+
+	luaL_argcheck(L, offset >= 1 && (size_t)offset <= b->size+1, 3, "out of bounds");
+	n = luaL_optinteger(L, 4, (lua_Integer)(b->size - offset + 1));
+	luaL_argcheck(L, n > 0 && n <= INT_MAX, 4, "invalid size");
+	if (b->data && b->data->storage == BUFFER_MAPPED)
+		luaL_error(L, "cannot modify a read-only memory mapped Buffer");
+	s->read = FALSE;
+	dest = buffer_reserve(L, b, (size_t)(offset - 1 + n)) + offset - 1;
+	if (s->rlen) {
+		done = (int)min((size_t)n, s->rlen);
+		memcpy(dest, s->rbuf + s->rstart, done);
+		buffer_consume(s, done);
+	} else if ((done = receive(s, (char*)dest, (int)n)) <= 0)
+		return recv_failed(L, s, done, 0, Socket_recvintok);
+	if ((size_t)(offset - 1 + done) > b->size)
+		b->size = (size_t)(offset - 1 + done);
+	lua_pushinteger(L, done);
+	return 1;
+}
+
+static int Socket_recvintok(lua_State *L, int status, lua_KContext ctx) {
+	return Socket_recvinto(L);
+}
+
+//--- Encrypts in place a record built by the TLS writer
+static int SealRecord(void *udata, uint8_t *record, size_t datalen, size_t *reclen) {
+	TLS *t = udata;
+	SecBufferDesc MessageDesc;
+	SecBuffer MsgBuffer[4];
+	SECURITY_STATUS scRet;
+
+	FillSecBuffer(&MsgBuffer[0], SECBUFFER_STREAM_HEADER, t->sizes.cbHeader, record);
+	FillSecBuffer(&MsgBuffer[1], SECBUFFER_DATA, (ULONG)datalen, record + t->sizes.cbHeader);
+	FillSecBuffer(&MsgBuffer[2], SECBUFFER_STREAM_TRAILER, t->sizes.cbTrailer, record + t->sizes.cbHeader + datalen);
+	FillSecBuffer(&MsgBuffer[3], SECBUFFER_EMPTY, 0, NULL);
+	MessageDesc.cBuffers = 4;
+	MessageDesc.ulVersion = SECBUFFER_VERSION;
+	MessageDesc.pBuffers = MsgBuffer;
+	if (FAILED(scRet = EncryptMessage(t->pCtxtHandle, 0, &MessageDesc, 0))) {
+		SetLastError(scRet);
+		return -1;
 	}
-	if (done == 0)
-		lua_pushboolean(L, FALSE);
-	else {
-		lua_pushlstring(L, buff, done);
-		lua_pushinstance(L, Buffer, 1);
+	*reclen = MsgBuffer[0].cbBuffer + MsgBuffer[1].cbBuffer + MsgBuffer[2].cbBuffer;
+	return 0;
+}
+
+//--- Writes plaintext to the TLS records, returns 0, SOCKET_ERROR or -2 when out of memory
+static int EncryptWrite(Socket *s, const char *message, size_t len) {
+	TLS *t = s->tls;
+
+	if (!t->writer.seal)
+		tlsrec_writer_init(&t->writer, t->sizes.cbHeader, t->sizes.cbTrailer, t->sizes.cbMaximumMessage, SealRecord, t);
+	switch (tlsrec_write(&t->writer, message, len)) {
+		case TLSREC_ENOMEM:	return -2;
+		case TLSREC_ESEAL:	return SOCKET_ERROR;
 	}
-	free(buff);
-	return 1;
+	return 0;
 }
 
-static int EncryptSend(lua_State *L, Socket *s, const char *message, ULONG msgLen) {
-	PSecPkgContext_StreamSizes sizes = &(s->tls->sizes);
-	int messageSize = 0;
-	int sentBytes = 0;
-	//int maxMessageBlobSize = sizes->cbHeader + sizes->cbMaximumMessage + sizes->cbTrailer;
-	ULONG i;
-	PBYTE sendBuf;
-	int sent, sendBytes = 0;
+//--- Seals and sends the pending TLS records, returns 0 once they have all been sent, or SOCKET_ERROR
+static int EncryptFlush(Socket *s) {
+	tlsrec_writer *w = &s->tls->writer;
+	const uint8_t *data;
+	size_t len;
+	int sent;
 
-	lua_pushboolean(L, FALSE);
-	for (i = 0; i < msgLen; i += sizes->cbMaximumMessage) {
-		SecBufferDesc MessageDesc;
-		SecBuffer MsgBuffer[4];
-		SECURITY_STATUS scRet;
-
-		messageSize = min(sizes->cbMaximumMessage, msgLen - i);
-		sendBuf = calloc(1, sizes->cbHeader + messageSize + sizes->cbTrailer);
-		if (sendBuf == NULL) {
-			sendBytes = -2;
-			break;
-		}
-		MoveMemory(sendBuf + sizes->cbHeader, message + i, messageSize);
-		FillSecBuffer(&MsgBuffer[0], SECBUFFER_STREAM_HEADER, sizes->cbHeader, sendBuf);
-		FillSecBuffer(&MsgBuffer[1], SECBUFFER_DATA, messageSize, sendBuf + sizes->cbHeader);
-		FillSecBuffer(&MsgBuffer[2], SECBUFFER_STREAM_TRAILER, sizes->cbTrailer, sendBuf + sizes->cbHeader + messageSize);
-		MsgBuffer[3].BufferType = SECBUFFER_EMPTY;
-		MessageDesc.cBuffers = 4;
-		MessageDesc.ulVersion = SECBUFFER_VERSION;
-		MessageDesc.pBuffers = MsgBuffer;
-		if (FAILED(scRet = EncryptMessage(s->tls->pCtxtHandle, 0, &MessageDesc, 0))) {
-			SetLastError(scRet);
-			sentBytes = SOCKET_ERROR;
-			break;
-		}
-		if ((sent = send(s->sock, (LPSTR)sendBuf, MsgBuffer[0].cbBuffer + MsgBuffer[1].cbBuffer + MsgBuffer[2].cbBuffer, 0)) == SOCKET_ERROR) {
-			sentBytes = SOCKET_ERROR;
-			break;
+	if (w->seal && tlsrec_seal(w))
+		return SOCKET_ERROR;
+	while ((len = tlsrec_pending(w, &data))) {
+		if ((sent = send(s->sock, (const char*)data, (int)min(len, (size_t)INT_MAX), 0)) == SOCKET_ERROR)
+			return SOCKET_ERROR;
+		tlsrec_sent(w, sent);
+	}
+	return 0;
+}
+
+//--- Encrypts and sends a message by windows of full records, returns the count of plaintext bytes whose records have all been sent
+//--- Records that would block are kept, and the next call must start with the same plaintext bytes, that are sent and not encrypted again
+//--- SOCKET_ERROR is returned only when no plaintext has been sent
+static int EncryptSend(Socket *s, const char *message, ULONG msgLen) {
+	tlsrec_writer *w = &s->tls->writer;
+	ULONG done = 0, n;
+	int err;
+
+	if (w->held) {
+		if (EncryptFlush(s))
+			return SOCKET_ERROR;
+		//--- held bytes beyond a shorter message are reported by the next calls
+		if ((w->held = tlsrec_release(w)) > msgLen) {
+			w->held -= msgLen;
+			return msgLen;
 		}
-		sentBytes += sent;
-		free(sendBuf);
+		done = (ULONG)w->held;
+		w->held = 0;
+	}
+	while (done < msgLen) {
+		n = min(msgLen - done, TLS_SENDWINDOW);
+		if ((err = EncryptWrite(s, message + done, n)))
+			return done ? (int)done : err;
+		if (EncryptFlush(s))
+			return done ? (int)done : SOCKET_ERROR;
+		done += (ULONG)tlsrec_release(w);
 	}
-	if (sendBytes < 0)
-		free(sendBuf);
-	return sentBytes;
+	return done;
 }
 
-LUA_METHOD(Socket, sendall) {
-	size_t len, total = 0;
+//--- Sends the string argument from offset, yielding async tasks until everything is sent
+static int sendall(lua_State *L, size_t offset) {
+	size_t len;
 	Socket *s = lua_self(L, 1, Socket);
 	const char *str;
-	size_t i;
+	int i;
 
+	lua_settop(L, 2);
 	str = luaL_tolstring(L, 2, &len);
 	s->write = FALSE;
-	while(len) {
-		str += total;
-		switch((i = s->tls ? EncryptSend(L, s, str, len) : send(s->sock, str, len, 0))) {
-			case -2 : SetLastError(ERROR_NOT_ENOUGH_MEMORY); goto error;
-			case SOCKET_ERROR : if (!s->blocking && WSAGetLastError() == WSAEWOULDBLOCK) {
-									lua_pushnil(L);
-									return 1;
-								} else {
-							error:	lua_pushboolean(L, FALSE);
-									return 1;
-								}	
-			default : if (i < len) { total +=i; len -= i; } else goto done;
-		}
+	while(offset < len) {
+		if ((i = s->tls ? EncryptSend(s, str + offset, len - offset) : send(s->sock, str + offset, len - offset, 0)) < 0)
+			goto failed;
+		offset += i;
 	}
-done:
 	lua_pushboolean(L, TRUE);
 	return 1;
+failed:
+	if (i == -2)
+		SetLastError(ERROR_NOT_ENOUGH_MEMORY);
+	else if (!s->blocking && WSAGetLastError() == WSAEWOULDBLOCK) {
+		if (async_intask(L, s))
+			return async_wait(L, s, POLLER_WRITE, (lua_KContext)offset, Socket_sendallk);
+		lua_pushnil(L);
+		return 1;
+	}
+	lua_pushboolean(L, FALSE);
+	return 1;
 }
 
+static int Socket_sendallk(lua_State *L, int status, lua_KContext ctx) {
+	return sendall(L, (size_t)ctx);
+}
+
+LUA_METHOD(Socket, sendall) {
+	return sendall(L, 0);
+}
 
 LUA_METHOD(Socket, send) {
 	size_t len;
@@ -440,8 +683,14 @@ LUA_METHOD(Socket, send) {
 	str = luaL_tolstring(L, 2, &len);
 	s->write = FALSE;
 	if (len)
-		switch((i = s->tls ? EncryptSend(L, s, str, len) : send(s->sock, str, len, 0))) {
-			case SOCKET_ERROR : if (WSAGetLastError() == WSAEWOULDBLOCK) lua_pushnil(L); else lua_pushboolean(L, FALSE); break;
+		switch((i = s->tls ? EncryptSend(s, str, len) : send(s->sock, str, len, 0))) {
+			case SOCKET_ERROR : if (WSAGetLastError() == WSAEWOULDBLOCK) {
+									lua_settop(L, 2);
+									if (async_intask(L, s))
+										return async_wait(L, s, POLLER_WRITE, 0, Socket_sendk);
+									lua_pushnil(L);
+								} else lua_pushboolean(L, FALSE);
+								break;
 			case -2 : SetLastError(ERROR_NOT_ENOUGH_MEMORY); lua_pushboolean(L, FALSE); break;
 			default : lua_pushinteger(L, i);
 		}
@@ -450,6 +699,187 @@ LUA_METHOD(Socket, send) {
 	return 1;
 }
 
+static int Socket_sendk(lua_State *L, int status, lua_KContext ctx) {
+	return Socket_send(L);
+}
+
+//-------------------------------------[ Vectored and file sends ]
+//--- Returns the bytes of a string or Buffer chunk, without copying them
+static const char *chunk_bytes(lua_State *L, int idx, size_t *len) {
+	Buffer *b;
+
+	if (lua_type(L, idx) == LUA_TSTRING)
+		return lua_tolstring(L, idx, len);
+	if ( (b = lua_iscinstance(L, idx, TBuffer)) ) {
+		*len = b->size;
+		return (const char*)b->bytes;
+	}
+	return NULL;
+}
+
+//--- Pushes the result of a vectored or file send that sent bytes before failing with done
+static int send_result(lua_State *L, Socket *s, int done, size_t sent, lua_KFunction k) {
+	if (done == SOCKET_ERROR && !s->blocking && WSAGetLastError() == WSAEWOULDBLOCK) {
+		if (async_intask(L, s))
+			return async_wait(L, s, POLLER_WRITE, (lua_KContext)sent, k);
+		if (sent)
+			lua_pushinteger(L, (lua_Integer)sent);
+		else
+			lua_pushnil(L);
+	} else if (done)
+		lua_pushboolean(L, FALSE);
+	else
+		lua_pushinteger(L, (lua_Integer)sent);
+	return 1;
+}
+
+//--- Sends the chunks of the table argument, skipping the sent bytes already sent
+static int sendv(lua_State *L, size_t sent) {
+	Socket *s = lua_self(L, 1, Socket);
+	WSABUF stackbufs[SOCKET_MAXVEC], *bufs = stackbufs;
+	int n, count, i, done = 0;
+	size_t skip, len;
+	const char *bytes;
+	DWORD written;
+
+	luaL_checktype(L, 2, LUA_TTABLE);
+	lua_settop(L, 2);
+	if ((n = (int)luaL_len(L, 2)) > SOCKET_MAXVEC)
+		bufs = lua_newuserdatauv(L, n*sizeof(WSABUF), 0);
+	s->write = FALSE;
+	do {
+		for (i = 1, count = 0, skip = sent; i <= n; i++) {
+			lua_rawgeti(L, 2, i);
+			if ( !(bytes = chunk_bytes(L, -1, &len)) )
+				luaL_error(L, "bad chunk #%d (string or Buffer expected, found %s)", i, luaL_typename(L, -1));
+			lua_pop(L, 1);
+			if (skip >= len) {
+				skip -= len;
+				continue;
+			}
+			bufs[count].buf = (char*)bytes + skip;
+			bufs[count++].len = (ULONG)(len - skip);
+			skip = 0;
+		}
+		if (!count)
+			break;
+		if (s->tls) {
+			//--- chunks are coalesced in full records, skipping the bytes already held in records that would have blocked
+			for (i = 0, skip = s->tls->writer.held; i < count && !done; i++, skip = 0)
+				if (skip < bufs[i].len)
+					done = EncryptWrite(s, bufs[i].buf + skip, bufs[i].len - skip);
+				else skip -= bufs[i].len;
+			if (!done)
+				done = EncryptFlush(s);
+			//--- only the chunks whose records have all been sent are counted
+			sent += tlsrec_release(&s->tls->writer);
+			if (done == -2)
+				SetLastError(ERROR_NOT_ENOUGH_MEMORY);
+			if (done)
+				return send_result(L, s, SOCKET_ERROR, sent, Socket_sendvk);
+		} else if (WSASend(s->sock, bufs, count, &written, 0, NULL, NULL) == SOCKET_ERROR)
+			return send_result(L, s, SOCKET_ERROR, sent, Socket_sendvk);
+		else
+			sent += written;
+	//--- async tasks wait until all chunks have been sent
+	} while (async_intask(L, s));
+	return send_result(L, s, done, sent, Socket_sendvk);
+}
+
+static int Socket_sendvk(lua_State *L, int status, lua_KContext ctx) {
+	return sendv(L, (size_t)ctx);
+}
+
+//--- Socket:sendv(chunks) sends a table of strings and Buffers with a single call
+LUA_METHOD(Socket, sendv) {
+	return sendv(L, 0);
+}
+
+//--- Sends the file with TransmitFile(), the kernel reading it directly from the file cache
+static int transmit(Socket *s, HANDLE h, ULONGLONG offset, ULONGLONG length, size_t *sent) {
+	LARGE_INTEGER pos;
+	DWORD n;
+
+	while (*sent < length) {
+		pos.QuadPart = (LONGLONG)(offset + *sent);
+		n = (DWORD)min(length - *sent, SOCKET_TRANSMITMAX);
+		if (!SetFilePointerEx(h, pos, NULL, FILE_BEGIN) || !TransmitFile(s->sock, h, n, 0, NULL, NULL, TF_USE_KERNEL_APC))
+			return SOCKET_ERROR;
+		*sent += n;
+	}
+	return 0;
+}
+
+//--- Sends the file by chunks read in memory, for TLS and non-blocking Sockets
+static int send_chunks(lua_State *L, Socket *s, HANDLE h, ULONGLONG offset, ULONGLONG length, size_t *sent) {
+	OVERLAPPED ov = {0};
+	ULONGLONG pos;
+	DWORD len;
+	char *chunk;
+	int done = 0;
+
+	if ( !(chunk = malloc(SOCKET_SENDCHUNK)) ) {
+		WSASetLastError(WSA_NOT_ENOUGH_MEMORY);
+		return SOCKET_ERROR;
+	}
+	while (*sent < length) {
+		pos = offset + *sent;
+		ov.Offset = (DWORD)pos;
+		ov.OffsetHigh = (DWORD)(pos >> 32);
+		if (!ReadFile(h, chunk, (DWORD)min(length - *sent, SOCKET_SENDCHUNK), &len, &ov)) {
+			done = SOCKET_ERROR;
+			break;
+		}
+		if (!len)
+			break;
+		if ((done = s->tls ? EncryptSend(s, chunk, len) : send(s->sock, chunk, len, 0)) < 0)
+			break;
+		*sent += done;
+		done = 0;
+	}
+	free(chunk);
+	return done < 0 ? SOCKET_ERROR : 0;
+}
+
+static int sendfile(lua_State *L, size_t sent) {
+	Socket *s = lua_self(L, 1, Socket);
+	wchar_t *fname = luaL_checkFilename(L, 2);
+	lua_Integer offset = luaL_optinteger(L, 3, 0), length = luaL_optinteger(L, 4, -1);
+	LARGE_INTEGER size;
+	HANDLE h;
+	int done;
+
+	if (offset < 0) {
+		free(fname);
+		luaL_argerror(L, 3, "negative offset");
+	}
+	h = CreateFileW(fname, GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, NULL);
+	free(fname);
+	if (h == INVALID_HANDLE_VALUE || !GetFileSizeEx(h, &size)) {
+		if (h != INVALID_HANDLE_VALUE)
+			CloseHandle(h);
+		lua_pushboolean(L, FALSE);
+		return 1;
+	}
+	if (offset > size.QuadPart)
+		offset = size.QuadPart;
+	if (length < 0 || length > size.QuadPart - offset)
+		length = size.QuadPart - offset;
+	s->write = FALSE;
+	done = s->tls || !s->blocking ? send_chunks(L, s, h, offset, length, &sent) : transmit(s, h, offset, length, &sent);
+	CloseHandle(h);
+	return send_result(L, s, done, sent, Socket_sendfilek);
+}
+
+static int Socket_sendfilek(lua_State *L, int status, lua_KContext ctx) {
+	return sendfile(L, (size_t)ctx);
+}
+
+//--- Socket:sendfile(file, [offset], [length]) sends a file content without loading it in Lua memory
+LUA_METHOD(Socket, sendfile) {
+	return sendfile(L, 0);
+}
+
 LUA_METHOD(Socket, start_tls)	{
 	SCHANNEL_CRED sc = {0};
 	PCCERT_CONTEXT pCertContext = NULL;
@@ -562,9 +992,36 @@ error:
 	return 1;
 }
 
+//--- Async connections complete when the socket becomes writable, or fail when select() reports an exception
+//--- WSAPoll() does not report failed connections before Windows 10 2004, so the socket is also checked periodically
+static int Socket_connectk(lua_State *L, int status, lua_KContext ctx) {
+	Socket *s = lua_self(L, 1, Socket);
+	int err = 0, len = sizeof(int);
+	TIMEVAL now = {0, 0};
+	fd_set wfds, efds;
+
+	FD_ZERO(&wfds);
+	FD_ZERO(&efds);
+	FD_SET(s->sock, &wfds);
+	FD_SET(s->sock, &efds);
+	switch (select(0, NULL, &wfds, &efds, &now)) {
+		case 0:				return async_waitfor(L, s, POLLER_WRITE, SOCKET_CONNECTPOLL, 0, Socket_connectk);
+		case SOCKET_ERROR:	err = WSAGetLastError();
+							break;
+		default:			if (getsockopt(s->sock, SOL_SOCKET, SO_ERROR, (char*)&err, &len) == SOCKET_ERROR)
+								err = WSAGetLastError();
+	}
+	if (err)
+		WSASetLastError(err);
+	lua_pushboolean(L, err == 0);
+	return 1;
+}
+
 LUA_METHOD(Socket, connect) {
 	Socket *s = lua_self(L, 1, Socket);
 	int result = connect(s->sock, (SOCKADDR*)&s->addr, s->sizeaddr);
+	if (result == SOCKET_ERROR && WSAGetLastError() == WSAEWOULDBLOCK && async_intask(L, s))
+		return async_waitfor(L, s, POLLER_WRITE, SOCKET_CONNECTPOLL, 0, Socket_connectk);
 	result = (result != SOCKET_ERROR) || ((result == SOCKET_ERROR) && (GetLastError() == WSAEWOULDBLOCK)) ? TRUE : FALSE;
 	lua_pushboolean(L, result);
 	return 1;	
@@ -590,36 +1047,45 @@ LUA_METHOD(Socket, accept) {
 	
 	server->read = FALSE;
 	if ((int)accepted == SOCKET_ERROR ) {
-		if (WSAGetLastError() == WSAEWOULDBLOCK)
+		if (WSAGetLastError() == WSAEWOULDBLOCK) {
+			if (async_intask(L, server))
+				return async_wait(L, server, POLLER_READ, 0, Socket_acceptk);
 			lua_pushnil(L);
-		else
+		} else
 			lua_pushboolean(L, FALSE);
 	}
 	else {
 		DWORD size = len;
-		Socket *s = (Socket *)calloc(1, sizeof(Socket));
-		s->sock = accepted;
-		s->isServerContext = TRUE;
+		Socket s = {0};
+		s.sock = accepted;
+		s.isServerContext = TRUE;
 		if (addr.ss_family == AF_INET) {
-			s->addr = *(SOCKADDR_IN*)paddr;
-			s->sizeaddr = sizeof(SOCKADDR_IN);
+			s.addr = *(SOCKADDR_IN*)paddr;
+			s.sizeaddr = sizeof(SOCKADDR_IN);
 		}
 		else {
-			s->addr6 = *(SOCKADDR_IN6*)paddr;
-			s->sizeaddr = sizeof(SOCKADDR_IN6);
+			s.addr6 = *(SOCKADDR_IN6*)paddr;
+			s.sizeaddr = sizeof(SOCKADDR_IN6);
 		}
-		WSAAddressToStringA((LPSOCKADDR)&s->addr, s->sizeaddr, NULL, s->ip, &size);
-		s->blocking = TRUE;
-		lua_pushlightuserdata(L, s);
+		WSAAddressToStringA((LPSOCKADDR)&s.addr, s.sizeaddr, NULL, s.ip, &size);
+		//--- accepted sockets inherit the non-blocking mode of the listening socket
+		s.blocking = server->blocking;
+		s.async = server->async;
+		lua_pushlightuserdata(L, &s);
 		lua_pushinstance(L, Socket, 1);
 	}
 	return 1;
 }
 
+static int Socket_acceptk(lua_State *L, int status, lua_KContext ctx) {
+	return Socket_accept(L);
+}
+
 LUA_METHOD(Socket, peek) {
+	Socket *s = lua_self(L, 1, Socket);
 	u_long size;
-	ioctlsocket(lua_self(L, 1, Socket)->sock, FIONREAD, &size);
-	lua_pushinteger(L, (lua_Integer)size);
+	ioctlsocket(s->sock, FIONREAD, &size);
+	lua_pushinteger(L, (lua_Integer)size + (lua_Integer)s->rlen);
 	return 1;
 }
 
@@ -632,10 +1098,27 @@ LUA_PROPERTY_SET(Socket, blocking) {
 	Socket *s = lua_self(L, 1, Socket);
 	unsigned long mode = !lua_toboolean(L, 2);
 	ioctlsocket(s->sock, FIONBIO, &mode);
-	s->blocking = mode;
+	s->blocking = !mode;
+	if (s->blocking)
+		s->async = FALSE;
+	return 0;
+}
+
+//--- Async Sockets are non-blocking, and yield the current net task instead of returning nil
+LUA_PROPERTY_SET(Socket, async) {
+	Socket *s = lua_self(L, 1, Socket);
+	unsigned long mode = lua_toboolean(L, 2);
+	ioctlsocket(s->sock, FIONBIO, &mode);
+	s->blocking = !mode;
+	s->async = mode;
 	return 0;
 }
 
+LUA_PROPERTY_GET(Socket, async) {
+	lua_pushboolean(L, lua_self(L, 1, Socket)->async);
+	return 1;
+}
+
 LUA_PROPERTY_GET(Socket, blocking) {
 	lua_pushboolean(L, lua_self(L, 1, Socket)->blocking);
 	return 1;
@@ -697,7 +1180,6 @@ LUA_METHOD(Socket,__gc)
 	if ((s = lua_self(L, 1, Socket))) {
 		if (s->sock != INVALID_SOCKET)
 			Socket_close(L);
-		free(s);
 	}
 	return 0;
 }
@@ -713,13 +1195,21 @@ const luaL_Reg Socket_methods[] = {
 	{"connect",			Socket_connect},
 	{"bind",			Socket_listen},
 	{"peek",			Socket_peek},
+	{"readexactly",		Socket_readexactly},
+	{"readline",		Socket_readline},
+	{"readuntil",		Socket_readuntil},
 	{"recv",			Socket_recv},
+	{"recvinto",		Socket_recvinto},
 	{"send",			Socket_send},
 	{"sendall",			Socket_sendall},
+	{"sendfile",		Socket_sendfile},
+	{"sendv",			Socket_sendv},
 	{"shutdown",		Socket_shutdown},
 	{"starttls",		Socket_start_tls},
 	{"get_blocking",	Socket_getblocking},
 	{"set_blocking",	Socket_setblocking},
+	{"get_async",		Socket_getasync},
+	{"set_async",		Socket_setasync},
 	{"get_nodelay",		Socket_getnodelay},
 	{"set_nodelay",		Socket_setnodelay},
 	{"get_port",		Socket_getport},
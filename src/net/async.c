@@ -0,0 +1,354 @@
+/*
+ | LuaRT - A Windows programming framework for Lua
+ | Luart.org, Copyright (c) Tine Samir 2022.
+ | See Copyright Notice in LICENSE.TXT
+ |-------------------------------------------------
+ | async.c | LuaRT net module tasks scheduler
+ | Tasks are coroutines that yield when an async Socket operation would block, or when sleeping
+*/
+
+#include <Socket.h>
+#include "lrtapi.h"
+#include <luart.h>
+
+#include <string.h>
+
+//--- Tasks waiting for a Socket (registry references to their thread, LUA_NOREF when none)
+//--- and the timers limiting their waits (0 when none)
+typedef struct {
+	int				reader;
+	int				writer;
+	unsigned int	rtimer;
+	unsigned int	wtimer;
+} Waiters;
+
+typedef struct {
+	ULONGLONG		due;
+	unsigned int	seq;
+	int				ref;
+	poller_fd		fd;			//--- Socket wait ended by the timer, INVALID_SOCKET for net.sleep()
+	int				events;
+} Timer;
+
+static struct {
+	poller_t		*poller;
+	poller_entry	*events;
+	int				nevents;
+	int				*ready;		//--- ring buffer of tasks ready to be resumed
+	int				rhead;
+	int				rcount;
+	int				rsize;
+	Timer			*timers;	//--- binary min-heap ordered by due time, then by creation
+	int				ntimers;
+	int				tsize;
+	unsigned int	seq;
+	int				tasks;
+	lua_State		*current;	//--- task being resumed, and its reference
+	int				ref;
+	BOOL			waiting;	//--- set when the current task yields to wait for a Socket or a timer
+} sched;
+
+static void *grow(lua_State *L, void *p, int *size, size_t elemsize) {
+	int newsize = *size ? *size*2 : 64;
+	if ( !(p = realloc(p, newsize*elemsize)) )
+		luaL_error(L, "not enough memory");
+	*size = newsize;
+	return p;
+}
+
+//-------------------------------------[ Ready queue ]
+static void ready_push(lua_State *L, int ref) {
+	if (sched.rcount == sched.rsize) {
+		int oldsize = sched.rsize;
+		sched.ready = grow(L, sched.ready, &sched.rsize, sizeof(int));
+		//--- unwraps the ring buffer in the enlarged array
+		if (sched.rhead + sched.rcount > oldsize)
+			memcpy(sched.ready + oldsize, sched.ready, (sched.rhead + sched.rcount - oldsize)*sizeof(int));
+	}
+	sched.ready[(sched.rhead + sched.rcount++) % sched.rsize] = ref;
+}
+
+static int ready_pop(void) {
+	int ref = sched.ready[sched.rhead];
+	sched.rhead = (sched.rhead + 1) % sched.rsize;
+	sched.rcount--;
+	return ref;
+}
+
+//-------------------------------------[ Timers ]
+static BOOL timer_before(Timer *a, Timer *b) {
+	return a->due < b->due || (a->due == b->due && (int)(a->seq - b->seq) < 0);
+}
+
+//--- Returns the timer sequence number, never 0
+static unsigned int timer_push(lua_State *L, ULONGLONG due, int ref, poller_fd fd, int events) {
+	Timer t, tmp;
+	int i, parent;
+
+	if (sched.ntimers == sched.tsize)
+		sched.timers = grow(L, sched.timers, &sched.tsize, sizeof(Timer));
+	t.due = due;
+	if (!(t.seq = ++sched.seq))
+		t.seq = ++sched.seq;
+	t.ref = ref;
+	t.fd = fd;
+	t.events = events;
+	sched.timers[i = sched.ntimers++] = t;
+	for (; i && timer_before(&sched.timers[i], &sched.timers[parent = (i-1)/2]); i = parent) {
+		tmp = sched.timers[i];
+		sched.timers[i] = sched.timers[parent];
+		sched.timers[parent] = tmp;
+	}
+	return t.seq;
+}
+
+static Timer timer_pop(void) {
+	Timer t = sched.timers[0], tmp;
+	int i = 0, child;
+
+	sched.timers[0] = sched.timers[--sched.ntimers];
+	while ((child = 2*i+1) < sched.ntimers) {
+		if (child+1 < sched.ntimers && timer_before(&sched.timers[child+1], &sched.timers[child]))
+			child++;
+		if (!timer_before(&sched.timers[child], &sched.timers[i]))
+			break;
+		tmp = sched.timers[i];
+		sched.timers[i] = sched.timers[child];
+		sched.timers[child] = tmp;
+		i = child;
+	}
+	return t;
+}
+
+//-------------------------------------[ Socket waits ]
+static void wake(lua_State *L, poller_entry *e, int events) {
+	Waiters *w = e->udata;
+	poller_fd fd = e->fd;
+	int interest;
+
+	if ((events & (POLLER_READ | POLLER_ERROR)) && w->reader != LUA_NOREF) {
+		ready_push(L, w->reader);
+		w->reader = LUA_NOREF;
+		w->rtimer = 0;
+	}
+	if ((events & (POLLER_WRITE | POLLER_ERROR)) && w->writer != LUA_NOREF) {
+		ready_push(L, w->writer);
+		w->writer = LUA_NOREF;
+		w->wtimer = 0;
+	}
+	if ( (interest = (w->reader != LUA_NOREF ? POLLER_READ : 0) | (w->writer != LUA_NOREF ? POLLER_WRITE : 0)) )
+		poller_modify(sched.poller, fd, interest);
+	else {
+		poller_remove(sched.poller, fd);
+		free(w);
+	}
+}
+
+BOOL async_intask(lua_State *L, Socket *s) {
+	return s->async && L == sched.current;
+}
+
+//--- Resumes a task whose Socket wait has timed out, unless that wait has already ended
+static void wait_timeout(lua_State *L, Timer *t) {
+	poller_entry *e;
+	Waiters *w;
+
+	if (sched.poller && (e = poller_find(sched.poller, t->fd))) {
+		w = e->udata;
+		if (t->seq == (t->events & POLLER_READ ? w->rtimer : w->wtimer))
+			wake(L, e, t->events);
+	}
+}
+
+int async_wait(lua_State *L, Socket *s, int events, lua_KContext ctx, lua_KFunction k) {
+	return async_waitfor(L, s, events, -1, ctx, k);
+}
+
+int async_waitfor(lua_State *L, Socket *s, int events, int delay, lua_KContext ctx, lua_KFunction k) {
+	poller_entry *e;
+	Waiters *w;
+	unsigned int seq = 0;
+
+	if (!sched.poller && !(sched.poller = poller_new()))
+		luaL_error(L, "not enough memory");
+	if ( (e = poller_find(sched.poller, s->sock)) ) {
+		w = e->udata;
+		if ((events & POLLER_READ && w->reader != LUA_NOREF) || (events & POLLER_WRITE && w->writer != LUA_NOREF))
+			luaL_error(L, "Socket is already awaited by another task");
+		poller_modify(sched.poller, s->sock, e->events | events);
+	} else {
+		if ( !(w = malloc(sizeof(Waiters))) )
+			luaL_error(L, "not enough memory");
+		w->reader = w->writer = LUA_NOREF;
+		w->rtimer = w->wtimer = 0;
+		if (poller_add(sched.poller, s->sock, events, w)) {
+			free(w);
+			luaL_error(L, "cannot wait for Socket");
+		}
+	}
+	if (delay >= 0)
+		seq = timer_push(L, GetTickCount64() + (ULONGLONG)delay, sched.ref, s->sock, events);
+	if (events & POLLER_READ) {
+		w->reader = sched.ref;
+		w->rtimer = seq;
+	} else {
+		w->writer = sched.ref;
+		w->wtimer = seq;
+	}
+	sched.waiting = TRUE;
+	return lua_yieldk(L, 0, ctx, k);
+}
+
+//--- Resumes the tasks waiting for a Socket being closed, their operation will then fail
+void async_release(lua_State *L, Socket *s) {
+	poller_entry *e;
+
+	if (sched.poller && (e = poller_find(sched.poller, s->sock)))
+		wake(L, e, POLLER_ERROR);
+}
+
+//-------------------------------------[ Scheduler ]
+static void resume(lua_State *L, int ref) {
+	lua_State *co;
+	int status, nres;
+
+	lua_rawgeti(L, LUA_REGISTRYINDEX, ref);
+	co = lua_tothread(L, -1);
+	lua_pop(L, 1);
+	sched.current = co;
+	sched.ref = ref;
+	sched.waiting = FALSE;
+	status = lua_resume(co, L, lua_status(co) == LUA_OK ? lua_gettop(co)-1 : 0, &nres);
+	sched.current = NULL;
+	if (status == LUA_YIELD) {
+		lua_pop(co, nres);
+		//--- tasks that yield by themselves are resumed at the next step
+		if (!sched.waiting)
+			ready_push(L, ref);
+		return;
+	}
+	sched.tasks--;
+	luaL_unref(L, LUA_REGISTRYINDEX, ref);
+	if (status != LUA_OK) {
+		lua_xmove(co, L, 1);
+		if (lua_type(L, -1) == LUA_TSTRING)
+			luaL_traceback(L, co, lua_tostring(L, -1), 0);
+		lua_resetthread(co);
+		lua_error(L);
+	}
+}
+
+//--- Runs one scheduler step, waiting for events unless nowait is set
+//--- Returns FALSE when there is nothing left to wait for
+static BOOL step(lua_State *L, BOOL nowait) {
+	int timeout = -1, count = sched.poller ? poller_count(sched.poller) : 0, n, i;
+	ULONGLONG now;
+	poller_entry *e;
+	Timer t;
+
+	if (sched.current)
+		luaL_error(L, "cannot run the scheduler from a task");
+	if (sched.rcount || nowait)
+		timeout = 0;
+	else if (sched.ntimers) {
+		now = GetTickCount64();
+		timeout = sched.timers[0].due > now ? (int)(sched.timers[0].due - now) : 0;
+	} else if (!count)
+		return FALSE;
+	if (count || timeout > 0) {
+		if (count > sched.nevents) {
+			if ( !(e = realloc(sched.events, count*sizeof(poller_entry))) )
+				luaL_error(L, "not enough memory");
+			sched.events = e;
+			sched.nevents = count;
+		}
+		if (!sched.poller) {
+			Sleep(timeout);
+			n = 0;
+		} else if ((n = poller_wait(sched.poller, sched.events, count, timeout)) == -1) {
+			lasterror(L, WSAGetLastError());
+			lua_error(L);
+		}
+		for (i = 0; i < n; i++)
+			if ( (e = poller_find(sched.poller, sched.events[i].fd)) )
+				wake(L, e, sched.events[i].events);
+	}
+	now = GetTickCount64();
+	while (sched.ntimers && sched.timers[0].due <= now)
+		if ((t = timer_pop()).fd == INVALID_SOCKET)
+			ready_push(L, t.ref);
+		else wait_timeout(L, &t);
+	//--- tasks made ready while running this step are resumed at the next one
+	for (n = sched.rcount; n; n--)
+		resume(L, ready_pop());
+	return TRUE;
+}
+
+//--- net.spawn(func, ...) creates a task that will run func(...) at the next scheduler step
+LUA_METHOD(net, spawn) {
+	int n = lua_gettop(L), i;
+	lua_State *co;
+
+	luaL_checktype(L, 1, LUA_TFUNCTION);
+	co = lua_newthread(L);
+	for (i = 1; i <= n; i++)
+		lua_pushvalue(L, i);
+	lua_xmove(L, co, n);
+	lua_pushvalue(L, -1);
+	ready_push(L, luaL_ref(L, LUA_REGISTRYINDEX));
+	sched.tasks++;
+	return 1;
+}
+
+//--- net.sleep(delay) suspends the current task for delay milliseconds, or blocks when called outside a task
+LUA_METHOD(net, sleep) {
+	lua_Integer delay = luaL_optinteger(L, 1, 0);
+
+	if (delay < 0)
+		delay = 0;
+	if (L != sched.current) {
+		Sleep((DWORD)delay);
+		return 0;
+	}
+	timer_push(L, GetTickCount64() + (ULONGLONG)delay, sched.ref, INVALID_SOCKET, 0);
+	sched.waiting = TRUE;
+	return lua_yield(L, 0);
+}
+
+//--- net.run([func, ...]) runs the scheduler until all tasks have terminated
+LUA_METHOD(net, run) {
+	if (lua_gettop(L)) {
+		net_spawn(L);
+		lua_settop(L, 0);
+	}
+	while (sched.tasks && step(L, FALSE));
+	return 0;
+}
+
+//--- net.update() runs one scheduler step without waiting, to be used within another event loop
+LUA_METHOD(net, update) {
+	step(L, TRUE);
+	lua_pushinteger(L, sched.tasks);
+	return 1;
+}
+
+LUA_PROPERTY_GET(net, tasks) {
+	lua_pushinteger(L, sched.tasks);
+	return 1;
+}
+
+void async_finalize(void) {
+	poller_entry *e;
+
+	if (sched.poller) {
+		while ( (e = poller_entry_at(sched.poller, 0)) ) {
+			free(e->udata);
+			poller_remove(sched.poller, e->fd);
+		}
+		poller_free(sched.poller);
+	}
+	free(sched.events);
+	free(sched.ready);
+	free(sched.timers);
+	memset(&sched, 0, sizeof(sched));
+}
@@ -0,0 +1,258 @@
+/*
+ | LuaRT - A Windows programming framework for Lua
+ | Luart.org, Copyright (c) Tine Samir 2022.
+ | See Copyright Notice in LICENSE.TXT
+ |-------------------------------------------------
+ | poller.c | Persistent socket readiness poller (WSAPoll on Windows, epoll elsewhere)
+*/
+
+#include "poller.h"
+#include <stdint.h>
+#include <stdlib.h>
+
+#ifndef _WIN32
+#include <sys/epoll.h>
+#include <unistd.h>
+#endif
+
+//--- Registered sockets are kept in a dense array, with an fd -> index hash table (linear probing)
+struct poller_t {
+	poller_entry	*entries;
+	int				count;
+	int				capacity;
+	int				*slots;		//--- index+1 in entries, 0 for an empty slot
+	unsigned int	slotmask;
+#ifdef _WIN32
+	WSAPOLLFD		*fds;		//--- kept in the same order than entries
+#else
+	int				epfd;
+	struct epoll_event *ready;
+#endif
+};
+
+static unsigned int hash_fd(poller_fd fd) {
+	uint64_t h = (uint64_t)fd * 0x9E3779B97F4A7C15ULL;
+	return (unsigned int)(h >> 32);
+}
+
+//--- Returns the slot of fd, or the empty slot where it should be inserted
+static unsigned int find_slot(poller_t *p, poller_fd fd) {
+	unsigned int i = hash_fd(fd) & p->slotmask;
+
+	while (p->slots[i] && p->entries[p->slots[i]-1].fd != fd)
+		i = (i + 1) & p->slotmask;
+	return i;
+}
+
+//--- Removes a slot, moving back the following entries of the probe sequence so no tombstone is needed
+static void delete_slot(poller_t *p, unsigned int i) {
+	unsigned int j = i, k;
+
+	for (;;) {
+		j = (j + 1) & p->slotmask;
+		if (!p->slots[j])
+			break;
+		k = hash_fd(p->entries[p->slots[j]-1].fd) & p->slotmask;
+		if (i <= j ? (i < k && k <= j) : (i < k || k <= j))
+			continue;
+		p->slots[i] = p->slots[j];
+		i = j;
+	}
+	p->slots[i] = 0;
+}
+
+static int grow(poller_t *p) {
+	int capacity = p->capacity ? p->capacity*2 : 64, i;
+	unsigned int mask = (unsigned int)capacity*2 - 1;
+	poller_entry *entries;
+	int *slots;
+
+	if ( !(entries = realloc(p->entries, capacity*sizeof(poller_entry))) )
+		return -1;
+	p->entries = entries;
+#ifdef _WIN32
+	{
+		WSAPOLLFD *fds = realloc(p->fds, capacity*sizeof(WSAPOLLFD));
+		if (!fds)
+			return -1;
+		p->fds = fds;
+	}
+#else
+	{
+		struct epoll_event *ready = realloc(p->ready, capacity*sizeof(struct epoll_event));
+		if (!ready)
+			return -1;
+		p->ready = ready;
+	}
+#endif
+	if ( !(slots = calloc(mask+1, sizeof(int))) )
+		return -1;
+	free(p->slots);
+	p->slots = slots;
+	p->slotmask = mask;
+	p->capacity = capacity;
+	for (i = 0; i < p->count; i++)
+		p->slots[find_slot(p, p->entries[i].fd)] = i+1;
+	return 0;
+}
+
+poller_t *poller_new(void) {
+	poller_t *p = calloc(1, sizeof(poller_t));
+
+	if (p) {
+#ifndef _WIN32
+		if ((p->epfd = epoll_create1(EPOLL_CLOEXEC)) == -1) {
+			free(p);
+			return NULL;
+		}
+#endif
+		if (grow(p)) {
+			poller_free(p);
+			return NULL;
+		}
+	}
+	return p;
+}
+
+void poller_free(poller_t *p) {
+#ifdef _WIN32
+	free(p->fds);
+#else
+	close(p->epfd);
+	free(p->ready);
+#endif
+	free(p->slots);
+	free(p->entries);
+	free(p);
+}
+
+#ifdef _WIN32
+static SHORT poll_events(int events) {
+	return (events & POLLER_READ ? POLLRDNORM : 0) | (events & POLLER_WRITE ? POLLWRNORM : 0);
+}
+#else
+static uint32_t poll_events(int events) {
+	return (events & POLLER_READ ? EPOLLIN | EPOLLRDHUP : 0) | (events & POLLER_WRITE ? EPOLLOUT : 0);
+}
+
+static int epoll_update(poller_t *p, int op, poller_fd fd, int events) {
+	struct epoll_event ev = {0};
+
+	ev.events = poll_events(events);
+	ev.data.fd = fd;
+	return epoll_ctl(p->epfd, op, fd, &ev);
+}
+#endif
+
+int poller_add(poller_t *p, poller_fd fd, int events, void *udata) {
+	unsigned int slot;
+	poller_entry *e;
+
+	if (p->slots[find_slot(p, fd)] || (p->count == p->capacity && grow(p)))
+		return -1;
+	slot = find_slot(p, fd);
+#ifdef _WIN32
+	p->fds[p->count].fd = fd;
+	p->fds[p->count].events = poll_events(events);
+	p->fds[p->count].revents = 0;
+#else
+	if (epoll_update(p, EPOLL_CTL_ADD, fd, events))
+		return -1;
+#endif
+	e = &p->entries[p->count++];
+	e->fd = fd;
+	e->events = events & (POLLER_READ | POLLER_WRITE);
+	e->udata = udata;
+	p->slots[slot] = p->count;
+	return 0;
+}
+
+int poller_modify(poller_t *p, poller_fd fd, int events) {
+	int idx = p->slots[find_slot(p, fd)];
+
+	if (!idx--)
+		return -1;
+#ifdef _WIN32
+	p->fds[idx].events = poll_events(events);
+#else
+	if (epoll_update(p, EPOLL_CTL_MOD, fd, events))
+		return -1;
+#endif
+	p->entries[idx].events = events & (POLLER_READ | POLLER_WRITE);
+	return 0;
+}
+
+int poller_remove(poller_t *p, poller_fd fd) {
+	unsigned int slot = find_slot(p, fd);
+	int idx = p->slots[slot], last = p->count - 1;
+
+	if (!idx--)
+		return -1;
+#ifndef _WIN32
+	//--- closed descriptors have already been removed from the epoll set
+	epoll_update(p, EPOLL_CTL_DEL, fd, 0);
+#endif
+	delete_slot(p, slot);
+	if (idx != last) {
+		p->entries[idx] = p->entries[last];
+#ifdef _WIN32
+		p->fds[idx] = p->fds[last];
+#endif
+		p->slots[find_slot(p, p->entries[idx].fd)] = idx+1;
+	}
+	p->count--;
+	return 0;
+}
+
+poller_entry *poller_find(poller_t *p, poller_fd fd) {
+	int idx = p->slots[find_slot(p, fd)];
+	return idx ? &p->entries[idx-1] : NULL;
+}
+
+int poller_count(poller_t *p) {
+	return p->count;
+}
+
+poller_entry *poller_entry_at(poller_t *p, int i) {
+	return i >= 0 && i < p->count ? &p->entries[i] : NULL;
+}
+
+int poller_wait(poller_t *p, poller_entry *events, int max, int timeout) {
+	int i, n, done = 0;
+	poller_entry *e;
+
+#ifdef _WIN32
+	SHORT revents;
+
+	if (!p->count) {
+		//--- WSAPoll() fails without sockets
+		if (timeout > 0)
+			Sleep(timeout);
+		return 0;
+	}
+	if ((n = WSAPoll(p->fds, p->count, timeout)) == SOCKET_ERROR)
+		return -1;
+	for (i = 0; n && done < max && i < p->count; i++)
+		if ( (revents = p->fds[i].revents) ) {
+			n--;
+			e = &events[done++];
+			*e = p->entries[i];
+			e->events = (revents & (POLLRDNORM | POLLHUP) ? POLLER_READ : 0) | (revents & POLLWRNORM ? POLLER_WRITE : 0) | (revents & (POLLERR | POLLNVAL) ? POLLER_ERROR : 0);
+		}
+#else
+	uint32_t revents;
+	poller_entry *entry;
+
+	if ((n = epoll_wait(p->epfd, p->ready, p->capacity, timeout)) == -1)
+		return -1;
+	//--- events beyond max are reported again by the next call, as sockets are level-triggered
+	for (i = 0; i < n && done < max; i++)
+		if ( (entry = poller_find(p, p->ready[i].data.fd)) ) {
+			revents = p->ready[i].events;
+			e = &events[done++];
+			*e = *entry;
+			e->events = (revents & (EPOLLIN | EPOLLHUP | EPOLLRDHUP) ? POLLER_READ : 0) | (revents & EPOLLOUT ? POLLER_WRITE : 0) | (revents & EPOLLERR ? POLLER_ERROR : 0);
+		}
+#endif
+	return done;
+}
@@ -0,0 +1,44 @@
+/*
+ | LuaRT - A Windows programming framework for Lua
+ | Luart.org, Copyright (c) Tine Samir 2022.
+ | See Copyright Notice in LICENSE.TXT
+ |-------------------------------------------------
+ | poller.h | Persistent socket readiness poller (WSAPoll on Windows, epoll elsewhere)
+*/
+
+#pragma once
+
+#ifdef _WIN32
+#include <winsock2.h>
+typedef SOCKET poller_fd;
+#else
+typedef int poller_fd;
+#endif
+
+//--- Event flags, POLLER_ERROR is always reported and cannot be registered
+#define POLLER_READ		1
+#define POLLER_WRITE	2
+#define POLLER_ERROR	4
+
+typedef struct {
+	poller_fd	fd;
+	int			events;		//--- registered interest for poller_entry, ready events for poller_wait() results
+	void		*udata;
+} poller_entry;
+
+typedef struct poller_t poller_t;
+
+poller_t *poller_new(void);
+void poller_free(poller_t *p);
+//--- Registers a socket, returns 0 on success or -1 (already registered, out of memory or system error)
+int poller_add(poller_t *p, poller_fd fd, int events, void *udata);
+int poller_modify(poller_t *p, poller_fd fd, int events);
+//--- Unregisters a socket, returns 0 on success or -1 if it was not registered
+int poller_remove(poller_t *p, poller_fd fd);
+poller_entry *poller_find(poller_t *p, poller_fd fd);
+int poller_count(poller_t *p);
+//--- Registered entries, from 0 to poller_count()-1 (indexes change when sockets are removed)
+poller_entry *poller_entry_at(poller_t *p, int i);
+//--- Waits up to timeout milliseconds (-1 for infinite) and fills events with at most max ready sockets
+//--- Returns the number of ready sockets, or -1 on error
+int poller_wait(poller_t *p, poller_entry *events, int max, int timeout);
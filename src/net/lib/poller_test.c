@@ -0,0 +1,149 @@
+/*
+ | LuaRT - A Windows programming framework for Lua
+ | Luart.org, Copyright (c) Tine Samir 2022.
+ | See Copyright Notice in LICENSE.TXT
+ |-------------------------------------------------
+ | poller_test.c | Standalone stress test of the socket poller (POSIX build)
+ |
+ | gcc -std=gnu99 -Wall -o poller_test net/lib/poller_test.c net/lib/poller.c && ./poller_test
+*/
+
+#include "poller.h"
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+//--- Socket pairs, the poller watches the first socket of each pair (keep 2*SOCKETS under the open files limit)
+#define SOCKETS		400
+#define OPERATIONS	200000
+
+static int failures = 0;
+
+#define check(cond) do { if (!(cond)) { fprintf(stderr, "%s:%d: check failed: %s\n", __FILE__, __LINE__, #cond); failures++; } } while (0)
+
+static int pairs[SOCKETS][2];
+static int registered[SOCKETS];		//--- registered events, 0 if not registered
+
+//--- Every registered socket is found with its udata and events, and listed exactly once by poller_entry_at()
+static void check_consistency(poller_t *p) {
+	int i, count = 0, seen[SOCKETS] = {0};
+	poller_entry *e;
+
+	for (i = 0; i < SOCKETS; i++)
+		if (registered[i]) {
+			count++;
+			e = poller_find(p, pairs[i][0]);
+			check(e && (intptr_t)e->udata == i && e->events == registered[i]);
+		} else check(!poller_find(p, pairs[i][0]));
+	check(poller_count(p) == count);
+	for (i = 0; i < poller_count(p); i++) {
+		e = poller_entry_at(p, i);
+		check(e && (intptr_t)e->udata >= 0 && (intptr_t)e->udata < SOCKETS && !seen[(intptr_t)e->udata]++);
+	}
+}
+
+static void test_operations(poller_t *p) {
+	int n, i, events;
+
+	for (n = 0; n < OPERATIONS; n++) {
+		i = rand() % SOCKETS;
+		events = 1 + rand() % 3;
+		switch (rand() % 4) {
+			case 0:
+			case 1:	if (registered[i]) {
+						check(poller_add(p, pairs[i][0], events, NULL) == -1);
+						check(poller_remove(p, pairs[i][0]) == 0);
+						registered[i] = 0;
+					} else {
+						check(poller_remove(p, pairs[i][0]) == -1);
+						check(poller_add(p, pairs[i][0], events, (void *)(intptr_t)i) == 0);
+						registered[i] = events;
+					}
+					break;
+			case 2:	if (registered[i]) {
+						check(poller_modify(p, pairs[i][0], events) == 0);
+						registered[i] = events;
+					} else check(poller_modify(p, pairs[i][0], events) == -1);
+					break;
+			case 3:	check((poller_find(p, pairs[i][0]) != NULL) == (registered[i] != 0));
+		}
+		if (n % 10000 == 0)
+			check_consistency(p);
+	}
+	check_consistency(p);
+}
+
+//--- Only the registered sockets with pending data are reported as readable, and all the writable ones as writable
+static void test_wait(poller_t *p) {
+	poller_entry ready[SOCKETS];
+	int i, n, expected = 0, reported[SOCKETS] = {0};
+	char byte;
+
+	for (i = 0; i < SOCKETS; i++)
+		if (registered[i] && poller_modify(p, pairs[i][0], POLLER_READ) == 0)
+			registered[i] = POLLER_READ;
+	check(poller_wait(p, ready, SOCKETS, 0) == 0);
+	for (i = 0; i < SOCKETS; i += 3) {
+		check(write(pairs[i][1], "x", 1) == 1);
+		expected += registered[i] != 0;
+	}
+	n = poller_wait(p, ready, SOCKETS, 100);
+	check(n == expected);
+	for (i = 0; i < n; i++) {
+		check(ready[i].events == POLLER_READ);
+		check((intptr_t)ready[i].udata % 3 == 0 && !reported[(intptr_t)ready[i].udata]++);
+	}
+	//--- max limits the results
+	if (expected > 2)
+		check(poller_wait(p, ready, 2, 0) == 2);
+	for (i = 0; i < SOCKETS; i += 3)
+		check(read(pairs[i][0], &byte, 1) == 1);
+	check(poller_wait(p, ready, SOCKETS, 0) == 0);
+	//--- connected sockets are always writable
+	expected = 0;
+	for (i = 0; i < SOCKETS; i++)
+		if (registered[i]) {
+			check(poller_modify(p, pairs[i][0], POLLER_WRITE) == 0);
+			expected++;
+		}
+	check(poller_wait(p, ready, SOCKETS, 0) == expected);
+	//--- a closed peer is reported even without registered events, as readable so that reading gets the end of stream
+	for (i = 0; i < SOCKETS && !registered[i]; i++);
+	if (i < SOCKETS) {
+		check(poller_modify(p, pairs[i][0], 0) == 0);
+		close(pairs[i][1]);
+		pairs[i][1] = -1;
+		n = poller_wait(p, ready, SOCKETS, 0);
+		check(n == expected);
+		while (n-- && (intptr_t)ready[n].udata != i);
+		check(n >= 0 && ready[n].events & POLLER_READ);
+	}
+}
+
+int main(void) {
+	poller_t *p = poller_new();
+	int i;
+
+	check(p != NULL);
+	for (i = 0; i < SOCKETS; i++)
+		if (socketpair(AF_UNIX, SOCK_STREAM, 0, pairs[i])) {
+			perror("socketpair");
+			return 1;
+		}
+	srand(1);
+	test_operations(p);
+	test_wait(p);
+	poller_free(p);
+	for (i = 0; i < SOCKETS; i++) {
+		close(pairs[i][0]);
+		if (pairs[i][1] != -1)
+			close(pairs[i][1]);
+	}
+	if (failures)
+		printf("%d check(s) failed\n", failures);
+	else puts("all tests passed");
+	return failures != 0;
+}
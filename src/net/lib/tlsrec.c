@@ -0,0 +1,136 @@
+/*
+ | LuaRT - A Windows programming framework for Lua
+ | Luart.org, Copyright (c) Tine Samir 2022.
+ | See Copyright Notice in LICENSE.TXT
+ |-------------------------------------------------
+ | tlsrec.c | TLS records framing and buffering, independent of the security provider
+*/
+
+#include "tlsrec.h"
+#include <stdlib.h>
+#include <string.h>
+
+//-------------------------------------[ Byte queue ]
+uint8_t *tlsrec_reserve(tlsrec_buffer *b, size_t room) {
+	size_t capacity;
+	uint8_t *data;
+
+	if (b->start + b->len + room > b->capacity) {
+		if (b->start) {
+			memmove(b->data, b->data + b->start, b->len);
+			b->start = 0;
+		}
+		if (b->len + room > b->capacity) {
+			for (capacity = b->capacity ? b->capacity : TLSREC_MAXSIZE; capacity < b->len + room; capacity *= 2);
+			if ( !(data = realloc(b->data, capacity)) )
+				return NULL;
+			b->data = data;
+			b->capacity = capacity;
+		}
+	}
+	return b->data + b->start + b->len;
+}
+
+int tlsrec_append(tlsrec_buffer *b, const void *data, size_t len) {
+	uint8_t *p;
+
+	if ( !(p = tlsrec_reserve(b, len)) )
+		return TLSREC_ENOMEM;
+	memcpy(p, data, len);
+	b->len += len;
+	return 0;
+}
+
+void tlsrec_consume(tlsrec_buffer *b, size_t len) {
+	b->start += len;
+	if (!(b->len -= len))
+		b->start = 0;
+}
+
+void tlsrec_free(tlsrec_buffer *b) {
+	free(b->data);
+	memset(b, 0, sizeof(tlsrec_buffer));
+}
+
+//-------------------------------------[ Framing ]
+size_t tlsrec_framed(const uint8_t *data, size_t len) {
+	size_t size;
+
+	if (len < TLSREC_HEADER)
+		return 0;
+	size = TLSREC_HEADER + ((size_t)data[3] << 8 | data[4]);
+	//--- content types are 20 to 23 (24 for heartbeat), and all protocol versions start with 3
+	if (data[0] < 20 || data[0] > 24 || data[1] != 3 || size > TLSREC_MAXSIZE)
+		return (size_t)-1;
+	return len >= size ? size : 0;
+}
+
+//-------------------------------------[ Record writer ]
+void tlsrec_writer_init(tlsrec_writer *w, size_t header, size_t trailer, size_t maxdata, tlsrec_sealfunc seal, void *udata) {
+	w->header = header;
+	w->trailer = trailer;
+	w->maxdata = maxdata;
+	w->open = 0;
+	w->held = 0;
+	w->isopen = 0;
+	w->seal = seal;
+	w->udata = udata;
+}
+
+int tlsrec_seal(tlsrec_writer *w) {
+	size_t reclen;
+
+	if (w->isopen) {
+		if (w->seal(w->udata, w->out.data + w->out.start + w->out.len, w->open, &reclen))
+			return TLSREC_ESEAL;
+		w->out.len += reclen;
+		w->isopen = 0;
+		w->open = 0;
+	}
+	return 0;
+}
+
+int tlsrec_write(tlsrec_writer *w, const void *data, size_t len) {
+	const uint8_t *p = data;
+	size_t n;
+
+	while (len) {
+		if (!w->isopen) {
+			if (!tlsrec_reserve(&w->out, w->header + w->maxdata + w->trailer))
+				return TLSREC_ENOMEM;
+			w->isopen = 1;
+		}
+		n = w->maxdata - w->open;
+		if (n > len)
+			n = len;
+		memcpy(w->out.data + w->out.start + w->out.len + w->header + w->open, p, n);
+		w->open += n;
+		w->held += n;
+		p += n;
+		len -= n;
+		if (w->open == w->maxdata && tlsrec_seal(w))
+			return TLSREC_ESEAL;
+	}
+	return 0;
+}
+
+size_t tlsrec_pending(tlsrec_writer *w, const uint8_t **data) {
+	*data = w->out.data + w->out.start;
+	return w->out.len;
+}
+
+void tlsrec_sent(tlsrec_writer *w, size_t len) {
+	//--- the open record must stay in place
+	w->out.start += len;
+	if (!(w->out.len -= len) && !w->isopen)
+		w->out.start = 0;
+}
+
+size_t tlsrec_release(tlsrec_writer *w) {
+	size_t held = w->held;
+
+	if (w->isopen || w->out.len)
+		return 0;
+	w->held = 0;
+	return held;
+}
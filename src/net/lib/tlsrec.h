@@ -0,0 +1,65 @@
+/*
+ | LuaRT - A Windows programming framework for Lua
+ | Luart.org, Copyright (c) Tine Samir 2022.
+ | See Copyright Notice in LICENSE.TXT
+ |-------------------------------------------------
+ | tlsrec.h | TLS records framing and buffering, independent of the security provider
+*/
+
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+//--- Record header (content type, protocol version, length) and maximum record size (2^14 bytes + 2048 bytes expansion)
+#define TLSREC_HEADER		5
+#define TLSREC_MAXSIZE		(TLSREC_HEADER + 16384 + 2048)
+
+//--- Errors returned by the record writer
+#define TLSREC_ENOMEM		-1
+#define TLSREC_ESEAL		-2
+
+//--- Growable byte queue, data being moved back to the start of the buffer only when more room is needed
+typedef struct {
+	uint8_t		*data;
+	size_t		start;
+	size_t		len;
+	size_t		capacity;
+} tlsrec_buffer;
+
+//--- Ensures that room bytes can be appended, returns a pointer to them or NULL when out of memory
+uint8_t *tlsrec_reserve(tlsrec_buffer *b, size_t room);
+int tlsrec_append(tlsrec_buffer *b, const void *data, size_t len);
+void tlsrec_consume(tlsrec_buffer *b, size_t len);
+void tlsrec_free(tlsrec_buffer *b);
+
+//--- Size of the complete record at the start of data, 0 if more data is needed or (size_t)-1 for an invalid record
+size_t tlsrec_framed(const uint8_t *data, size_t len);
+
+//--- Encrypts in place the record data (datalen bytes after the header), and sets the final record size
+//--- Returns 0 on success
+typedef int (*tlsrec_sealfunc)(void *udata, uint8_t *record, size_t datalen, size_t *reclen);
+
+//--- Record writer: plaintext is written to an open record, that is sealed when full or when flushed
+typedef struct {
+	tlsrec_buffer	out;		//--- sealed records waiting to be sent, followed by the open record
+	size_t			header;
+	size_t			trailer;
+	size_t			maxdata;
+	size_t			open;		//--- plaintext bytes in the open record
+	size_t			held;		//--- plaintext bytes written whose records have not all been sent yet
+	int				isopen;
+	tlsrec_sealfunc	seal;
+	void			*udata;
+} tlsrec_writer;
+
+void tlsrec_writer_init(tlsrec_writer *w, size_t header, size_t trailer, size_t maxdata, tlsrec_sealfunc seal, void *udata);
+//--- Writes plaintext, sealing each record that becomes full, returns 0, TLSREC_ENOMEM or TLSREC_ESEAL
+int tlsrec_write(tlsrec_writer *w, const void *data, size_t len);
+//--- Seals the open record if any, returns 0 or TLSREC_ESEAL
+int tlsrec_seal(tlsrec_writer *w);
+//--- Sealed bytes waiting to be sent, and their removal once sent
+size_t tlsrec_pending(tlsrec_writer *w, const uint8_t **data);
+void tlsrec_sent(tlsrec_writer *w, size_t len);
+//--- Returns the plaintext bytes written since the last release once all their records have been sent, 0 otherwise
+size_t tlsrec_release(tlsrec_writer *w);
@@ -0,0 +1,203 @@
+/*
+ | LuaRT - A Windows programming framework for Lua
+ | Luart.org, Copyright (c) Tine Samir 2022.
+ | See Copyright Notice in LICENSE.TXT
+ |-------------------------------------------------
+ | tlsrec_test.c | Standalone test of the TLS records framing and buffering, with a fake security provider
+ |
+ | gcc -std=gnu99 -Wall -o tlsrec_test net/lib/tlsrec_test.c net/lib/tlsrec.c && ./tlsrec_test
+*/
+
+#include "tlsrec.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define TRAILER		16
+#define PAYLOAD		(1 << 20)
+
+static int failures = 0;
+
+#define check(cond) do { if (!(cond)) { fprintf(stderr, "%s:%d: check failed: %s\n", __FILE__, __LINE__, #cond); failures++; } } while (0)
+
+static uint8_t src[PAYLOAD], wire[2*PAYLOAD], got[PAYLOAD];
+
+//--- Fake sealing : plaintext XORed in place, followed by a random length trailer whose last byte is its length
+static int fake_seal(void *udata, uint8_t *record, size_t datalen, size_t *reclen) {
+	size_t trailer = 1 + rand() % TRAILER, body = datalen + trailer, i;
+
+	if (udata && !--*(int *)udata)
+		return -1;
+	record[0] = 23;
+	record[1] = 3;
+	record[2] = 3;
+	record[3] = (uint8_t)(body >> 8);
+	record[4] = (uint8_t)body;
+	for (i = 0; i < datalen; i++)
+		record[TLSREC_HEADER+i] ^= 0x5A;
+	memset(record+TLSREC_HEADER+datalen, 0xEE, trailer);
+	record[TLSREC_HEADER+body-1] = (uint8_t)trailer;
+	*reclen = TLSREC_HEADER + body;
+	return 0;
+}
+
+//--- Reads the wire in random pieces, unsealing each framed record, returns the plaintext length or (size_t)-1
+static size_t unseal(const uint8_t *data, size_t len) {
+	tlsrec_buffer in = {0};
+	size_t pos, n, size, body, i, plain = 0;
+	uint8_t *record;
+
+	for (pos = 0; pos < len; pos += n) {
+		n = 1 + rand() % 30000;
+		if (n > len - pos)
+			n = len - pos;
+		check(tlsrec_append(&in, data + pos, n) == 0);
+		while ((size = tlsrec_framed(in.data + in.start, in.len))) {
+			if (size == (size_t)-1) {
+				tlsrec_free(&in);
+				return size;
+			}
+			record = in.data + in.start;
+			body = (size_t)record[3] << 8 | record[4];
+			for (i = 0; i < body - record[TLSREC_HEADER+body-1]; i++)
+				got[plain++] = record[TLSREC_HEADER+i] ^ 0x5A;
+			tlsrec_consume(&in, size);
+		}
+	}
+	check(in.len == 0);
+	tlsrec_free(&in);
+	return plain;
+}
+
+static void test_buffer(void) {
+	tlsrec_buffer b = {0};
+	uint8_t *p;
+	int i;
+
+	//--- the first reservation allocates a full record, larger ones double the capacity
+	check((p = tlsrec_reserve(&b, 10)) && b.capacity == TLSREC_MAXSIZE);
+	check(tlsrec_append(&b, "0123456789", 10) == 0 && b.len == 10);
+	tlsrec_consume(&b, 4);
+	check(b.start == 4 && b.len == 6 && !memcmp(b.data + b.start, "456789", 6));
+	check(tlsrec_reserve(&b, 3*TLSREC_MAXSIZE) && b.capacity == 4*TLSREC_MAXSIZE);
+	//--- data is moved back to the start of the buffer when more room is needed
+	check(b.start == 0 && !memcmp(b.data, "456789", 6));
+	tlsrec_consume(&b, 6);
+	check(b.start == 0 && b.len == 0);
+	for (i = 0; i < 1000; i++) {
+		check(tlsrec_append(&b, src, 100) == 0);
+		tlsrec_consume(&b, 99);
+	}
+	check(b.len == 1000 && b.capacity == 4*TLSREC_MAXSIZE);
+	tlsrec_free(&b);
+	check(!b.data && !b.capacity && !b.len);
+}
+
+static void test_framed(void) {
+	uint8_t record[TLSREC_MAXSIZE+1] = { 23, 3, 3, 0, 10 };
+
+	check(tlsrec_framed(record, 0) == 0);
+	check(tlsrec_framed(record, TLSREC_HEADER-1) == 0);
+	check(tlsrec_framed(record, TLSREC_HEADER+9) == 0);
+	check(tlsrec_framed(record, TLSREC_HEADER+10) == TLSREC_HEADER+10);
+	check(tlsrec_framed(record, 100) == TLSREC_HEADER+10);
+	record[3] = (uint8_t)((TLSREC_MAXSIZE - TLSREC_HEADER) >> 8);
+	record[4] = (uint8_t)(TLSREC_MAXSIZE - TLSREC_HEADER);
+	check(tlsrec_framed(record, sizeof(record)) == TLSREC_MAXSIZE);
+	record[4]++;
+	check(tlsrec_framed(record, sizeof(record)) == (size_t)-1);
+	record[3] = 0;
+	record[0] = 19;
+	check(tlsrec_framed(record, 100) == (size_t)-1);
+	record[0] = 23;
+	record[1] = 2;
+	check(tlsrec_framed(record, 100) == (size_t)-1);
+}
+
+//--- Random writes, seals and partial sends give back the plaintext, in records no larger than maxdata
+static void test_writer(void) {
+	tlsrec_writer w = {0};
+	size_t total, pos, wlen, n, maxdata;
+	const uint8_t *p;
+	int trial;
+
+	for (trial = 0; trial < 100; trial++) {
+		total = rand() % PAYLOAD;
+		maxdata = 1 + rand() % 16384;
+		for (n = 0; n < total; n++)
+			src[n] = (uint8_t)rand();
+		tlsrec_writer_init(&w, TLSREC_HEADER, TRAILER, maxdata, fake_seal, NULL);
+		for (pos = wlen = 0; pos < total || tlsrec_pending(&w, &p) || w.isopen;)
+			switch (rand() % 4) {
+				case 0:	n = rand() % (trial % 2 ? 50 : 40000);
+						if (n > total - pos)
+							n = total - pos;
+						check(tlsrec_write(&w, src + pos, n) == 0);
+						pos += n;
+						break;
+				case 1:	check(tlsrec_seal(&w) == 0);
+						break;
+				default:if ((n = tlsrec_pending(&w, &p))) {
+							n = 1 + rand() % n;
+							memcpy(wire + wlen, p, n);
+							wlen += n;
+							tlsrec_sent(&w, n);
+						} else if (pos == total)
+							check(tlsrec_seal(&w) == 0);
+			}
+		check(unseal(wire, wlen) == total && !memcmp(got, src, total));
+		tlsrec_free(&w.out);
+	}
+}
+
+//--- Plaintext is released only once all its records have left the buffer, like the Socket send methods report it
+static void test_release(void) {
+	tlsrec_writer w = {0};
+	size_t n, wlen = 0, released = 0;
+	const uint8_t *p;
+	int seals = 2;
+
+	memset(src, 'a', 110);
+	tlsrec_writer_init(&w, TLSREC_HEADER, TRAILER, 40, fake_seal, NULL);
+	check(tlsrec_release(&w) == 0);
+	check(tlsrec_write(&w, src, 100) == 0);
+	//--- two full records are sealed, the open one holds 20 bytes
+	check(w.held == 100 && w.open == 20);
+	check(tlsrec_release(&w) == 0);
+	check(tlsrec_seal(&w) == 0);
+	check(tlsrec_release(&w) == 0);
+	//--- partial sends release nothing, even when only the last byte is left
+	n = tlsrec_pending(&w, &p);
+	memcpy(wire, p, n - 1);
+	tlsrec_sent(&w, n - 1);
+	wlen = n - 1;
+	check(tlsrec_release(&w) == 0);
+	check(tlsrec_write(&w, src, 10) == 0 && w.held == 110);
+	check(tlsrec_release(&w) == 0);
+	check(tlsrec_seal(&w) == 0);
+	while ((n = tlsrec_pending(&w, &p))) {
+		wire[wlen++] = *p;
+		tlsrec_sent(&w, 1);
+	}
+	check((released = tlsrec_release(&w)) == 110);
+	check(tlsrec_release(&w) == 0 && w.held == 0);
+	check(unseal(wire, wlen) == released && !memcmp(got, src, released));
+	tlsrec_free(&w.out);
+	//--- failed seals keep the plaintext held
+	tlsrec_writer_init(&w, TLSREC_HEADER, TRAILER, 40, fake_seal, &seals);
+	check(tlsrec_write(&w, src, 100) == TLSREC_ESEAL);
+	check(w.held == 80 && tlsrec_release(&w) == 0);
+	tlsrec_free(&w.out);
+}
+
+int main(void) {
+	srand(1);
+	test_buffer();
+	test_framed();
+	test_writer();
+	test_release();
+	if (failures)
+		printf("%d check(s) failed\n", failures);
+	else puts("all tests passed");
+	return failures != 0;
+}
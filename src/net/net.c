@@ -7,6 +7,7 @@
 */
 
 #include <Socket.h>
+#include <Poller.h>
 #include "lrtapi.h"
 #include <luart.h>
 #include "../include/Http.h"
@@ -140,6 +141,12 @@ LUA_METHOD(net, select) {
 	return 1;
 }
 
+extern int net_spawn(lua_State *L);
+extern int net_sleep(lua_State *L);
+extern int net_run(lua_State *L);
+extern int net_update(lua_State *L);
+extern int net_gettasks(lua_State *L);
+
 extern URL_COMPONENTSW *get_url(lua_State *L, int idx, wchar_t **url_str);
 
 LUA_METHOD(net, urlparse) {
@@ -253,6 +260,7 @@ static const luaL_Reg net_properties[] = {
 	{"get_isalive",	net_getisalive},
 	{"get_ip",		net_getip},
 	{"get_publicip",net_getpublicip},
+	{"get_tasks",	net_gettasks},
 	{NULL, NULL}
 };
 
@@ -262,10 +270,15 @@ static const luaL_Reg netlib[] = {
 	{"reverse",		net_reverse},
 	{"urlparse",	net_urlparse},
 	{"adapters",	net_adapters},
+	{"spawn",		net_spawn},
+	{"sleep",		net_sleep},
+	{"run",			net_run},
+	{"update",		net_update},
 	{NULL, NULL}
 };
 
 LUALIB_API int net_finalize(lua_State *L) {
+	async_finalize();
 	WSACleanup();
 	return 0;
 }
@@ -273,7 +286,8 @@ LUALIB_API int net_finalize(lua_State *L) {
 LUAMOD_API int luaopen_net(lua_State *L) {
 	WSAStartup(MAKEWORD(2, 2), &wsadata); 
 	lua_regmodulefinalize(L, net);
-	lua_regobjectmt(L, Socket);
+	lua_regcobjectmt(L, Socket);
+	lua_regcobjectmt(L, Poller);
 	lua_regobjectmt(L, Http);
 	lua_regobjectmt(L, Ftp);
 	return 1;
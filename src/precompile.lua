@@ -0,0 +1,36 @@
+--[[
+ | LuaRT - A Windows programming framework for Lua
+ | Luart.org, Copyright (c) Tine Samir 2022.
+ | See Copyright Notice in LICENSE.TXT
+ |-------------------------------------------------
+ | precompile.lua | Stores a "module.luac" bytecode entry next to each Lua module of a directory
+ |                | Needs the compile() function of luart.exe built with -DRTC
+ |                | usage: luart.exe precompile.lua directory [clean]
+--]]
+
+local clean = arg[3] == "clean"
+
+local function precompile(dir)
+    for entry in each(dir) do
+        if is(entry, sys.Directory) then
+            precompile(entry)
+        elseif entry.extension == ".lua" or entry.extension == ".wlua" then
+            local fname = entry.fullpath:gsub("%.w?lua$", ".luac")
+            if clean then
+                sys.File(fname):remove()
+            else
+                local f = assert(io.open(entry.fullpath, "rb"))
+                local src = f:read("a")
+                f:close()
+                f = assert(io.open(fname, "wb"))
+                f:write(compile(src, "@"..entry.name))
+                f:close()
+            end
+        end
+    end
+end
+
+if not clean and not compile then
+    error("precompile.lua needs luart.exe built with -DRTC")
+end
+precompile(sys.Directory(arg[2]))
@@ -24,6 +24,11 @@
 #include "lrtapi.h"
 #include <luart.h>
 
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define UTF8_SIMD
+#endif
+
 /* macro to 'unsign' a character */
 #define uchar(c)	((unsigned char)(c))
 
@@ -59,15 +64,7 @@ int utf8_fromcodepoint(char *utf8, UINT32 codepoint) {
 #define ONEMASK ((size_t)(-1) / 0xFF)
 
 size_t utf8_len(const char *s, size_t l) {
-	size_t len = 0, cp;
-	l = l == 0 ? strlen(s) : l;
-	while (l) {
-		cp = utf8_charsize(s);
-		s += cp;
-		l -= cp;
-		len++;
-	}
-	return len;
+	return utf8_count(s, l == 0 ? strlen(s) : l);
 }
 
 #define utf8_next(s) (s+utf8_charsize(s))
@@ -105,6 +102,526 @@ const char *utf8_pos(const void *str, size_t pos) {
   return (const char *)s;
 }
 
+// ------------------------------------------------------------------------ UTF8 scanning kernels
+
+//--- Kernels process 16 (SSE2) or 32 (AVX2) bytes blocks and return the number of bytes processed
+//--- The remaining bytes are processed by the scalar version, that works on machine words
+//--- A character is counted for each byte that is not a continuation byte (0x80-0xBF, or less than -64 as a signed char)
+
+#define iscontinuation(c)	((((unsigned char)(c)) & 0xC0) == 0x80)
+
+#ifdef UTF8_SIMD
+
+static int simd_level = -1;
+
+static int utf8_simd(void) {
+	if (simd_level < 0) {
+		__builtin_cpu_init();
+		simd_level = __builtin_cpu_supports("avx2") ? 2 : (__builtin_cpu_supports("sse2") ? 1 : 0);
+	}
+	return simd_level;
+}
+
+__attribute__((target("sse2"))) static size_t ascii_sse2(const char *s, size_t l, size_t *span) {
+	size_t i;
+	int mask;
+
+	for (i = 0; i + 16 <= l; i += 16)
+		if ((mask = _mm_movemask_epi8(_mm_loadu_si128((const __m128i *)(s + i))))) {
+			*span = i + __builtin_ctz(mask);
+			return l;
+		}
+	*span = i;
+	return i;
+}
+
+__attribute__((target("avx2"))) static size_t ascii_avx2(const char *s, size_t l, size_t *span) {
+	size_t i;
+	unsigned int mask;
+
+	for (i = 0; i + 32 <= l; i += 32)
+		if ((mask = _mm256_movemask_epi8(_mm256_loadu_si256((const __m256i *)(s + i))))) {
+			*span = i + __builtin_ctz(mask);
+			return l;
+		}
+	*span = i;
+	return i;
+}
+
+__attribute__((target("sse2"))) static size_t count_sse2(const char *s, size_t l, size_t *count) {
+	const __m128i cont = _mm_set1_epi8(-65);
+	size_t i;
+
+	for (i = 0; i + 16 <= l; i += 16)
+		*count += __builtin_popcount(_mm_movemask_epi8(_mm_cmpgt_epi8(_mm_loadu_si128((const __m128i *)(s + i)), cont)));
+	return i;
+}
+
+__attribute__((target("avx2"))) static size_t count_avx2(const char *s, size_t l, size_t *count) {
+	const __m256i cont = _mm256_set1_epi8(-65);
+	size_t i;
+
+	for (i = 0; i + 32 <= l; i += 32)
+		*count += __builtin_popcount((unsigned int)_mm256_movemask_epi8(_mm256_cmpgt_epi8(_mm256_loadu_si256((const __m256i *)(s + i)), cont)));
+	return i;
+}
+
+//--- Returns the offset of the character n (starting from 0), or the number of bytes processed if not found
+static size_t nth_mask(unsigned int mask, size_t *n) {
+	while ((*n)--)
+		mask &= mask - 1;
+	*n = 0;
+	return __builtin_ctz(mask);
+}
+
+__attribute__((target("sse2"))) static size_t skip_sse2(const char *s, size_t l, size_t *n, BOOL *found) {
+	const __m128i cont = _mm_set1_epi8(-65);
+	size_t i, count;
+	unsigned int mask;
+
+	for (i = 0; i + 16 <= l; i += 16) {
+		mask = _mm_movemask_epi8(_mm_cmpgt_epi8(_mm_loadu_si128((const __m128i *)(s + i)), cont));
+		if ((count = __builtin_popcount(mask)) > *n) {
+			*found = TRUE;
+			return i + nth_mask(mask, n);
+		}
+		*n -= count;
+	}
+	return i;
+}
+
+__attribute__((target("avx2"))) static size_t skip_avx2(const char *s, size_t l, size_t *n, BOOL *found) {
+	const __m256i cont = _mm256_set1_epi8(-65);
+	size_t i, count;
+	unsigned int mask;
+
+	for (i = 0; i + 32 <= l; i += 32) {
+		mask = _mm256_movemask_epi8(_mm256_cmpgt_epi8(_mm256_loadu_si256((const __m256i *)(s + i)), cont));
+		if ((count = __builtin_popcount(mask)) > *n) {
+			*found = TRUE;
+			return i + nth_mask(mask, n);
+		}
+		*n -= count;
+	}
+	return i;
+}
+
+//--- Validation kernels use the lookup algorithm of Keiser and Lemire : each byte and its 3 predecessors are classified with
+//--- 3 nibble lookup tables whose bits flag the errors a pair of bytes can reveal, and 3rd/4th continuation bytes are checked apart
+//--- A character that ends in the next block is only validated with it, so kernels return the start of the last character they checked
+#define TOO_SHORT		(1 << 0)
+#define TOO_LONG		(1 << 1)
+#define OVERLONG_3		(1 << 2)
+#define TOO_LARGE		(1 << 3)
+#define SURROGATE		(1 << 4)
+#define OVERLONG_2		(1 << 5)
+#define TOO_LARGE_1000	(1 << 6)
+#define OVERLONG_4		(1 << 6)
+#define TWO_CONTS		(1 << 7)
+#define CARRY			(TOO_SHORT | TOO_LONG | TWO_CONTS)
+
+#define BYTE_1_HIGH		TOO_LONG, TOO_LONG, TOO_LONG, TOO_LONG, TOO_LONG, TOO_LONG, TOO_LONG, TOO_LONG, \
+						TWO_CONTS, TWO_CONTS, TWO_CONTS, TWO_CONTS, TOO_SHORT | OVERLONG_2, TOO_SHORT, \
+						TOO_SHORT | OVERLONG_3 | SURROGATE, TOO_SHORT | TOO_LARGE | TOO_LARGE_1000 | OVERLONG_4
+#define BYTE_1_LOW		CARRY | OVERLONG_3 | OVERLONG_2 | OVERLONG_4, CARRY | OVERLONG_2, CARRY, CARRY, CARRY | TOO_LARGE, \
+						CARRY | TOO_LARGE | TOO_LARGE_1000, CARRY | TOO_LARGE | TOO_LARGE_1000, CARRY | TOO_LARGE | TOO_LARGE_1000, \
+						CARRY | TOO_LARGE | TOO_LARGE_1000, CARRY | TOO_LARGE | TOO_LARGE_1000, CARRY | TOO_LARGE | TOO_LARGE_1000, \
+						CARRY | TOO_LARGE | TOO_LARGE_1000, CARRY | TOO_LARGE | TOO_LARGE_1000, CARRY | TOO_LARGE | TOO_LARGE_1000 | SURROGATE, \
+						CARRY | TOO_LARGE | TOO_LARGE_1000, CARRY | TOO_LARGE | TOO_LARGE_1000
+#define BYTE_2_HIGH		TOO_SHORT, TOO_SHORT, TOO_SHORT, TOO_SHORT, TOO_SHORT, TOO_SHORT, TOO_SHORT, TOO_SHORT, \
+						TOO_LONG | OVERLONG_2 | TWO_CONTS | OVERLONG_3 | TOO_LARGE_1000 | OVERLONG_4, \
+						TOO_LONG | OVERLONG_2 | TWO_CONTS | OVERLONG_3 | TOO_LARGE, \
+						TOO_LONG | OVERLONG_2 | TWO_CONTS | SURROGATE | TOO_LARGE, \
+						TOO_LONG | OVERLONG_2 | TWO_CONTS | SURROGATE | TOO_LARGE, \
+						TOO_SHORT, TOO_SHORT, TOO_SHORT, TOO_SHORT
+//--- Bytes above these values at the end of a block start a character that continues in the next block
+#define INCOMPLETE		-1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, 0xEF, 0xDF, 0xBF
+
+static size_t check_boundary(const unsigned char *s, size_t i) {
+	size_t j = i;
+
+	while (j > 0 && i - j < 3 && iscontinuation(s[j-1]))
+		j--;
+	if (j > 0 && s[j-1] >= 0xC0)
+		j--;
+	return j;
+}
+
+__attribute__((target("ssse3"))) static size_t check_ssse3(const char *s, size_t l) {
+	const __m128i high1 = _mm_setr_epi8(BYTE_1_HIGH), low1 = _mm_setr_epi8(BYTE_1_LOW), high2 = _mm_setr_epi8(BYTE_2_HIGH);
+	const __m128i nibble = _mm_set1_epi8(0x0F), incomplete = _mm_setr_epi8(INCOMPLETE);
+	__m128i prev = _mm_setzero_si128(), pending = _mm_setzero_si128(), input, prev1, error;
+	size_t i;
+
+	for (i = 0; i + 16 <= l; i += 16, prev = input) {
+		input = _mm_loadu_si128((const __m128i *)(s + i));
+		if (!_mm_movemask_epi8(input))
+			error = pending;
+		else {
+			prev1 = _mm_alignr_epi8(input, prev, 15);
+			error = _mm_and_si128(_mm_and_si128(_mm_shuffle_epi8(high1, _mm_and_si128(_mm_srli_epi16(prev1, 4), nibble)),
+												_mm_shuffle_epi8(low1, _mm_and_si128(prev1, nibble))),
+								  _mm_shuffle_epi8(high2, _mm_and_si128(_mm_srli_epi16(input, 4), nibble)));
+			error = _mm_xor_si128(error, _mm_and_si128(_mm_or_si128(_mm_subs_epu8(_mm_alignr_epi8(input, prev, 14), _mm_set1_epi8(0x60)),
+																	_mm_subs_epu8(_mm_alignr_epi8(input, prev, 13), _mm_set1_epi8(0x70))), _mm_set1_epi8(-128)));
+			pending = _mm_subs_epu8(input, incomplete);
+		}
+		if (_mm_movemask_epi8(_mm_cmpeq_epi8(error, _mm_setzero_si128())) != 0xFFFF)
+			break;
+	}
+	return check_boundary((const unsigned char *)s, i);
+}
+
+__attribute__((target("avx2"))) static size_t check_avx2(const char *s, size_t l) {
+	const __m256i high1 = _mm256_setr_epi8(BYTE_1_HIGH, BYTE_1_HIGH), low1 = _mm256_setr_epi8(BYTE_1_LOW, BYTE_1_LOW);
+	const __m256i high2 = _mm256_setr_epi8(BYTE_2_HIGH, BYTE_2_HIGH), nibble = _mm256_set1_epi8(0x0F);
+	const __m256i incomplete = _mm256_setr_epi8(-1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, INCOMPLETE);
+	__m256i prev = _mm256_setzero_si256(), pending = _mm256_setzero_si256(), input, shifted, prev1, error;
+	size_t i;
+
+	for (i = 0; i + 32 <= l; i += 32, prev = input) {
+		input = _mm256_loadu_si256((const __m256i *)(s + i));
+		if (!_mm256_movemask_epi8(input))
+			error = pending;
+		else {
+			//--- the last 16 bytes of the previous block followed by the first 16 bytes of this one
+			shifted = _mm256_permute2x128_si256(prev, input, 0x21);
+			prev1 = _mm256_alignr_epi8(input, shifted, 15);
+			error = _mm256_and_si256(_mm256_and_si256(_mm256_shuffle_epi8(high1, _mm256_and_si256(_mm256_srli_epi16(prev1, 4), nibble)),
+													  _mm256_shuffle_epi8(low1, _mm256_and_si256(prev1, nibble))),
+									 _mm256_shuffle_epi8(high2, _mm256_and_si256(_mm256_srli_epi16(input, 4), nibble)));
+			error = _mm256_xor_si256(error, _mm256_and_si256(_mm256_or_si256(_mm256_subs_epu8(_mm256_alignr_epi8(input, shifted, 14), _mm256_set1_epi8(0x60)),
+																			 _mm256_subs_epu8(_mm256_alignr_epi8(input, shifted, 13), _mm256_set1_epi8(0x70))), _mm256_set1_epi8(-128)));
+			pending = _mm256_subs_epu8(input, incomplete);
+		}
+		if (!_mm256_testz_si256(error, error))
+			break;
+	}
+	return check_boundary((const unsigned char *)s, i);
+}
+
+#endif
+
+//--- Returns the length in bytes of the ASCII prefix of the string
+size_t utf8_asciispan(const char *s, size_t l) {
+	size_t i = 0, w;
+#ifdef UTF8_SIMD
+	size_t span;
+	switch (utf8_simd()) {
+		case 2: 	if (ascii_avx2(s, l, &span) == l)
+						return span;
+					i = span; break;
+		case 1: 	if (ascii_sse2(s, l, &span) == l)
+						return span;
+					i = span;
+	}
+#endif
+	for (; i + sizeof(size_t) <= l; i += sizeof(size_t)) {
+		memcpy(&w, s + i, sizeof(size_t));
+		if (w & (ONEMASK * 0x80))
+			break;
+	}
+	while (i < l && !(s[i] & 0x80))
+		i++;
+	return i;
+}
+
+//--- Returns the number of UTF8 characters in the l first bytes of the string
+size_t utf8_count(const char *s, size_t l) {
+	size_t i = 0, count = 0, w;
+#ifdef UTF8_SIMD
+	switch (utf8_simd()) {
+		case 2: i = count_avx2(s, l, &count); break;
+		case 1: i = count_sse2(s, l, &count);
+	}
+#endif
+	for (; i + sizeof(size_t) <= l; i += sizeof(size_t)) {
+		memcpy(&w, s + i, sizeof(size_t));
+		//--- continuation bytes have their bit 7 set and their bit 6 cleared
+		w = (w & ~(w << 1) & (ONEMASK * 0x80)) >> 7;
+		count += sizeof(size_t) - ((w * ONEMASK) >> ((sizeof(size_t) - 1) * 8));
+	}
+	for (; i < l; i++)
+		count += !iscontinuation(s[i]);
+	return count;
+}
+
+//--- Returns the byte offset of the character n (starting from 0) in the l first bytes of the string
+//--- If the string has less characters, returns l and set n to the number of missing characters
+size_t utf8_skip(const char *s, size_t l, size_t *n) {
+	size_t i = 0;
+#ifdef UTF8_SIMD
+	BOOL found = FALSE;
+	switch (utf8_simd()) {
+		case 2: i = skip_avx2(s, l, n, &found); break;
+		case 1: i = skip_sse2(s, l, n, &found);
+	}
+	if (found)
+		return i;
+#endif
+	for (; i < l; i++)
+		if (!iscontinuation(s[i]) && !(*n)--) {
+			*n = 0;
+			return i;
+		}
+	return l;
+}
+
+//--- Returns the byte offset of the first invalid UTF8 sequence in the l first bytes of the string, or l if valid
+//--- Overlong encodings, surrogates and codepoints above U+10FFFF are rejected
+size_t utf8_check(const char *str, size_t l) {
+	const unsigned char *s = (const unsigned char *)str;
+	size_t i = 0, size;
+
+#ifdef UTF8_SIMD
+	//--- the ASCII prefix is skipped first, with the faster ASCII kernels
+	i = utf8_asciispan(str, l);
+	switch (utf8_simd()) {
+		case 2: i += check_avx2(str + i, l - i); break;
+		case 1: if (__builtin_cpu_supports("ssse3"))
+					i += check_ssse3(str + i, l - i);
+	}
+#endif
+	while (i < l) {
+		unsigned char c = s[i];
+		if (c < 0x80) {
+			i += utf8_asciispan(str + i, l - i);
+			continue;
+		}
+		if (c >= 0xC2 && c <= 0xDF)
+			size = 2;
+		else if (c >= 0xE0 && c <= 0xEF)
+			size = 3;
+		else if (c >= 0xF0 && c <= 0xF4)
+			size = 4;
+		else break;
+		if (i + size > l)
+			break;
+		if ((c == 0xE0 && s[i+1] < 0xA0) || (c == 0xED && s[i+1] > 0x9F) || (c == 0xF0 && s[i+1] < 0x90) || (c == 0xF4 && s[i+1] > 0x8F))
+			break;
+		if (!iscontinuation(s[i+1]) || (size > 2 && !iscontinuation(s[i+2])) || (size > 3 && !iscontinuation(s[i+3])))
+			break;
+		i += size;
+	}
+	return i;
+}
+
+// ------------------------------------------------------------------------ Substring search
+
+//--- Short needles are searched by filtering candidates on their first and last bytes, then comparing the middle
+//--- Longer needles use Boyer-Moore-Horspool with a bad character shift table
+#define SEARCH_SHORT	32
+
+#ifdef UTF8_SIMD
+
+__attribute__((target("sse2"))) static size_t filter_sse2(const char *h, size_t hlen, const char *n, size_t nlen, const char **found) {
+	const __m128i first = _mm_set1_epi8(n[0]), last = _mm_set1_epi8(n[nlen-1]);
+	size_t i;
+	unsigned int mask;
+
+	for (i = 0; i + nlen + 15 <= hlen; i += 16) {
+		mask = _mm_movemask_epi8(_mm_and_si128(_mm_cmpeq_epi8(first, _mm_loadu_si128((const __m128i *)(h + i))),
+											   _mm_cmpeq_epi8(last, _mm_loadu_si128((const __m128i *)(h + i + nlen - 1)))));
+		for (; mask; mask &= mask - 1) {
+			const char *pos = h + i + __builtin_ctz(mask);
+			if (!memcmp(pos + 1, n + 1, nlen - 2)) {
+				*found = pos;
+				return hlen;
+			}
+		}
+	}
+	return i;
+}
+
+__attribute__((target("avx2"))) static size_t filter_avx2(const char *h, size_t hlen, const char *n, size_t nlen, const char **found) {
+	const __m256i first = _mm256_set1_epi8(n[0]), last = _mm256_set1_epi8(n[nlen-1]);
+	size_t i;
+	unsigned int mask;
+
+	for (i = 0; i + nlen + 31 <= hlen; i += 32) {
+		mask = _mm256_movemask_epi8(_mm256_and_si256(_mm256_cmpeq_epi8(first, _mm256_loadu_si256((const __m256i *)(h + i))),
+													 _mm256_cmpeq_epi8(last, _mm256_loadu_si256((const __m256i *)(h + i + nlen - 1)))));
+		for (; mask; mask &= mask - 1) {
+			const char *pos = h + i + __builtin_ctz(mask);
+			if (!memcmp(pos + 1, n + 1, nlen - 2)) {
+				*found = pos;
+				return hlen;
+			}
+		}
+	}
+	return i;
+}
+
+#endif
+
+static const char *search_horspool(const char *h, size_t hlen, const char *n, size_t nlen) {
+	size_t shift[256], i, last = nlen - 1;
+
+	for (i = 0; i < 256; i++)
+		shift[i] = nlen;
+	for (i = 0; i < last; i++)
+		shift[(unsigned char)n[i]] = last - i;
+	for (i = 0; i + nlen <= hlen; i += shift[(unsigned char)h[i + last]])
+		if (h[i + last] == n[last] && !memcmp(h + i, n, last))
+			return h + i;
+	return NULL;
+}
+
+//--- Binary safe substring search, returns the address of the first occurence of n in h, or NULL if not found
+const char *str_memfind(const char *h, size_t hlen, const char *n, size_t nlen) {
+	const char *found = NULL, *end = h + hlen;
+	size_t i = 0;
+
+	if (!nlen)
+		return h;
+	if (nlen > hlen)
+		return NULL;
+	if (nlen == 1)
+		return memchr(h, *n, hlen);
+	if (nlen > SEARCH_SHORT && hlen >= 4*nlen)
+		return search_horspool(h, hlen, n, nlen);
+#ifdef UTF8_SIMD
+	switch (utf8_simd()) {
+		case 2: i = filter_avx2(h, hlen, n, nlen, &found); break;
+		case 1: i = filter_sse2(h, hlen, n, nlen, &found);
+	}
+	if (found)
+		return found;
+#endif
+	for (h += i; end - h >= (ptrdiff_t)nlen; h++) {
+		if (!(h = memchr(h, *n, end - h - nlen + 1)))
+			break;
+		if (!memcmp(h + 1, n + 1, nlen - 1))
+			return h;
+	}
+	return NULL;
+}
+
+// ------------------------------------------------------------------------ UTF8 character index
+
+#define UTF8_INDEX_MIN		256				//--- minimum byte length of indexed strings
+#define UTF8_INDEX_STEP		64				//--- a byte offset is stored every UTF8_INDEX_STEP characters
+#define UTF8_INDEX_KEEP		32				//--- number of most recently built indexes kept across garbage collections
+#define UTF8_INDEXES		"LuaRT utf8 indexes"
+#define UTF8_KEPTINDEXES	"LuaRT utf8 kept indexes"
+
+typedef struct {
+	size_t	count;		//--- number of characters
+	BOOL	ascii;		//--- pure ASCII string, character positions are byte offsets
+	size_t	offsets[1];	//--- byte offset of characters 0, UTF8_INDEX_STEP, 2*UTF8_INDEX_STEP...
+} Utf8Index;
+
+static Utf8Index *utf8_newindex(lua_State *L, const char *str, size_t len) {
+	Utf8Index *ix;
+	size_t i = 0, n, offset = 0;
+
+	if (utf8_asciispan(str, len) == len) {
+		ix = lua_newuserdatauv(L, sizeof(Utf8Index), 0);
+		ix->ascii = TRUE;
+		ix->count = len;
+		return ix;
+	}
+	ix = lua_newuserdatauv(L, sizeof(Utf8Index) + (len / UTF8_INDEX_STEP + 1) * sizeof(size_t), 0);
+	ix->ascii = FALSE;
+	ix->offsets[0] = 0;
+	for (;;) {
+		n = UTF8_INDEX_STEP;
+		offset += utf8_skip(str + offset, len - offset, &n);
+		if (offset == len) {
+			ix->count = i * UTF8_INDEX_STEP + UTF8_INDEX_STEP - n;
+			if (!n)
+				ix->offsets[i + 1] = len;
+			break;
+		}
+		ix->offsets[++i] = offset;
+	}
+	return ix;
+}
+
+//--- Keeps the index on top of the stack alive, in a ring of the UTF8_INDEX_KEEP most recently built indexes
+//--- (string keys are never removed from weak tables, so the indexes table can only have weak values)
+static void utf8_keepindex(lua_State *L) {
+	lua_Integer slot;
+
+	luaL_getsubtable(L, LUA_REGISTRYINDEX, UTF8_KEPTINDEXES);
+	lua_rawgeti(L, -1, 0);
+	slot = lua_tointeger(L, -1) % UTF8_INDEX_KEEP + 1;
+	lua_pop(L, 1);
+	lua_pushvalue(L, -2);
+	lua_rawseti(L, -2, slot);
+	lua_pushinteger(L, slot);
+	lua_rawseti(L, -2, 0);
+	lua_pop(L, 1);
+}
+
+//--- Pushes the character index of the string at index idx and returns it (or pushes nil and returns NULL for short strings)
+//--- The index is kept in a weak table, and survives garbage collections while it is one of the most recently built ones
+static Utf8Index *utf8_index(lua_State *L, int idx, const char *str, size_t len) {
+	Utf8Index *ix = NULL;
+
+	if (len < UTF8_INDEX_MIN) {
+		lua_pushnil(L);
+		return NULL;
+	}
+	idx = lua_absindex(L, idx);
+	if (!luaL_getsubtable(L, LUA_REGISTRYINDEX, UTF8_INDEXES)) {
+		lua_createtable(L, 0, 1);
+		lua_pushliteral(L, "v");
+		lua_setfield(L, -2, "__mode");
+		lua_setmetatable(L, -2);
+	}
+	lua_pushvalue(L, idx);
+	if (lua_rawget(L, -2) == LUA_TNIL) {
+		lua_pop(L, 1);
+		lua_pushvalue(L, idx);
+		ix = utf8_newindex(L, str, len);
+		utf8_keepindex(L);
+		lua_pushvalue(L, -1);
+		lua_insert(L, -4);
+		lua_rawset(L, -3);
+	} else {
+		ix = lua_touserdata(L, -1);
+		lua_insert(L, -2);
+	}
+	lua_pop(L, 1);
+	return ix;
+}
+
+//--- Returns the address of the character at position pos (starting from 0) using the optional index ix
+static const char *utf8_indexpos(Utf8Index *ix, const char *str, size_t len, size_t pos) {
+	size_t offset = 0;
+
+	if (ix) {
+		if (pos >= ix->count)
+			return str + len;
+		if (ix->ascii)
+			return str + pos;
+		offset = ix->offsets[pos / UTF8_INDEX_STEP];
+		pos %= UTF8_INDEX_STEP;
+	}
+	return str + offset + utf8_skip(str + offset, len - offset, &pos);
+}
+
+//--- Returns the character position (starting from 0) of the byte at offset using the optional index ix
+static size_t utf8_indexchar(Utf8Index *ix, const char *str, size_t offset) {
+	size_t lo = 0, hi, pos;
+
+	if (!ix)
+		return utf8_count(str, offset);
+	if (ix->ascii)
+		return offset;
+	hi = ix->count / UTF8_INDEX_STEP;
+	while (lo < hi) {
+		size_t mid = (lo + hi + 1) / 2;
+		if (ix->offsets[mid] <= offset)
+			lo = mid;
+		else
+			hi = mid - 1;
+	}
+	pos = lo * UTF8_INDEX_STEP;
+	return pos + utf8_count(str + ix->offsets[lo], offset - ix->offsets[lo]);
+}
+
 /* ------------------------------------------------------------------------ */
 
 /*
@@ -129,7 +646,8 @@ const char *utf8_pos(const void *str, size_t pos) {
 static int str_len(lua_State *L) {
 	size_t len;
 	const char *str = luaL_checklstring(L, 1, &len);
-	lua_pushinteger(L, (lua_Integer)utf8_len(str, len));
+	Utf8Index *ix = utf8_index(L, 1, str, len);
+	lua_pushinteger(L, (lua_Integer)(ix ? ix->count : utf8_len(str, len)));
 	return 1;
 }
 
@@ -171,16 +689,19 @@ size_t getendpos (lua_State *L, int arg, lua_Integer def,
 
 
 static int str_sub (lua_State *L) {
-  size_t len;
+  size_t len, l, start, end;
   const char *str, *s = luaL_checklstring(L, 1, &len);
-  size_t l = utf8_len(s, len);
-  size_t start;
-  size_t end;
+  Utf8Index *ix;
+  lua_settop(L, 3);  /* the index is pushed after the arguments */
+  ix = utf8_index(L, 1, s, len);
+  l = ix ? ix->count : utf8_len(s, len);
   start = posrelatI(luaL_checkinteger(L, 2), l);
   end = getendpos(L, 3, -1, l);
   if (start <= end) {
-	  str = utf8_pos(s, start - 1);
-	lua_pushlstring(L, str, utf8_pos(str, (end - start) + 1)-str);
+	  str = utf8_indexpos(ix, s, len, start - 1);
+	  len = utf8_indexpos(ix, s, len, end) - str;
+	  lua_pop(L, 1);
+	  lua_pushlstring(L, str, len);
   }
   else lua_pushliteral(L, "");
   return 1;
@@ -189,17 +710,21 @@ static int str_sub (lua_State *L) {
 
 static int str_reverse (lua_State *L) {
   luaL_Buffer b;
-  size_t l, i;
+  size_t l, i, len;
   const char *s = luaL_checklstring(L, 1, &l);
   char *buff = luaL_buffinitsize(L, &b, l) + l;
   i = l;
   while (i) {
-		int len = utf8_charsize(s);
+		len = utf8_asciispan(s, i);
+		i -= len;
+		while (len--)
+			*--buff = *s++;
+		if (!i)
+			break;
+		if ((len = utf8_charsize(s)) > i)
+			len = i;
 		buff -= len;
-		if (len > 1)
-			memcpy(buff, s, len);
-		else
-			*buff = *s;
+		memcpy(buff, s, len);
 		s += len;
 		i -= len;
 	}
@@ -264,22 +789,28 @@ static int str_rep (lua_State *L) {
 
 
 static int str_byte(lua_State *L) {
-	size_t l;
-	const char *str = luaL_checklstring(L, 1, &l);
-	size_t len = utf8_len(str, l);
+	size_t l, len, start, stop, n;
+	const char *str = luaL_checklstring(L, 1, &l), *end;
 	lua_Integer pi = luaL_optinteger(L, 2, 1);
-	size_t start = posrelatI(pi, len)-1;
-	size_t stop = getendpos(L, 3, pi, len);
-	size_t i, size = 0, n = lua_gettop(L);
-	str = utf8_pos(str, start);
-	lua_checkstack(L, utf8_pos(str, stop)-str);
-	while (start++ < stop) {
-		str += size;
-		size = utf8_charsize(str);
-		for (i = 0 ; i < size; i++)
-			lua_pushinteger(L, (unsigned char)*(str+i));
-	};
-	return lua_gettop(L)-n;
+	Utf8Index *ix;
+
+	//--- the index is pushed after the arguments
+	lua_settop(L, 3);
+	ix = utf8_index(L, 1, str, l);
+	len = ix ? ix->count : utf8_len(str, l);
+	start = posrelatI(pi, len)-1;
+	stop = getendpos(L, 3, pi, len);
+	if (start >= stop)
+		return 0;
+	end = utf8_indexpos(ix, str, l, stop);
+	str = utf8_indexpos(ix, str, l, start);
+	//--- characters start to stop-1 are returned as their bytes
+	if ((n = end - str) >= INT_MAX)
+		return luaL_error(L, "string slice too long");
+	luaL_checkstack(L, (int)n, "string slice too long");
+	while (str < end)
+		lua_pushinteger(L, (unsigned char)*str++);
+	return (int)n;
 }
 
 static int str_char (lua_State *L) {
@@ -300,20 +831,17 @@ static int str_search(lua_State *L) {
 	size_t nlen, len;
 	const char *str = luaL_checklstring(L, 1, &len);
 	const char *needle = luaL_checklstring(L, 2, &nlen);
-	lua_Integer pi = luaL_optinteger(L, 3, 1);
-	size_t start = posrelatI(pi, len)-1;
-	const char *result;
-	lua_Integer i = 0;
-
-	if ((result = strstr(utf8_pos(str, start), needle))) {
-		UINT32 cp;
-		while (str != result) {
-			i++;
-			cp = utf8_charsize(str);
-			str += cp;
-		}
-		lua_pushinteger(L, i+1);
-		lua_pushinteger(L, i+utf8_len(needle, nlen));
+	lua_Integer init = luaL_optinteger(L, 3, 1);
+	Utf8Index *ix = utf8_index(L, 1, str, len);
+	size_t start = posrelatI(init, ix ? ix->count : utf8_count(str, len))-1;
+	const char *from = utf8_indexpos(ix, str, len, start);
+	const char *result = str_memfind(from, len - (from - str), needle, nlen);
+
+	lua_pop(L, 1);
+	if (result) {
+		start += utf8_count(from, result - from);
+		lua_pushinteger(L, start+1);
+		lua_pushinteger(L, start+utf8_count(needle, nlen));
 		return 2;
 	}
 	luaL_pushfail(L);
@@ -888,31 +1416,10 @@ static const char *match (MatchState *ms, const char *s, const char *p) {
   return s;
 }
 
-static size_t cmp(const char *s1, const char *s2) {
-	while (*s1 && *s2) {
-		if (!utf8_charcmp(s1, s2))
-			return 0;
-		s1 = utf8_next(s1);
-		s2 = utf8_next(s2);
-	}
-	return *s2 == 0;
-}
-
-static size_t utf8_find (const char *s1, const char *s2, size_t l2, const char *result) {
-  size_t pos = 0;
-  if (l2 == 0) {
-	  result = s1;
-	  return 1;  /* empty strings are everywhere */
-  }
-  else if (l2 >  utf8_len(s1, 0)) return 0;  /* avoids a negative 'l1' */
-  else 
-	  while(*s1 && *s2) {
-		if (cmp(s1, s2))
-			return ++pos;
-		s1 = utf8_next(s1);
-		pos++;
-  }
-  return 0;  /* not found */
+//--- Returns the character position (starting from 1) of s2 in s1, or 0 if not found
+static size_t utf8_find (const char *s1, size_t l1, const char *s2, size_t l2) {
+  const char *result = str_memfind(s1, l1, s2, l2);
+  return result ? utf8_count(s1, result - s1) + 1 : 0;
 }
 
 
@@ -998,25 +1505,31 @@ static int str_find_aux (lua_State *L, int find) {
   size_t ls, lp;
   const char *s = luaL_checklstring(L, 1, &ls);
   const char *p = luaL_checklstring(L, 2, &lp);
-  size_t init = posrelatI(luaL_optinteger(L, 3, 1), utf8_len(s, ls))-1;
-  if (init > ls) {  /* start after string's end? */
+  lua_Integer pinit = luaL_optinteger(L, 3, 1);
+  Utf8Index *ix;
+  size_t count, init;
+  lua_settop(L, 4);  /* the index is pushed after the arguments */
+  ix = utf8_index(L, 1, s, ls);
+  count = ix ? ix->count : utf8_count(s, ls);
+  init = posrelatI(pinit, count)-1;
+  if (init > count) {  /* start after string's end? */
     luaL_pushfail(L);  /* cannot find anything */
     return 1;
   }
   /* explicit request or no special characters? */
   if (find && (lua_toboolean(L, 4) || nospecials(p, lp))) {
     /* do a plain search */
-	const char *result = NULL;
-    size_t pos = utf8_find(utf8_pos(s, init), p, utf8_len(p, lp), result);//utf8_find(utf8_pos(s, init), p, utf8_len(p, lp), result);
-    if (pos || result) {
+    const char *s1 = utf8_indexpos(ix, s, ls, init);
+    size_t pos = utf8_find(s1, ls - (s1 - s), p, lp);
+    if (pos) {
       lua_pushinteger(L, init + pos);
-      lua_pushinteger(L, init + pos + utf8_len(p, 0)-1); //0
+      lua_pushinteger(L, init + pos + utf8_count(p, lp)-1);
       return 2;
     }
   }
   else {
     MatchState ms;
-    const char *s1 = utf8_pos(s, init);
+    const char *s1 = utf8_indexpos(ix, s, ls, init);
     int anchor = (*p == '^');
     if (anchor) {
       p++; lp--;  /* skip anchor character */
@@ -1028,7 +1541,7 @@ static int str_find_aux (lua_State *L, int find) {
       if ((res=match(&ms, s1, p)) != NULL) {
         if (find) {
           lua_pushinteger(L, (s1 - s) + 1);  /* start */
-          lua_pushinteger(L, utf8_len(s, res - s));   /* end */
+          lua_pushinteger(L, utf8_indexchar(ix, s, res - s));   /* end */
           return push_captures(&ms, NULL, 0) + 2;
         }
         else
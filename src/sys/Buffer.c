@@ -7,14 +7,16 @@
 */
 
 #include <Buffer.h>
+#include <Codec.h>
 #include "lrtapi.h"
 #include <luart.h>
 #include <stdlib.h>
 
 #define _GNU_SOURCE
 #include <string.h>
+#include "lib\map.h"
 
-static const char* encodings[] = { "utf8", "unicode", "base64", "hex", NULL };
+static const char* encodings[] = { "utf8", "unicode", "base64", "hex", "base64url", NULL };
 luart_type TBuffer;
 
 Buffer *luart_tobuffer(lua_State *L, int idx) {
@@ -35,12 +37,109 @@ void lua_toBuffer(lua_State *L, void *p, size_t len) {
 	lua_pushinstance(L, Buffer, 1);
 }
 
+//--- Releases the Buffer storage when its last Buffer is released
+void buffer_release(Buffer *b) {
+	BufferData *d = b->data;
+
+	if (d && !--d->refs) {
+		if (d->storage == BUFFER_HEAP)
+			free(d->base);
+		else {
+			if (d->storage == BUFFER_MAPPEDRW)
+				map_flush(d->base, d->capacity);
+			map_release(d->base, d->capacity);
+		}
+		free(d);
+	}
+	b->data = NULL;
+	b->bytes = NULL;
+	b->size = 0;
+}
+
+//--- Gives ownership of bytes (heap allocated or mapped) to the Buffer, releasing its previous storage
+//--- Returns FALSE when out of memory, freeing heap allocated bytes
+static BOOL buffer_tryattach(Buffer *b, BYTE *bytes, size_t size, size_t capacity, BufferStorage storage) {
+	BufferData *d = malloc(sizeof(BufferData));
+
+	if (!d) {
+		if (storage == BUFFER_HEAP)
+			free(bytes);
+		return FALSE;
+	}
+	buffer_release(b);
+	d->refs = 1;
+	d->capacity = capacity;
+	d->storage = storage;
+	d->base = bytes;
+	b->data = d;
+	b->bytes = bytes;
+	b->size = size;
+	return TRUE;
+}
+
+void buffer_attach(lua_State *L, Buffer *b, BYTE *bytes, size_t size, size_t capacity, BufferStorage storage) {
+	if (!buffer_tryattach(b, bytes, size, capacity, storage))
+		luaL_error(L, "Buffer allocation error: not enough memory");
+}
+
+//--- Replaces the Buffer storage with size zeroed bytes
+BYTE *buffer_alloc(lua_State *L, Buffer *b, size_t size) {
+	BYTE *bytes = NULL;
+
+	if (size && (bytes = calloc(1, size)) == NULL)
+		luaL_error(L, "memory allocation error: not enough memory");
+	buffer_attach(L, b, bytes, size, size, BUFFER_HEAP);
+	return bytes;
+}
+
+//--- Ensures that the Buffer owns its storage, with room for at least capacity bytes
+//--- Shared heap storage is copied first, growing storage is enlarged by half its capacity at least
+//--- Returns NULL when out of memory, or when a memory mapped Buffer would have to grow
+BYTE *buffer_tryreserve(Buffer *b, size_t capacity) {
+	BufferData *d = b->data;
+	BYTE *bytes;
+
+	if (d && (d->storage != BUFFER_HEAP))
+		return capacity > b->size ? NULL : b->bytes;
+	if (d && (d->refs == 1)) {
+		size_t offset = b->bytes - d->base;
+		if (offset + capacity > d->capacity) {
+			size_t grow = d->capacity + d->capacity/2;
+			if (grow < offset + capacity)
+				grow = offset + capacity;
+			if ((bytes = realloc(d->base, grow)) == NULL)
+				return NULL;
+			d->base = bytes;
+			d->capacity = grow;
+			b->bytes = bytes + offset;
+		}
+		return b->bytes;
+	}
+	if (capacity < b->size)
+		capacity = b->size;
+	if ((bytes = malloc(capacity ? capacity : 1)) == NULL)
+		return NULL;
+	memcpy(bytes, b->bytes, b->size);
+	return buffer_tryattach(b, bytes, b->size, capacity, BUFFER_HEAP) ? bytes : NULL;
+}
+
+//--- Same as buffer_tryreserve(), raising an error on failure
+BYTE *buffer_reserve(lua_State *L, Buffer *b, size_t capacity) {
+	BYTE *bytes = buffer_tryreserve(b, capacity);
+
+	if (!bytes) {
+		if (b->data && (b->data->storage != BUFFER_HEAP))
+			luaL_error(L, "cannot resize a memory mapped Buffer");
+		luaL_error(L, "Buffer allocation error: not enough memory");
+	}
+	return bytes;
+}
+
 static void table_toarray(lua_State *L, int idx, Buffer *b) {
 	lua_Integer value;
 	size_t i = 0;
 
-	b->size = (size_t)luaL_len(L, idx);
-	b->bytes = calloc(1, b->size);
+	buffer_alloc(L, b, (size_t)luaL_len(L, idx));
 	lua_pushvalue(L, idx);
 	lua_pushnil(L);
 	while (lua_next(L, -2)) {
@@ -58,84 +157,52 @@ static void table_toarray(lua_State *L, int idx, Buffer *b) {
 extern size_t posrelatI (lua_Integer pos, size_t len);
 extern size_t getendpos (lua_State *L, int arg, lua_Integer def, size_t len);
 
-void base64_decode(Buffer *b) {
-	DWORD len = 0, skip = 0, flags = 0;
-	if (CryptStringToBinaryA((LPCSTR)b->bytes, b->size, CRYPT_STRING_BASE64, NULL, &len, &skip, &flags))
-    {
-		BYTE *buff = malloc(sizeof(char)*len);
-		if (CryptStringToBinaryA((LPCSTR)b->bytes, b->size, CRYPT_STRING_BASE64, buff, &len, &skip, &flags))
-		{
-			b->bytes = buff;
-			b->size = len;
-			return;
-		}
-		free(buff);
-	}
-}
+//--- Decodes a base64 or hexadecimal string straight into the Buffer storage
+static void buff_decode(lua_State *L, Buffer *b, const BYTE *src, size_t size, CodecKind kind) {
+	Codec c = {0};
+	BYTE *bytes;
 
-unsigned char char2val(lua_State *L, unsigned char c)
-{
-	if (c >= '0' && c <= '9')
-		return c - '0';
-	else if (c >= 'A' && c <= 'F')
-		return c - 'A' + 10;
-	else if (c >= 'a' && c <= 'f')
-		return c - 'a' + 10;
-	else return luaL_error(L, "invalid character '%c' in hexadecimal sequence", c);
+	c.kind = kind;
+	buffer_release(b);
+	bytes = buffer_reserve(L, b, codec_decodedsize(kind, size));
+	b->size = codec_decode(L, &c, (const char *)src, size, bytes, TRUE);
 }
 
-void hex_decode(lua_State *L, Buffer *b)
-{
-	unsigned char *result;
-    size_t j = 0, i = 0;
-	
-	if (b->size & 1)
-		luaL_error(L, "invalid hexadecimal sequence(odd number of characters)");
-	result = malloc(b->size/2);
-	while (i < b->size) {
-		result[j++] = char2val(L, b->bytes[i])*16 + char2val(L, b->bytes[i+1]);
-		i += 2;
-	}
-	b->bytes = result;
-	b->size /= 2;
+static int buff_encode(lua_State *L, Buffer *b, CodecKind kind) {
+	Codec c = {0};
+	luaL_Buffer B;
+	char *out = luaL_buffinitsize(L, &B, codec_encodedsize(kind, b->size));
+
+	c.kind = kind;
+	luaL_pushresultsize(&B, codec_encode(&c, b->bytes, b->size, out, TRUE));
+	return 1;
 }
 
 int base64_encode(lua_State *L, Buffer *b) {
-	DWORD b64len = 0;
-	int result = 0;
-	if (CryptBinaryToStringA(b->bytes, b->size, CRYPT_STRING_BASE64 | CRYPT_STRING_NOCRLF, NULL, &b64len))
-	{
-		char *buff = malloc(sizeof(char)*b64len);
-		if (CryptBinaryToStringA(b->bytes, b->size, CRYPT_STRING_BASE64 | CRYPT_STRING_NOCRLF, buff, &b64len)) {
-			lua_pushlstring(L, buff, b64len);
-			result = 1;
-		}
-		free(buff);
-	}
-	return result;
+	return buff_encode(L, b, CODEC_BASE64);
 }
 
 static void buff_init(lua_State *L, int idx, Buffer *b) {
 	BYTE *src = NULL;
 	BOOL free_src = FALSE;
+	size_t size = 0;
 
-	free(b->bytes);
 	switch(lua_type(L, idx)) {
-		case LUA_TNUMBER:	if ( (b->size = (size_t)luaL_checkinteger(L, idx)) == 0 ) luaL_error(L, "cannot create Buffer with zero length"); break;
-		case LUA_TSTRING:	src = (BYTE*)luaL_checklstring(L, idx, &b->size); 
+		case LUA_TNUMBER:	if ( (size = (size_t)luaL_checkinteger(L, idx)) == 0 ) luaL_error(L, "cannot create Buffer with zero length"); break;
+		case LUA_TSTRING:	src = (BYTE*)luaL_checklstring(L, idx, &size); 
 							if ( (idx > 0) && (lua_gettop(L) > 2) ){
 								int encoding = luaL_checkoption(L, idx+1, "utf8", encodings);
-								int len;
+								int len = (int)size;
 								switch (encoding) {
 									case 0: break;
 									case 1: free_src = TRUE;
 											src = (BYTE*)utf8_towchar((const char *)src, &len);
-											b->size = len; break;
-									case 2: b->bytes = src;
-											base64_decode(b);
+											size = len*sizeof(wchar_t); break;
+									case 2: buff_decode(L, b, src, size, CODEC_BASE64);
+											return;
+									case 3: buff_decode(L, b, src, size, CODEC_HEX);
 											return;
-									case 3: b->bytes = src;
-											hex_decode(L, b);
+									case 4: buff_decode(L, b, src, size, CODEC_BASE64URL);
 											return;
 									default:luaL_error(L, "unknown encoding '%s'", encodings[encoding]);  
 								}
@@ -145,22 +212,19 @@ static void buff_init(lua_State *L, int idx, Buffer *b) {
 		case LUA_TTABLE:	table_toarray(L, idx, b); return;
 		default:			luaL_error(L, "cannot create Buffer from %s", luaL_typename(L, idx));
 	}
-	if ( b->size && ((b->bytes = calloc(1, b->size)) == NULL) )
-		luaL_error(L, "memory allocation error: not enough memory");
+	buffer_alloc(L, b, size);
 	if (src) {
-		memcpy(b->bytes, src, b->size);
+		memcpy(b->bytes, src, size);
 		if (free_src)
 			free(src);
 	}
 }
 
 LUA_CONSTRUCTOR(Buffer) {
-	Buffer *b = calloc(1, sizeof(Buffer));
+	Buffer *b = lua_allocinstance(L, Buffer);
 	if (lua_islightuserdata(L, 2)) {
 		Buffer *from = lua_touserdata(L, 2);
-		b->size = from->size;
-		b->bytes = malloc(b->size);
-		memcpy(b->bytes, from->bytes, b->size);
+		memcpy(buffer_alloc(L, b, from->size), from->bytes, from->size);
 	}
 	else if (!lua_isnil(L, 2))
 		buff_init(L, 2, b);
@@ -168,6 +232,27 @@ LUA_CONSTRUCTOR(Buffer) {
 	return 1;
 }
 
+static Buffer *check_resizable(lua_State *L, int idx) {
+	Buffer *b = lua_self(L, idx, Buffer);
+	if (b->data && b->data->storage != BUFFER_HEAP)
+		luaL_error(L, "cannot resize a memory mapped Buffer");
+	return b;
+}
+
+//--- Returns the bytes of a Buffer or a string argument, without copying them
+static const BYTE *tobytes(lua_State *L, int idx, size_t *len) {
+	Buffer *b;
+
+	if (lua_type(L, idx) == LUA_TSTRING)
+		return (const BYTE *)lua_tolstring(L, idx, len);
+	if ((b = lua_tocinstance(L, idx, NULL)) && (b->type == TBuffer)) {
+		*len = b->size;
+		return b->bytes;
+	}
+	return NULL;
+}
+
+//--- Buffer:sub() returns a slice that shares the Buffer storage until one of them is modified
 LUA_METHOD(Buffer, sub) {
 	Buffer *b, *buff = lua_self(L, 1, Buffer);
 	size_t start = posrelatI(luaL_optinteger(L, 2, 0), buff->size); 
@@ -177,26 +262,44 @@ LUA_METHOD(Buffer, sub) {
 		end = buff->size;
 	lua_pushnil(L);
 	b = lua_pushinstance(L, Buffer, 1);
-	b->size = end-start+1;
-	b->bytes = malloc(b->size);
-	memcpy(b->bytes, buff->bytes+start-1, b->size);
+	if (start <= buff->size) {
+		b->data = buff->data;
+		b->data->refs++;
+		b->size = end-start+1;
+		b->bytes = buff->bytes+start-1;
+	}
 	return 1;
 }
 
 LUA_METHOD(Buffer, append) {
 	Buffer *b = lua_self(L, 1, Buffer);
 	Buffer temp = {0};
+	const BYTE *src;
+	size_t len;
+
+	if (lua_gettop(L) > 2 || !(src = tobytes(L, 2, &len))) {
+		buff_init(L, 2, &temp);
+		src = temp.bytes;
+		len = temp.size;
+	}
+	if (len) {
+		//--- the appended bytes may be moved when appending a Buffer to itself
+		size_t offset = (src >= b->bytes) && (src < b->bytes + b->size) ? (size_t)(src - b->bytes) : (size_t)-1;
+		buffer_reserve(L, b, b->size + len);
+		memcpy(b->bytes+b->size, offset == (size_t)-1 ? src : b->bytes+offset, len);
+		b->size += len;
+	}
+	buffer_release(&temp);
+	return 0;
+}
 
-	buff_init(L, 2, &temp);
-	b->bytes = realloc(b->bytes, b->size + temp.size);
-	memcpy(b->bytes+b->size, temp.bytes, temp.size);
-	free(temp.bytes);
-	b->size += temp.size;
+LUA_METHOD(Buffer, reserve) {
+	buffer_reserve(L, lua_self(L, 1, Buffer), (size_t)luaL_checkinteger(L, 2));
 	return 0;
 }
 
 LUA_METHOD(Buffer, from) {
-	Buffer *b = lua_self(L, 1, Buffer);
+	Buffer *b = check_resizable(L, 1);
 	buff_init(L, 2, b);
 	return 0;
 }
@@ -205,7 +308,7 @@ extern int str_pack (lua_State *L);
 extern int str_unpack (lua_State *L);
 
 LUA_METHOD(Buffer, pack) {
-	Buffer *b = lua_self(L, 1, Buffer);
+	Buffer *b = check_resizable(L, 1);
 	int n = lua_gettop(L);
 
 	lua_pushcfunction(L, str_pack);
@@ -232,21 +335,13 @@ LUA_METHOD(Buffer, contains) {
 	Buffer *b = lua_self(L, 1, Buffer);
 	size_t len;
 	const char *str = luaL_tolstring(L, 2, &len);
-	const char *pos;
-  	const char *last = (const char *) b->bytes + b->size - len;
-  	BOOL result = FALSE;
-
-  	if (len && (b->size > len))
-	  	for (pos = (const char *)b->bytes; pos <= last; ++pos)
-			if (pos[0] == ((const char *) str)[0] && !memcmp ((const void *) &pos[1], (const void *) ((const char *) str + 1), len - 1)) {
-				result = TRUE;
-				break;
-			}
-  	if (result)
+	const char *pos = len ? str_memfind((const char *)b->bytes, b->size, str, len) : NULL;
+
+  	if (pos)
   		lua_pushinteger(L, pos-(char*)b->bytes+1);
 	else
-  		lua_pushboolean(L, result);
-	return 2;
+  		lua_pushboolean(L, FALSE);
+	return 1;
 }
 
 LUA_PROPERTY_GET(Buffer, len) {
@@ -255,10 +350,13 @@ LUA_PROPERTY_GET(Buffer, len) {
 }
 
 LUA_PROPERTY_SET(Buffer, len) {
-	Buffer *b = lua_self(L, 1, Buffer);
-	b->size = (size_t)luaL_checkinteger(L, 2);
-	if ( (b->bytes = realloc(b->bytes, b->size)) == NULL)
-		luaL_error(L, "Buffer allocation error: not enough memory");
+	Buffer *b = check_resizable(L, 1);
+	size_t size = (size_t)luaL_checkinteger(L, 2);
+
+	buffer_reserve(L, b, size);
+	if (size > b->size)
+		memset(b->bytes+b->size, 0, size-b->size);
+	b->size = size;
 	return 0;
 }
 
@@ -287,7 +385,9 @@ LUA_METHOD(Buffer, __metanewindex) {
 		luaL_error(L, "out of bounds index for Buffer");
 	if (value<0 || value>255)
 		luaL_error(L, "invalid value (byte overflow)");
-	b->bytes[i] = (BYTE)value;
+	if (b->data->storage == BUFFER_MAPPED)
+		luaL_error(L, "cannot modify a read-only memory mapped Buffer");
+	buffer_reserve(L, b, b->size)[i] = (BYTE)value;
 	return 0;
 }
 
@@ -297,17 +397,6 @@ LUA_METHOD(Buffer, __tostring) {
 	return 1;
 }
 
-int hex_encode(lua_State *L, const char *bb, size_t len) {
-    static const char xx[]= "0123456789ABCDEF";
-	int n = len*2;
-	char *xp = malloc(n);
-    while (--n >= 0)
-		xp[n] = xx[(bb[n>>1] >> ((1 - (n&1)) << 2)) & 0xF];
-	lua_pushlstring(L, xp, len*2);
-	free(xp);
-	return 1;
-}
-
 LUA_METHOD(Buffer, encode) {
 	int encoding = luaL_checkoption(L, 2, "utf8", encodings);
 	Buffer *b = lua_self(L, 1, Buffer);
@@ -315,8 +404,9 @@ LUA_METHOD(Buffer, encode) {
 	switch(encoding) {
 		case 0:		lua_pushlstring(L, (const char *)b->bytes, b->size); break;
 		case 1:		lua_pushlwstring(L, (wchar_t*)b->bytes, b->size/2); break;
-		case 2:		base64_encode(L, b); break;
-		case 3:		hex_encode(L, (const char *)b->bytes, b->size); break;
+		case 2:		buff_encode(L, b, CODEC_BASE64); break;
+		case 3:		buff_encode(L, b, CODEC_HEX); break;
+		case 4:		buff_encode(L, b, CODEC_BASE64URL); break;
 		default:	luaL_error(L, "unknown encoding '%s'", encodings[encoding]); 
 	}		
 	return 1;
@@ -328,18 +418,26 @@ LUA_METHOD(Buffer, __len) {
 }
 
 LUA_METHOD(Buffer, __gc) {
-	Buffer *b = lua_self(L, 1, Buffer);
-	if (b->size)
-		free(b->bytes);
-	free(b);
+	buffer_release(lua_self(L, 1, Buffer));
 	return 0;
 }
 
 LUA_METHOD(Buffer, __concat) {
-	luaL_tolstring(L, 1, NULL);
-	luaL_tolstring(L, 2, NULL);
-	lua_concat(L, 2);
-	lua_pushinstance(L, Buffer, 1);
+	size_t len1, len2;
+	const BYTE *b1, *b2;
+	BYTE *bytes;
+	Buffer *b;
+
+	if (!(b1 = tobytes(L, 1, &len1)))
+		b1 = (const BYTE *)luaL_tolstring(L, 1, &len1);
+	if (!(b2 = tobytes(L, 2, &len2)))
+		b2 = (const BYTE *)luaL_tolstring(L, 2, &len2);
+	lua_pushnil(L);
+	b = lua_pushinstance(L, Buffer, 1);
+	bytes = buffer_reserve(L, b, len1+len2);
+	memcpy(bytes, b1, len1);
+	memcpy(bytes+len1, b2, len2);
+	b->size = len1+len2;
 	return 1;
 }
 
@@ -389,6 +487,7 @@ const luaL_Reg Buffer_methods[] = {
 	{"pack",		Buffer_pack},
 	{"unpack",		Buffer_unpack},
 	{"append",		Buffer_append},
+	{"reserve",		Buffer_reserve},
 	{"contains",	Buffer_contains},
 	{"encode",		Buffer_encode},
 	{"set_size",	Buffer_setlen},
@@ -0,0 +1,514 @@
+/*
+ | LuaRT - A Windows programming framework for Lua
+ | Luart.org, Copyright (c) Tine Samir 2022.
+ | See Copyright Notice in LICENSE.TXT
+ |-------------------------------------------------
+ | Codec.c | LuaRT base64/hex codecs, Encoder and Decoder objects implementation
+*/
+
+#include <Codec.h>
+#include <Buffer.h>
+#include <luart.h>
+#include <stdlib.h>
+#include <string.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define CODEC_SIMD
+#endif
+
+luart_type TEncoder, TDecoder;
+
+static const char *codecs[] = { "base64", "base64url", "hex", NULL };
+static const char *alphabets[] = { "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/", "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789-_" };
+static const char hexdigits[] = "0123456789ABCDEF";
+
+//--- Decoding tables: character value, or one of the following values
+#define INVALID		-1
+#define IGNORED		-2		//--- whitespace between base64 characters
+#define PADDING		-3
+
+static signed char b64_values[256];
+static signed char hex_values[256];
+static BOOL tables_ready = FALSE;
+
+static void init_tables(void) {
+	int i;
+
+	memset(b64_values, INVALID, 256);
+	memset(hex_values, INVALID, 256);
+	for (i = 0; i < 64; i++) {
+		b64_values[(unsigned char)alphabets[0][i]] = i;
+		b64_values[(unsigned char)alphabets[1][i]] = i;
+	}
+	b64_values[' '] = b64_values['\t'] = b64_values['\r'] = b64_values['\n'] = IGNORED;
+	b64_values['='] = PADDING;
+	for (i = 0; i < 16; i++)
+		hex_values[(unsigned char)hexdigits[i]] = hex_values[(unsigned char)"0123456789abcdef"[i]] = i;
+	tables_ready = TRUE;
+}
+
+size_t codec_encodedsize(CodecKind kind, size_t len) {
+	return kind == CODEC_HEX ? len*2 : ((len+2)/3)*4;
+}
+
+size_t codec_decodedsize(CodecKind kind, size_t len) {
+	return kind == CODEC_HEX ? (len+1)/2 : (len/4)*3+3;
+}
+
+//-------------------------------------[ SIMD kernels ]
+//--- Each kernel processes whole blocks only and returns the number of input bytes consumed, the scalar code doing the rest
+//--- Hex kernels need SSE2, base64 kernels need SSSE3 (byte shuffles), all of them have an AVX2 version
+#ifdef CODEC_SIMD
+
+#define SIMD_SSE2	1
+#define SIMD_SSSE3	2
+#define SIMD_AVX2	3
+
+static int simd_level = -1;
+
+static int codec_simd(void) {
+	if (simd_level < 0) {
+		__builtin_cpu_init();
+		simd_level = __builtin_cpu_supports("avx2") ? SIMD_AVX2 : __builtin_cpu_supports("ssse3") ? SIMD_SSSE3 : __builtin_cpu_supports("sse2") ? SIMD_SSE2 : 0;
+	}
+	return simd_level;
+}
+
+//--- Hex encoding: 16 (32) bytes to 32 (64) characters
+__attribute__((target("sse2"))) static inline __m128i hex_digits_sse2(__m128i n) {
+	return _mm_add_epi8(_mm_add_epi8(n, _mm_set1_epi8('0')), _mm_and_si128(_mm_cmpgt_epi8(n, _mm_set1_epi8(9)), _mm_set1_epi8('A'-'9'-1)));
+}
+
+__attribute__((target("sse2"))) static size_t hexenc_sse2(const BYTE *src, size_t len, char *out) {
+	const __m128i mask = _mm_set1_epi8(15);
+	size_t i;
+
+	for (i = 0; i + 16 <= len; i += 16, out += 32) {
+		__m128i in = _mm_loadu_si128((const __m128i *)(src + i));
+		__m128i hi = hex_digits_sse2(_mm_and_si128(_mm_srli_epi16(in, 4), mask));
+		__m128i lo = hex_digits_sse2(_mm_and_si128(in, mask));
+		_mm_storeu_si128((__m128i *)out, _mm_unpacklo_epi8(hi, lo));
+		_mm_storeu_si128((__m128i *)(out + 16), _mm_unpackhi_epi8(hi, lo));
+	}
+	return i;
+}
+
+__attribute__((target("avx2"))) static inline __m256i hex_digits_avx2(__m256i n) {
+	return _mm256_add_epi8(_mm256_add_epi8(n, _mm256_set1_epi8('0')), _mm256_and_si256(_mm256_cmpgt_epi8(n, _mm256_set1_epi8(9)), _mm256_set1_epi8('A'-'9'-1)));
+}
+
+__attribute__((target("avx2"))) static size_t hexenc_avx2(const BYTE *src, size_t len, char *out) {
+	const __m256i mask = _mm256_set1_epi8(15);
+	size_t i;
+
+	for (i = 0; i + 32 <= len; i += 32, out += 64) {
+		__m256i in = _mm256_loadu_si256((const __m256i *)(src + i));
+		__m256i hi = hex_digits_avx2(_mm256_and_si256(_mm256_srli_epi16(in, 4), mask));
+		__m256i lo = hex_digits_avx2(_mm256_and_si256(in, mask));
+		__m256i a = _mm256_unpacklo_epi8(hi, lo), b = _mm256_unpackhi_epi8(hi, lo);
+		//--- unpacking works within 128 bits lanes
+		_mm256_storeu_si256((__m256i *)out, _mm256_permute2x128_si256(a, b, 0x20));
+		_mm256_storeu_si256((__m256i *)(out + 32), _mm256_permute2x128_si256(a, b, 0x31));
+	}
+	return i;
+}
+
+//--- Hex decoding: 32 (64) characters to 16 (32) bytes, stops at the first block with a non hexadecimal character
+__attribute__((target("sse2"))) static inline __m128i in_range_sse2(__m128i c, char lo, char count) {
+	__m128i t = _mm_sub_epi8(c, _mm_set1_epi8(lo));
+	return _mm_cmpeq_epi8(_mm_min_epu8(t, _mm_set1_epi8(count-1)), t);
+}
+
+__attribute__((target("sse2"))) static BOOL hex_values_sse2(__m128i c, __m128i *v) {
+	__m128i digit = in_range_sse2(c, '0', 10), alpha = in_range_sse2(_mm_or_si128(c, _mm_set1_epi8(0x20)), 'a', 6);
+
+	*v = _mm_or_si128(_mm_and_si128(digit, _mm_sub_epi8(c, _mm_set1_epi8('0'))), _mm_and_si128(alpha, _mm_sub_epi8(_mm_or_si128(c, _mm_set1_epi8(0x20)), _mm_set1_epi8('a'-10))));
+	return _mm_movemask_epi8(_mm_or_si128(digit, alpha)) == 0xFFFF;
+}
+
+__attribute__((target("sse2"))) static size_t hexdec_sse2(const BYTE *src, size_t len, BYTE *out) {
+	const __m128i low = _mm_set1_epi16(0xFF);
+	__m128i a, b;
+	size_t i;
+
+	for (i = 0; i + 32 <= len; i += 32, out += 16) {
+		if (!hex_values_sse2(_mm_loadu_si128((const __m128i *)(src + i)), &a) || !hex_values_sse2(_mm_loadu_si128((const __m128i *)(src + i + 16)), &b))
+			break;
+		//--- each 16 bits lane holds the high nibble in its low byte
+		a = _mm_or_si128(_mm_slli_epi16(_mm_and_si128(a, low), 4), _mm_srli_epi16(a, 8));
+		b = _mm_or_si128(_mm_slli_epi16(_mm_and_si128(b, low), 4), _mm_srli_epi16(b, 8));
+		_mm_storeu_si128((__m128i *)out, _mm_packus_epi16(a, b));
+	}
+	return i;
+}
+
+__attribute__((target("avx2"))) static inline __m256i in_range_avx2(__m256i c, char lo, char count) {
+	__m256i t = _mm256_sub_epi8(c, _mm256_set1_epi8(lo));
+	return _mm256_cmpeq_epi8(_mm256_min_epu8(t, _mm256_set1_epi8(count-1)), t);
+}
+
+__attribute__((target("avx2"))) static BOOL hex_values_avx2(__m256i c, __m256i *v) {
+	__m256i lower = _mm256_or_si256(c, _mm256_set1_epi8(0x20));
+	__m256i digit = in_range_avx2(c, '0', 10), alpha = in_range_avx2(lower, 'a', 6);
+
+	*v = _mm256_or_si256(_mm256_and_si256(digit, _mm256_sub_epi8(c, _mm256_set1_epi8('0'))), _mm256_and_si256(alpha, _mm256_sub_epi8(lower, _mm256_set1_epi8('a'-10))));
+	return (unsigned int)_mm256_movemask_epi8(_mm256_or_si256(digit, alpha)) == 0xFFFFFFFF;
+}
+
+__attribute__((target("avx2"))) static size_t hexdec_avx2(const BYTE *src, size_t len, BYTE *out) {
+	const __m256i low = _mm256_set1_epi16(0xFF);
+	__m256i a, b;
+	size_t i;
+
+	for (i = 0; i + 64 <= len; i += 64, out += 32) {
+		if (!hex_values_avx2(_mm256_loadu_si256((const __m256i *)(src + i)), &a) || !hex_values_avx2(_mm256_loadu_si256((const __m256i *)(src + i + 32)), &b))
+			break;
+		a = _mm256_or_si256(_mm256_slli_epi16(_mm256_and_si256(a, low), 4), _mm256_srli_epi16(a, 8));
+		b = _mm256_or_si256(_mm256_slli_epi16(_mm256_and_si256(b, low), 4), _mm256_srli_epi16(b, 8));
+		//--- packing works within 128 bits lanes
+		_mm256_storeu_si256((__m256i *)out, _mm256_permute4x64_epi64(_mm256_packus_epi16(a, b), 0xD8));
+	}
+	return i;
+}
+
+//--- Base64 encoding: 12 (24) bytes to 16 (32) characters
+//--- Each 32 bits lane gets 3 input bytes, split into four 6 bits values then translated to the alphabet with a shuffle
+//--- (offsets to add, selected by 0 for 'A'-'Z', 1 for 'a'-'z', 2-11 for digits, 12 and 13 for the two last characters)
+#define B64_OFFSETS(c62, c63)	65, 71, -4, -4, -4, -4, -4, -4, -4, -4, -4, -4, (c62)-62, (c63)-63, 0, 0
+
+__attribute__((target("ssse3"))) static size_t b64enc_ssse3(const BYTE *src, size_t len, char *out, BOOL url) {
+	const __m128i shuffle = _mm_setr_epi8(1, 0, 2, 1, 4, 3, 5, 4, 7, 6, 8, 7, 10, 9, 11, 10);
+	const __m128i offsets = url ? _mm_setr_epi8(B64_OFFSETS('-', '_')) : _mm_setr_epi8(B64_OFFSETS('+', '/'));
+	__m128i in, idx;
+	size_t i;
+
+	for (i = 0; i + 16 <= len; i += 12, out += 16) {
+		in = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i *)(src + i)), shuffle);
+		in = _mm_or_si128(_mm_mulhi_epu16(_mm_and_si128(in, _mm_set1_epi32(0x0FC0FC00)), _mm_set1_epi32(0x04000040)), _mm_mullo_epi16(_mm_and_si128(in, _mm_set1_epi32(0x003F03F0)), _mm_set1_epi32(0x01000010)));
+		idx = _mm_sub_epi8(_mm_subs_epu8(in, _mm_set1_epi8(51)), _mm_cmpgt_epi8(in, _mm_set1_epi8(25)));
+		_mm_storeu_si128((__m128i *)out, _mm_add_epi8(in, _mm_shuffle_epi8(offsets, idx)));
+	}
+	return i;
+}
+
+__attribute__((target("avx2"))) static size_t b64enc_avx2(const BYTE *src, size_t len, char *out, BOOL url) {
+	const __m256i shuffle = _mm256_setr_epi8(1, 0, 2, 1, 4, 3, 5, 4, 7, 6, 8, 7, 10, 9, 11, 10, 1, 0, 2, 1, 4, 3, 5, 4, 7, 6, 8, 7, 10, 9, 11, 10);
+	const __m256i offsets = url ? _mm256_setr_epi8(B64_OFFSETS('-', '_'), B64_OFFSETS('-', '_')) : _mm256_setr_epi8(B64_OFFSETS('+', '/'), B64_OFFSETS('+', '/'));
+	__m256i in, idx;
+	size_t i;
+
+	for (i = 0; i + 28 <= len; i += 24, out += 32) {
+		//--- each 128 bits lane gets 12 input bytes
+		in = _mm256_inserti128_si256(_mm256_castsi128_si256(_mm_loadu_si128((const __m128i *)(src + i))), _mm_loadu_si128((const __m128i *)(src + i + 12)), 1);
+		in = _mm256_shuffle_epi8(in, shuffle);
+		in = _mm256_or_si256(_mm256_mulhi_epu16(_mm256_and_si256(in, _mm256_set1_epi32(0x0FC0FC00)), _mm256_set1_epi32(0x04000040)), _mm256_mullo_epi16(_mm256_and_si256(in, _mm256_set1_epi32(0x003F03F0)), _mm256_set1_epi32(0x01000010)));
+		idx = _mm256_sub_epi8(_mm256_subs_epu8(in, _mm256_set1_epi8(51)), _mm256_cmpgt_epi8(in, _mm256_set1_epi8(25)));
+		_mm256_storeu_si256((__m256i *)out, _mm256_add_epi8(in, _mm256_shuffle_epi8(offsets, idx)));
+	}
+	return i;
+}
+
+//--- Base64 decoding: 16 (32) characters to 12 (24) bytes, stops at the first block with padding, whitespace or an invalid character
+//--- Both alphabets are accepted, as by the scalar decoder
+//--- The last store writes 4 (8) bytes past the decoded ones: callers keep at least 24 (48) characters left to decode
+__attribute__((target("ssse3"))) static BOOL b64_values_ssse3(__m128i c, __m128i *v) {
+	__m128i upper = in_range_sse2(c, 'A', 26), lower = in_range_sse2(c, 'a', 26), digit = in_range_sse2(c, '0', 10);
+	__m128i c62 = _mm_or_si128(_mm_cmpeq_epi8(c, _mm_set1_epi8('+')), _mm_cmpeq_epi8(c, _mm_set1_epi8('-')));
+	__m128i c63 = _mm_or_si128(_mm_cmpeq_epi8(c, _mm_set1_epi8('/')), _mm_cmpeq_epi8(c, _mm_set1_epi8('_')));
+	__m128i offset = _mm_or_si128(_mm_or_si128(_mm_and_si128(upper, _mm_set1_epi8(-65)), _mm_and_si128(lower, _mm_set1_epi8(-71))), _mm_and_si128(digit, _mm_set1_epi8(4)));
+
+	*v = _mm_andnot_si128(_mm_or_si128(c62, c63), _mm_add_epi8(c, offset));
+	*v = _mm_or_si128(*v, _mm_or_si128(_mm_and_si128(c62, _mm_set1_epi8(62)), _mm_and_si128(c63, _mm_set1_epi8(63))));
+	return _mm_movemask_epi8(_mm_or_si128(_mm_or_si128(upper, lower), _mm_or_si128(digit, _mm_or_si128(c62, c63)))) == 0xFFFF;
+}
+
+__attribute__((target("ssse3"))) static size_t b64dec_ssse3(const BYTE *src, size_t len, BYTE *out) {
+	const __m128i shuffle = _mm_setr_epi8(2, 1, 0, 6, 5, 4, 10, 9, 8, 14, 13, 12, -1, -1, -1, -1);
+	__m128i v;
+	size_t i;
+
+	for (i = 0; i + 24 <= len; i += 16, out += 12) {
+		if (!b64_values_ssse3(_mm_loadu_si128((const __m128i *)(src + i)), &v))
+			break;
+		//--- packs four 6 bits values in each 32 bits lane, then reorders the three bytes
+		v = _mm_madd_epi16(_mm_maddubs_epi16(v, _mm_set1_epi32(0x01400140)), _mm_set1_epi32(0x00011000));
+		_mm_storeu_si128((__m128i *)out, _mm_shuffle_epi8(v, shuffle));
+	}
+	return i;
+}
+
+__attribute__((target("avx2"))) static BOOL b64_values_avx2(__m256i c, __m256i *v) {
+	__m256i upper = in_range_avx2(c, 'A', 26), lower = in_range_avx2(c, 'a', 26), digit = in_range_avx2(c, '0', 10);
+	__m256i c62 = _mm256_or_si256(_mm256_cmpeq_epi8(c, _mm256_set1_epi8('+')), _mm256_cmpeq_epi8(c, _mm256_set1_epi8('-')));
+	__m256i c63 = _mm256_or_si256(_mm256_cmpeq_epi8(c, _mm256_set1_epi8('/')), _mm256_cmpeq_epi8(c, _mm256_set1_epi8('_')));
+	__m256i offset = _mm256_or_si256(_mm256_or_si256(_mm256_and_si256(upper, _mm256_set1_epi8(-65)), _mm256_and_si256(lower, _mm256_set1_epi8(-71))), _mm256_and_si256(digit, _mm256_set1_epi8(4)));
+
+	*v = _mm256_andnot_si256(_mm256_or_si256(c62, c63), _mm256_add_epi8(c, offset));
+	*v = _mm256_or_si256(*v, _mm256_or_si256(_mm256_and_si256(c62, _mm256_set1_epi8(62)), _mm256_and_si256(c63, _mm256_set1_epi8(63))));
+	return (unsigned int)_mm256_movemask_epi8(_mm256_or_si256(_mm256_or_si256(upper, lower), _mm256_or_si256(digit, _mm256_or_si256(c62, c63)))) == 0xFFFFFFFF;
+}
+
+__attribute__((target("avx2"))) static size_t b64dec_avx2(const BYTE *src, size_t len, BYTE *out) {
+	const __m256i shuffle = _mm256_setr_epi8(2, 1, 0, 6, 5, 4, 10, 9, 8, 14, 13, 12, -1, -1, -1, -1, 2, 1, 0, 6, 5, 4, 10, 9, 8, 14, 13, 12, -1, -1, -1, -1);
+	__m256i v;
+	size_t i;
+
+	for (i = 0; i + 48 <= len; i += 32, out += 24) {
+		if (!b64_values_avx2(_mm256_loadu_si256((const __m256i *)(src + i)), &v))
+			break;
+		v = _mm256_madd_epi16(_mm256_maddubs_epi16(v, _mm256_set1_epi32(0x01400140)), _mm256_set1_epi32(0x00011000));
+		//--- gathers the 12 bytes of each 128 bits lane
+		v = _mm256_permutevar8x32_epi32(_mm256_shuffle_epi8(v, shuffle), _mm256_setr_epi32(0, 1, 2, 4, 5, 6, 3, 7));
+		_mm256_storeu_si256((__m256i *)out, v);
+	}
+	return i;
+}
+
+#endif
+
+//-------------------------------------[ Encoding ]
+static char *encode_group(char *out, const char *alphabet, UINT32 v) {
+	out[0] = alphabet[(v >> 18) & 63];
+	out[1] = alphabet[(v >> 12) & 63];
+	out[2] = alphabet[(v >> 6) & 63];
+	out[3] = alphabet[v & 63];
+	return out+4;
+}
+
+size_t codec_encode(Codec *c, const BYTE *src, size_t len, char *dst, BOOL last) {
+	const char *alphabet = alphabets[c->kind == CODEC_BASE64URL];
+	char *out = dst;
+#ifdef CODEC_SIMD
+	size_t n = 0;
+#endif
+
+	if (c->kind == CODEC_HEX) {
+#ifdef CODEC_SIMD
+		switch (codec_simd()) {
+			case SIMD_AVX2:		n = hexenc_avx2(src, len, out); break;
+			case SIMD_SSSE3:
+			case SIMD_SSE2:		n = hexenc_sse2(src, len, out);
+		}
+		src += n;
+		len -= n;
+		out += n*2;
+#endif
+		for (; len--; src++) {
+			*out++ = hexdigits[*src >> 4];
+			*out++ = hexdigits[*src & 15];
+		}
+		return out-dst;
+	}
+	if (c->npending) {
+		for (; c->npending < 3 && len; len--)
+			c->pending[c->npending++] = *src++;
+		if (c->npending == 3) {
+			out = encode_group(out, alphabet, (c->pending[0] << 16) | (c->pending[1] << 8) | c->pending[2]);
+			c->npending = 0;
+		}
+	}
+#ifdef CODEC_SIMD
+	switch (codec_simd()) {
+		case SIMD_AVX2:		n = b64enc_avx2(src, len, out, c->kind == CODEC_BASE64URL); break;
+		case SIMD_SSSE3:	n = b64enc_ssse3(src, len, out, c->kind == CODEC_BASE64URL);
+	}
+	src += n;
+	len -= n;
+	out += n/3*4;
+#endif
+	for (; len >= 3; len -= 3, src += 3)
+		out = encode_group(out, alphabet, (src[0] << 16) | (src[1] << 8) | src[2]);
+	while (len--)
+		c->pending[c->npending++] = *src++;
+	if (last && c->npending) {
+		c->pending[c->npending] = 0;
+		encode_group(out, alphabet, (c->pending[0] << 16) | (c->npending > 1 ? (c->pending[1] << 8) : 0));
+		out += c->npending+1;
+		if (c->kind == CODEC_BASE64)
+			while ((out-dst) & 3)
+				*out++ = '=';
+		c->npending = 0;
+	}
+	return out-dst;
+}
+
+//-------------------------------------[ Decoding ]
+size_t codec_decode(lua_State *L, Codec *c, const char *src, size_t len, BYTE *dst, BOOL last) {
+	const BYTE *s = (const BYTE *)src, *end = s+len;
+	BYTE *out = dst;
+	int v;
+#ifdef CODEC_SIMD
+	int level = codec_simd();
+	const BYTE *retry = level >= SIMD_SSSE3 ? s : end;
+	size_t n = 0;
+#endif
+
+	if (!tables_ready)
+		init_tables();
+	if (c->kind == CODEC_HEX) {
+		if (c->nbits && (s < end)) {
+			if ((v = hex_values[*s++]) < 0)
+				goto hexerr;
+			*out++ = (BYTE)((c->bits << 4) | v);
+			c->nbits = 0;
+		}
+#ifdef CODEC_SIMD
+		//--- the kernels stop before any invalid character, that the scalar loop reports
+		switch (level) {
+			case SIMD_AVX2:		n = hexdec_avx2(s, end-s, out); break;
+			case SIMD_SSSE3:
+			case SIMD_SSE2:		n = hexdec_sse2(s, end-s, out);
+		}
+		s += n;
+		out += n/2;
+#endif
+		for (; end-s >= 2; s += 2) {
+			int hi = hex_values[s[0]], lo = hex_values[s[1]];
+			if ((hi | lo) < 0) {
+				s += hi >= 0;
+				goto hexerr;
+			}
+			*out++ = (BYTE)((hi << 4) | lo);
+		}
+		if (s < end) {
+			if ((v = hex_values[*s]) < 0)
+				goto hexerr;
+			c->bits = v;
+			c->nbits = 4;
+		}
+		if (last && c->nbits) {
+			c->nbits = 0;
+			luaL_error(L, "invalid hexadecimal sequence (odd number of characters)");
+		}
+		return out-dst;
+hexerr:	c->nbits = 0;
+		return luaL_error(L, "invalid character '%c' in hexadecimal sequence", *s);
+	}
+	while (s < end) {
+#ifdef CODEC_SIMD
+		//--- SIMD kernels, tried again one block after the position where they stopped
+		if (!c->nbits && (s >= retry) && (end-s >= 24)) {
+			n = level == SIMD_AVX2 ? b64dec_avx2(s, end-s, out) : b64dec_ssse3(s, end-s, out);
+			s += n;
+			out += n/4*3;
+			retry = s + 32;
+			continue;
+		}
+#endif
+		//--- fast path for groups of four characters
+		if (!c->nbits && (end-s >= 4)) {
+			int a = b64_values[s[0]], b = b64_values[s[1]], d = b64_values[s[2]], e = b64_values[s[3]];
+			if ((a | b | d | e) >= 0) {
+				UINT32 group = (a << 18) | (b << 12) | (d << 6) | e;
+				out[0] = (BYTE)(group >> 16);
+				out[1] = (BYTE)(group >> 8);
+				out[2] = (BYTE)group;
+				out += 3;
+				s += 4;
+				continue;
+			}
+		}
+		if ((v = b64_values[*s]) >= 0) {
+			c->bits = (c->bits << 6) | v;
+			if ((c->nbits += 6) >= 8) {
+				c->nbits -= 8;
+				*out++ = (BYTE)(c->bits >> c->nbits);
+				c->bits &= (1 << c->nbits)-1;
+			}
+		} else if (v == PADDING)
+			c->bits = c->nbits = 0;
+		else if (v == INVALID) {
+			c->bits = c->nbits = 0;
+			luaL_error(L, "invalid character '%c' in base64 sequence", *s);
+		}
+		s++;
+	}
+	if (last && c->nbits) {
+		BOOL truncated = c->nbits == 6;
+		c->bits = c->nbits = 0;
+		if (truncated)
+			luaL_error(L, "invalid base64 sequence (truncated)");
+	}
+	return out-dst;
+}
+
+//-------------------------------------[ Encoder and Decoder objects ]
+static const BYTE *codec_input(lua_State *L, int idx, size_t *len) {
+	Buffer *b;
+
+	if (lua_isnoneornil(L, idx)) {
+		*len = 0;
+		return NULL;
+	}
+	if (lua_type(L, idx) == LUA_TSTRING)
+		return (const BYTE *)lua_tolstring(L, idx, len);
+	b = luaL_checkcinstance(L, idx, Buffer);
+	*len = b->size;
+	return b->bytes;
+}
+
+static int encoder_update(lua_State *L, BOOL last) {
+	Encoder *e = lua_self(L, 1, Encoder);
+	luaL_Buffer b;
+	size_t len;
+	const BYTE *src = codec_input(L, 2, &len);
+	char *out = luaL_buffinitsize(L, &b, codec_encodedsize(e->kind, len + e->npending));
+
+	luaL_pushresultsize(&b, codec_encode(e, src, len, out, last));
+	return 1;
+}
+
+static int decoder_update(lua_State *L, BOOL last) {
+	Decoder *d = lua_self(L, 1, Decoder);
+	size_t len;
+	const BYTE *src = codec_input(L, 2, &len);
+	Buffer *b;
+
+	lua_pushnil(L);
+	b = lua_pushinstance(L, Buffer, 1);
+	b->size = codec_decode(L, d, (const char *)src, len, buffer_reserve(L, b, codec_decodedsize(d->kind, len)), last);
+	return 1;
+}
+
+LUA_CONSTRUCTOR(Encoder) {
+	Encoder *e = lua_allocinstance(L, Encoder);
+	e->kind = luaL_checkoption(L, 2, "base64", codecs);
+	lua_newinstance(L, e, Encoder);
+	return 1;
+}
+
+LUA_METHOD(Encoder, update) {
+	return encoder_update(L, FALSE);
+}
+
+LUA_METHOD(Encoder, finish) {
+	return encoder_update(L, TRUE);
+}
+
+LUA_CONSTRUCTOR(Decoder) {
+	Decoder *d = lua_allocinstance(L, Decoder);
+	d->kind = luaL_checkoption(L, 2, "base64", codecs);
+	lua_newinstance(L, d, Decoder);
+	return 1;
+}
+
+LUA_METHOD(Decoder, update) {
+	return decoder_update(L, FALSE);
+}
+
+LUA_METHOD(Decoder, finish) {
+	return decoder_update(L, TRUE);
+}
+
+const luaL_Reg Encoder_methods[] = {
+	{"update",		Encoder_update},
+	{"finish",		Encoder_finish},
+	{NULL, NULL}
+};
+
+const luaL_Reg Decoder_methods[] = {
+	{"update",		Decoder_update},
+	{"finish",		Decoder_finish},
+	{NULL, NULL}
+};
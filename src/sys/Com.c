@@ -103,7 +103,7 @@ static int COM_method_call(lua_State *L) {
 								V_VT(var) = VT_BSTR;
 								free(str);
 								break;
-			case LUA_TTABLE:	{
+			case LUA_TUSERDATA:	{
 									COM *o = lua_self(L, idx, COM);
 									V_DISPATCH(var) = o->this;
 									IDispatch_AddRef(o->this);
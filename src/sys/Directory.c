@@ -24,7 +24,7 @@ luart_type TDirectory;
 //-------------------------------------[ Directory Constructor ]
 LUA_CONSTRUCTOR(Directory) {
 	DWORD dwAttrib;
-	Directory *dir = calloc(1, sizeof(Directory));
+	Directory *dir = lua_allocinstance(L, Directory);
 	dir->type = TDirectory;
 	init_fullpath(L, dir);
 	lua_newinstance(L, dir, Directory);
@@ -18,6 +18,7 @@
 #include <limits.h>
 #include <fcntl.h>
 #include <shlwapi.h>
+#include "lib\map.h"
 
 luart_type TFile;
 const char *file_modes[] = { "read", "append", "write", "readwrite", NULL };
@@ -28,6 +29,7 @@ const int bom_size[] = {0, 3, 2};
 const int encoding_size[]= {1, 1, 2};
 
 const char* seek_modes[] = { "start", "here", "end", NULL };
+const char* map_modes[] = { "read", "readwrite", NULL };
 const unsigned long seek_values[] = { SEEK_SET , SEEK_CUR, SEEK_END};
 
 static BOOL update_time(File *f) {
@@ -70,7 +72,7 @@ void init_fullpath(lua_State *L, File *f) {
 
 //-------------------------------------[ File Constructor ]
 LUA_CONSTRUCTOR(File) {
-	File *f = calloc(1, sizeof(File));
+	File *f = lua_allocinstance(L, File);
 	f->type = TFile;
 	init_fullpath(L, f);
 	lua_newinstance(L, f, File);
@@ -92,6 +94,7 @@ LUA_METHOD(File, open) {
 	if (!f->std) {
 		if (f->stream)
 			fclose(f->stream);
+		f->bufpos = f->buflen = 0;
 		f->stream = _wfopen(f->fullpath, file_values[mode]);
 		if (!f->stream)
 			luaL_error(L, "File open failed '%s'", strerror(errno));
@@ -135,6 +138,25 @@ LUA_METHOD(File, open) {
 	return 0;
 }
 
+//--- Gives back unread buffered bytes to the stream, before writing or seeking
+void file_sync(File *f) {
+	if (f->bufpos < f->buflen)
+		_fseeki64(f->stream, -(__int64)(f->buflen - f->bufpos), SEEK_CUR);
+	f->bufpos = f->buflen = 0;
+}
+
+//--- Refills the read buffer, keeping the unread bytes. Returns the number of bytes read from the stream
+static size_t file_fill(lua_State *L, File *f) {
+	size_t left = f->buflen - f->bufpos;
+
+	if (!f->buffer && !(f->buffer = malloc(FILE_BUFFERSIZE)))
+		luaL_error(L, "memory allocation error: not enough memory");
+	memmove(f->buffer, f->buffer + f->bufpos, left);
+	f->bufpos = 0;
+	f->buflen = left + fread(f->buffer + left, 1, FILE_BUFFERSIZE - left, f->stream);
+	return f->buflen - left;
+}
+
 //-------------------------------------[ File.write() ]
 LUA_METHOD(File, write) {
 	File *f = lua_self(L, 1, File);
@@ -145,6 +167,7 @@ LUA_METHOD(File, write) {
 		size_t r, done = 0;
 		if (!f->mode)
 			luaL_error(L, "error: File not opened for writing");
+		file_sync(f);
 		if (f->encoding == UNICODE) {
 			if (!lua_isstring(L, 2))
 				buf = (char*)luaL_tolstring(L, 2, &wsize);
@@ -169,6 +192,7 @@ LUA_METHOD(File, writeln) {
 	File *f = lua_self(L, 1, File);
 	if (lua_gettop(L) > 1)
 		File_write(L);
+	file_sync(f);
 	if (f->encoding == UNICODE)
 		fputws(L"\r\n", f->stream);
 	else
@@ -176,14 +200,30 @@ LUA_METHOD(File, writeln) {
 	return 1;
 }
 
+//--- Removes carriage returns followed by a line feed, in a buffer of nbytes characters
+static size_t strip_crlf(char *buff, size_t len, int nbytes) {
+	size_t i, j;
+
+	if (nbytes == 1) {
+		for (i = j = 0; i < len; i++)
+			if (buff[i] != 13 || i+1 == len || buff[i+1] != 10)
+				buff[j++] = buff[i];
+	} else {
+		wchar_t *w = (wchar_t*)buff;
+		len /= sizeof(wchar_t);
+		for (i = j = 0; i < len; i++)
+			if (w[i] != 13 || i+1 == len || w[i+1] != 10)
+				w[j++] = w[i];
+		j *= sizeof(wchar_t);
+	}
+	return j;
+}
+
 static int FileRead(lua_State *L, File *f, size_t size, BOOL line) {
 	luaL_Buffer b;
-	char buff[sizeof(wchar_t)];
-	wchar_t *c = (wchar_t*)buff;
 	int nbytes = f->std ? 2 : encoding_size[f->encoding];
 	size_t todo = size;
-	size_t utf8size;
-	size_t i, last = 0;
+	size_t i;
 	extern wchar_t echochar;
 
 	if (f->mode > 0 && f->mode < 3)
@@ -239,23 +279,44 @@ readstd:	while (ReadConsoleW(f->h, &ch, 1, (LPDWORD)&i, NULL)) {
 		} else goto readstd;
 	}
 	else if (f->stream) {
-		while ( (fread(buff, nbytes, 1, f->stream)) ) {
-			if (f->encoding == UTF8 && ((utf8size = utf8_charsize(buff)) > 1)) {
-				fread(buff+1, utf8size-1, 1, f->stream);
-				luaL_addlstring(&b, buff, utf8size);
+		//--- reads whole slices of the buffer: up to the next line feed for lines, or up to todo characters
+		if (!todo)
+			todo = (size_t)-1;
+		while (f->buflen - f->bufpos >= (size_t)nbytes || file_fill(L, f)) {
+			char *start = f->buffer + f->bufpos;
+			size_t len = (f->buflen - f->bufpos) & ~(size_t)(nbytes-1);
+			const char *end;
+
+			if (!len)
 				continue;
-			}
-			if (((nbytes == 2) && (*c == 10)) || ((nbytes == 1) && (*buff == 10))) {
-				if (f->encoding && last == 13)
-					b.n = b.n-nbytes;
-				if (line)
+			if (line) {
+				end = nbytes == 2 ? (const char *)wmemchr((wchar_t*)start, 10, len/2) : memchr(start, 10, len);
+				if (end) {
+					luaL_addlstring(&b, start, end-start);
+					f->bufpos += end-start+nbytes;
+					if (f->encoding && b.n >= (size_t)nbytes && (nbytes == 2 ? ((wchar_t*)(luaL_buffaddr(&b)+b.n))[-1] : luaL_buffaddr(&b)[b.n-1]) == 13)
+						luaL_buffsub(&b, nbytes);
 					break;
-			}
-			last = nbytes == 2 ? *c : *buff;
-			luaL_addlstring(&b, buff, nbytes);
-			if (!--todo)
+				}
+			} else if (f->encoding == UTF8) {
+				//--- todo counts the characters left to read, plus the following one that ends the last character
+				len = utf8_skip(start, len, &todo);
+				if (len < f->buflen - f->bufpos) {
+					luaL_addlstring(&b, start, len);
+					f->bufpos += len;
+					break;
+				}
+			} else if (len/nbytes >= todo) {
+				luaL_addlstring(&b, start, todo*nbytes);
+				f->bufpos += todo*nbytes;
 				break;
+			} else
+				todo -= len/nbytes;
+			luaL_addlstring(&b, start, len);
+			f->bufpos += len;
 		}
+		if (!line && f->encoding)
+			b.n = strip_crlf(luaL_buffaddr(&b), b.n, nbytes);
 	}
 	else
 		luaL_error(L, "could not read, File is not open");
@@ -294,6 +355,26 @@ LUA_METHOD(File, readln) {
 	return 1;          
 }
 
+//-------------------------------------[ File.map() ]
+LUA_METHOD(File, map) {
+	File *f = lua_self(L, 1, File);
+	BOOL rw = luaL_checkoption(L, 2, "read", map_modes);
+	void *view;
+	size_t size;
+	Buffer *b;
+	int err;
+
+	lua_pushnil(L);
+	b = lua_pushinstance(L, Buffer, 1);
+	if ((err = map_file(f->fullpath, rw, &view, &size))) {
+		lasterror(L, err);
+		luaL_error(L, "File mapping failed (%s)", lua_tostring(L, -1));
+	}
+	if (view)
+		buffer_attach(L, b, view, size, size, rw ? BUFFER_MAPPEDRW : BUFFER_MAPPED);
+	return 1;
+}
+
 //-------------------------------------[ File.flush() ]
 LUA_METHOD(File, flush) {
 	File *f = lua_self(L, 1, File);
@@ -310,6 +391,7 @@ LUA_METHOD(File, close) {
 		fclose(f->stream);
 		f->stream = 0;
 		f->h = 0;
+		f->bufpos = f->buflen = 0;
 	}
 	if (f->stdstream) {
 		f->std = TRUE;
@@ -532,7 +614,7 @@ LUA_METHOD(File, setmodified) {
 LUA_METHOD(File, getposition) {
 	File *f = lua_self(L, 1, File);
 	if (f->stream)
-		lua_pushinteger(L, _ftelli64( f->stream)-1);
+		lua_pushinteger(L, _ftelli64( f->stream)-(f->buflen-f->bufpos)-1);
 	else
 		lua_pushnil(L);
 	return 1;
@@ -545,8 +627,10 @@ LUA_METHOD(File, setposition) {
 	if (pos == 0)
 		luaL_error(L, "zero is an invalid File.position value");
 
-	if (f->stream)
+	if (f->stream) {
+		f->bufpos = f->buflen = 0;
 		_fseeki64(f->stream, (pos-1) + bom_size[f->encoding], SEEK_SET);
+	}
 	return 0;
 }
 
@@ -554,7 +638,7 @@ LUA_METHOD(File, setposition) {
 LUA_METHOD(File, geteof) {
 	File *f = lua_self(L, 1, File);
 	if (f->stream)
-		lua_pushboolean(L, feof(f->stream));
+		lua_pushboolean(L, feof(f->stream) && (f->bufpos == f->buflen));
 	else
 		lua_pushnil(L);
 	return 1;
@@ -581,7 +665,7 @@ LUA_METHOD(File, getencoding) {
 //-------------------------------------[ File.lines ]
 static int iterate_lines(lua_State *L) {
 	File *f = lua_self(L, lua_upvalueindex(1), File);
-	if (feof(f->stream))
+	if (feof(f->stream) && (f->bufpos == f->buflen))
 		return 0;
 	FileRead(L, f, 0, TRUE);
 	return 1;
@@ -600,6 +684,7 @@ const luaL_Reg File_methods[] = {
 	{"writeln",			File_writeln},
 	{"read",			File_read},
 	{"readln",			File_readln},
+	{"map",				File_map},
 	{"flush",			File_flush},
 	{"remove",			File_remove},
 	{"copy",			File_copy},
@@ -637,7 +722,7 @@ LUA_METHOD(File, gc) {
 	File_close(L);
 	free(f->fullpath);
 	free(f->fname);
-	free(f);
+	free(f->buffer);
 	return 0;
 }
 
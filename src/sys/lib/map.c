@@ -0,0 +1,119 @@
+/*
+ | LuaRT - A Windows programming framework for Lua
+ | Luart.org, Copyright (c) Tine Samir 2022.
+ | See Copyright Notice in LICENSE.TXT
+ |-------------------------------------------------
+ | map.c | Whole file memory mapping (file mapping objects on Windows, mmap elsewhere)
+*/
+
+#include "map.h"
+#include <stdint.h>
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <stdlib.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+#ifdef _WIN32
+
+int map_handle(intptr_t handle, int rw, void **view, size_t *size) {
+	HANDLE h = (HANDLE)handle, map;
+	LARGE_INTEGER len;
+	int err = 0;
+
+	*view = NULL;
+	*size = 0;
+	if (!GetFileSizeEx(h, &len))
+		err = GetLastError();
+	else if ((ULONGLONG)len.QuadPart > SIZE_MAX)
+		err = ERROR_NOT_ENOUGH_MEMORY;
+	else if (len.QuadPart) {
+		if ((map = CreateFileMappingW(h, NULL, rw ? PAGE_READWRITE : PAGE_READONLY, 0, 0, NULL))) {
+			if ((*view = MapViewOfFile(map, rw ? FILE_MAP_WRITE : FILE_MAP_READ, 0, 0, 0)))
+				*size = (size_t)len.QuadPart;
+			else err = GetLastError();
+			//--- the view keeps a reference to the mapping object
+			CloseHandle(map);
+		} else err = GetLastError();
+	}
+	return err;
+}
+
+int map_file(const wchar_t *path, int rw, void **view, size_t *size) {
+	HANDLE h;
+	int err;
+
+	*view = NULL;
+	*size = 0;
+	if ((h = CreateFileW(path, rw ? GENERIC_READ | GENERIC_WRITE : GENERIC_READ, FILE_SHARE_READ | FILE_SHARE_WRITE, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL)) == INVALID_HANDLE_VALUE)
+		return GetLastError();
+	err = map_handle((intptr_t)h, rw, view, size);
+	CloseHandle(h);
+	return err;
+}
+
+int map_flush(void *view, size_t size) {
+	return FlushViewOfFile(view, 0) ? 0 : GetLastError();
+}
+
+void map_release(void *view, size_t size) {
+	UnmapViewOfFile(view);
+}
+
+#else
+
+int map_handle(intptr_t handle, int rw, void **view, size_t *size) {
+	int fd = (int)handle, err = 0;
+	struct stat st;
+
+	*view = NULL;
+	*size = 0;
+	if (fstat(fd, &st))
+		err = errno;
+	else if ((uint64_t)st.st_size > SIZE_MAX)
+		err = EFBIG;
+	else if (st.st_size) {
+		if ((*view = mmap(NULL, (size_t)st.st_size, rw ? PROT_READ | PROT_WRITE : PROT_READ, MAP_SHARED, fd, 0)) != MAP_FAILED)
+			*size = (size_t)st.st_size;
+		else {
+			err = errno;
+			*view = NULL;
+		}
+	}
+	return err;
+}
+
+int map_file(const wchar_t *path, int rw, void **view, size_t *size) {
+	char fname[PATH_MAX];
+	size_t len;
+	int fd, err;
+
+	*view = NULL;
+	*size = 0;
+	if ((len = wcstombs(fname, path, PATH_MAX)) == (size_t)-1)
+		return EILSEQ;
+	if (len == PATH_MAX)
+		return ENAMETOOLONG;
+	if ((fd = open(fname, rw ? O_RDWR : O_RDONLY)) < 0)
+		return errno;
+	err = map_handle(fd, rw, view, size);
+	close(fd);
+	return err;
+}
+
+int map_flush(void *view, size_t size) {
+	return msync(view, size, MS_SYNC) ? errno : 0;
+}
+
+void map_release(void *view, size_t size) {
+	munmap(view, size);
+}
+
+#endif
@@ -0,0 +1,22 @@
+/*
+ | LuaRT - A Windows programming framework for Lua
+ | Luart.org, Copyright (c) Tine Samir 2022.
+ | See Copyright Notice in LICENSE.TXT
+ |-------------------------------------------------
+ | map.h | Whole file memory mapping (file mapping objects on Windows, mmap elsewhere)
+*/
+
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+#include <wchar.h>
+
+//--- Maps an existing file in memory, for reading only or for reading and writing
+//--- Returns 0 with the view and its size (NULL and 0 for an empty file), or the system error code (GetLastError() on Windows, errno elsewhere)
+int map_file(const wchar_t *path, int rw, void **view, size_t *size);
+//--- Same as map_file() for an already opened file, a HANDLE on Windows or a file descriptor elsewhere, that is left open
+int map_handle(intptr_t handle, int rw, void **view, size_t *size);
+//--- Writes the modified pages of a read/write view to the file
+int map_flush(void *view, size_t size);
+void map_release(void *view, size_t size);
@@ -0,0 +1,103 @@
+/*
+ | LuaRT - A Windows programming framework for Lua
+ | Luart.org, Copyright (c) Tine Samir 2022.
+ | See Copyright Notice in LICENSE.TXT
+ |-------------------------------------------------
+ | map_test.c | Standalone test of the file mapping helper (POSIX build)
+ |
+ | gcc -std=gnu99 -Wall -o map_test sys/lib/map_test.c sys/lib/map.c && ./map_test
+*/
+
+#include "map.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+static int failures = 0;
+
+#define check(cond) do { if (!(cond)) { fprintf(stderr, "%s:%d: check failed: %s\n", __FILE__, __LINE__, #cond); failures++; } } while (0)
+
+static void write_file(const char *path, const char *data, size_t len) {
+	FILE *f = fopen(path, "wb");
+	fwrite(data, 1, len, f);
+	fclose(f);
+}
+
+static void tempname(char *fname, wchar_t *wname) {
+	int fd;
+
+	strcpy(fname, "/tmp/map_testXXXXXX");
+	fd = mkstemp(fname);
+	close(fd);
+	mbstowcs(wname, fname, 64);
+}
+
+int main(void) {
+	char fname[64], content[8192], data[16];
+	wchar_t wname[64];
+	void *view;
+	size_t size, i;
+	FILE *f;
+	int fd;
+
+	for (i = 0; i < sizeof(content); i++)
+		content[i] = (char)(i * 7);
+	tempname(fname, wname);
+
+	//--- read only mapping
+	write_file(fname, content, sizeof(content));
+	check(map_file(wname, 0, &view, &size) == 0);
+	check(view && size == sizeof(content));
+	check(view && !memcmp(view, content, sizeof(content)));
+	map_release(view, size);
+
+	//--- read/write mapping, changes reach the file once flushed
+	check(map_file(wname, 1, &view, &size) == 0);
+	if (view) {
+		memcpy(view, "mapped", 6);
+		memcpy((char *)view + size - 4, "tail", 4);
+		check(map_flush(view, size) == 0);
+		map_release(view, size);
+	}
+	f = fopen(fname, "rb");
+	check(fread(data, 1, 6, f) == 6 && !memcmp(data, "mapped", 6));
+	fseek(f, -4, SEEK_END);
+	check(fread(data, 1, 4, f) == 4 && !memcmp(data, "tail", 4));
+	fclose(f);
+
+	//--- already opened files are mapped without being closed
+	fd = open(fname, O_RDONLY);
+	check(map_handle(fd, 0, &view, &size) == 0);
+	check(view && size == sizeof(content) && !memcmp((char *)view + 6, content + 6, size - 10));
+	map_release(view, size);
+	check(lseek(fd, 0, SEEK_END) == (off_t)sizeof(content));
+	close(fd);
+	check(map_handle(fd, 0, &view, &size) == EBADF && view == NULL);
+
+	//--- empty files are not mapped
+	write_file(fname, "", 0);
+	view = (void *)1;
+	size = 1;
+	check(map_file(wname, 0, &view, &size) == 0);
+	check(view == NULL && size == 0);
+
+	//--- errors are reported with the system error code
+	unlink(fname);
+	check(map_file(wname, 0, &view, &size) == ENOENT);
+	check(view == NULL && size == 0);
+	write_file(fname, content, sizeof(content));
+	chmod(fname, 0400);
+	if (getuid())
+		check(map_file(wname, 1, &view, &size) == EACCES);
+	unlink(fname);
+
+	if (failures)
+		fprintf(stderr, "%d check(s) failed\n", failures);
+	else
+		puts("map_test: all checks passed");
+	return failures != 0;
+}
@@ -14,6 +14,7 @@
 #include <File.h>
 #include <Directory.h>
 #include <Pipe.h>
+#include <Codec.h>
 #include <Date.h>
 #include <Com.h>
 #include <luart.h>
@@ -345,26 +346,25 @@ LUA_METHOD(reg, write) {
 								type = (n == 5) && lua_toboolean(L, 5) ? REG_EXPAND_SZ : REG_SZ;
 								break;
 							}							
+		case LUA_TUSERDATA:	{
+								Buffer *buff = luaL_checkcinstance(L, 4, Buffer);
+								luaL_addlstring(&b, (const char*)buff->bytes, buff->size);
+								type = REG_BINARY;
+								break;
+							}
 		case LUA_TTABLE:	{
-								luart_type t;
-								Buffer *buff = lua_tocinstance(L, 4, &t);
-								if (buff && (t == TBuffer)) {
-									luaL_addlstring(&b, (const char*)buff->bytes, buff->size);
-									type = REG_BINARY;
-								} else {
-									lua_pushvalue(L, 4);
-									lua_pushnil(L);
-									type = REG_MULTI_SZ;
-									while(lua_next(L, -2)) {
-										int len;
-										wchar_t *str;
-										if (!lua_isstring(L, -1))
-											luaL_argerror(L, 4, "table of strings");
-										str = lua_tolwstring(L, -1, &len);
-										luaL_addlstring(&b, (const char *)str, (++len)*sizeof(wchar_t));								
-										lua_pop(L, 1);
-									}
-								}							
+								lua_pushvalue(L, 4);
+								lua_pushnil(L);
+								type = REG_MULTI_SZ;
+								while(lua_next(L, -2)) {
+									int len;
+									wchar_t *str;
+									if (!lua_isstring(L, -1))
+										luaL_argerror(L, 4, "table of strings");
+									str = lua_tolwstring(L, -1, &len);
+									luaL_addlstring(&b, (const char *)str, (++len)*sizeof(wchar_t));								
+									lua_pop(L, 1);
+								}
 								break;
 							}
 		case LUA_TNIL:		type = REG_NONE;
@@ -441,11 +441,13 @@ LUAMOD_API int luaopen_sys(lua_State *L) {
 	setlocale(LC_ALL, ".UTF8");
 	setlocale(LC_TIME, "");
 	lua_regmodule(L, sys);
-	lua_regobjectmt(L, File);
-	lua_regobjectmt(L, Buffer);
+	lua_regcobjectmt(L, File);
+	lua_regcobjectmt(L, Buffer);
 	lua_regobjectmt(L, Pipe);
-	lua_regobjectmt(L, Directory);
+	lua_regcobjectmt(L, Directory);
 	lua_regobjectmt(L, Datetime);
 	lua_regobjectmt(L, COM);
+	lua_regcobject(L, Encoder);
+	lua_regcobject(L, Decoder);
 	return 1;
 }
\ No newline at end of file
@@ -583,7 +583,7 @@ LUA_METHOD(Listbox, remove) {
 							break;
 		case LUA_TSTRING:	idx = find_item_bytext(L, w, 0, &hti);
 							break;
-		case LUA_TTABLE:	{
+		case LUA_TUSERDATA:	{
 								Widget *item = check_widget(L, 2, UIItem);
 								if (w->wtype != item->item.itemtype)
 									luaL_typeerror(L, 2, types[w->wtype-UIList]);
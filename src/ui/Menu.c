@@ -149,7 +149,7 @@ static int add_menuitems(lua_State *L, lua_Integer idx, int stridx) {
 		mi.cch = len+1;
 		mi.dwTypeData = str;
 		stridx++;
-		if (lua_gettop(L) == stridx && lua_istable(L, stridx)) {
+		if (lua_gettop(L) == stridx && lua_isuserdata(L, stridx)) {
 			mi.fMask |= MIIM_SUBMENU | MIIM_DATA;
 			mi.dwItemData = (ULONG_PTR)check_widget(L, stridx, UIMenu);
 			mi.hSubMenu = ((Widget*)mi.dwItemData)->handle;
@@ -264,7 +264,7 @@ LUA_PROPERTY_SET(MenuItem, onClick) {
 			luaL_typeerror(L, 2, "function");
 		lua_pushstring(L, "onClick");
 		lua_pushvalue(L, 2);
-		lua_rawset(L, 1);
+		lua_rawsetinstance(L, 1);
 		lua_pushvalue(L, 1);
 		id = (UINT)luaL_ref(L, LUA_REGISTRYINDEX); 
 	}	
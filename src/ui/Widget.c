@@ -956,7 +956,7 @@ HICON widget_loadicon(lua_State *L) {
 	if (lua_gettop(L) > 1)
 		switch(lua_type(L, 2)) {
 			case LUA_TNIL:		break;
-			case LUA_TTABLE:	buff = lua_tocinstance(L, 2, &t);
+			case LUA_TUSERDATA:	buff = lua_tocinstance(L, 2, &t);
 								if (t == TBuffer) {
 									icon = CreateIconFromResourceEx(buff->bytes, buff->size, TRUE, 0x00030000, 16, 16, 0);	
 									break;						
@@ -334,8 +334,7 @@ LUA_PROPERTY_SET(Window, menu) {
 	} else {
 		if (w->menu) {
 			lua_rawgeti(L, LUA_REGISTRYINDEX, w->menu);	
-			luaL_getmetafield(L, -1, "__userdata");
-			FreeMenu(L, lua_touserdata(L, -1));
+			FreeMenu(L, lua_tocinstance(L, -1, NULL));
 		}
 	}
 	DrawMenuBar(w->handle);
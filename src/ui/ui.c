@@ -320,7 +320,7 @@ LUA_METHOD(ui, dirdialog) {
 
 LUA_METHOD(ui, remove) {
 	Widget *w;
-	if (lua_gettop(L) && (lua_type(L, 1) == LUA_TTABLE)) {
+	if (lua_gettop(L) && (lua_type(L, 1) == LUA_TUSERDATA)) {
 		w = lua_self(L, 1, Widget);
 		if (w->ref)
 			luaL_unref(L, LUA_REGISTRYINDEX, w->ref);
@@ -391,7 +391,7 @@ peek:	if (PeekMessage(&msg, NULL, 0, 0, PM_REMOVE)) {
 					} else lua_pop(L, 1);					
 				} else if (msg.message == WM_LUAMENU) {			
 					int type = 	lua_rawgeti(L, LUA_REGISTRYINDEX, msg.wParam);
-					if (type == LUA_TTABLE && lua_getfield(L, -1, "onClick")) {
+					if (type == LUA_TUSERDATA && lua_getfield(L, -1, "onClick")) {
 						lua_insert(L, -2);
 						if (msg.lParam > -1) {
 							lua_pushinteger(L, msg.lParam);
@@ -475,7 +475,7 @@ LUA_METHOD(ui, fontdialog) {
 	CHOOSEFONTW cf = {0};
 	int n = lua_gettop(L), idx = 1;
 
-	if (n && (lua_type(L, 1) == LUA_TTABLE)) {
+	if (n && (lua_type(L, 1) == LUA_TUSERDATA)) {
 		Widget *w = lua_self(L, 1, Widget);
 		if (w->wtype == UIEdit) {
 			CHARFORMAT2W chf;